@@ -0,0 +1,298 @@
+/**
+ * @file http_alloc_bench.c
+ * @brief Allocator calls per HTTP request of the server request cycle
+ *
+ * Runs what the server does for a keep-alive GET over a socketpair: receive,
+ * parse, build a response with a small file body, send it and release both,
+ * and counts the malloc family calls made by the shared code on the way. The
+ * binary is linked with --wrap for malloc, calloc, realloc and free, so only
+ * calls from our own objects are counted, not the ones libc makes internally.
+ * Reports one JSON object per line like the other benchmarks.
+ */
+
+// Standard library headers
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Networking headers
+#include <sys/socket.h>
+
+// Shared headers
+#include "../shared/arena.h"
+#include "../shared/http.h"
+
+// Project header
+#include "http_alloc_bench.h"
+
+static const char *mode_names[ALLOC_MODE_COUNT] = {"malloc", "arena"};
+static Alloc_Counters counters;
+static FILE *results; // The real stdout, sendall logs every send on stdout
+
+// The linker sends every malloc family call of our objects through these
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+int main(int argc, char *argv[])
+{
+    int mode, m, r;
+    long iterations;
+
+    mode = -1; // All modes
+    iterations = DEFAULT_ITERATIONS;
+
+    r = parse_arguments(argc, argv, &mode, &iterations);
+    if (r != 0)
+    {
+        return r > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Only the JSON lines go to stdout, the log lines of the shared code are dropped
+    fflush(stdout);
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("http_alloc_bench: stdout");
+        return EXIT_FAILURE;
+    }
+
+    for (m = 0; m < ALLOC_MODE_COUNT; m++)
+    {
+        if (mode >= 0 && m != mode)
+        {
+            continue;
+        }
+        if (run_alloc_benchmark((Alloc_Mode)m, iterations) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    http_buffer_pool_clear();
+    fclose(results);
+    return EXIT_SUCCESS;
+}
+
+int run_alloc_benchmark(Alloc_Mode mode, long iterations)
+{
+    static const char request[] = "GET /hello.html HTTP/1.1\r\n"
+                                  "Host: 127.0.0.1:3030\r\n"
+                                  "User-Agent: curl/7.88.1\r\n"
+                                  "Accept: */*\r\n"
+                                  "\r\n";
+    int sockfds[2];
+    long i;
+    uint64_t start_ns, end_ns;
+    Alloc_Counters before;
+    Arena *arena;
+    HTTP_Receive_Buffer *buffer;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfds) < 0)
+    {
+        perror("http_alloc_bench: socketpair");
+        return -1;
+    }
+    buffer = create_http_receive_buffer(HTTP_DEFAULT_MAX_HEADER_SIZE, HTTP_DEFAULT_MAX_BODY_SIZE);
+    arena = mode == ALLOC_MODE_ARENA ? create_arena(ARENA_BLOCK_SIZE) : NULL;
+    if (buffer == NULL || (mode == ALLOC_MODE_ARENA && arena == NULL))
+    {
+        free_http_receive_buffer(&buffer);
+        close(sockfds[0]);
+        close(sockfds[1]);
+        return -1;
+    }
+
+    // Warms the buffer pool and the arena up, a long lived connection is past this point
+    if (serve_once(sockfds, buffer, arena, request, sizeof(request) - 1) < 0)
+    {
+        fprintf(stderr, "http_alloc_bench: error en el ciclo de request\n");
+        free_arena(&arena);
+        free_http_receive_buffer(&buffer);
+        close(sockfds[0]);
+        close(sockfds[1]);
+        return -1;
+    }
+
+    before = counters;
+    start_ns = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        serve_once(sockfds, buffer, arena, request, sizeof(request) - 1);
+    }
+    end_ns = now_ns();
+
+    fprintf(results, "{\"benchmark\":\"http_alloc\",\"mode\":\"%s\",\"iterations\":%ld,"
+            "\"allocs_per_request\":%.2f,\"frees_per_request\":%.2f,\"ns_per_request\":%.1f}\n",
+            mode_names[mode],
+            iterations,
+            (double)(counters.allocs - before.allocs) / iterations,
+            (double)(counters.frees - before.frees) / iterations,
+            (double)(end_ns - start_ns) / iterations);
+    fflush(results);
+
+    free_arena(&arena);
+    free_http_receive_buffer(&buffer);
+    close(sockfds[0]);
+    close(sockfds[1]);
+    return 0;
+}
+
+// One request through the server path, returns -1 if any step failed
+int serve_once(int sockfds[2], HTTP_Receive_Buffer *buffer, Arena *arena, const char *request, size_t length)
+{
+    char drain[DRAIN_BUFFER_SIZE], size_str[HTTP_UINT_STR_LEN];
+    int ret_val;
+    HTTP_Request *http_request;
+    HTTP_Response *response;
+
+    // The client side writes the request, the server side reads it like a connection would
+    if (send(sockfds[0], request, length, 0) != (ssize_t)length || fill_http_receive_buffer(sockfds[1], buffer) <= 0)
+    {
+        return -1;
+    }
+    if (next_http_request(buffer, &http_request, arena) != HTTP_PARSE_DONE)
+    {
+        return -1;
+    }
+
+    // Same headers and body the server sends for a small file
+    ret_val = -1;
+    response = create_http_response_in_arena(arena, "HTTP/1.1", 200, "OK", NULL);
+    if (response != NULL)
+    {
+        add_header(&response->headers, "Content-Type", "text/html");
+        http_format_uint(size_str, BODY_SIZE);
+        add_header(&response->headers, "Content-Length", size_str);
+        add_header(&response->headers, "Connection", "keep-alive");
+        response->body = arena != NULL ? (char *)arena_alloc(arena, BODY_SIZE + 1) : (char *)malloc(BODY_SIZE + 1);
+        if (response->body != NULL)
+        {
+            memset(response->body, 'x', BODY_SIZE);
+            response->body[BODY_SIZE] = '\0';
+            response->body_length = BODY_SIZE;
+            if (send_http_response(sockfds[1], response) == 0 && recv(sockfds[0], drain, sizeof(drain), 0) > 0)
+            {
+                ret_val = 0;
+            }
+        }
+    }
+
+    free_http_request(&http_request);
+    free_http_response(&response);
+    arena_reset(arena);
+    return ret_val;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    counters.allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    counters.allocs++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    counters.allocs++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        counters.frees++;
+    }
+    __real_free(ptr);
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int parse_arguments(int argc, char *argv[], int *mode, long *iterations)
+{
+    int i, j, ret_val;
+
+    ret_val = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            show_help();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            show_version();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < ALLOC_MODE_COUNT && strcmp(argv[i + 1], mode_names[j]) != 0; j++)
+                ;
+            if (j == ALLOC_MODE_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("http_alloc_bench: modo no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *mode = (j == ALLOC_MODE_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the mode
+        }
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            *iterations = atol(argv[i + 1]);
+            if (*iterations <= 0)
+            {
+                printf("http_alloc_bench: cantidad de iteraciones inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of iterations
+        }
+        else
+        {
+            printf("http_alloc_bench: opción o argumento no soportado: %s\n", argv[i]);
+            show_help();
+            ret_val = -1;
+            break;
+        }
+    }
+    return ret_val;
+}
+
+void show_help()
+{
+    puts("Uso: http_alloc_bench [opciones]");
+    puts("Opciones:");
+    puts("  --help    Muestra este mensaje de ayuda");
+    puts("  --version    Muestra version del programa");
+    puts("  --mode <malloc|arena|all>    malloc: request y response con malloc; arena: desde una arena por request (Default: all)");
+    puts("  --iterations <número>    Cantidad de requests por corrida (Default: 200000)");
+    puts("Cada corrida imprime una línea JSON con llamadas al allocator y nanosegundos por request.");
+}
+
+void show_version()
+{
+    printf("HTTP Alloc Bench Version %s\n", VERSION);
+}
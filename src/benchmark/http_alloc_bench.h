@@ -0,0 +1,40 @@
+#ifndef HTTP_ALLOC_BENCH_H
+#define HTTP_ALLOC_BENCH_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared headers
+#include "../shared/arena.h"
+#include "../shared/http.h"
+
+// Constants
+#define VERSION "0.0.1"
+#define DEFAULT_ITERATIONS 200000
+#define ARENA_BLOCK_SIZE 4096 // Same as the server HTTP_REQUEST_ARENA_SIZE
+#define BODY_SIZE 98          // Same as assets/hello.html
+#define DRAIN_BUFFER_SIZE 4096
+
+typedef enum
+{
+    ALLOC_MODE_MALLOC, // Request and response from malloc, like the server used to
+    ALLOC_MODE_ARENA,  // Request and response from an arena reset after each response
+    ALLOC_MODE_COUNT
+} Alloc_Mode;
+
+typedef struct
+{
+    uint64_t allocs; // malloc, calloc and realloc calls
+    uint64_t frees;
+} Alloc_Counters;
+
+// Function prototypes
+int run_alloc_benchmark(Alloc_Mode mode, long iterations);
+int serve_once(int sockfds[2], HTTP_Receive_Buffer *buffer, Arena *arena, const char *request, size_t length);
+uint64_t now_ns(void);
+int parse_arguments(int argc, char *argv[], int *mode, long *iterations);
+void show_help(void);
+void show_version(void);
+
+#endif // HTTP_ALLOC_BENCH_H
@@ -0,0 +1,687 @@
+/**
+ * @file http_fuzz_bench.c
+ * @brief Fuzzing and throughput harness for the HTTP parsers of src/shared
+ *
+ * Feeds a corpus of realistic and malformed inputs to every parser path:
+ * deserialize_http_request_header, deserialize_headers,
+ * deserialize_http_response_header, http_parser_execute and http_chunk_decode.
+ * In bench mode it reports inputs and megabytes per second of each path, one
+ * JSON object per line like the other benchmarks. In fuzz mode it mutates the
+ * corpus and runs every input through LLVMFuzzerTestOneInput, which also checks
+ * that the resumable parsers give the same result fed whole or byte by byte and
+ * aborts when they do not.
+ *
+ * Built with -DHTTP_FUZZ_LIBFUZZER and -fsanitize=fuzzer main is left out and
+ * libFuzzer drives LLVMFuzzerTestOneInput instead, see the fuzz target of the
+ * Makefile. stderr goes to /dev/null while the harness runs, so a sanitizer
+ * build needs ASAN_OPTIONS=log_path=<file> to keep its reports.
+ */
+
+// Standard library headers
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Shared headers
+#include "../shared/http.h"
+#include "../shared/http_parser.h"
+
+// Project header
+#include "http_fuzz_bench.h"
+
+static const char *path_names[FUZZ_PATH_COUNT] = {"request_header", "headers", "response_header", "parser", "chunked"};
+static const char *mode_names[FUZZ_MODE_COUNT] = {"bench", "fuzz"};
+
+// Pieces the mutations insert, the bytes the parsers look for
+static const char *tokens[] = {"\r\n", "\r\n\r\n", "\n", "\r", ":", ": ", " ", "\t", "\0", "0\r\n\r\n",
+                               "HTTP/1.1", "GET ", "Content-Length: ", "Transfer-Encoding: chunked\r\n",
+                               "ffffffff", "7fffffff", ";ext=1", "%", "99999999999999999999"};
+
+#ifndef HTTP_FUZZ_LIBFUZZER
+int main(int argc, char *argv[])
+{
+    int path, mode, p, r;
+    long iterations;
+    uint64_t seed;
+    Fuzz_Corpus *corpus;
+
+    path = -1; // All paths
+    mode = FUZZ_MODE_BENCH;
+    iterations = 0;
+    seed = DEFAULT_SEED;
+
+    r = parse_arguments(argc, argv, &path, &mode, &iterations, &seed);
+    if (r != 0)
+    {
+        return r > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    corpus = (Fuzz_Corpus *)calloc(1, sizeof(Fuzz_Corpus));
+    if (corpus == NULL)
+    {
+        fprintf(stderr, "http_fuzz_bench: error al asignar memoria\n");
+        return EXIT_FAILURE;
+    }
+    build_corpus(corpus);
+
+    // The parsers report every malformed input on stderr, only a crash matters here
+    fflush(stderr);
+    if (freopen("/dev/null", "w", stderr) == NULL)
+    {
+        perror("http_fuzz_bench: stderr");
+        free(corpus);
+        return EXIT_FAILURE;
+    }
+
+    r = 0;
+    if (mode == FUZZ_MODE_FUZZ)
+    {
+        r = run_fuzz(corpus, iterations > 0 ? iterations : DEFAULT_FUZZ_ITERATIONS, seed);
+    }
+    for (p = 0; mode == FUZZ_MODE_BENCH && p < FUZZ_PATH_COUNT && r == 0; p++)
+    {
+        if (path >= 0 && p != path)
+        {
+            continue;
+        }
+        r = run_path_benchmark(corpus, (Fuzz_Path)p, iterations > 0 ? iterations : DEFAULT_ROUNDS);
+    }
+
+    http_buffer_pool_clear();
+    free(corpus);
+    return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
+/* LLVMFuzzerTestOneInput:
+ * Runs one input through every parser path. The string based deserializers
+ * see it up to its first '\0', like they would see it in the server.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char *text;
+
+    text = (char *)malloc(size + 1);
+    if (text == NULL)
+    {
+        return 0;
+    }
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    parse_with_path(FUZZ_PATH_REQUEST_HEADER, text, size);
+    parse_with_path(FUZZ_PATH_HEADERS, text, size);
+    parse_with_path(FUZZ_PATH_RESPONSE_HEADER, text, size);
+    check_parser(text, size);
+    check_chunked(text, size);
+
+    free(text);
+    return 0;
+}
+
+int run_path_benchmark(const Fuzz_Corpus *corpus, Fuzz_Path path, long rounds)
+{
+    static const Fuzz_Kind path_kinds[FUZZ_PATH_COUNT] = {FUZZ_KIND_REQUEST, FUZZ_KIND_REQUEST, FUZZ_KIND_RESPONSE, FUZZ_KIND_REQUEST, FUZZ_KIND_CHUNKED};
+    int i, cases, rejected;
+    long round;
+    size_t bytes;
+    uint64_t start_ns, end_ns;
+    double seconds;
+
+    // Also checks every valid input is accepted before timing them
+    cases = 0;
+    rejected = 0;
+    bytes = 0;
+    for (i = 0; i < corpus->count; i++)
+    {
+        if (corpus->cases[i].kind != path_kinds[path])
+        {
+            continue;
+        }
+        if (parse_with_path(path, corpus->cases[i].data, corpus->cases[i].length) < 0)
+        {
+            if (corpus->cases[i].valid)
+            {
+                printf("http_fuzz_bench: %s rechazó el caso válido %s\n", path_names[path], corpus->cases[i].name);
+                return -1;
+            }
+            rejected++;
+        }
+        cases++;
+        bytes += corpus->cases[i].length;
+    }
+
+    start_ns = now_ns();
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < corpus->count; i++)
+        {
+            if (corpus->cases[i].kind == path_kinds[path])
+            {
+                parse_with_path(path, corpus->cases[i].data, corpus->cases[i].length);
+            }
+        }
+    }
+    end_ns = now_ns();
+
+    seconds = (double)(end_ns - start_ns) / 1e9;
+    printf("{\"benchmark\":\"http_fuzz\",\"path\":\"%s\",\"cases\":%d,\"rejected\":%d,\"rounds\":%ld,"
+           "\"seconds\":%.6f,\"inputs_per_sec\":%.0f,\"mb_per_sec\":%.1f}\n",
+           path_names[path],
+           cases,
+           rejected,
+           rounds,
+           seconds,
+           (double)cases * rounds / seconds,
+           (double)bytes * rounds / seconds / 1e6);
+    fflush(stdout);
+    return 0;
+}
+
+int run_fuzz(const Fuzz_Corpus *corpus, long iterations, uint64_t seed)
+{
+    static char data[MAX_CASE_SIZE];
+    const Fuzz_Case *base;
+    long i;
+    size_t length;
+    uint64_t state, start_ns, end_ns;
+    double seconds;
+
+    state = seed != 0 ? seed : DEFAULT_SEED;
+    start_ns = now_ns();
+
+    // The corpus as it is first, then mutations of it
+    for (i = 0; i < corpus->count; i++)
+    {
+        LLVMFuzzerTestOneInput((const uint8_t *)corpus->cases[i].data, corpus->cases[i].length);
+    }
+    for (i = 0; i < iterations; i++)
+    {
+        base = &corpus->cases[next_random(&state) % corpus->count];
+        memcpy(data, base->data, base->length);
+        length = mutate(corpus, data, base->length, &state);
+        LLVMFuzzerTestOneInput((const uint8_t *)data, length);
+    }
+    end_ns = now_ns();
+
+    seconds = (double)(end_ns - start_ns) / 1e9;
+    printf("{\"benchmark\":\"http_fuzz\",\"mode\":\"fuzz\",\"seed\":%llu,\"inputs\":%ld,\"seconds\":%.6f,\"inputs_per_sec\":%.0f}\n",
+           (unsigned long long)seed,
+           iterations + corpus->count,
+           seconds,
+           (double)(iterations + corpus->count) / seconds);
+    fflush(stdout);
+    return 0;
+}
+
+// Returns 0 if the path accepted the input or -1 if it rejected it
+int parse_with_path(Fuzz_Path path, const char *data, size_t length)
+{
+    static char scratch[MAX_CASE_SIZE];
+    const char *line_end;
+    int ret_val;
+    HTTP_Parser parser;
+    HTTP_Chunk_Decoder decoder;
+    Header_List headers;
+    HTTP_Request *request;
+    HTTP_Response *response;
+
+    ret_val = -1;
+    switch (path)
+    {
+    case FUZZ_PATH_REQUEST_HEADER:
+        request = deserialize_http_request_header(data);
+        if (request != NULL)
+        {
+            ret_val = 0;
+            free_http_request(&request);
+        }
+        break;
+
+    case FUZZ_PATH_HEADERS:
+        // The header block, past the request or status line if there is one
+        line_end = strstr(data, "\r\n");
+        init_header_list(&headers);
+        ret_val = deserialize_headers(line_end != NULL ? line_end + 2 : data, &headers) == 0 ? 0 : -1;
+        free_header_list(&headers);
+        break;
+
+    case FUZZ_PATH_RESPONSE_HEADER:
+        response = deserialize_http_response_header(data);
+        if (response != NULL)
+        {
+            ret_val = 0;
+            free_http_response(&response);
+        }
+        break;
+
+    case FUZZ_PATH_PARSER:
+        http_parser_init(&parser);
+        ret_val = http_parser_execute(&parser, data, length) == HTTP_PARSE_DONE ? 0 : -1;
+        break;
+
+    case FUZZ_PATH_CHUNKED:
+        // Decoded in place, so on a copy
+        if (length > sizeof(scratch))
+        {
+            break;
+        }
+        memcpy(scratch, data, length);
+        http_chunk_decoder_init(&decoder);
+        ret_val = http_chunk_decode(&decoder, scratch, length) == HTTP_PARSE_DONE ? 0 : -1;
+        break;
+
+    default:
+        break;
+    }
+    return ret_val;
+}
+
+/* check_parser:
+ * The server parses a request as its bytes arrive, so the result must not
+ * depend on how they were split. Parses the input whole and one byte per
+ * call and aborts if the results differ or a slice ends past the headers.
+ */
+void check_parser(const char *data, size_t size)
+{
+    size_t length;
+    int i, whole, split;
+    HTTP_Parser a, b;
+
+    http_parser_init(&a);
+    whole = http_parser_execute(&a, data, size);
+
+    http_parser_init(&b);
+    split = http_parser_execute(&b, data, 0);
+    for (length = 1; split == HTTP_PARSE_INCOMPLETE && length <= size; length++)
+    {
+        split = http_parser_execute(&b, data, length);
+    }
+
+    if (whole != split)
+    {
+        fprintf(stdout, "http_fuzz_bench: el parser devolvió %d entero y %d de a un byte\n", whole, split);
+        fflush(stdout);
+        abort();
+    }
+    if (whole != HTTP_PARSE_DONE)
+    {
+        return;
+    }
+    if (a.header_length != b.header_length || a.header_count != b.header_count || a.header_length > size ||
+        memcmp(&a.method, &b.method, sizeof(HTTP_Slice)) != 0 ||
+        memcmp(&a.uri, &b.uri, sizeof(HTTP_Slice)) != 0 ||
+        memcmp(&a.version, &b.version, sizeof(HTTP_Slice)) != 0 ||
+        memcmp(a.headers, b.headers, sizeof(HTTP_Header_Slice) * a.header_count) != 0 ||
+        memcmp(a.known, b.known, sizeof(a.known)) != 0)
+    {
+        fprintf(stdout, "http_fuzz_bench: el parser encontró otros campos de a un byte\n");
+        fflush(stdout);
+        abort();
+    }
+    for (i = 0; i < a.header_count; i++)
+    {
+        if ((size_t)a.headers[i].name.offset + a.headers[i].name.length > a.header_length ||
+            (size_t)a.headers[i].value.offset + a.headers[i].value.length > a.header_length)
+        {
+            fprintf(stdout, "http_fuzz_bench: header %d fuera de los headers\n", i);
+            fflush(stdout);
+            abort();
+        }
+    }
+}
+
+// Same check as check_parser for the chunked body decoder
+void check_chunked(const char *data, size_t size)
+{
+    static char a[MAX_CASE_SIZE], b[MAX_CASE_SIZE];
+    size_t length;
+    int whole, split;
+    HTTP_Chunk_Decoder da, db;
+
+    if (size > MAX_CASE_SIZE)
+    {
+        return;
+    }
+    memcpy(a, data, size);
+    memcpy(b, data, size);
+
+    http_chunk_decoder_init(&da);
+    whole = http_chunk_decode(&da, a, size);
+
+    http_chunk_decoder_init(&db);
+    split = HTTP_PARSE_INCOMPLETE;
+    for (length = 1; split == HTTP_PARSE_INCOMPLETE && length <= size; length++)
+    {
+        split = http_chunk_decode(&db, b, length);
+    }
+
+    if (whole != split || (whole == HTTP_PARSE_DONE && (da.read != db.read || da.written != db.written || memcmp(a, b, da.written) != 0)))
+    {
+        fprintf(stdout, "http_fuzz_bench: el decoder de chunks devolvió %d entero y %d de a un byte\n", whole, split);
+        fflush(stdout);
+        abort();
+    }
+    // Only meaningful while the decoder has not given up
+    if (whole != HTTP_PARSE_ERROR && (da.written > da.read || da.read > size))
+    {
+        fprintf(stdout, "http_fuzz_bench: el decoder de chunks pasó el final del body\n");
+        fflush(stdout);
+        abort();
+    }
+}
+
+// Applies a few random edits to data, which holds MAX_CASE_SIZE bytes. Returns the new length
+size_t mutate(const Fuzz_Corpus *corpus, char *data, size_t length, uint64_t *state)
+{
+    int i, count;
+    size_t position, n, token_length;
+    const char *token;
+    const Fuzz_Case *other;
+
+    count = 1 + next_random(state) % MUTATIONS_PER_INPUT;
+    for (i = 0; i < count; i++)
+    {
+        position = length > 0 ? next_random(state) % (length + 1) : 0;
+        switch (next_random(state) % 6)
+        {
+        case 0:
+            // Change one byte
+            if (position < length)
+            {
+                data[position] = (char)next_random(state);
+            }
+            break;
+
+        case 1:
+            // Insert one of the tokens
+            token = tokens[next_random(state) % (sizeof(tokens) / sizeof(tokens[0]))];
+            token_length = token[0] != '\0' ? strlen(token) : 1;
+            if (length + token_length <= MAX_CASE_SIZE)
+            {
+                memmove(data + position + token_length, data + position, length - position);
+                memcpy(data + position, token, token_length);
+                length += token_length;
+            }
+            break;
+
+        case 2:
+            // Remove a range
+            n = next_random(state) % 16 + 1;
+            if (position + n <= length)
+            {
+                memmove(data + position, data + position + n, length - position - n);
+                length -= n;
+            }
+            break;
+
+        case 3:
+            // Repeat a range
+            n = next_random(state) % 64 + 1;
+            if (position + n <= length && length + n <= MAX_CASE_SIZE)
+            {
+                memmove(data + position + n, data + position, length - position);
+                length += n;
+            }
+            break;
+
+        case 4:
+            // Keep the head and take the tail of another input
+            other = &corpus->cases[next_random(state) % corpus->count];
+            n = other->length > 0 ? next_random(state) % other->length : 0;
+            if (position + other->length - n <= MAX_CASE_SIZE)
+            {
+                memcpy(data + position, other->data + n, other->length - n);
+                length = position + other->length - n;
+            }
+            break;
+
+        default:
+            // Cut it short
+            length = position;
+            break;
+        }
+    }
+    return length;
+}
+
+// xorshift64*, the same sequence for the same --seed
+uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+void build_corpus(Fuzz_Corpus *corpus)
+{
+    static char data[MAX_CASE_SIZE];
+    size_t length;
+    int i;
+
+#define ADD(name, kind, valid, literal) add_case(corpus, name, kind, valid, literal, sizeof(literal) - 1)
+
+    // Requests as clients send them
+    ADD("curl", FUZZ_KIND_REQUEST, 1,
+        "GET /hello.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:3030\r\n"
+        "User-Agent: curl/7.88.1\r\n"
+        "Accept: */*\r\n"
+        "\r\n");
+    ADD("browser", FUZZ_KIND_REQUEST, 1,
+        "GET /server.png HTTP/1.1\r\n"
+        "Host: localhost:3030\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Referer: http://localhost:3030/hello.html\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: es-AR,es;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+        "Cookie: session=4f2a9c1e7b3d8a6f5e0c2b1a9d8e7f6a; theme=dark\r\n"
+        "If-None-Match: \"5f3e-1a2b3c4d\"\r\n"
+        "\r\n");
+    ADD("post", FUZZ_KIND_REQUEST, 1,
+        "POST /upload HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 11\r\n"
+        "\r\n"
+        "a=1&b=2&c=3");
+    ADD("chunked_post", FUZZ_KIND_REQUEST, 1,
+        "POST /upload HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5\r\nhello\r\n0\r\n\r\n");
+    ADD("http10", FUZZ_KIND_REQUEST, 1, "GET / HTTP/1.0\r\n\r\n");
+    ADD("whitespace", FUZZ_KIND_REQUEST, 1, "GET / HTTP/1.1\r\nHost:localhost\r\nX-Empty:\r\nX-Padded: \t value \t\r\n\r\n");
+
+    // Requests the parsers have to turn down without crashing
+    ADD("bare_lf", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\nHost: localhost\n\n");
+    ADD("no_colon", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\r\nHost localhost\r\n\r\n");
+    ADD("space_in_name", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\r\nHo st: localhost\r\n\r\n");
+    ADD("obs_fold", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\r\nX-Folded: a\r\n b\r\n\r\n");
+    ADD("no_version", FUZZ_KIND_REQUEST, 0, "GET /\r\n\r\n");
+    ADD("empty", FUZZ_KIND_REQUEST, 0, "");
+    ADD("crlf_only", FUZZ_KIND_REQUEST, 0, "\r\n\r\n");
+    ADD("truncated", FUZZ_KIND_REQUEST, 0, "GET /hello.html HTTP/1.1\r\nHost: loc");
+    ADD("nul_in_header", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\r\nHost: a\0b\r\n\r\n");
+    ADD("control_in_uri", FUZZ_KIND_REQUEST, 0, "GET /\x01\x7f HTTP/1.1\r\n\r\n");
+    ADD("bad_length", FUZZ_KIND_REQUEST, 0, "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n");
+    ADD("header_without_value", FUZZ_KIND_REQUEST, 0, "GET / HTTP/1.1\r\nX:");
+
+    length = snprintf(data, sizeof(data), "GET / HTTP/1.1\r\nHost: localhost\r\n");
+    for (i = 0; i < HTTP_PARSER_MAX_HEADERS + 6; i++)
+    {
+        length += snprintf(data + length, sizeof(data) - length, "X-Header-%02d: %d\r\n", i, i);
+    }
+    length += snprintf(data + length, sizeof(data) - length, "\r\n");
+    add_case(corpus, "too_many_headers", FUZZ_KIND_REQUEST, 0, data, length);
+
+    length = snprintf(data, sizeof(data), "GET / HTTP/1.1\r\nCookie: ");
+    memset(data + length, 'c', 8192);
+    length += 8192;
+    length += snprintf(data + length, sizeof(data) - length, "\r\n\r\n");
+    add_case(corpus, "long_header", FUZZ_KIND_REQUEST, 1, data, length);
+
+    memcpy(data, "GET /", 5);
+    memset(data + 5, 'u', 4096);
+    length = 5 + 4096;
+    length += snprintf(data + length, sizeof(data) - length, " HTTP/1.1\r\n\r\n");
+    add_case(corpus, "long_uri", FUZZ_KIND_REQUEST, 1, data, length);
+
+    // Responses as the client receives them
+    ADD("ok", FUZZ_KIND_RESPONSE, 1,
+        "HTTP/1.1 200 OK\r\n"
+        "Date: Sun, 18 Oct 2026 19:46:28 GMT\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 98\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n");
+    ADD("not_found", FUZZ_KIND_RESPONSE, 1, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    ADD("chunked_response", FUZZ_KIND_RESPONSE, 1, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    ADD("no_reason", FUZZ_KIND_RESPONSE, 0, "HTTP/1.1 200\r\n\r\n");
+    ADD("no_status", FUZZ_KIND_RESPONSE, 0, "HTTP/1.1\r\n\r\n");
+    ADD("no_blank_line", FUZZ_KIND_RESPONSE, 0, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n");
+
+    memcpy(data, "HTTP/1.1", 8);
+    memset(data + 8, '1', 64);
+    length = 8 + 64;
+    length += snprintf(data + length, sizeof(data) - length, " 200 OK\r\n\r\n");
+    add_case(corpus, "long_version", FUZZ_KIND_RESPONSE, 0, data, length);
+
+    length = snprintf(data, sizeof(data), "HTTP/1.1 200 ");
+    memset(data + length, 'r', 1024);
+    length += 1024;
+    length += snprintf(data + length, sizeof(data) - length, "\r\n\r\n");
+    add_case(corpus, "long_reason", FUZZ_KIND_RESPONSE, 0, data, length);
+
+    // Chunked bodies
+    ADD("chunks", FUZZ_KIND_CHUNKED, 1, "5\r\nhello\r\n7\r\n, world\r\n0\r\n\r\n");
+    ADD("extensions_and_trailer", FUZZ_KIND_CHUNKED, 1, "5;name=value\r\nhello\r\n0\r\nX-Trailer: 1\r\n\r\n");
+    ADD("uppercase_size", FUZZ_KIND_CHUNKED, 1, "A\r\n0123456789\r\n0\r\n\r\n");
+    ADD("size_overflow", FUZZ_KIND_CHUNKED, 0, "fffffffffffffffff\r\nx\r\n0\r\n\r\n");
+    ADD("missing_crlf", FUZZ_KIND_CHUNKED, 0, "5\r\nhelloX0\r\n\r\n");
+    ADD("no_size", FUZZ_KIND_CHUNKED, 0, "\r\nhello\r\n0\r\n\r\n");
+
+#undef ADD
+}
+
+void add_case(Fuzz_Corpus *corpus, const char *name, Fuzz_Kind kind, int valid, const char *data, size_t length)
+{
+    Fuzz_Case *fuzz_case;
+
+    if (corpus->count >= MAX_CASES || length >= MAX_CASE_SIZE)
+    {
+        return;
+    }
+    fuzz_case = &corpus->cases[corpus->count++];
+    fuzz_case->name = name;
+    fuzz_case->kind = kind;
+    fuzz_case->valid = valid;
+    memcpy(fuzz_case->data, data, length);
+    fuzz_case->data[length] = '\0'; // The string based paths need it
+    fuzz_case->length = length;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int parse_arguments(int argc, char *argv[], int *path, int *mode, long *iterations, uint64_t *seed)
+{
+    int i, j, ret_val;
+
+    ret_val = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            show_help();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            show_version();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < FUZZ_PATH_COUNT && strcmp(argv[i + 1], path_names[j]) != 0; j++)
+                ;
+            if (j == FUZZ_PATH_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("http_fuzz_bench: parser no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *path = (j == FUZZ_PATH_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the path
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < FUZZ_MODE_COUNT && strcmp(argv[i + 1], mode_names[j]) != 0; j++)
+                ;
+            if (j == FUZZ_MODE_COUNT)
+            {
+                printf("http_fuzz_bench: modo no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *mode = j;
+            i++; // Skip the next argument since it's the mode
+        }
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            *iterations = atol(argv[i + 1]);
+            if (*iterations <= 0)
+            {
+                printf("http_fuzz_bench: cantidad de iteraciones inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of iterations
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            *seed = strtoull(argv[i + 1], NULL, 10);
+            i++; // Skip the next argument since it's the seed
+        }
+        else
+        {
+            printf("http_fuzz_bench: opción o argumento no soportado: %s\n", argv[i]);
+            show_help();
+            ret_val = -1;
+            break;
+        }
+    }
+    return ret_val;
+}
+
+void show_help()
+{
+    puts("Uso: http_fuzz_bench [opciones]");
+    puts("Opciones:");
+    puts("  --help    Muestra este mensaje de ayuda");
+    puts("  --version    Muestra version del programa");
+    puts("  --mode <bench|fuzz>    bench: requests/s y MB/s de cada parser; fuzz: mutaciones del corpus (Default: bench)");
+    puts("  --path <request_header|headers|response_header|parser|chunked|all>    Parser a medir (Default: all, solo modo bench)");
+    puts("  --iterations <número>    Pasadas por el corpus en modo bench (Default: 20000) o inputs mutados en modo fuzz (Default: 200000)");
+    puts("  --seed <número>    Semilla de las mutaciones, la misma semilla repite los mismos inputs (Default: 1)");
+    puts("Cada corrida imprime una línea JSON. En modo fuzz un error del parser termina con abort().");
+}
+
+void show_version()
+{
+    printf("HTTP Fuzz Bench Version %s\n", VERSION);
+}
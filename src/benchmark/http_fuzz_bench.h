@@ -0,0 +1,72 @@
+#ifndef HTTP_FUZZ_BENCH_H
+#define HTTP_FUZZ_BENCH_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define VERSION "0.0.1"
+#define MAX_CASE_SIZE 16384          // Largest input of the corpus and of the mutations
+#define MAX_CASES 64
+#define DEFAULT_ROUNDS 20000         // Passes over the corpus per parser path in bench mode
+#define DEFAULT_FUZZ_ITERATIONS 200000 // Mutated inputs in fuzz mode
+#define DEFAULT_SEED 1
+#define MUTATIONS_PER_INPUT 8        // At most, the actual number is random
+
+typedef enum
+{
+    FUZZ_KIND_REQUEST,  // Request line, headers and maybe a body
+    FUZZ_KIND_RESPONSE, // Status line and headers
+    FUZZ_KIND_CHUNKED   // Chunked body
+} Fuzz_Kind;
+
+typedef enum
+{
+    FUZZ_PATH_REQUEST_HEADER,  // deserialize_http_request_header
+    FUZZ_PATH_HEADERS,         // deserialize_headers
+    FUZZ_PATH_RESPONSE_HEADER, // deserialize_http_response_header
+    FUZZ_PATH_PARSER,          // http_parser_execute, what the server uses
+    FUZZ_PATH_CHUNKED,         // http_chunk_decode
+    FUZZ_PATH_COUNT
+} Fuzz_Path;
+
+typedef enum
+{
+    FUZZ_MODE_BENCH, // Throughput of every path over the corpus
+    FUZZ_MODE_FUZZ,  // Mutations of the corpus through LLVMFuzzerTestOneInput
+    FUZZ_MODE_COUNT
+} Fuzz_Mode;
+
+typedef struct
+{
+    const char *name;
+    Fuzz_Kind kind;
+    int valid; // Whether the parsers should accept it
+    char data[MAX_CASE_SIZE];
+    size_t length;
+} Fuzz_Case;
+
+typedef struct
+{
+    Fuzz_Case cases[MAX_CASES];
+    int count;
+} Fuzz_Corpus;
+
+// Function prototypes
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+int run_path_benchmark(const Fuzz_Corpus *corpus, Fuzz_Path path, long rounds);
+int run_fuzz(const Fuzz_Corpus *corpus, long iterations, uint64_t seed);
+int parse_with_path(Fuzz_Path path, const char *data, size_t length);
+void check_parser(const char *data, size_t size);
+void check_chunked(const char *data, size_t size);
+size_t mutate(const Fuzz_Corpus *corpus, char *data, size_t length, uint64_t *state);
+uint64_t next_random(uint64_t *state);
+void build_corpus(Fuzz_Corpus *corpus);
+void add_case(Fuzz_Corpus *corpus, const char *name, Fuzz_Kind kind, int valid, const char *data, size_t length);
+uint64_t now_ns(void);
+int parse_arguments(int argc, char *argv[], int *path, int *mode, long *iterations, uint64_t *seed);
+void show_help(void);
+void show_version(void);
+
+#endif // HTTP_FUZZ_BENCH_H
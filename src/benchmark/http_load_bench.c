@@ -0,0 +1,592 @@
+/**
+ * @file http_load_bench.c
+ * @brief Load generator for the HTTP side of src/server
+ *
+ * Opens --connections clients that send --requests GET requests each, either
+ * reusing their connection (keep-alive) or opening a new one per request
+ * (close), and reports requests per second and latency percentiles as one
+ * JSON object per line like the other benchmarks. Needs a running server.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Networking headers
+#include <netdb.h>
+#include <sys/socket.h>
+
+// System headers
+#include <sys/time.h>
+#include <sys/types.h>
+
+// Shared headers
+#include "../shared/http_parser.h"
+
+// Project header
+#include "http_load_bench.h"
+
+static const char *mode_names[LOAD_MODE_COUNT] = {"keep-alive", "close"};
+
+int main(int argc, char *argv[])
+{
+    int m, mode, pipeline, ret_val;
+    Load_Config config;
+
+    config.host = DEFAULT_HOST;
+    config.port = DEFAULT_PORT;
+    config.resource = DEFAULT_RESOURCE;
+    config.connections = DEFAULT_CONNECTIONS;
+    config.requests = DEFAULT_REQUESTS;
+    config.pipeline = 1;
+    mode = -1; // All modes
+
+    ret_val = parse_arguments(argc, argv, &config, &mode);
+    if (ret_val != 0)
+    {
+        return ret_val > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (m = 0; m < LOAD_MODE_COUNT; m++)
+    {
+        if (mode >= 0 && m != mode)
+        {
+            continue;
+        }
+        config.mode = (Load_Mode)m;
+        pipeline = config.pipeline;
+        if (config.mode == LOAD_MODE_CLOSE)
+        {
+            // Each request closes its connection, there is nothing to pipeline
+            config.pipeline = 1;
+        }
+        if (run_load_benchmark(&config) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+        config.pipeline = pipeline;
+    }
+    return EXIT_SUCCESS;
+}
+
+int run_load_benchmark(const Load_Config *config)
+{
+    int i, completed, errors, connects, failed;
+    uint64_t start_ns, end_ns, *latencies;
+    double seconds;
+    pthread_t *threads;
+    Load_Client *clients;
+
+    threads = (pthread_t *)calloc(config->connections, sizeof(pthread_t));
+    clients = (Load_Client *)calloc(config->connections, sizeof(Load_Client));
+    latencies = (uint64_t *)calloc((size_t)config->connections * config->requests, sizeof(uint64_t));
+    if (threads == NULL || clients == NULL || latencies == NULL)
+    {
+        fprintf(stderr, "http_load_bench: error al asignar memoria\n");
+        free(threads);
+        free(clients);
+        free(latencies);
+        return -1;
+    }
+
+    failed = 0;
+    start_ns = now_ns();
+    for (i = 0; i < config->connections; i++)
+    {
+        clients[i].config = config;
+        clients[i].latencies = latencies + (size_t)i * config->requests;
+        if (pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0)
+        {
+            fprintf(stderr, "http_load_bench: error al crear thread\n");
+            failed = 1;
+            break;
+        }
+    }
+    while (--i >= 0)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    end_ns = now_ns();
+    if (failed)
+    {
+        free(threads);
+        free(clients);
+        free(latencies);
+        return -1;
+    }
+
+    // Completed latencies are packed at the start of each client's slice
+    completed = 0;
+    errors = 0;
+    connects = 0;
+    for (i = 0; i < config->connections; i++)
+    {
+        memmove(latencies + completed, clients[i].latencies, clients[i].completed * sizeof(uint64_t));
+        completed += clients[i].completed;
+        errors += clients[i].errors;
+        connects += clients[i].connects;
+    }
+    qsort(latencies, completed, sizeof(uint64_t), compare_u64);
+
+    seconds = (double)(end_ns - start_ns) / 1e9;
+    printf("{\"benchmark\":\"http_load\",\"mode\":\"%s\",\"resource\":\"%s\",\"connections\":%d,"
+           "\"pipeline\":%d,\"requests\":%d,\"completed\":%d,\"errors\":%d,\"tcp_connects\":%d,\"seconds\":%.6f,\"requests_per_sec\":%.1f,",
+           mode_names[config->mode],
+           config->resource,
+           config->connections,
+           config->pipeline,
+           config->connections * config->requests,
+           completed,
+           errors,
+           connects,
+           seconds,
+           completed / seconds);
+    if (completed > 0)
+    {
+        printf("\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+               latencies[completed * 50 / 100] / 1e3,
+               latencies[completed * 90 / 100] / 1e3,
+               latencies[completed * 99 / 100] / 1e3,
+               latencies[completed - 1] / 1e3);
+    }
+    else
+    {
+        printf("\"latency_us\":null}\n");
+    }
+    fflush(stdout);
+
+    free(threads);
+    free(clients);
+    free(latencies);
+    return 0;
+}
+
+void *run_client(void *arg)
+{
+    int i, sockfd, keep_open, batch, buffered;
+    uint64_t start_ns;
+    char *buffer;
+    Load_Client *client;
+
+    client = (Load_Client *)arg;
+    buffer = (char *)malloc(LOAD_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        client->errors = client->config->requests;
+        return NULL;
+    }
+
+    sockfd = -1;
+    buffered = 0;
+    while (client->completed + client->errors < client->config->requests)
+    {
+        start_ns = now_ns();
+        if (sockfd < 0)
+        {
+            sockfd = open_connection(client->config);
+            if (sockfd < 0)
+            {
+                client->errors++;
+                continue;
+            }
+            client->connects++;
+            buffered = 0;
+        }
+
+        // Up to --pipeline requests go out before reading the first response
+        batch = client->config->requests - client->completed - client->errors;
+        if (batch > client->config->pipeline)
+        {
+            batch = client->config->pipeline;
+        }
+        keep_open = client->config->mode == LOAD_MODE_KEEP_ALIVE;
+        if (send_requests(sockfd, client->config, batch) < 0)
+        {
+            client->errors++;
+            keep_open = 0;
+            batch = 0;
+        }
+        for (i = 0; i < batch; i++)
+        {
+            if (read_response(sockfd, buffer, &buffered, &keep_open) < 0)
+            {
+                client->errors++;
+                keep_open = 0;
+                break;
+            }
+            client->latencies[client->completed++] = now_ns() - start_ns;
+            if (!keep_open)
+            {
+                // Server closed after this one, the rest of the batch goes out again on a new connection
+                break;
+            }
+        }
+
+        if (!keep_open)
+        {
+            close(sockfd);
+            sockfd = -1;
+        }
+    }
+
+    if (sockfd >= 0)
+    {
+        close(sockfd);
+    }
+    free(buffer);
+    return NULL;
+}
+
+int open_connection(const Load_Config *config)
+{
+    int sockfd, err;
+    struct addrinfo hints, *servinfo, *p;
+    struct timeval timeout;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(config->host, config->port, &hints, &servinfo)) != 0)
+    {
+        fprintf(stderr, "http_load_bench: getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+
+    sockfd = -1;
+    for (p = servinfo; p != NULL; p = p->ai_next)
+    {
+        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+        {
+            continue;
+        }
+        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1)
+        {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(servinfo);
+    if (sockfd < 0)
+    {
+        fprintf(stderr, "http_load_bench: no se pudo conectar a %s:%s\n", config->host, config->port);
+        return -1;
+    }
+
+    timeout.tv_sec = RECEIVE_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sockfd;
+}
+
+// Writes count copies of the request at once, so pipelined requests share packets
+int send_requests(int sockfd, const Load_Config *config, int count)
+{
+    char request[1024], *requests;
+    int i, length, sent, n;
+
+    length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+                      config->resource,
+                      config->host,
+                      config->mode == LOAD_MODE_CLOSE ? "Connection: close\r\n" : "");
+    if (length >= (int)sizeof(request))
+    {
+        return -1;
+    }
+    requests = (char *)malloc((size_t)length * count);
+    if (requests == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        memcpy(requests + (size_t)i * length, request, length);
+    }
+
+    for (sent = 0; sent < length * count; sent += n)
+    {
+        n = send(sockfd, requests + sent, length * count - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            free(requests);
+            return -1;
+        }
+    }
+    free(requests);
+    return 0;
+}
+
+/* read_response:
+ * Reads one response and discards its body. Non 2xx responses count as errors.
+ * *buffered bytes at the start of buffer were received with the previous
+ * response, and on return it holds the bytes received past this one, which
+ * belong to the next pipelined response. *keep_open is cleared when the server
+ * closes or announces it will close the connection, and when the body length
+ * is only known by reading until close.
+ */
+int read_response(int sockfd, char *buffer, int *buffered, int *keep_open)
+{
+    int received, n;
+    long body_length, remaining;
+    size_t scanned, headers_end;
+    const char *value;
+
+    received = *buffered;
+    *buffered = 0;
+    scanned = 0;
+    headers_end = http_find_headers_end(buffer, &scanned, received);
+    while (headers_end == 0)
+    {
+        if (received == LOAD_BUFFER_SIZE)
+        {
+            return -1;
+        }
+        n = recv(sockfd, buffer + received, LOAD_BUFFER_SIZE - received, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        received += n;
+        headers_end = http_find_headers_end(buffer, &scanned, received);
+    }
+
+    if (received < 12 || strncmp(buffer, "HTTP/1.", 7) != 0 || buffer[9] != '2')
+    {
+        return -1;
+    }
+
+    value = find_response_header(buffer, headers_end, "Connection");
+    if (value != NULL && strncasecmp(value, "close", 5) == 0)
+    {
+        *keep_open = 0;
+    }
+
+    value = find_response_header(buffer, headers_end, "Transfer-Encoding");
+    if (value != NULL && strncasecmp(value, "chunked", 7) == 0)
+    {
+        return read_chunked_body(sockfd, buffer, received - headers_end, headers_end, buffered);
+    }
+
+    value = find_response_header(buffer, headers_end, "Content-Length");
+    if (value == NULL)
+    {
+        // Delimited by the end of the connection
+        *keep_open = 0;
+        while ((n = recv(sockfd, buffer, LOAD_BUFFER_SIZE, 0)) > 0)
+            ;
+        return n == 0 ? 0 : -1;
+    }
+
+    body_length = atol(value);
+    if (body_length <= (long)(received - headers_end))
+    {
+        // The whole body is here, keep what follows it for the next response
+        *buffered = received - headers_end - body_length;
+        memmove(buffer, buffer + headers_end + body_length, *buffered);
+        return 0;
+    }
+
+    // Never read past the body, the next response starts right after it
+    remaining = body_length - (long)(received - headers_end);
+    while (remaining > 0)
+    {
+        n = recv(sockfd, buffer, remaining < LOAD_BUFFER_SIZE ? remaining : LOAD_BUFFER_SIZE, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        remaining -= n;
+    }
+    return 0;
+}
+
+int read_chunked_body(int sockfd, char *buffer, int length, int offset, int *buffered)
+{
+    HTTP_Chunk_Decoder decoder;
+    int result, n;
+
+    // Only the framing matters here, so the decoded data is dropped as soon as it is known
+    memmove(buffer, buffer + offset, length);
+    http_chunk_decoder_init(&decoder);
+    while ((result = http_chunk_decode(&decoder, buffer, length)) == HTTP_PARSE_INCOMPLETE)
+    {
+        length -= decoder.read;
+        memmove(buffer, buffer + decoder.read, length);
+        decoder.read = 0;
+        decoder.written = 0;
+        n = recv(sockfd, buffer + length, LOAD_BUFFER_SIZE - length, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        length += n;
+    }
+    if (result != HTTP_PARSE_DONE)
+    {
+        return -1;
+    }
+
+    // Keep what follows the last chunk for the next response
+    *buffered = length - decoder.read;
+    memmove(buffer, buffer + decoder.read, *buffered);
+    return 0;
+}
+
+// Value of the header called name in the first length bytes of a response, NULL if absent
+const char *find_response_header(const char *headers, size_t length, const char *name)
+{
+    size_t i, name_length;
+
+    name_length = strlen(name);
+    for (i = 0; i + name_length + 1 < length; i++)
+    {
+        // Header lines start right after a line feed
+        if (i > 0 && headers[i - 1] == '\n' && strncasecmp(headers + i, name, name_length) == 0 && headers[i + name_length] == ':')
+        {
+            i += name_length + 1;
+            while (i < length && (headers[i] == ' ' || headers[i] == '\t'))
+            {
+                i++;
+            }
+            return headers + i;
+        }
+    }
+    return NULL;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x, y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int parse_arguments(int argc, char *argv[], Load_Config *config, int *mode)
+{
+    int i, j, ret_val;
+
+    ret_val = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            show_help();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            show_version();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+        {
+            config->host = argv[i + 1];
+            i++; // Skip the next argument since it's the host
+        }
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            config->port = argv[i + 1];
+            i++; // Skip the next argument since it's the port number
+        }
+        else if (strcmp(argv[i], "--resource") == 0 && i + 1 < argc)
+        {
+            config->resource = argv[i + 1];
+            i++; // Skip the next argument since it's the resource
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < LOAD_MODE_COUNT && strcmp(argv[i + 1], mode_names[j]) != 0; j++)
+                ;
+            if (j == LOAD_MODE_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("http_load_bench: modo no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *mode = (j == LOAD_MODE_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the mode
+        }
+        else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc)
+        {
+            config->connections = atoi(argv[i + 1]);
+            if (config->connections <= 0)
+            {
+                printf("http_load_bench: cantidad de conexiones inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of connections
+        }
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+        {
+            config->requests = atoi(argv[i + 1]);
+            if (config->requests <= 0)
+            {
+                printf("http_load_bench: cantidad de requests inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of requests
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+        {
+            config->pipeline = atoi(argv[i + 1]);
+            if (config->pipeline <= 0)
+            {
+                printf("http_load_bench: profundidad de pipeline inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the pipeline depth
+        }
+        else
+        {
+            printf("http_load_bench: opción o argumento no soportado: %s\n", argv[i]);
+            show_help();
+            ret_val = -1;
+            break;
+        }
+    }
+    return ret_val;
+}
+
+void show_help()
+{
+    puts("Uso: http_load_bench [opciones]");
+    puts("Opciones:");
+    puts("  --help    Muestra este mensaje de ayuda");
+    puts("  --version    Muestra version del programa");
+    puts("  --host <ip>    Host del server HTTP (Default: " DEFAULT_HOST ")");
+    puts("  --port <puerto>    Puerto del server HTTP (Default: " DEFAULT_PORT ")");
+    puts("  --resource <recurso>    Recurso pedido en cada request (Default: " DEFAULT_RESOURCE ")");
+    puts("  --mode <keep-alive|close|all>    keep-alive: reusar la conexión; close: una conexión por request (Default: all)");
+    puts("  --connections <número>    Clientes concurrentes");
+    puts("  --requests <número>    Requests por cliente");
+    puts("  --pipeline <número>    Requests enviados antes de leer la primera response en modo keep-alive (Default: 1)");
+    puts("Requiere el server corriendo. Cada corrida imprime una línea JSON con requests/s y percentiles de latencia.");
+}
+
+void show_version()
+{
+    printf("HTTP Load Bench Version %s\n", VERSION);
+}
@@ -0,0 +1,59 @@
+#ifndef HTTP_LOAD_BENCH_H
+#define HTTP_LOAD_BENCH_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define VERSION "0.0.1"
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "3030"           // Same as the server LOCAL_PORT_TCP_HTTP
+#define DEFAULT_RESOURCE "/hello.html"
+#define DEFAULT_CONNECTIONS 4         // Clients sending requests at the same time
+#define DEFAULT_REQUESTS 200          // Requests sent by each client
+#define RECEIVE_TIMEOUT_SEC 10        // A response slower than this counts as an error
+#define LOAD_BUFFER_SIZE 65536
+
+typedef enum
+{
+    LOAD_MODE_KEEP_ALIVE, // Every request of a client goes over the same connection while the server allows it
+    LOAD_MODE_CLOSE,      // "Connection: close" and a new connection per request, like the server used to force
+    LOAD_MODE_COUNT
+} Load_Mode;
+
+typedef struct
+{
+    const char *host;
+    const char *port;
+    const char *resource;
+    int connections;
+    int requests; // Per connection
+    int pipeline; // Requests sent before reading the first response
+    Load_Mode mode;
+} Load_Config;
+
+typedef struct
+{
+    const Load_Config *config;
+    uint64_t *latencies; // One per completed request, from send to the last body byte
+    int completed;
+    int errors;
+    int connects; // TCP connections opened
+} Load_Client;
+
+// Function prototypes
+int run_load_benchmark(const Load_Config *config);
+void *run_client(void *arg);
+int open_connection(const Load_Config *config);
+int send_requests(int sockfd, const Load_Config *config, int count);
+int read_response(int sockfd, char *buffer, int *buffered, int *keep_open);
+int read_chunked_body(int sockfd, char *buffer, int length, int offset, int *buffered);
+const char *find_response_header(const char *headers, size_t length, const char *name);
+uint64_t now_ns(void);
+int compare_u64(const void *a, const void *b);
+int parse_arguments(int argc, char *argv[], Load_Config *config, int *mode);
+void show_help(void);
+void show_version(void);
+
+#endif // HTTP_LOAD_BENCH_H
@@ -0,0 +1,296 @@
+/**
+ * @file http_parser_bench.c
+ * @brief Throughput benchmark for src/shared/http_parser.c
+ *
+ * Parses a few representative requests over and over and reports GB/s and
+ * nanoseconds per request, one JSON object per line like threadpool_bench.
+ */
+
+// Standard library headers
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Shared headers
+#include "../shared/http.h"
+#include "../shared/http_parser.h"
+
+// Project header
+#include "http_parser_bench.h"
+
+#define REQUEST_COUNT 3
+
+static const char *mode_names[PARSE_MODE_COUNT] = {"whole", "incremental", "materialize"};
+
+int main(int argc, char *argv[])
+{
+    int request, mode, r, m;
+    long iterations;
+    Bench_Request *requests;
+
+    request = -1; // All requests
+    mode = -1;    // All modes
+    iterations = 0;
+
+    requests = (Bench_Request *)calloc(REQUEST_COUNT, sizeof(Bench_Request));
+    if (requests == NULL)
+    {
+        fprintf(stderr, "http_parser_bench: error al asignar memoria\n");
+        return EXIT_FAILURE;
+    }
+    build_requests(requests);
+
+    r = parse_arguments(argc, argv, &request, &mode, &iterations);
+    if (r != 0)
+    {
+        free(requests);
+        return r > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (r = 0; r < REQUEST_COUNT; r++)
+    {
+        if (request >= 0 && r != request)
+        {
+            continue;
+        }
+        for (m = 0; m < PARSE_MODE_COUNT; m++)
+        {
+            if (mode >= 0 && m != mode)
+            {
+                continue;
+            }
+            if (run_parser_benchmark(&requests[r], (Parse_Mode)m, iterations) < 0)
+            {
+                free(requests);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(requests);
+    return EXIT_SUCCESS;
+}
+
+int run_parser_benchmark(const Bench_Request *request, Parse_Mode mode, long iterations)
+{
+    long i;
+    uint64_t start_ns, end_ns;
+    double seconds;
+    char scratch[MAX_REQUEST_SIZE];
+
+    if (iterations <= 0)
+    {
+        iterations = DEFAULT_BYTES / (long)request->length;
+    }
+
+    // Also checks the request is valid before timing it
+    if (parse_once(request, mode, scratch) < 0)
+    {
+        fprintf(stderr, "http_parser_bench: request %s inválido\n", request->name);
+        return -1;
+    }
+
+    start_ns = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        parse_once(request, mode, scratch);
+    }
+    end_ns = now_ns();
+
+    seconds = (double)(end_ns - start_ns) / 1e9;
+    printf("{\"benchmark\":\"http_parser\",\"request\":\"%s\",\"mode\":\"%s\",\"bytes\":%zu,"
+           "\"iterations\":%ld,\"seconds\":%.6f,\"gb_per_sec\":%.3f,\"ns_per_request\":%.1f}\n",
+           request->name,
+           mode_names[mode],
+           request->length,
+           iterations,
+           seconds,
+           (double)request->length * iterations / seconds / 1e9,
+           (double)(end_ns - start_ns) / iterations);
+    fflush(stdout);
+    return 0;
+}
+
+// Returns the number of headers found or -1 if the request did not parse
+int parse_once(const Bench_Request *request, Parse_Mode mode, char *scratch)
+{
+    int ret_val;
+    size_t length;
+    HTTP_Parser parser;
+    HTTP_Request *http_request;
+
+    http_parser_init(&parser);
+    switch (mode)
+    {
+    case PARSE_MODE_INCREMENTAL:
+        ret_val = HTTP_PARSE_INCOMPLETE;
+        for (length = INCREMENTAL_STEP; ret_val == HTTP_PARSE_INCOMPLETE && length < request->length + INCREMENTAL_STEP; length += INCREMENTAL_STEP)
+        {
+            ret_val = http_parser_execute(&parser, request->data, length < request->length ? length : request->length);
+        }
+        break;
+
+    case PARSE_MODE_MATERIALIZE:
+        // The server parses straight into its receive buffer, the copy stands in for recv
+        memcpy(scratch, request->data, request->length);
+        ret_val = http_parser_execute(&parser, scratch, request->length);
+        if (ret_val == HTTP_PARSE_DONE)
+        {
+            http_request = create_http_request_in_place(scratch, &parser, NULL);
+            if (http_request == NULL)
+            {
+                return -1;
+            }
+            // scratch is not ours, so only the request itself is released
+            free_header_list(&http_request->headers);
+            free(http_request);
+        }
+        break;
+
+    default:
+        ret_val = http_parser_execute(&parser, request->data, request->length);
+        break;
+    }
+
+    return ret_val == HTTP_PARSE_DONE ? parser.header_count : -1;
+}
+
+void build_requests(Bench_Request *requests)
+{
+    int i;
+    size_t length;
+
+    requests[0].name = "curl";
+    length = snprintf(requests[0].data, MAX_REQUEST_SIZE,
+                      "GET /hello.html HTTP/1.1\r\n"
+                      "Host: 127.0.0.1:3030\r\n"
+                      "User-Agent: curl/7.88.1\r\n"
+                      "Accept: */*\r\n"
+                      "\r\n");
+    requests[0].length = length;
+
+    requests[1].name = "browser";
+    length = snprintf(requests[1].data, MAX_REQUEST_SIZE,
+                      "GET /server.png HTTP/1.1\r\n"
+                      "Host: localhost:3030\r\n"
+                      "Connection: keep-alive\r\n"
+                      "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+                      "sec-ch-ua-mobile: ?0\r\n"
+                      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+                      "sec-ch-ua-platform: \"Linux\"\r\n"
+                      "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+                      "Sec-Fetch-Site: same-origin\r\n"
+                      "Sec-Fetch-Mode: no-cors\r\n"
+                      "Sec-Fetch-Dest: image\r\n"
+                      "Referer: http://localhost:3030/hello.html\r\n"
+                      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+                      "Accept-Language: es-AR,es;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+                      "Cookie: session=4f2a9c1e7b3d8a6f5e0c2b1a9d8e7f6a; theme=dark; _ga=GA1.1.123456789.1700000000\r\n"
+                      "If-None-Match: \"5f3e-1a2b3c4d\"\r\n"
+                      "\r\n");
+    requests[1].length = length;
+
+    requests[2].name = "many_headers";
+    length = snprintf(requests[2].data, MAX_REQUEST_SIZE, "GET / HTTP/1.1\r\nHost: localhost\r\n");
+    for (i = 0; i < MANY_HEADERS_COUNT; i++)
+    {
+        length += snprintf(requests[2].data + length, MAX_REQUEST_SIZE - length, "X-Custom-Header-%02d: value-%02d\r\n", i, i);
+    }
+    length += snprintf(requests[2].data + length, MAX_REQUEST_SIZE - length, "\r\n");
+    requests[2].length = length;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int parse_arguments(int argc, char *argv[], int *request, int *mode, long *iterations)
+{
+    static const char *request_names[REQUEST_COUNT] = {"curl", "browser", "many_headers"};
+    int i, j, ret_val;
+
+    ret_val = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            show_help();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            show_version();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--request") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < REQUEST_COUNT && strcmp(argv[i + 1], request_names[j]) != 0; j++)
+                ;
+            if (j == REQUEST_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("http_parser_bench: request no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *request = (j == REQUEST_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the request
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < PARSE_MODE_COUNT && strcmp(argv[i + 1], mode_names[j]) != 0; j++)
+                ;
+            if (j == PARSE_MODE_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("http_parser_bench: modo no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *mode = (j == PARSE_MODE_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the mode
+        }
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            *iterations = atol(argv[i + 1]);
+            if (*iterations <= 0)
+            {
+                printf("http_parser_bench: cantidad de iteraciones inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of iterations
+        }
+        else
+        {
+            printf("http_parser_bench: opción o argumento no soportado: %s\n", argv[i]);
+            show_help();
+            ret_val = -1;
+            break;
+        }
+    }
+    return ret_val;
+}
+
+void show_help()
+{
+    puts("Uso: http_parser_bench [opciones]");
+    puts("Opciones:");
+    puts("  --help    Muestra este mensaje de ayuda");
+    puts("  --version    Muestra version del programa");
+    puts("  --request <curl|browser|many_headers|all>    Request a parsear (Default: all)");
+    puts("  --mode <whole|incremental|materialize|all>    whole: todo junto; incremental: de a 16 bytes; materialize: parser + HTTP_Request (Default: all)");
+    puts("  --iterations <número>    Cantidad de veces que se parsea cada request (Default: 256 MB por corrida)");
+    puts("Cada corrida imprime una línea JSON con GB/s y nanosegundos por request.");
+}
+
+void show_version()
+{
+    printf("HTTP Parser Bench Version %s\n", VERSION);
+}
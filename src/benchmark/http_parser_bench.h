@@ -0,0 +1,39 @@
+#ifndef HTTP_PARSER_BENCH_H
+#define HTTP_PARSER_BENCH_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define VERSION "0.0.1"
+#define DEFAULT_BYTES (256L * 1024 * 1024) // Bytes parsed per run unless --iterations is given
+#define INCREMENTAL_STEP 16                // Bytes added per call in the "incremental" mode
+#define MANY_HEADERS_COUNT 40              // Headers of the "many_headers" request
+#define MAX_REQUEST_SIZE 4096              // Same as the server receive buffer
+
+typedef enum
+{
+    PARSE_MODE_WHOLE,       // The full request in one call
+    PARSE_MODE_INCREMENTAL, // INCREMENTAL_STEP bytes per call, like a slow or fragmented peer
+    PARSE_MODE_MATERIALIZE, // Parse and build the HTTP_Request the server uses
+    PARSE_MODE_COUNT
+} Parse_Mode;
+
+typedef struct
+{
+    const char *name;
+    char data[MAX_REQUEST_SIZE];
+    size_t length;
+} Bench_Request;
+
+// Function prototypes
+int run_parser_benchmark(const Bench_Request *request, Parse_Mode mode, long iterations);
+int parse_once(const Bench_Request *request, Parse_Mode mode, char *scratch);
+void build_requests(Bench_Request *requests);
+uint64_t now_ns(void);
+int parse_arguments(int argc, char *argv[], int *request, int *mode, long *iterations);
+void show_help(void);
+void show_version(void);
+
+#endif // HTTP_PARSER_BENCH_H
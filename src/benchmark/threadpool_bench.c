@@ -0,0 +1,516 @@
+/**
+ * @file threadpool_bench.c
+ * @brief Microbenchmark for src/shared/threadpool.c
+ *
+ * Drives threadpool_add/threadpool_wait with empty, short, mixed and
+ * connection-like (affinity) tasks across producer and consumer counts.
+ * Each run prints one JSON object per line so results can be diffed or
+ * loaded by a script when comparing queue and scheduler changes.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// System headers
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// Shared headers
+#include "../shared/threadpool.h"
+
+// Project header
+#include "threadpool_bench.h"
+
+static const char *scenario_names[SCENARIO_COUNT] = {"empty", "short", "mixed", "affinity"};
+static const char *mode_names[MODE_COUNT] = {"sync", "async"};
+
+int main(int argc, char *argv[])
+{
+    int scenario, mode, producer_count, consumer_count, tasks;
+    int producers[MAX_COUNTS] = {1, 2, 4};
+    int consumers[MAX_COUNTS] = {1, 2, 4, 8};
+    int s, m, p, c, a, ret_val;
+    Bench_Config config;
+
+    scenario = -1; // All scenarios
+    mode = -1;     // All modes
+    producer_count = 3;
+    consumer_count = 4;
+    tasks = DEFAULT_TASKS;
+
+    ret_val = parse_arguments(argc, argv, &scenario, &mode, producers, &producer_count, consumers, &consumer_count, &tasks);
+    if (ret_val > 0)
+    {
+        return EXIT_SUCCESS;
+    }
+    else if (ret_val < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    for (s = 0; s < SCENARIO_COUNT; s++)
+    {
+        if (scenario >= 0 && s != scenario)
+        {
+            continue;
+        }
+        for (m = 0; m < MODE_COUNT; m++)
+        {
+            if (mode >= 0 && m != mode)
+            {
+                continue;
+            }
+            for (p = 0; p < producer_count; p++)
+            {
+                for (c = 0; c < consumer_count; c++)
+                {
+                    // The affinity scenario is measured with and without an affinity key
+                    for (a = (s == SCENARIO_AFFINITY ? 0 : 1); a < 2; a++)
+                    {
+                        config.scenario = (Bench_Scenario)s;
+                        config.mode = (Bench_Mode)m;
+                        config.producers = producers[p];
+                        config.consumers = consumers[c];
+                        config.tasks = tasks;
+                        config.use_affinity = (s == SCENARIO_AFFINITY) ? a : 0;
+                        if (run_benchmark(&config) < 0)
+                        {
+                            return EXIT_FAILURE;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int run_benchmark(const Bench_Config *config)
+{
+    int i, per_producer, perf_fd;
+    long long cache_misses;
+    uint64_t start_ns, end_ns, *latencies;
+    double seconds;
+    volatile int completed;
+    unsigned char *states;
+    pthread_t *threads;
+    Bench_Sample *samples;
+    Bench_Producer *producers;
+
+    samples = (Bench_Sample *)calloc(config->tasks, sizeof(Bench_Sample));
+    latencies = (uint64_t *)malloc(sizeof(uint64_t) * config->tasks);
+    states = (unsigned char *)calloc(AFFINITY_KEYS, AFFINITY_STATE_SIZE);
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * config->producers);
+    producers = (Bench_Producer *)calloc(config->producers, sizeof(Bench_Producer));
+    if (samples == NULL || latencies == NULL || states == NULL || threads == NULL || producers == NULL)
+    {
+        fprintf(stderr, "threadpool_bench: error al asignar memoria: %s\n", strerror(errno));
+        free(samples);
+        free(latencies);
+        free(states);
+        free(threads);
+        free(producers);
+        return -1;
+    }
+
+    completed = 0;
+    for (i = 0; i < config->tasks; i++)
+    {
+        samples[i].key = -1;
+        samples[i].completed = &completed;
+        switch (config->scenario)
+        {
+        case SCENARIO_EMPTY:
+            samples[i].work_ns = 0;
+            break;
+        case SCENARIO_SHORT:
+            samples[i].work_ns = SHORT_TASK_NS;
+            break;
+        case SCENARIO_MIXED:
+            samples[i].work_ns = (i % MIXED_LONG_EVERY == 0) ? LONG_TASK_NS : SHORT_TASK_NS;
+            break;
+        case SCENARIO_AFFINITY:
+            // Short tasks that read and write the state of one of a few connections
+            samples[i].work_ns = SHORT_TASK_NS;
+            samples[i].key = i % AFFINITY_KEYS;
+            samples[i].state = states + (size_t)samples[i].key * AFFINITY_STATE_SIZE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Opened before the pool exists so the counter is inherited by every worker
+    perf_fd = open_cache_miss_counter();
+
+    producers[0].pool = threadpool_create(config->consumers, DEFAULT_QUEUE_SIZE, 0);
+    if (producers[0].pool == NULL)
+    {
+        fprintf(stderr, "threadpool_bench: error al crear threadpool\n");
+        if (perf_fd >= 0)
+        {
+            close(perf_fd);
+        }
+        free(samples);
+        free(latencies);
+        free(states);
+        free(threads);
+        free(producers);
+        return -1;
+    }
+
+    per_producer = config->tasks / config->producers;
+    for (i = 0; i < config->producers; i++)
+    {
+        producers[i].pool = producers[0].pool;
+        producers[i].samples = samples + i * per_producer;
+        producers[i].sample_count = (i == config->producers - 1) ? config->tasks - i * per_producer : per_producer;
+        producers[i].mode = config->mode;
+        producers[i].use_affinity = config->use_affinity;
+    }
+
+    if (perf_fd >= 0)
+    {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    start_ns = now_ns();
+
+    for (i = 0; i < config->producers; i++)
+    {
+        pthread_create(&threads[i], NULL, run_producer, &producers[i]);
+    }
+    for (i = 0; i < config->producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    // Async producers return as soon as everything is queued
+    while (__atomic_load_n(&completed, __ATOMIC_ACQUIRE) < config->tasks)
+    {
+        sched_yield();
+    }
+
+    end_ns = now_ns();
+    threadpool_destroy(producers[0].pool, THREADPOOL_GRACEFUL);
+
+    // Worker counts are folded into the counter when the workers exit
+    cache_misses = read_cache_miss_counter(perf_fd);
+
+    for (i = 0; i < config->tasks; i++)
+    {
+        // A task that never ran means the pool lost or duplicated work, the numbers are meaningless
+        if (samples[i].end_ns == 0)
+        {
+            fprintf(stderr, "threadpool_bench: la tarea %d no se ejecutó\n", i);
+            if (perf_fd >= 0)
+            {
+                close(perf_fd);
+            }
+            free(samples);
+            free(latencies);
+            free(states);
+            free(threads);
+            free(producers);
+            return -1;
+        }
+        latencies[i] = samples[i].end_ns - samples[i].submit_ns;
+    }
+    qsort(latencies, config->tasks, sizeof(uint64_t), compare_u64);
+
+    seconds = (double)(end_ns - start_ns) / 1e9;
+    printf("{\"benchmark\":\"threadpool\",\"scenario\":\"%s\",\"mode\":\"%s\",\"affinity\":%s,"
+           "\"producers\":%d,\"consumers\":%d,\"tasks\":%d,\"seconds\":%.6f,\"tasks_per_sec\":%.1f,"
+           "\"latency_ns\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},",
+           scenario_names[config->scenario],
+           mode_names[config->mode],
+           config->use_affinity ? "true" : "false",
+           config->producers,
+           config->consumers,
+           config->tasks,
+           seconds,
+           config->tasks / seconds,
+           (unsigned long long)latencies[config->tasks * 50 / 100],
+           (unsigned long long)latencies[config->tasks * 90 / 100],
+           (unsigned long long)latencies[config->tasks * 99 / 100],
+           (unsigned long long)latencies[config->tasks * 999 / 1000],
+           (unsigned long long)latencies[config->tasks - 1]);
+    for (i = 1; i < config->producers; i++)
+    {
+        producers[0].retries += producers[i].retries;
+    }
+    printf("\"queue_full_retries\":%d,", producers[0].retries);
+    if (cache_misses >= 0)
+    {
+        printf("\"cache_misses\":%lld,\"cache_misses_per_task\":%.3f}\n", cache_misses, (double)cache_misses / config->tasks);
+    }
+    else
+    {
+        printf("\"cache_misses\":null,\"cache_misses_per_task\":null}\n");
+    }
+    fflush(stdout);
+
+    if (perf_fd >= 0)
+    {
+        close(perf_fd);
+    }
+    free(samples);
+    free(latencies);
+    free(states);
+    free(threads);
+    free(producers);
+    return 0;
+}
+
+void *run_producer(void *arg)
+{
+    int i, err;
+    threadpool_options_t options;
+    threadpool_task_t *task;
+    Bench_Producer *producer;
+
+    producer = (Bench_Producer *)arg;
+    options.timeout_ms = 0;
+    options.token = NULL;
+
+    for (i = 0; i < producer->sample_count; i++)
+    {
+        options.affinity_key = producer->use_affinity ? producer->samples[i].key : THREADPOOL_NO_AFFINITY;
+        producer->samples[i].submit_ns = now_ns();
+        while ((err = threadpool_add_with_options(producer->pool, bench_task, &producer->samples[i],
+                                                  producer->mode == MODE_SYNC ? &task : NULL, 0, &options)) == THREADPOOL_QUEUE_FULL)
+        {
+            producer->retries++;
+            sched_yield();
+        }
+        if (err != 0)
+        {
+            fprintf(stderr, "threadpool_bench: error al agregar task: %d\n", err);
+            exit(EXIT_FAILURE);
+        }
+        if (producer->mode == MODE_SYNC)
+        {
+            threadpool_wait(task);
+        }
+    }
+    return NULL;
+}
+
+void *bench_task(void *arg)
+{
+    size_t i;
+    uint64_t until;
+    Bench_Sample *sample;
+
+    sample = (Bench_Sample *)arg;
+    sample->start_ns = now_ns();
+
+    if (sample->state != NULL)
+    {
+        // Touch every cache line of the connection state, like parsing into its buffers would
+        for (i = 0; i < AFFINITY_STATE_SIZE; i += 64)
+        {
+            sample->state[i]++;
+        }
+    }
+
+    until = sample->start_ns + sample->work_ns;
+    while (sample->work_ns > 0 && now_ns() < until)
+    {
+        // Busy work
+    }
+
+    sample->end_ns = now_ns();
+    __atomic_add_fetch(sample->completed, 1, __ATOMIC_RELEASE);
+    return sample;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Returns a hardware cache miss counter for this process and its future threads, -1 if unavailable
+int open_cache_miss_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long read_cache_miss_counter(int fd)
+{
+    long long count;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+    {
+        return -1;
+    }
+    return count;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x, y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int parse_arguments(int argc, char *argv[], int *scenario, int *mode, int *producers, int *producer_count, int *consumers, int *consumer_count, int *tasks)
+{
+    int i, j, ret_val;
+
+    ret_val = 0;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            show_help();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            show_version();
+            ret_val = 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < SCENARIO_COUNT && strcmp(argv[i + 1], scenario_names[j]) != 0; j++)
+                ;
+            if (j == SCENARIO_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("threadpool_bench: escenario no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *scenario = (j == SCENARIO_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the scenario
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            for (j = 0; j < MODE_COUNT && strcmp(argv[i + 1], mode_names[j]) != 0; j++)
+                ;
+            if (j == MODE_COUNT && strcmp(argv[i + 1], "all") != 0)
+            {
+                printf("threadpool_bench: modo no soportado: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            *mode = (j == MODE_COUNT) ? -1 : j;
+            i++; // Skip the next argument since it's the mode
+        }
+        else if (strcmp(argv[i], "--producers") == 0 && i + 1 < argc)
+        {
+            if (parse_counts(argv[i + 1], producers, producer_count) < 0)
+            {
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the list
+        }
+        else if (strcmp(argv[i], "--consumers") == 0 && i + 1 < argc)
+        {
+            if (parse_counts(argv[i + 1], consumers, consumer_count) < 0)
+            {
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the list
+        }
+        else if (strcmp(argv[i], "--tasks") == 0 && i + 1 < argc)
+        {
+            *tasks = atoi(argv[i + 1]);
+            if (*tasks <= 0)
+            {
+                printf("threadpool_bench: cantidad de tasks inválida: %s\n", argv[i + 1]);
+                ret_val = -1;
+                break;
+            }
+            i++; // Skip the next argument since it's the number of tasks
+        }
+        else
+        {
+            printf("threadpool_bench: opción o argumento no soportado: %s\n", argv[i]);
+            show_help();
+            ret_val = -1;
+            break;
+        }
+    }
+    return ret_val;
+}
+
+// Parses a comma separated list such as "1,2,4"
+int parse_counts(const char *list, int *counts, int *count)
+{
+    char *copy, *token, *saveptr;
+    int value;
+
+    copy = strdup(list);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    *count = 0;
+    for (token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+    {
+        value = atoi(token);
+        if (value <= 0 || *count == MAX_COUNTS)
+        {
+            printf("threadpool_bench: lista inválida: %s\n", list);
+            free(copy);
+            return -1;
+        }
+        counts[(*count)++] = value;
+    }
+    free(copy);
+    return *count > 0 ? 0 : -1;
+}
+
+void show_help()
+{
+    puts("Uso: threadpool_bench [opciones]");
+    puts("Opciones:");
+    puts("  --help    Muestra este mensaje de ayuda");
+    puts("  --version    Muestra version del programa");
+    puts("  --scenario <empty|short|mixed|affinity|all>    Tipo de task a medir (Default: all)");
+    puts("  --mode <sync|async|all>    sync: add + wait por task; async: sin wait (Default: all)");
+    puts("  --producers <lista>    Cantidad de threads que agregan tasks, ej: 1,2,4");
+    puts("  --consumers <lista>    Cantidad de threads del threadpool, ej: 1,2,4,8");
+    puts("  --tasks <número>    Cantidad de tasks por corrida");
+    puts("Cada corrida imprime una línea JSON con throughput, percentiles de latencia y cache misses.");
+}
+
+void show_version()
+{
+    printf("Threadpool Bench Version %s\n", VERSION);
+}
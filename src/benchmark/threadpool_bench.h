@@ -0,0 +1,81 @@
+#ifndef THREADPOOL_BENCH_H
+#define THREADPOOL_BENCH_H
+
+// Standard library headers
+#include <stdint.h>
+
+// Shared headers
+#include "../shared/threadpool.h"
+
+// Constants
+#define VERSION "0.0.1"
+#define DEFAULT_TASKS 20000      // Tasks submitted per run, split between producers
+#define DEFAULT_QUEUE_SIZE 1024  // Shared queue capacity, producers retry while it is full
+#define SHORT_TASK_NS 1000       // Busy work of a "short" task
+#define LONG_TASK_NS 100000      // Busy work of the long tasks in the "mixed" scenario
+#define MIXED_LONG_EVERY 10      // One out of every N tasks is long in the "mixed" scenario
+#define AFFINITY_KEYS 64         // Simulated connections in the "affinity" scenario
+#define AFFINITY_STATE_SIZE 8192 // Bytes of per connection state touched by every task
+#define MAX_COUNTS 8             // Max values accepted by --producers and --consumers
+
+typedef enum
+{
+    SCENARIO_EMPTY,
+    SCENARIO_SHORT,
+    SCENARIO_MIXED,
+    SCENARIO_AFFINITY,
+    SCENARIO_COUNT
+} Bench_Scenario;
+
+typedef enum
+{
+    MODE_SYNC,  // threadpool_add + threadpool_wait per task, like the server does
+    MODE_ASYNC, // Fire and forget, completion is tracked with a counter
+    MODE_COUNT
+} Bench_Mode;
+
+typedef struct
+{
+    uint64_t submit_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t work_ns;
+    int key;                   // Simulated connection, -1 if the task has none
+    unsigned char *state;      // Connection state touched by the task, NULL if none
+    volatile int *completed;   // Incremented when the task ends
+} Bench_Sample;
+
+typedef struct
+{
+    threadpool_t *pool;
+    Bench_Sample *samples;
+    int sample_count;
+    Bench_Mode mode;
+    int use_affinity;
+    int retries; // Times threadpool_add returned THREADPOOL_QUEUE_FULL
+} Bench_Producer;
+
+typedef struct
+{
+    Bench_Scenario scenario;
+    Bench_Mode mode;
+    int producers;
+    int consumers;
+    int tasks;
+    int use_affinity;
+} Bench_Config;
+
+// Function prototypes
+int run_benchmark(const Bench_Config *config);
+void *run_producer(void *arg);
+void *bench_task(void *arg);
+uint64_t now_ns(void);
+int open_cache_miss_counter(void);
+long long read_cache_miss_counter(int fd);
+int compare_u64(const void *a, const void *b);
+int parse_arguments(int argc, char *argv[], int *scenario, int *mode, int *producers, int *producer_count, int *consumers, int *consumer_count, int *tasks);
+int parse_counts(const char *list, int *counts, int *count);
+void show_help(void);
+void show_version(void);
+
+#endif // THREADPOOL_BENCH_H
@@ -342,12 +342,10 @@ int handle_connection_http(int sockfd, const char *resource)
     char timestamp[DEFAULT_TIMESTAMP_SIZE];
     char filename[DEFAULT_FILENAME_SIZE];
     char *formatted_resource;
-    const char *connection, *content_length;
-    int header_index, header_count;
+    const char *connection;
     time_t rawtime;
     struct tm *timeinfo;
     FILE *file;
-    Header *headers;
     HTTP_Request *request;
     HTTP_Response *response;
 
@@ -361,14 +359,15 @@ int handle_connection_http(int sockfd, const char *resource)
     formatted_resource[0] = '/';
     strcpy(formatted_resource + 1, resource);
 
-    header_index = 0;
-    header_count = INITIAL_HEADER_COUNT;
-    headers = create_headers(header_count);
-    add_header(&headers, &header_index, &header_count, "Host", DEFAULT_HOST);
-
     // Create the HTTP request with Host header
-    request = create_http_request(DEFAULT_HTTP_METHOD, formatted_resource, DEFAULT_HTTP_VERSION, headers, header_count, NULL);
+    request = create_http_request(DEFAULT_HTTP_METHOD, formatted_resource, DEFAULT_HTTP_VERSION, NULL);
     free(formatted_resource);
+    if (request == NULL || add_header(&request->headers, "Host", DEFAULT_HOST) < 0)
+    {
+        fprintf(stderr, "client: error al crear request\n");
+        free_http_request(&request);
+        return -1;
+    }
 
     if (send_http_request(sockfd, request) < 0)
     {
@@ -382,7 +381,7 @@ int handle_connection_http(int sockfd, const char *resource)
            request->request_line.uri,
            request->request_line.version);
     puts("client: headers enviados:");
-    log_headers(request->headers, request->header_count);
+    log_headers(&request->headers);
 
     // Receive the HTTP response
     response = receive_http_response(sockfd);
@@ -395,14 +394,13 @@ int handle_connection_http(int sockfd, const char *resource)
 
     printf("client: Response Line: %s %d %s\n", response->response_line.version, response->response_line.status_code, response->response_line.reason_phrase);
 
-    if (response->header_count > 0)
+    if (response->headers.count > 0)
     {
         printf("client: Headers:\n");
-        log_headers(response->headers, response->header_count);
+        log_headers(&response->headers);
 
         // Check for specific headers
-        content_length = find_header_value(response->headers, response->header_count, "Content-Length");
-        connection = find_header_value(response->headers, response->header_count, "Connection");
+        connection = find_known_header_value(&response->headers, HTTP_HEADER_CONNECTION);
         if (response->response_line.status_code == 200)
         {
             if (request->request_line.uri[0] == '/' && strlen(request->request_line.uri) > 1)
@@ -427,7 +425,8 @@ int handle_connection_http(int sockfd, const char *resource)
                 }
                 else
                 {
-                    fwrite(response->body, 1, atoi(content_length), file);
+                    // body_length covers Content-Length and chunked bodies alike
+                    fwrite(response->body, 1, response->body_length, file);
                     fclose(file);
                 }
             }
@@ -2,19 +2,24 @@
 #include <errno.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 // Networking headers
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 
 // System headers
+#include <poll.h>
 #include <signal.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -22,17 +27,40 @@
 #include <sys/wait.h>
 
 // Shared headers
+#include "../shared/arena.h"
 #include "../shared/common.h"
 #include "../shared/http.h"
+#include "../shared/http2.h"
+#include "../shared/http_mime.h"
+#include "../shared/http_router.h"
+#include "../shared/http_variants.h"
 #include "../shared/threadpool.h"
 
 // Project header
 #include "server.h"
 
 volatile sig_atomic_t stop;
-pthread_mutex_t lock;
-pthread_mutex_t lock_file;
 threadpool_t *pool;
+threadpool_options_t http_task_options;
+threadpool_options_t tcp_task_options;
+long keep_alive_max;
+long keep_alive_timeout_ms;
+int max_header_size;
+int max_body_size;
+HTTP_Router *router;
+HTTP_Variant_Index *variants;
+threadpool_t *variant_pool;
+
+// Results are immutable and shared, so handlers hand them back without allocating
+static Thread_Result thread_results[] = {
+    {THREAD_RESULT_EMPTY_REQUEST},
+    {THREAD_RESULT_EMPTY_PACKET},
+    {THREAD_RESULT_ERROR},
+    {THREAD_RESULT_SUCCESS},
+    {THREAD_RESULT_CLOSED},
+    {THREAD_RESULT_CANCELLED},
+    {THREAD_RESULT_INCOMPLETE},
+};
 
 int main(int argc, char *argv[])
 {
@@ -40,29 +68,28 @@ int main(int argc, char *argv[])
         local_port_tcp_http[PORTSTRLEN], local_port_udp[PORTSTRLEN];
     int ret_val;
     int sockfd_tcp, sockfd_tcp_http, sockfd_udp; // listen on these sockfd
-    int thread_count, queue_size;
+    int thread_count, queue_size, watchdog_quarantine, gzip_variants;
+    long task_timeout_ms, watchdog_ms;
+    const char *mime_types_path;
 
     thread_count = DEFAULT_THREAD_COUNT;
     queue_size = DEFAULT_QUEUE_SIZE;
+    task_timeout_ms = DEFAULT_TASK_TIMEOUT_MS;
+    watchdog_ms = DEFAULT_WATCHDOG_MS;
+    watchdog_quarantine = 0;
+    keep_alive_max = DEFAULT_KEEP_ALIVE_MAX;
+    keep_alive_timeout_ms = DEFAULT_KEEP_ALIVE_TIMEOUT_MS;
+    max_header_size = HTTP_DEFAULT_MAX_HEADER_SIZE;
+    max_body_size = HTTP_DEFAULT_MAX_BODY_SIZE;
+    mime_types_path = HTTP_MIME_DEFAULT_TYPES_FILE;
+    gzip_variants = 0;
 
     strcpy(local_ip, LOCAL_IP);
     strcpy(local_port_tcp, LOCAL_PORT_TCP);
     strcpy(local_port_tcp_http, LOCAL_PORT_TCP_HTTP);
     strcpy(local_port_udp, LOCAL_PORT_UDP);
 
-    if (pthread_mutex_init(&lock, NULL) != 0)
-    {
-        perror("server: error en lock init\n");
-        return EXIT_FAILURE;
-    }
-
-    if (pthread_mutex_init(&lock_file, NULL) != 0)
-    {
-        perror("server: error en lock_file init\n");
-        return EXIT_FAILURE;
-    }
-
-    ret_val = parse_arguments(argc, argv, local_ip, local_port_tcp, local_port_udp, local_port_tcp_http, &thread_count, &queue_size);
+    ret_val = parse_arguments(argc, argv, local_ip, local_port_tcp, local_port_udp, local_port_tcp_http, &thread_count, &queue_size, &task_timeout_ms, &watchdog_ms, &watchdog_quarantine, &keep_alive_max, &keep_alive_timeout_ms, &max_header_size, &max_body_size, &mime_types_path, &gzip_variants);
     if (ret_val > 0)
     {
         return EXIT_SUCCESS;
@@ -97,6 +124,44 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
     printf("server: threadpool comienzo. threads: %d queue size: %d\n", thread_count, queue_size);
+    if (watchdog_ms > 0)
+    {
+        if (threadpool_watchdog_start(pool, watchdog_ms, handle_stuck_task, (void *)&watchdog_quarantine) != 0)
+        {
+            fprintf(stderr, "server: error al intentar iniciar watchdog\n");
+            return EXIT_FAILURE;
+        }
+        printf("server: watchdog comienzo. umbral: %ld ms cuarentena: %s\n", watchdog_ms, watchdog_quarantine ? "si" : "no");
+    }
+    http_task_options.timeout_ms = task_timeout_ms;
+    printf("server: keep-alive. máximo de requests: %ld inactividad: %ld ms\n", keep_alive_max, keep_alive_timeout_ms);
+    printf("server: HTTP request. máximo de headers: %d bytes máximo de body: %d bytes\n", max_header_size, max_body_size);
+    tcp_task_options.timeout_ms = 0;
+    tcp_task_options.token = NULL;
+    router = setup_http_routes();
+    if (router == NULL)
+    {
+        fprintf(stderr, "server: error al registrar las rutas HTTP\n");
+        return EXIT_FAILURE;
+    }
+    printf("server: rutas HTTP registradas: %d\n", router->route_count);
+    ret_val = http_mime_load(mime_types_path);
+    if (ret_val < 0)
+    {
+        fprintf(stderr, "server: error al cargar los tipos MIME\n");
+        return EXIT_FAILURE;
+    }
+    printf("server: tipos MIME cargados: %d\n", ret_val);
+    // Without the index files are served as they are
+    variants = create_http_variant_index(RESOURCES_FOLDER);
+    if (variants != NULL)
+    {
+        printf("server: recursos indexados: %d\n", variants->count);
+    }
+    if (variants != NULL && gzip_variants)
+    {
+        start_gzip_variants();
+    }
 
     ret_val = handle_connections(sockfd_tcp, sockfd_udp, sockfd_tcp_http);
     if (ret_val < 0)
@@ -112,17 +177,23 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
     printf("server: threadpool finalizado\n");
+    http_buffer_pool_clear();
+    free_http_router(&router);
+    if (variant_pool != NULL)
+    {
+        threadpool_destroy(variant_pool, 0);
+    }
+    free_http_variant_index(&variants);
+    http_mime_clear();
 
     close(sockfd_tcp);
     close(sockfd_udp);
     close(sockfd_tcp_http);
-    pthread_mutex_destroy(&lock);
-    pthread_mutex_destroy(&lock_file);
     puts("server: finalizando");
     return EXIT_SUCCESS;
 }
 
-int parse_arguments(int argc, char *argv[], char *local_ip, char *local_port_tcp, char *local_port_udp, char *local_port_tcp_http, int *thread_count, int *queue_size)
+int parse_arguments(int argc, char *argv[], char *local_ip, char *local_port_tcp, char *local_port_udp, char *local_port_tcp_http, int *thread_count, int *queue_size, long *task_timeout_ms, long *watchdog_ms, int *watchdog_quarantine, long *keep_alive_max, long *keep_alive_timeout_ms, int *max_header_size, int *max_body_size, const char **mime_types_path, int *gzip_variants)
 {
     int ret_val;
 
@@ -173,6 +244,49 @@ int parse_arguments(int argc, char *argv[], char *local_ip, char *local_port_tcp
                 *queue_size = atoi(argv[i + 1]);
                 i++; // Skip the next argument since it's the port number
             }
+            else if (strcmp(argv[i], "--task-timeout") == 0 && i + 1 < argc)
+            {
+                *task_timeout_ms = atol(argv[i + 1]);
+                i++; // Skip the next argument since it's the timeout
+            }
+            else if (strcmp(argv[i], "--watchdog") == 0 && i + 1 < argc)
+            {
+                *watchdog_ms = atol(argv[i + 1]);
+                i++; // Skip the next argument since it's the threshold
+            }
+            else if (strcmp(argv[i], "--watchdog-quarantine") == 0)
+            {
+                *watchdog_quarantine = 1;
+            }
+            else if (strcmp(argv[i], "--keep-alive-max") == 0 && i + 1 < argc)
+            {
+                *keep_alive_max = atol(argv[i + 1]);
+                i++; // Skip the next argument since it's the number of requests
+            }
+            else if (strcmp(argv[i], "--keep-alive-timeout") == 0 && i + 1 < argc)
+            {
+                *keep_alive_timeout_ms = atol(argv[i + 1]);
+                i++; // Skip the next argument since it's the timeout
+            }
+            else if (strcmp(argv[i], "--max-header-size") == 0 && i + 1 < argc)
+            {
+                *max_header_size = atoi(argv[i + 1]);
+                i++; // Skip the next argument since it's the size
+            }
+            else if (strcmp(argv[i], "--max-body-size") == 0 && i + 1 < argc)
+            {
+                *max_body_size = atoi(argv[i + 1]);
+                i++; // Skip the next argument since it's the size
+            }
+            else if (strcmp(argv[i], "--mime-types") == 0 && i + 1 < argc)
+            {
+                *mime_types_path = argv[i + 1];
+                i++; // Skip the next argument since it's the path
+            }
+            else if (strcmp(argv[i], "--gzip-variants") == 0)
+            {
+                *gzip_variants = 1;
+            }
             else
             {
                 printf("server: opción o argumento no soportado: %s\n", argv[i]);
@@ -197,6 +311,15 @@ void show_help()
     puts("  --local-port-tcp-http <puerto>    Especificar el número de puerto tcp http local");
     puts("  --threads <número>    Especificar la cantidad de threads del threadpool");
     puts("  --queue <número>    Especificar el tamaño de la queue del threadpool");
+    puts("  --task-timeout <ms>    Especificar el tiempo máximo de una tarea HTTP (0: sin límite)");
+    puts("  --watchdog <ms>    Reportar tareas que corren hace más de <ms> (0: desactivado)");
+    puts("  --watchdog-quarantine    Cerrar la conexión de las tareas reportadas por el watchdog");
+    puts("  --keep-alive-max <número>    Máximo de requests por conexión HTTP (1: cerrar después de cada response)");
+    puts("  --keep-alive-timeout <ms>    Cerrar conexiones HTTP inactivas luego de <ms> (0: sin límite)");
+    puts("  --max-header-size <bytes>    Tamaño máximo de request line y headers HTTP (más grandes: 431)");
+    puts("  --max-body-size <bytes>    Tamaño máximo del body de un HTTP request (más grande: 413)");
+    puts("  --mime-types <archivo>    Archivo con los tipos MIME por extensión (por defecto: " HTTP_MIME_DEFAULT_TYPES_FILE ")");
+    puts("  --gzip-variants    Crear en segundo plano las variantes .gz que falten de los recursos de texto");
 }
 
 void show_version()
@@ -376,7 +499,8 @@ int setup_server_udp(char *local_ip, char *local_port)
 int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
 {
     char their_ipstr[INET_ADDRSTRLEN];
-    int i, max_fd, new_fd, ret_val, their_port, select_ret;
+    int i, max_fd, new_fd, ret_val, their_port, select_ret, task_status, simple_write, parse_ready, yes;
+    uint64_t now, last_simple_write_ms;
     fd_set master, read_fds, write_fds, except_fds;
     threadpool_task_t *task;
     socklen_t sin_size;
@@ -389,6 +513,7 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
     void *result;
 
     ret_val = 0;
+    yes = 1;
 
     // Initialize sets
     FD_ZERO(&master);
@@ -401,9 +526,6 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
     FD_SET(sockfd_tcp_http, &master);
     max_fd = find_max(3, sockfd_tcp, sockfd_udp, sockfd_tcp_http);
 
-    timeout.tv_sec = 1; // Wait for 1 seconds
-    timeout.tv_usec = 0;
-
     heartbeat_data = create_heartbeat_data(sockfd_udp);
     if (heartbeat_data == NULL)
     {
@@ -430,18 +552,79 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
 
     // Main accept() loop
     stop = 0;
+    last_simple_write_ms = 0;
     while (stop == 0)
     {
         // Reset sets to master value
         read_fds = master;
-        write_fds = master;
         except_fds = master;
+        FD_ZERO(&write_fds);
+
+        // The UDP and simple TCP sockets are almost always writable and their handlers
+        // always have something to send, so they are only offered once per interval
+        now = now_ms();
+        simple_write = now - last_simple_write_ms >= SIMPLE_WRITE_INTERVAL_MS;
+        if (simple_write)
+        {
+            last_simple_write_ms = now;
+        }
+        parse_ready = 0;
+        for (i = 0; i <= max_fd; i++)
+        {
+            if (index_in_client_http_data_array(http_clients, MAX_CLIENTS, i))
+            {
+                if (http_clients[i]->state == HTTP_CONNECTION_WRITING)
+                {
+                    // Response pending: wait until it can be sent, not for the next request
+                    FD_CLR(i, &read_fds);
+                    FD_SET(i, &write_fds);
+                }
+                else if (http_clients[i]->parse_pending)
+                {
+                    parse_ready = 1;
+                }
+                else if (keep_alive_timeout_ms > 0 && now - http_clients[i]->last_active_ms >= (uint64_t)keep_alive_timeout_ms)
+                {
+                    printf("server: cliente (%s:%d) inactivo\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                    printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                    free_client_http_data(&http_clients[i]);
+                    FD_CLR(i, &master);
+                    FD_CLR(i, &read_fds);
+                    FD_CLR(i, &except_fds);
+                }
+            }
+            else if (simple_write && FD_ISSET(i, &master) && i != sockfd_tcp && i != sockfd_tcp_http)
+            {
+                FD_SET(i, &write_fds);
+            }
+        }
 
-        // Because of UDP socket sometimes select return really fast
-        sleep(1); // Sleep for 1s before retry
+        // Wake up for the next write interval, which also checks idle connections
+        timeout.tv_sec = (SIMPLE_WRITE_INTERVAL_MS - (now - last_simple_write_ms)) / 1000;
+        timeout.tv_usec = ((SIMPLE_WRITE_INTERVAL_MS - (now - last_simple_write_ms)) % 1000) * 1000;
+        if (parse_ready)
+        {
+            // Only poll, there are buffered requests to serve right away
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 0;
+        }
 
         // First argument is always nfds = max_fd + 1
         select_ret = select(max_fd + 1, &read_fds, &write_fds, &except_fds, &timeout);
+        // Responses to whatever woke us up carry the current second
+        http_date_update();
+        // Requests already in a receive buffer do not make the socket readable again
+        for (i = 0; parse_ready && select_ret >= 0 && i <= max_fd; i++)
+        {
+            if (index_in_client_http_data_array(http_clients, MAX_CLIENTS, i) &&
+                http_clients[i]->state == HTTP_CONNECTION_READING &&
+                http_clients[i]->parse_pending &&
+                !FD_ISSET(i, &read_fds))
+            {
+                FD_SET(i, &read_fds);
+                select_ret++;
+            }
+        }
         // if select_ret = 0 -> o I/O event happened within the specified timeout period
         // if select_ret > 0 -> n file descriptors are ready
         if (select_ret > 0)
@@ -523,6 +706,9 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                             close(new_fd);
                             break;
                         }
+                        // Back to back responses of a pipeline are small writes, Nagle would hold
+                        // each one until the client acknowledges the previous one
+                        setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
 
                         printf("server: obtuvo conexión de %s:%d\n", their_ipstr, their_port);
                         continue;
@@ -549,7 +735,6 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                             {
                                 fprintf(stderr, "server: error en lectura de packet UDP\n");
                             }
-                            free(thread_result);
                         }
                         else
                         {
@@ -562,7 +747,10 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                     {
                         // handle HTTP read
                         // adding a task
-                        if (threadpool_add(pool, handle_client_http_read, (void *)http_clients[i], &task, 0))
+                        // Same connection, same worker: keeps its buffers in that core's cache
+                        http_task_options.token = &http_clients[i]->token;
+                        http_task_options.affinity_key = i;
+                        if (threadpool_add_with_options(pool, handle_client_http_read, (void *)http_clients[i], &task, 0, &http_task_options))
                         {
                             fprintf(stderr, "server: no se pudo agregar task al threadpool\n");
                             ret_val = -1;
@@ -572,10 +760,18 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                         }
 
                         // wait for the task to complete and get the result
-                        result = threadpool_wait(task);
+                        result = threadpool_wait_with_status(task, &task_status);
 
                         thread_result = (Thread_Result *)result;
-                        if (thread_result != NULL)
+                        if (task_status != 0)
+                        {
+                            // Dropped before running, free the capacity held by this connection
+                            printf("server: cliente (%s:%d) tarea descartada\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                            printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                            free_client_http_data(&http_clients[i]);
+                            FD_CLR(i, &master);
+                        }
+                        else if (thread_result != NULL)
                         {
                             if (thread_result->value == THREAD_RESULT_ERROR)
                             {
@@ -590,7 +786,36 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                                 free_client_http_data(&http_clients[i]);
                                 FD_CLR(i, &master);
                             }
-                            free(thread_result);
+                            else if (thread_result->value == THREAD_RESULT_CANCELLED)
+                            {
+                                printf("server: cliente (%s:%d) tarea cancelada\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                free_client_http_data(&http_clients[i]);
+                                FD_CLR(i, &master);
+                            }
+                            else if (thread_result->value == THREAD_RESULT_SUCCESS)
+                            {
+                                // Build the responses of the queued requests, they are written in order later
+                                thread_result = dispatch_http_responses(http_clients[i]);
+                                if (thread_result == NULL)
+                                {
+                                    ret_val = -1;
+                                    free_client_http_data(&http_clients[i]);
+                                    FD_CLR(i, &master);
+                                    break;
+                                }
+                                else if (thread_result->value == THREAD_RESULT_SUCCESS)
+                                {
+                                    http_clients[i]->state = HTTP_CONNECTION_WRITING;
+                                }
+                                else
+                                {
+                                    printf("server: cliente (%s:%d) error al generar respuesta\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                    printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                    free_client_http_data(&http_clients[i]);
+                                    FD_CLR(i, &master);
+                                }
+                            }
                         }
                         else
                         {
@@ -603,7 +828,8 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                     {
                         // handle read
                         // adding a task
-                        if (threadpool_add(pool, handle_client_simple_read, (void *)clients[i], &task, 0))
+                        tcp_task_options.affinity_key = i;
+                        if (threadpool_add_with_options(pool, handle_client_simple_read, (void *)clients[i], &task, 0, &tcp_task_options))
                         {
                             fprintf(stderr, "server: no se pudo agregar task al threadpool\n");
                             ret_val = -1;
@@ -631,7 +857,6 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                                 free_client_tcp_data(&clients[i]);
                                 FD_CLR(i, &master);
                             }
-                            free(thread_result);
                         }
                         else
                         {
@@ -666,7 +891,6 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                             {
                                 fprintf(stderr, "server: error en escritura de packet UDP\n");
                             }
-                            free(thread_result);
                         }
                         else
                         {
@@ -679,7 +903,11 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                     {
                         // handle HTTP write
                         // adding a task
-                        if (threadpool_add(pool, handle_client_http_write, (void *)http_clients[i], &task, 0))
+                        // Same connection, same worker: keeps its buffers in that core's cache
+                        http_task_options.token = &http_clients[i]->token;
+                        http_task_options.affinity_key = i;
+                        if (threadpool_add_with_options(pool, http_clients[i]->http2 != NULL ? handle_client_http2_write : handle_client_http_write,
+                                                        (void *)http_clients[i], &task, 0, &http_task_options))
                         {
                             fprintf(stderr, "server: no se pudo agregar task al threadpool\n");
                             ret_val = -1;
@@ -689,10 +917,18 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                         }
 
                         // wait for the task to complete and get the result
-                        result = threadpool_wait(task);
+                        result = threadpool_wait_with_status(task, &task_status);
 
                         thread_result = (Thread_Result *)result;
-                        if (thread_result != NULL)
+                        if (task_status != 0)
+                        {
+                            // Dropped before running, free the capacity held by this connection
+                            printf("server: cliente (%s:%d) tarea descartada\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                            printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                            free_client_http_data(&http_clients[i]);
+                            FD_CLR(i, &master);
+                        }
+                        else if (thread_result != NULL)
                         {
                             if (thread_result->value == THREAD_RESULT_ERROR)
                             {
@@ -707,7 +943,25 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                                 free_client_http_data(&http_clients[i]);
                                 FD_CLR(i, &master);
                             }
-                            free(thread_result);
+                            else if (thread_result->value == THREAD_RESULT_CANCELLED)
+                            {
+                                printf("server: cliente (%s:%d) tarea cancelada\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                free_client_http_data(&http_clients[i]);
+                                FD_CLR(i, &master);
+                            }
+                            else if (thread_result->value == THREAD_RESULT_SUCCESS && !http_clients[i]->keep_alive)
+                            {
+                                printf("server: cliente (%s:%d) cerrando conexión\n", http_clients[i]->client_ipstr, http_clients[i]->client_port);
+                                free_client_http_data(&http_clients[i]);
+                                FD_CLR(i, &master);
+                            }
+                            else
+                            {
+                                // Responses sent, back to waiting for the next requests
+                                http_clients[i]->state = HTTP_CONNECTION_READING;
+                                http_clients[i]->last_active_ms = now_ms();
+                            }
                         }
                         else
                         {
@@ -720,7 +974,8 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                     {
                         // handle write
                         // adding a task
-                        if (threadpool_add(pool, handle_client_simple_write, (void *)clients[i], &task, 0))
+                        tcp_task_options.affinity_key = i;
+                        if (threadpool_add_with_options(pool, handle_client_simple_write, (void *)clients[i], &task, 0, &tcp_task_options))
                         {
                             fprintf(stderr, "server: no se pudo agregar task al threadpool\n");
                             ret_val = -1;
@@ -748,7 +1003,6 @@ int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http)
                                 free_client_tcp_data(&clients[i]);
                                 FD_CLR(i, &master);
                             }
-                            free(thread_result);
                         }
                         else
                         {
@@ -817,7 +1071,6 @@ void *handle_client_simple_read(void *arg)
 {
     ssize_t recv_val;
     Client_Tcp_Data *client_data;
-    Thread_Result *thread_result;
 
     if (arg == NULL)
     {
@@ -825,15 +1078,6 @@ void *handle_client_simple_read(void *arg)
     }
 
     client_data = (Client_Tcp_Data *)arg;
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
-    {
-        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
     printf("Thread cliente (%s:%d): lectura comienzo\n", client_data->client_ipstr, client_data->client_port);
 
     // receive initial message from client
@@ -843,31 +1087,27 @@ void *handle_client_simple_read(void *arg)
         fprintf(stderr, "server: conexión finalizada antes de recibir packet\n");
         free_simple_packet(client_data->packet);
         client_data->packet = NULL;
-        thread_result->value = THREAD_RESULT_CLOSED;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_CLOSED);
     }
     else if (recv_val < 0)
     {
         fprintf(stderr, "server: error al recibir packet\n");
         free_simple_packet(client_data->packet);
         client_data->packet = NULL;
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
     }
     printf("server: mensaje recibido: \"%s\"\n", client_data->packet->data);
 
     // Print completion message
     printf("Thread cliente (%s:%d): lectura fin\n", client_data->client_ipstr, client_data->client_port);
 
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
 }
 
 void *handle_client_simple_write(void *arg)
 {
     char message[DEFAULT_BUFFER_SIZE];
     Client_Tcp_Data *client_data;
-    Thread_Result *thread_result;
 
     if (arg == NULL)
     {
@@ -875,15 +1115,6 @@ void *handle_client_simple_write(void *arg)
     }
 
     client_data = (Client_Tcp_Data *)arg;
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
-    {
-        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
     printf("Thread cliente (%s:%d): escritura comienzo\n", client_data->client_ipstr, client_data->client_port);
 
     // send PONG message
@@ -896,16 +1127,14 @@ void *handle_client_simple_write(void *arg)
         if ((client_data->packet = create_simple_packet(message)) == NULL)
         {
             fprintf(stderr, "server: error al crear packet\n");
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
         }
         if (send_simple_packet(client_data->client_sockfd, client_data->packet) < 0)
         {
             fprintf(stderr, "server: error al enviar packet\n");
             free_simple_packet(client_data->packet);
             client_data->packet = NULL;
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
         }
         printf("Thread cliente (%s:%d): mensaje enviado: \"%s\"\n", client_data->client_ipstr, client_data->client_port, client_data->packet->data);
     }
@@ -916,16 +1145,14 @@ void *handle_client_simple_write(void *arg)
         if ((client_data->packet = create_simple_packet(message)) == NULL)
         {
             fprintf(stderr, "server: error al crear packet\n");
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
         }
         if (send_simple_packet(client_data->client_sockfd, client_data->packet) < 0)
         {
             fprintf(stderr, "server: Error al enviar packet\n");
             free_simple_packet(client_data->packet);
             client_data->packet = NULL;
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
         }
         printf("Thread cliente (%s:%d): mensaje enviado: \"%s\"\n", client_data->client_ipstr, client_data->client_port, client_data->packet->data);
     }
@@ -933,8 +1160,7 @@ void *handle_client_simple_write(void *arg)
     // Print completion message
     printf("Thread cliente (%s:%d): escritura fin\n", client_data->client_ipstr, client_data->client_port);
 
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
 }
 
 void *handle_client_heartbeat_read(void *arg)
@@ -944,7 +1170,6 @@ void *handle_client_heartbeat_read(void *arg)
     struct sockaddr_in *client_ipv4;
     struct in_addr *client_addr;
     Heartbeat_Data *heartbeat_data;
-    Thread_Result *thread_result;
 
     if (arg == NULL)
     {
@@ -953,15 +1178,6 @@ void *handle_client_heartbeat_read(void *arg)
 
     heartbeat_data = (Heartbeat_Data *)arg;
 
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
-    {
-        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
     puts("Thread Heartbeat: lectura comienzo");
 
     if (heartbeat_data->packet != NULL)
@@ -973,8 +1189,7 @@ void *handle_client_heartbeat_read(void *arg)
     if ((heartbeat_data->packet = create_heartbeat_packet("")) == NULL)
     {
         fprintf(stderr, "server: error al crear packet\n");
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
     }
     // receive HEARTBEAT message from client
     recv_val = recv_heartbeat_packet(heartbeat_data->sockfd, heartbeat_data->packet, heartbeat_data->addr, &heartbeat_data->addrlen);
@@ -983,16 +1198,14 @@ void *handle_client_heartbeat_read(void *arg)
         fprintf(stderr, "server: conexión finalizada antes de recibir packet\n");
         free_heartbeat_packet(heartbeat_data->packet);
         heartbeat_data->packet = NULL;
-        thread_result->value = THREAD_RESULT_CLOSED;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_CLOSED);
     }
     else if (recv_val < 0)
     {
         fprintf(stderr, "server: error al recibir packet\n");
         free_heartbeat_packet(heartbeat_data->packet);
         heartbeat_data->packet = NULL;
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
     }
 
     client_ipv4 = (struct sockaddr_in *)heartbeat_data->addr;
@@ -1005,8 +1218,7 @@ void *handle_client_heartbeat_read(void *arg)
     // Print completion message
     puts("Thread Heartbeat: lectura fin");
 
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
 }
 
 void *handle_client_heartbeat_write(void *arg)
@@ -1016,7 +1228,6 @@ void *handle_client_heartbeat_write(void *arg)
     struct sockaddr_in *client_ipv4;
     struct in_addr *client_addr;
     Heartbeat_Data *heartbeat_data;
-    Thread_Result *thread_result;
 
     if (arg == NULL)
     {
@@ -1024,26 +1235,15 @@ void *handle_client_heartbeat_write(void *arg)
     }
 
     heartbeat_data = (Heartbeat_Data *)arg;
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
-    {
-        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
     if (heartbeat_data->packet == NULL)
     {
         // we can't send ACK if we haven't got a Heartbeat message first
-        thread_result->value = THREAD_RESULT_EMPTY_PACKET;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_EMPTY_PACKET);
     }
     // If server already received a packet from the client and it wasn't a Heartbeat
     if (heartbeat_data->packet != NULL && strstr(heartbeat_data->packet->message, "HEARTBEAT") == NULL)
     {
-        thread_result->value = THREAD_RESULT_SUCCESS;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
     }
 
     puts("Thread Heartbeat: escritura comienzo");
@@ -1056,16 +1256,14 @@ void *handle_client_heartbeat_write(void *arg)
     if ((heartbeat_data->packet = create_heartbeat_packet(message)) == NULL)
     {
         fprintf(stderr, "server: error al crear packet\n");
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
     }
     if (send_heartbeat_packet(heartbeat_data->sockfd, heartbeat_data->packet, heartbeat_data->addr, heartbeat_data->addrlen) < 0)
     {
         fprintf(stderr, "server: error al enviar packet\n");
         free_heartbeat_packet(heartbeat_data->packet);
         heartbeat_data->packet = NULL;
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
     }
     client_ipv4 = (struct sockaddr_in *)heartbeat_data->addr;
     client_addr = &(client_ipv4->sin_addr);
@@ -1080,14 +1278,16 @@ void *handle_client_heartbeat_write(void *arg)
     // Print completion message
     puts("Thread Heartbeat: escritura fin");
 
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
 }
 
 void *handle_client_http_read(void *arg)
 {
+    int parse_ret, pipeline_full, preface;
+    ssize_t bytes_recv;
     Client_Http_Data *client_data;
-    Thread_Result *thread_result;
+    HTTP_Request *request;
+    Http_Pipeline_Entry *entry;
 
     if (arg == NULL)
     {
@@ -1095,390 +1295,1780 @@ void *handle_client_http_read(void *arg)
     }
 
     client_data = (Client_Http_Data *)arg;
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
-    {
-        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
     printf("Thread HTTP (%s:%d): lectura comienzo\n", client_data->client_ipstr, client_data->client_port);
 
-    // Receive HTTP request
-    client_data->request = receive_http_request(client_data->client_sockfd);
-    if (client_data->request == NULL)
-    {
-        fprintf(stderr, "server: error al recibir HTTP request\n");
-        thread_result->value = THREAD_RESULT_ERROR;
-        return (void *)thread_result;
-    }
-
-    printf("Thread HTTP (%s:%d): HTTP request recibido: %s %s %s\n",
-           client_data->client_ipstr,
-           client_data->client_port,
-           client_data->request->request_line.method,
-           client_data->request->request_line.uri,
-           client_data->request->request_line.version);
-
-    // Log headers
-    printf("Thread HTTP (%s:%d): HTTP request headers:\n",
-           client_data->client_ipstr,
-           client_data->client_port);
-    log_headers(client_data->request->headers, client_data->request->header_count);
-
-    // Log body if present
-    if (client_data->request->body)
-    {
-        printf("Thread HTTP (%s:%d): HTTP request body:\n",
-               client_data->client_ipstr,
-               client_data->client_port);
-        printf("%s\n", client_data->request->body);
-    }
-
-    // Print completion message
-    printf("Thread HTTP (%s:%d): lectura fin\n", client_data->client_ipstr, client_data->client_port);
-
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
-}
-
-void *handle_client_http_write(void *arg)
-{
-    char *file_content, *full_path, *last_occurrence, *size_str;
-    const char *content_type;
-    int body_size, file_fd, header_index, header_count;
-    ssize_t bytes_read, total_bytes_read;
-    struct stat file_stat;
-    struct dirent *entry;
-    DIR *dp;
-    Client_Http_Data *client_data;
-    Thread_Result *thread_result;
-    Header *headers;
-
-    if (arg == NULL)
+    // Requests left over from the last read are parsed without waiting for the socket
+    if (!client_data->parse_pending)
     {
-        return NULL;
+        bytes_recv = fill_http_receive_buffer(client_data->client_sockfd, client_data->receive_buffer);
+        if (bytes_recv == 0)
+        {
+            // A keep-alive client closing between requests is not an error
+            return (void *)get_thread_result(THREAD_RESULT_CLOSED);
+        }
+        if (bytes_recv < 0)
+        {
+            fprintf(stderr, "server: error al recibir HTTP request\n");
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
+        }
     }
+    client_data->parse_pending = 0;
 
-    client_data = (Client_Http_Data *)arg;
-    pthread_mutex_lock(&lock); // Lock before malloc
-    thread_result = (Thread_Result *)malloc(sizeof(Thread_Result));
-    pthread_mutex_unlock(&lock); // Unlock after malloc
-    if (thread_result == NULL)
+    // A client with prior knowledge of HTTP/2 starts with its preface instead of a request
+    if (client_data->http2 == NULL && client_data->next_sequence == 0)
     {
-        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
+        preface = http2_match_preface(client_data->receive_buffer->data + client_data->receive_buffer->start,
+                                      client_data->receive_buffer->length - client_data->receive_buffer->start);
+        if (preface == HTTP2_PREFACE_PARTIAL)
+        {
+            return (void *)get_thread_result(THREAD_RESULT_INCOMPLETE);
+        }
+        if (preface == HTTP2_PREFACE_FOUND && start_http2(client_data, NULL) < 0)
+        {
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
+        }
     }
-
-    if (client_data->request == NULL)
+    if (client_data->http2 != NULL)
     {
-        thread_result->value = THREAD_RESULT_EMPTY_REQUEST;
-        return (void *)thread_result;
+        return (void *)get_thread_result(read_http2_frames(client_data));
     }
 
-    printf("Thread HTTP (%s:%d): escritura comienzo\n", client_data->client_ipstr, client_data->client_port);
-    header_index = 0;
-    header_count = INITIAL_HEADER_COUNT;
-    if (client_data->request->request_line.uri[0] == '/' && strlen(client_data->request->request_line.uri) > 1)
+    // A pipelining client can send several requests in one packet, queue every whole one
+    pipeline_full = 0;
+    while (!(pipeline_full = client_data->next_sequence - client_data->send_sequence == HTTP_PIPELINE_DEPTH))
     {
-        // Generate response for a particular file
-        // Allocate memory for the file content
-        full_path = (char *)malloc(sizeof(char) * (strlen(RESOURCES_FOLDER) + strlen(client_data->request->request_line.uri)) + 1);
-        if (full_path == NULL)
+        entry = &client_data->pipeline[client_data->next_sequence % HTTP_PIPELINE_DEPTH];
+        if (entry->arena == NULL && (entry->arena = create_arena(HTTP_REQUEST_ARENA_SIZE)) == NULL)
         {
-            fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-            free_http_request(&client_data->request);
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            fprintf(stderr, "server: error al crear arena de HTTP request\n");
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
         }
-        snprintf(full_path, strlen(RESOURCES_FOLDER) + strlen(client_data->request->request_line.uri) + 1, "%s%s", RESOURCES_FOLDER, client_data->request->request_line.uri);
 
-        // strrchr: searches for the last occurrence of a character in a string
-        // You don't need to free the result of strrchr.
-        // The strrchr function returns a pointer to a location within the original string
-        if ((last_occurrence = strrchr(full_path, '.')) == NULL)
+        parse_ret = next_http_request(client_data->receive_buffer, &request, entry->arena);
+        if (parse_ret == HTTP_PARSE_INCOMPLETE)
         {
-            fprintf(stderr, "server: error al buscar extension de archivo %s\n", full_path);
-            free(full_path);
-
-            // Generate response for resource error
-            client_data->response = create_http_response(DEFAULT_HTTP_VERSION, 400, HTTP_400_PHRASE, NULL, 0, NULL);
-            if (send_http_response(client_data->client_sockfd, client_data->response) < 0)
-            {
-                fprintf(stderr, "server: error al enviar HTTP response\n");
-                free_http_request(&client_data->request);
-                free_http_response(&client_data->response);
-                thread_result->value = THREAD_RESULT_ERROR;
-                return (void *)thread_result;
-            }
-            else
-            {
-                printf("Thread HTTP (%s:%d): response-line enviado: %s %d %s\n",
-                       client_data->client_ipstr,
-                       client_data->client_port,
-                       client_data->response->response_line.version,
-                       client_data->response->response_line.status_code,
-                       client_data->response->response_line.reason_phrase);
-            }
-            free_http_request(&client_data->request);
-            free_http_response(&client_data->response);
-            thread_result->value = THREAD_RESULT_SUCCESS;
-            return (void *)thread_result;
+            break;
         }
-
-        content_type = get_content_type(last_occurrence);
-        pthread_mutex_lock(&lock_file);
-        file_fd = open(full_path, O_RDONLY);
-        free(full_path);
-
-        if (file_fd > 0 && fstat(file_fd, &file_stat) == 0)
+        if (parse_ret == HTTP_PARSE_HEADERS_TOO_LARGE || parse_ret == HTTP_PARSE_TOO_MANY || parse_ret == HTTP_PARSE_BODY_TOO_LARGE)
         {
-            // Generate response for existing file
-            size_str = (char *)malloc(sizeof(int));
-            if (size_str == NULL)
-            {
-                close(file_fd);
-                fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-                free_http_request(&client_data->request);
-                thread_result->value = THREAD_RESULT_ERROR;
-                return (void *)thread_result;
-            }
-            headers = create_headers(header_count);
-            add_header(&headers, &header_index, &header_count, "Content-Type", content_type);
-            sprintf(size_str, "%ld", file_stat.st_size);
-            add_header(&headers, &header_index, &header_count, "Content-Length", size_str);
-            free(size_str);
-            add_header(&headers, &header_index, &header_count, "Connection", "close");
-
-            client_data->response = create_http_response(DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, headers, header_count, NULL);
-            client_data->response->headers = headers;
-            client_data->response->header_count = header_count;
-
-            // Allocate memory for the file content
-            file_content = (char *)malloc(sizeof(char) * file_stat.st_size + 1);
-            if (file_content == NULL)
-            {
-                close(file_fd);
-                pthread_mutex_unlock(&lock_file);
-                fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-                free_http_request(&client_data->request);
-                free_http_response(&client_data->response);
-                thread_result->value = THREAD_RESULT_ERROR;
-                return (void *)thread_result;
-            }
-            // Read the file content into response->body
-            total_bytes_read = 0;
-            while (total_bytes_read < file_stat.st_size)
-            {
-                bytes_read = read(file_fd, file_content + total_bytes_read, file_stat.st_size - total_bytes_read);
-                if (bytes_read < 0)
-                {
-                    fprintf(stderr, "server: error al leer archivo: %s\n", strerror(errno));
-                    close(file_fd);
-                    pthread_mutex_unlock(&lock_file);
-                    free_http_request(&client_data->request);
-                    free_http_response(&client_data->response);
-                    thread_result->value = THREAD_RESULT_ERROR;
-                    return (void *)thread_result;
-                }
-                total_bytes_read += bytes_read;
-            }
-            file_content[file_stat.st_size] = '\0'; // Null-terminate the body
-            client_data->response->body = file_content;
-            client_data->response->body_length = file_stat.st_size;
-
-            close(file_fd);
-            pthread_mutex_unlock(&lock_file);
-
-            if (send_http_response(client_data->client_sockfd, client_data->response) < 0)
+            // Over a limit rather than malformed, the client is told why before the connection closes
+            entry->client = client_data;
+            entry->request = NULL;
+            entry->keep_alive = 0;
+            if (parse_ret == HTTP_PARSE_BODY_TOO_LARGE)
             {
-                fprintf(stderr, "server: error al enviar HTTP response\n");
-                free_http_request(&client_data->request);
-                free_http_response(&client_data->response);
-                thread_result->value = THREAD_RESULT_ERROR;
-                return (void *)thread_result;
+                entry->response = create_http_response_in_arena(entry->arena, DEFAULT_HTTP_VERSION, 413, HTTP_413_PHRASE, NULL);
             }
-            printf("Thread HTTP (%s:%d): response-line enviado: %s %d %s\n",
-                   client_data->client_ipstr,
-                   client_data->client_port,
-                   client_data->response->response_line.version,
-                   client_data->response->response_line.status_code,
-                   client_data->response->response_line.reason_phrase);
-            printf("Thread HTTP (%s:%d): headers enviados:\n",
-                   client_data->client_ipstr,
-                   client_data->client_port);
-            log_headers(client_data->response->headers, client_data->response->header_count);
-        }
-        else if (file_fd < 0 || fstat(file_fd, &file_stat) != 0)
-        {
-            // File not found or error getting file stats
-            // Generate response for file not found
-            pthread_mutex_unlock(&lock_file);
-            client_data->response = create_http_response(DEFAULT_HTTP_VERSION, 404, HTTP_404_PHRASE, NULL, 0, NULL);
-            if (send_http_response(client_data->client_sockfd, client_data->response) < 0)
+            else
             {
-                fprintf(stderr, "server: error al enviar HTTP response\n");
-                free_http_request(&client_data->request);
-                free_http_response(&client_data->response);
-                thread_result->value = THREAD_RESULT_ERROR;
-                return (void *)thread_result;
+                entry->response = create_http_response_in_arena(entry->arena, DEFAULT_HTTP_VERSION, 431, HTTP_431_PHRASE, NULL);
             }
-            else
+            if (entry->response != NULL)
             {
-                printf("Thread HTTP (%s:%d): response-line enviado: %s %d %s\n",
+                add_header(&entry->response->headers, "Content-Length", "0");
+                add_header(&entry->response->headers, "Connection", "close");
+                entry->sequence = client_data->next_sequence++;
+                printf("Thread HTTP (%s:%d): HTTP request rechazado (#%lu): %d\n",
                        client_data->client_ipstr,
                        client_data->client_port,
-                       client_data->response->response_line.version,
-                       client_data->response->response_line.status_code,
-                       client_data->response->response_line.reason_phrase);
+                       entry->sequence,
+                       entry->response->response_line.status_code);
+                break;
             }
         }
-    }
-    else if (client_data->request->request_line.uri[0] == '/' && strlen(client_data->request->request_line.uri) == 1)
-    {
-        // Generate response that lists available files
-        pthread_mutex_lock(&lock_file);
-        dp = opendir(RESOURCES_FOLDER);
-        if (dp == NULL)
-        {
-            fprintf(stderr, "server: error al abrir carpeta de recursos: %s\n", strerror(errno));
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
-        }
-
-        client_data->response = create_http_response(DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, NULL, 0, NULL);
-
-        body_size = 0;
-        // First pass: Calculate total length
-        // While not the end of the directory
-        while ((entry = readdir(dp)) != NULL)
+        if (parse_ret != HTTP_PARSE_DONE)
         {
-            // Regular files
-            if (entry->d_type == DT_REG)
+            fprintf(stderr, "server: error al recibir HTTP request\n");
+            if (client_data->next_sequence == client_data->send_sequence)
             {
-                body_size += strlen(entry->d_name) + 2; // +1 for '\r\n'
+                return (void *)get_thread_result(THREAD_RESULT_ERROR);
             }
+            // Answer the requests before the malformed one, then close
+            client_data->pipeline[(client_data->next_sequence - 1) % HTTP_PIPELINE_DEPTH].keep_alive = 0;
+            break;
         }
 
-        // Allocate memory
-        client_data->response->body = (char *)malloc(sizeof(char) * body_size + 1); // +1 for '\0'
-        if (client_data->response->body == NULL)
-        {
-            closedir(dp);
-            pthread_mutex_unlock(&lock_file);
-            fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-            free_http_request(&client_data->request);
-            free_http_response(&client_data->response);
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
-        }
+        entry->sequence = client_data->next_sequence++;
+        entry->client = client_data;
+        entry->request = request;
+        entry->response = NULL;
+        entry->keep_alive = http_keep_alive(request, entry->sequence);
 
-        // Initialize the body with an empty string
-        client_data->response->body[0] = '\0';
+        printf("Thread HTTP (%s:%d): HTTP request recibido (#%lu): %s %s %s\n",
+               client_data->client_ipstr,
+               client_data->client_port,
+               entry->sequence,
+               request->request_line.method,
+               request->request_line.uri,
+               request->request_line.version);
 
-        // Rewind directory stream
-        rewinddir(dp);
+        // Log headers
+        printf("Thread HTTP (%s:%d): HTTP request headers:\n",
+               client_data->client_ipstr,
+               client_data->client_port);
+        log_headers(&request->headers);
 
-        // Second pass: Concatenate file names
-        while ((entry = readdir(dp)))
+        // Log body if present
+        if (request->body)
         {
-            if (entry->d_type == DT_REG)
-            {
-                strcat(client_data->response->body, entry->d_name);
-                strcat(client_data->response->body, "\r\n");
-            }
+            printf("Thread HTTP (%s:%d): HTTP request body:\n",
+                   client_data->client_ipstr,
+                   client_data->client_port);
+            printf("%s\n", request->body);
         }
-        client_data->response->body[body_size] = '\0';
-        closedir(dp);
-        pthread_mutex_unlock(&lock_file);
 
-        size_str = (char *)malloc(sizeof(int));
-        if (size_str == NULL)
+        // Upgrade: h2c on a request with nothing before it, the rest of the connection is HTTP/2
+        if (entry->sequence == client_data->send_sequence && http2_upgrade_requested(request) && start_http2(client_data, entry) == 0)
         {
-            fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
-            free_http_request(&client_data->request);
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
+            return (void *)get_thread_result(read_http2_frames(client_data));
         }
 
-        headers = create_headers(header_count);
-        add_header(&headers, &header_index, &header_count, "Content-Type", "text/plain");
-        sprintf(size_str, "%ld", strlen(client_data->response->body));
-        add_header(&headers, &header_index, &header_count, "Content-Length", size_str);
-        free(size_str);
-        add_header(&headers, &header_index, &header_count, "Connection", "close");
-        client_data->response->headers = headers;
-        client_data->response->header_count = header_count;
-        client_data->response->body_length = body_size;
-
-        if (send_http_response(client_data->client_sockfd, client_data->response) < 0)
-        {
-            fprintf(stderr, "server: error al enviar HTTP response\n");
-            free_http_request(&client_data->request);
-            free_http_response(&client_data->response);
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
-        }
-        printf("Thread HTTP (%s:%d): response-line enviado: %s %d %s\n",
-               client_data->client_ipstr,
-               client_data->client_port,
-               client_data->response->response_line.version,
-               client_data->response->response_line.status_code,
-               client_data->response->response_line.reason_phrase);
-        printf("Thread HTTP (%s:%d): headers enviados:\n",
-               client_data->client_ipstr,
-               client_data->client_port);
-        log_headers(client_data->response->headers, client_data->response->header_count);
-    }
-    else
-    {
-        // Resource error
-        // Generate response for resource error
-        client_data->response = create_http_response(DEFAULT_HTTP_VERSION, 400, HTTP_400_PHRASE, NULL, 0, NULL);
-        if (send_http_response(client_data->client_sockfd, client_data->response) < 0)
+        if (!entry->keep_alive)
         {
-            fprintf(stderr, "server: error al enviar HTTP response\n");
-            free_http_request(&client_data->request);
-            free_http_response(&client_data->response);
-            thread_result->value = THREAD_RESULT_ERROR;
-            return (void *)thread_result;
-        }
-        else
-        {
-            printf("Thread HTTP (%s:%d): response-line enviado: %s %d %s\n",
-                   client_data->client_ipstr,
-                   client_data->client_port,
-                   client_data->response->response_line.version,
-                   client_data->response->response_line.status_code,
-                   client_data->response->response_line.reason_phrase);
+            // Anything after it would be answered on a closed connection
+            break;
         }
     }
-
-    // Cleanup
-    free_http_request(&client_data->request);
-    free_http_response(&client_data->response);
+    // Once the responses are out, the rest is parsed before waiting for more bytes
+    client_data->parse_pending = pipeline_full && client_data->receive_buffer->length > client_data->receive_buffer->start;
 
     // Print completion message
-    printf("Thread HTTP (%s:%d): escritura fin\n", client_data->client_ipstr, client_data->client_port);
+    printf("Thread HTTP (%s:%d): lectura fin\n", client_data->client_ipstr, client_data->client_port);
 
-    thread_result->value = THREAD_RESULT_SUCCESS;
-    return (void *)thread_result;
+    if (client_data->next_sequence == client_data->send_sequence)
+    {
+        return (void *)get_thread_result(THREAD_RESULT_INCOMPLETE);
+    }
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
 }
 
-Client_Tcp_Data *create_client_tcp_data(int sockfd, const char *ipstr, in_port_t port)
+/* handle_client_http_response:
+ * Builds the response of one pipeline entry and leaves it there, sending is
+ * up to handle_client_http_write so responses built in parallel go out in order.
+ * The route registered for the method and path builds it, see setup_http_routes.
+ */
+void *handle_client_http_response(void *arg)
 {
-    Client_Tcp_Data *data;
-    if (sockfd <= 0 || ipstr == NULL || port <= 0)
+    int ret_val;
+    Http_Pipeline_Entry *pipeline_entry;
+    Client_Http_Data *client_data;
+    HTTP_Request *request;
+    HTTP_Response *response;
+    HTTP_Route_Match match;
+
+    if (arg == NULL)
     {
         return NULL;
     }
 
-    data = (Client_Tcp_Data *)malloc(sizeof(Client_Tcp_Data));
-    if (data == NULL)
+    pipeline_entry = (Http_Pipeline_Entry *)arg;
+    client_data = pipeline_entry->client;
+    request = pipeline_entry->request;
+    if (request == NULL)
     {
-        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return (void *)get_thread_result(THREAD_RESULT_EMPTY_REQUEST);
+    }
+
+    printf("Thread HTTP (%s:%d): respuesta #%lu comienzo\n", client_data->client_ipstr, client_data->client_port, pipeline_entry->sequence);
+    ret_val = http_router_match(router, request->request_line.method, request->request_line.uri, &match);
+    if (ret_val == HTTP_ROUTE_FOUND)
+    {
+        ret_val = match.route->handler(request, &match, pipeline_entry);
+    }
+    else if (ret_val == HTTP_ROUTE_METHOD_NOT_ALLOWED)
+    {
+        // The path exists, Allow tells the client which methods it takes
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 405, HTTP_405_PHRASE, NULL);
+        if (response != NULL)
+        {
+            response->rendered_headers = http_route_allow_header(&match, &response->rendered_headers_length);
+        }
+        ret_val = finish_empty_http_response(pipeline_entry, response);
+    }
+    else if (strcmp(request->request_line.uri, "*") == 0 && strcmp(request->request_line.method, "OPTIONS") == 0)
+    {
+        // OPTIONS * asks about the server as a whole, not about a path
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, NULL);
+        if (response != NULL)
+        {
+            response->rendered_headers = HTTP_SERVER_ALLOW;
+            response->rendered_headers_length = sizeof(HTTP_SERVER_ALLOW) - 1;
+        }
+        ret_val = finish_empty_http_response(pipeline_entry, response);
+    }
+    else
+    {
+        // Resource error
+        // Generate response for resource error
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 400, HTTP_400_PHRASE, NULL);
+        ret_val = finish_empty_http_response(pipeline_entry, response);
+    }
+    if (ret_val != THREAD_RESULT_SUCCESS)
+    {
+        return (void *)get_thread_result(ret_val);
+    }
+
+    // Print completion message
+    printf("Thread HTTP (%s:%d): respuesta #%lu fin\n", client_data->client_ipstr, client_data->client_port, pipeline_entry->sequence);
+
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
+}
+
+/* setup_http_routes:
+ * Endpoints of the HTTP server. A new endpoint is one more http_router_add
+ * here and its handler, handle_client_http_response does not change.
+ */
+HTTP_Router *setup_http_routes(void)
+{
+    HTTP_Router *http_router;
+
+    http_router = create_http_router();
+    if (http_router == NULL)
+    {
+        return NULL;
+    }
+    // POST gets the same response, its body is read and ignored. HEAD shares the
+    // handlers of GET, which leave the body out for it
+    if (http_router_add(http_router, "GET", "/", handle_http_resource_list) < 0 ||
+        http_router_add(http_router, "HEAD", "/", handle_http_resource_list) < 0 ||
+        http_router_add(http_router, "POST", "/", handle_http_resource_list) < 0 ||
+        http_router_add(http_router, "OPTIONS", "/", handle_http_options) < 0 ||
+        http_router_add(http_router, "GET", "/*file", handle_http_resource_file) < 0 ||
+        http_router_add(http_router, "HEAD", "/*file", handle_http_resource_file) < 0 ||
+        http_router_add(http_router, "POST", "/*file", handle_http_resource_file) < 0 ||
+        http_router_add(http_router, "OPTIONS", "/*file", handle_http_options) < 0)
+    {
+        free_http_router(&http_router);
+        return NULL;
+    }
+    return http_router;
+}
+
+/* handle_http_options:
+ * OPTIONS of any path: the methods it takes, from the Allow line the router
+ * rendered when the routes were registered.
+ */
+int handle_http_options(HTTP_Request *request, const HTTP_Route_Match *match, void *arg)
+{
+    Http_Pipeline_Entry *pipeline_entry;
+    HTTP_Response *response;
+
+    pipeline_entry = (Http_Pipeline_Entry *)arg;
+    response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, NULL);
+    if (response != NULL)
+    {
+        response->rendered_headers = http_route_allow_header(match, &response->rendered_headers_length);
+    }
+    return finish_empty_http_response(pipeline_entry, response);
+}
+
+/* handle_http_resource_list:
+ * GET /: lists the available files. HEAD gets the same headers and no list.
+ */
+int handle_http_resource_list(HTTP_Request *request, const HTTP_Route_Match *match, void *arg)
+{
+    Http_Pipeline_Entry *pipeline_entry;
+    HTTP_Response *response;
+
+    pipeline_entry = (Http_Pipeline_Entry *)arg;
+
+    // Generate response that lists available files
+    // The list is written while it is sent, never held in memory as a whole
+    response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, NULL);
+    if (response == NULL)
+    {
+        return THREAD_RESULT_ERROR;
+    }
+    add_header(&response->headers, "Content-Type", "text/plain");
+    if (strcmp(request->request_line.version, "HTTP/1.0") == 0)
+    {
+        // HTTP/1.0 has no chunked encoding, the end of the connection ends the body
+        pipeline_entry->keep_alive = 0;
+    }
+    else
+    {
+        add_header(&response->headers, "Transfer-Encoding", "chunked");
+    }
+    add_header(&response->headers, "Connection", pipeline_entry->keep_alive ? "keep-alive" : "close");
+    if (strcmp(request->request_line.method, "HEAD") != 0)
+    {
+        response->stream = stream_resource_list;
+        response->stream_arg = NULL;
+    }
+    pipeline_entry->response = response;
+    return THREAD_RESULT_SUCCESS;
+}
+
+/* handle_http_resource_file:
+ * GET of the "*file" pattern: sends a file of RESOURCES_FOLDER. HEAD gets the
+ * headers from fstat and the file is never read.
+ */
+int handle_http_resource_file(HTTP_Request *request, const HTTP_Route_Match *match, void *arg)
+{
+    char *file_content, *full_path, *last_occurrence, *validators;
+    char size_str[HTTP_UINT_STR_LEN], etag[HTTP_ETAG_SIZE], last_modified[HTTP_DATE_SIZE], content_range[HTTP_CONTENT_RANGE_SIZE];
+    const char *file, *range;
+    const HTTP_Mime_Type *mime;
+    HTTP_Variant_File *variant;
+    HTTP_Content_Coding coding;
+    size_t file_length, path_length, validators_length;
+    int file_fd, range_count, ret_val;
+    struct stat file_stat, original_stat;
+    HTTP_Byte_Range ranges[HTTP_RANGE_MAX];
+    Http_Pipeline_Entry *pipeline_entry;
+    HTTP_Response *response;
+
+    pipeline_entry = (Http_Pipeline_Entry *)arg;
+    file = http_route_param(match, "file", &file_length);
+
+    // Generate response for a particular file
+    // Scratch memory from the worker arena, released when the task completes
+    path_length = strlen(RESOURCES_FOLDER) + 1 + file_length;
+    full_path = (char *)arena_alloc(threadpool_arena(pool), sizeof(char) * path_length + HTTP_VARIANT_SUFFIX_SIZE);
+    if (full_path == NULL)
+    {
+        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
+        return THREAD_RESULT_ERROR;
+    }
+    snprintf(full_path, path_length + 1, "%s/%.*s", RESOURCES_FOLDER, (int)file_length, file);
+
+    // strrchr: searches for the last occurrence of a character in a string
+    // You don't need to free the result of strrchr.
+    // The strrchr function returns a pointer to a location within the original string
+    if ((last_occurrence = strrchr(full_path, '.')) == NULL)
+    {
+        fprintf(stderr, "server: error al buscar extension de archivo %s\n", full_path);
+
+        // Generate response for resource error
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 400, HTTP_400_PHRASE, NULL);
+        return finish_empty_http_response(pipeline_entry, response);
+    }
+
+    mime = http_mime_type(last_occurrence);
+
+    // A precompressed sidecar the client accepts is sent instead of the file
+    variant = variants != NULL ? http_variant_find(variants, file, file_length) : NULL;
+    coding = HTTP_CODING_IDENTITY;
+    if (variant != NULL)
+    {
+        coding = http_variant_select(variant, find_known_header_value(&request->headers, HTTP_HEADER_ACCEPT_ENCODING));
+        strcat(full_path, http_coding_suffix(coding));
+    }
+
+    // Files are only read, each task through its own descriptor, so lookups of
+    // different requests run in parallel
+    file_fd = open(full_path, O_RDONLY);
+    if (file_fd >= 0 && coding != HTTP_CODING_IDENTITY)
+    {
+        // The file may have changed since its sidecar was written
+        full_path[path_length] = '\0';
+        if (fstat(file_fd, &file_stat) != 0 || stat(full_path, &original_stat) != 0 || !http_variant_is_current(&original_stat, &file_stat))
+        {
+            close(file_fd);
+            file_fd = -1;
+            if (coding == HTTP_CODING_GZIP)
+            {
+                rebuild_gzip_variant(variant);
+            }
+        }
+    }
+    if (file_fd < 0 && coding != HTTP_CODING_IDENTITY)
+    {
+        // The sidecar went away since the index was built, or is older than the file
+        full_path[path_length] = '\0';
+        coding = HTTP_CODING_IDENTITY;
+        file_fd = open(full_path, O_RDONLY);
+    }
+    if (file_fd < 0 || fstat(file_fd, &file_stat) != 0)
+    {
+        // File not found or error getting file stats
+        // Generate response for file not found
+        if (file_fd >= 0)
+        {
+            close(file_fd);
+        }
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 404, HTTP_404_PHRASE, NULL);
+        return finish_empty_http_response(pipeline_entry, response);
+    }
+
+    // Validators come from fstat alone, the same block serves the 200 and the 304
+    validators = (char *)arena_alloc(pipeline_entry->arena, sizeof("ETag: \r\nLast-Modified: \r\n") + HTTP_ETAG_SIZE + HTTP_DATE_SIZE + HTTP_VARIANT_HEADERS_SIZE + mime->header_length + HTTP_BYTERANGES_HEADER_SIZE);
+    if (validators == NULL)
+    {
+        close(file_fd);
+        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
+        return THREAD_RESULT_ERROR;
+    }
+    http_format_etag(etag, (uint64_t)file_stat.st_ino, (uint64_t)file_stat.st_size, (uint64_t)file_stat.st_mtim.tv_sec * 1000000000ULL + (uint64_t)file_stat.st_mtim.tv_nsec);
+    validators_length = sprintf(validators, "ETag: %s\r\n", etag);
+    if (http_format_date(last_modified, file_stat.st_mtime) > 0)
+    {
+        validators_length += sprintf(validators + validators_length, "Last-Modified: %s\r\n", last_modified);
+    }
+    // Caches must know the body depends on Accept-Encoding, also when the file goes out as it is
+    if (variant != NULL && http_variant_codings(variant) != 0)
+    {
+        validators_length += sprintf(validators + validators_length, "Vary: Accept-Encoding\r\n");
+    }
+    if (coding != HTTP_CODING_IDENTITY)
+    {
+        validators_length += sprintf(validators + validators_length, "Content-Encoding: %s\r\n", http_coding_name(coding));
+    }
+
+    // The client copy is current, answer without reading the file
+    if ((strcmp(request->request_line.method, "GET") == 0 || strcmp(request->request_line.method, "HEAD") == 0) &&
+        http_not_modified(&request->headers, etag, file_stat.st_mtime))
+    {
+        close(file_fd);
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 304, HTTP_304_PHRASE, NULL);
+        if (response == NULL)
+        {
+            return THREAD_RESULT_ERROR;
+        }
+        response->rendered_headers = validators;
+        response->rendered_headers_length = validators_length;
+        add_header(&response->headers, "Connection", pipeline_entry->keep_alive ? "keep-alive" : "close");
+        pipeline_entry->response = response;
+        return THREAD_RESULT_SUCCESS;
+    }
+
+    // Range applies to GET only, and only while If-Range says the client copy is this one
+    range_count = HTTP_RANGE_NONE;
+    range = find_known_header_value(&request->headers, HTTP_HEADER_RANGE);
+    if (range != NULL && strcmp(request->request_line.method, "GET") == 0 &&
+        http_if_range_matches(find_known_header_value(&request->headers, HTTP_HEADER_IF_RANGE), etag, file_stat.st_mtime))
+    {
+        range_count = http_parse_range(range, (uint64_t)file_stat.st_size, ranges, HTTP_RANGE_MAX);
+    }
+    if (range_count == HTTP_RANGE_UNSATISFIABLE)
+    {
+        close(file_fd);
+        response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 416, HTTP_416_PHRASE, NULL);
+        if (response != NULL)
+        {
+            snprintf(content_range, sizeof(content_range), "bytes */%" PRIu64, (uint64_t)file_stat.st_size);
+            add_header(&response->headers, "Content-Range", content_range);
+        }
+        return finish_empty_http_response(pipeline_entry, response);
+    }
+    if (range_count > 0)
+    {
+        ret_val = finish_http_byteranges(pipeline_entry, file_fd, (uint64_t)file_stat.st_size, mime, etag, ranges, range_count, validators, validators_length);
+        close(file_fd);
+        return ret_val;
+    }
+
+    // Generate response for existing file
+    response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 200, HTTP_200_PHRASE, NULL);
+    if (response == NULL)
+    {
+        close(file_fd);
+        return THREAD_RESULT_ERROR;
+    }
+    // Validators and Content-Type go out as rendered, after the other headers
+    memcpy(validators + validators_length, mime->header, mime->header_length);
+    response->rendered_headers = validators;
+    response->rendered_headers_length = validators_length + mime->header_length;
+    http_format_uint(size_str, (uint64_t)file_stat.st_size);
+    add_header(&response->headers, "Content-Length", size_str);
+    add_header(&response->headers, "Accept-Ranges", "bytes");
+    add_header(&response->headers, "Connection", pipeline_entry->keep_alive ? "keep-alive" : "close");
+    if (strcmp(request->request_line.method, "HEAD") == 0)
+    {
+        close(file_fd);
+        pipeline_entry->response = response;
+        return THREAD_RESULT_SUCCESS;
+    }
+    // The body length of a response is an int
+    if ((uint64_t)file_stat.st_size > INT_MAX)
+    {
+        close(file_fd);
+        fprintf(stderr, "server: archivo demasiado grande: %" PRIu64 " bytes\n", (uint64_t)file_stat.st_size);
+        free_http_response(&response);
+        return THREAD_RESULT_ERROR;
+    }
+
+    // Allocate memory for the file content
+    // Released with the rest of the request, a large file gets an arena block of its own
+    file_content = (char *)arena_alloc(pipeline_entry->arena, sizeof(char) * file_stat.st_size + 1);
+    if (file_content == NULL)
+    {
+        close(file_fd);
+        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
+        free_http_response(&response);
+        return THREAD_RESULT_ERROR;
+    }
+    ret_val = read_http_file(pipeline_entry, file_fd, file_content, 0, (uint64_t)file_stat.st_size);
+    close(file_fd);
+    if (ret_val != THREAD_RESULT_SUCCESS)
+    {
+        free_http_response(&response);
+        return ret_val;
+    }
+    file_content[file_stat.st_size] = '\0'; // Null-terminate the body
+    response->body = file_content;
+    response->body_length = (int)file_stat.st_size;
+
+    pipeline_entry->response = response;
+    return THREAD_RESULT_SUCCESS;
+}
+
+/* finish_http_byteranges:
+ * 206 response with the ranges of a file, read from their offsets so the rest
+ * of the file is never touched. One range is the body itself, several go in a
+ * multipart/byteranges body, each part with its own Content-Range.
+ */
+int finish_http_byteranges(Http_Pipeline_Entry *pipeline_entry, int file_fd, uint64_t size, const HTTP_Mime_Type *mime, const char *etag,
+                           const HTTP_Byte_Range *ranges, int range_count, char *validators, size_t validators_length)
+{
+    char content_range[HTTP_CONTENT_RANGE_SIZE], boundary[HTTP_BOUNDARY_SIZE], length_str[HTTP_UINT_STR_LEN];
+    char *body, *ptr;
+    uint64_t body_length;
+    int i, ret_val;
+    HTTP_Response *response;
+
+    response = create_http_response_in_arena(pipeline_entry->arena, DEFAULT_HTTP_VERSION, 206, HTTP_206_PHRASE, NULL);
+    if (response == NULL)
+    {
+        return THREAD_RESULT_ERROR;
+    }
+
+    if (range_count == 1)
+    {
+        snprintf(content_range, sizeof(content_range), "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, ranges[0].first, ranges[0].last, size);
+        add_header(&response->headers, "Content-Range", content_range);
+        memcpy(validators + validators_length, mime->header, mime->header_length);
+        validators_length += mime->header_length;
+        body_length = ranges[0].last - ranges[0].first + 1;
+    }
+    else
+    {
+        // The boundary comes from the ETag, which is already unique to this file version
+        snprintf(boundary, sizeof(boundary), "byteranges-%.*s", (int)strlen(etag) - 2, etag + 1);
+        validators_length += sprintf(validators + validators_length, "Content-Type: multipart/byteranges; boundary=%s\r\n", boundary);
+        body_length = strlen("\r\n--") + strlen(boundary) + strlen("--\r\n");
+        for (i = 0; i < range_count; i++)
+        {
+            body_length += snprintf(NULL, 0, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n\r\n",
+                                    boundary, mime->type, ranges[i].first, ranges[i].last, size);
+            body_length += ranges[i].last - ranges[i].first + 1;
+        }
+    }
+    response->rendered_headers = validators;
+    response->rendered_headers_length = validators_length;
+    if (body_length > INT_MAX)
+    {
+        fprintf(stderr, "server: rango demasiado grande: %" PRIu64 " bytes\n", body_length);
+        free_http_response(&response);
+        return THREAD_RESULT_ERROR;
+    }
+    http_format_uint(length_str, body_length);
+    add_header(&response->headers, "Content-Length", length_str);
+    add_header(&response->headers, "Accept-Ranges", "bytes");
+    add_header(&response->headers, "Connection", pipeline_entry->keep_alive ? "keep-alive" : "close");
+
+    body = (char *)arena_alloc(pipeline_entry->arena, body_length + 1);
+    if (body == NULL)
+    {
+        fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
+        free_http_response(&response);
+        return THREAD_RESULT_ERROR;
+    }
+    ptr = body;
+    for (i = 0; i < range_count; i++)
+    {
+        if (range_count > 1)
+        {
+            ptr += sprintf(ptr, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n\r\n",
+                           boundary, mime->type, ranges[i].first, ranges[i].last, size);
+        }
+        ret_val = read_http_file(pipeline_entry, file_fd, ptr, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+        if (ret_val != THREAD_RESULT_SUCCESS)
+        {
+            free_http_response(&response);
+            return ret_val;
+        }
+        ptr += ranges[i].last - ranges[i].first + 1;
+    }
+    if (range_count > 1)
+    {
+        ptr += sprintf(ptr, "\r\n--%s--\r\n", boundary);
+    }
+    *ptr = '\0';
+    response->body = body;
+    response->body_length = (int)body_length;
+
+    pipeline_entry->response = response;
+    return THREAD_RESULT_SUCCESS;
+}
+
+/* read_http_file:
+ * Reads length bytes of a file starting at offset. pread leaves the descriptor
+ * offset alone, so ranges can be read in any order.
+ */
+int read_http_file(Http_Pipeline_Entry *pipeline_entry, int file_fd, char *buffer, uint64_t offset, uint64_t length)
+{
+    uint64_t total_bytes_read;
+    ssize_t bytes_read;
+    Client_Http_Data *client_data;
+
+    client_data = pipeline_entry->client;
+    total_bytes_read = 0;
+    while (total_bytes_read < length)
+    {
+        // A client that is gone cancels the rest of its responses as well
+        if (http_peer_gone(client_data->client_sockfd))
+        {
+            threadpool_cancel(&client_data->token);
+        }
+        // Stop reading if the connection was cancelled or the task ran out of time
+        if (threadpool_cancelled(pool))
+        {
+            printf("Thread HTTP (%s:%d): respuesta #%lu cancelada\n", client_data->client_ipstr, client_data->client_port, pipeline_entry->sequence);
+            return THREAD_RESULT_CANCELLED;
+        }
+        bytes_read = pread(file_fd, buffer + total_bytes_read, length - total_bytes_read < HTTP_FILE_READ_SIZE ? length - total_bytes_read : HTTP_FILE_READ_SIZE,
+                           (off_t)(offset + total_bytes_read));
+        if (bytes_read <= 0)
+        {
+            fprintf(stderr, "server: error al leer archivo: %s\n", bytes_read < 0 ? strerror(errno) : "fin de archivo inesperado");
+            return THREAD_RESULT_ERROR;
+        }
+        total_bytes_read += bytes_read;
+    }
+    return THREAD_RESULT_SUCCESS;
+}
+
+/* start_gzip_variants:
+ * Queues a gzip build for every text resource without one, on a pool of its
+ * own with a single thread, so building them never delays a request. Each
+ * variant is served as soon as it is complete. The pool stays for the
+ * rebuilds of files that change later, each file is queued at most once at
+ * a time, so one slot per text resource is enough.
+ */
+void start_gzip_variants(void)
+{
+    int i, pending, compressible;
+
+    pending = 0;
+    compressible = 0;
+    for (i = 0; i < variants->count; i++)
+    {
+        if (variants->files[i].compressible)
+        {
+            compressible++;
+            if ((http_variant_codings(&variants->files[i]) & (1u << HTTP_CODING_GZIP)) == 0)
+            {
+                pending++;
+            }
+        }
+    }
+    if (compressible == 0)
+    {
+        return;
+    }
+    variant_pool = threadpool_create(1, compressible, 0);
+    if (variant_pool == NULL)
+    {
+        fprintf(stderr, "server: error al intentar crear threadpool de variantes\n");
+        return;
+    }
+    for (i = 0; i < variants->count; i++)
+    {
+        if (variants->files[i].compressible && (http_variant_codings(&variants->files[i]) & (1u << HTTP_CODING_GZIP)) == 0 &&
+            threadpool_add(variant_pool, build_gzip_variant, (void *)&variants->files[i], NULL, 0) != 0)
+        {
+            fprintf(stderr, "server: no se pudo agregar task al threadpool de variantes\n");
+            break;
+        }
+    }
+    printf("server: variantes gzip pendientes: %d\n", pending);
+}
+
+/* rebuild_gzip_variant:
+ * Queues a new gzip sidecar for a file that changed after its last one was
+ * written. The first request to find it stale takes the sidecar out of use,
+ * the rest send the file as it is until the new one is complete.
+ */
+void rebuild_gzip_variant(HTTP_Variant_File *file)
+{
+    if (variant_pool == NULL || !file->compressible || !http_variant_drop(file, HTTP_CODING_GZIP))
+    {
+        return;
+    }
+    if (threadpool_add(variant_pool, build_gzip_variant, (void *)file, NULL, 0) != 0)
+    {
+        fprintf(stderr, "server: no se pudo agregar task al threadpool de variantes\n");
+        return;
+    }
+    printf("server: variante gzip de %s desactualizada, reconstruyendo\n", file->name);
+}
+
+void *build_gzip_variant(void *arg)
+{
+    HTTP_Variant_File *file;
+
+    file = (HTTP_Variant_File *)arg;
+    if (http_variant_build_gzip(variants, file) > 0)
+    {
+        printf("server: variante gzip de %s lista\n", file->name);
+    }
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
+}
+
+// Ends a response without a body and leaves it in the entry
+int finish_empty_http_response(Http_Pipeline_Entry *pipeline_entry, HTTP_Response *response)
+{
+    if (response == NULL)
+    {
+        return THREAD_RESULT_ERROR;
+    }
+    add_header(&response->headers, "Content-Length", "0");
+    add_header(&response->headers, "Connection", pipeline_entry->keep_alive ? "keep-alive" : "close");
+    pipeline_entry->response = response;
+    return THREAD_RESULT_SUCCESS;
+}
+
+/* handle_client_http_write:
+ * Sends the ready responses in sequence order and releases their entries. Stops
+ * at the first response that closes the connection.
+ */
+void *handle_client_http_write(void *arg)
+{
+    Client_Http_Data *client_data;
+    Http_Pipeline_Entry *entry;
+
+    if (arg == NULL)
+    {
+        return NULL;
+    }
+
+    client_data = (Client_Http_Data *)arg;
+    if (client_data->send_sequence == client_data->next_sequence)
+    {
+        return (void *)get_thread_result(THREAD_RESULT_EMPTY_REQUEST);
+    }
+
+    printf("Thread HTTP (%s:%d): escritura comienzo\n", client_data->client_ipstr, client_data->client_port);
+    while (client_data->send_sequence < client_data->next_sequence)
+    {
+        entry = &client_data->pipeline[client_data->send_sequence % HTTP_PIPELINE_DEPTH];
+        if (entry->response == NULL)
+        {
+            // Not built yet, later responses have to wait for it
+            break;
+        }
+
+        // Date of the moment it is sent, from the cache the main loop refreshes
+        add_header(&entry->response->headers, "Date", http_date());
+        if (send_http_response(client_data->client_sockfd, entry->response) < 0)
+        {
+            fprintf(stderr, "server: error al enviar HTTP response\n");
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
+        }
+        printf("Thread HTTP (%s:%d): response-line enviado (#%lu): %s %d %s\n",
+               client_data->client_ipstr,
+               client_data->client_port,
+               entry->sequence,
+               entry->response->response_line.version,
+               entry->response->response_line.status_code,
+               entry->response->response_line.reason_phrase);
+        printf("Thread HTTP (%s:%d): headers enviados:\n",
+               client_data->client_ipstr,
+               client_data->client_port);
+        log_headers(&entry->response->headers);
+
+        if (entry->request == NULL)
+        {
+            // Rejected while reading, the rest of it may still be on its way
+            linger_http_close(client_data->client_sockfd);
+        }
+
+        // Cleanup
+        client_data->keep_alive = entry->keep_alive;
+        free_http_request(&entry->request);
+        free_http_response(&entry->response);
+        arena_reset(entry->arena);
+        client_data->send_sequence++;
+        if (!client_data->keep_alive)
+        {
+            break;
+        }
+    }
+
+    // Print completion message
+    printf("Thread HTTP (%s:%d): escritura fin\n", client_data->client_ipstr, client_data->client_port);
+
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
+}
+
+/* handle_client_http2_write:
+ * Sends what an HTTP/2 connection has ready: the queued control frames, the
+ * HEADERS of every response built since the last call and then DATA, one
+ * frame per stream in turn so a large file does not hold back the others.
+ * Stops at the flow control windows, the WINDOW_UPDATE frames read later let
+ * the rest go.
+ */
+void *handle_client_http2_write(void *arg)
+{
+    char *block;
+    unsigned char frame_headers[HTTP2_WRITE_BATCH][HTTP2_FRAME_HEADER_SIZE];
+    struct iovec iov[2 * HTTP2_WRITE_BATCH];
+    int i, slot, idle, active, block_length, frame_count;
+    int64_t frame_length;
+    Client_Http_Data *client_data;
+    HTTP2_Connection *connection;
+    Http_Pipeline_Entry *entry;
+
+    if (arg == NULL)
+    {
+        return NULL;
+    }
+
+    client_data = (Client_Http_Data *)arg;
+    connection = client_data->http2;
+    printf("Thread HTTP (%s:%d): escritura HTTP/2 comienzo\n", client_data->client_ipstr, client_data->client_port);
+
+    for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+    {
+        entry = &client_data->pipeline[i];
+        if (entry->stream_id == 0 || entry->response == NULL || entry->headers_sent)
+        {
+            continue;
+        }
+        if (entry->response->stream != NULL && collect_http_body(entry) != THREAD_RESULT_SUCCESS)
+        {
+            // Nothing of it went out yet, only this stream fails
+            fprintf(stderr, "server: error al generar HTTP/2 response (stream %u)\n", entry->stream_id);
+            if (reset_http2_stream(client_data, entry->stream_id, HTTP2_INTERNAL_ERROR) != HTTP2_NO_ERROR)
+            {
+                return (void *)get_thread_result(THREAD_RESULT_ERROR);
+            }
+            continue;
+        }
+
+        // Date of the moment it is sent, from the cache the main loop refreshes
+        add_header(&entry->response->headers, "Date", http_date());
+        // The encoder table changes with every block, a failure leaves it out of step with the client
+        block_length = http2_encode_response(connection, entry->response, &block);
+        if (block_length < 0 || http2_queue_headers(connection, entry->stream_id, block, block_length, entry->response->body_length == 0) < 0)
+        {
+            fprintf(stderr, "server: error al enviar HTTP/2 response\n");
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
+        }
+        entry->headers_sent = 1;
+        printf("Thread HTTP (%s:%d): HTTP/2 response enviado (stream %u): %d\n",
+               client_data->client_ipstr,
+               client_data->client_port,
+               entry->stream_id,
+               entry->response->response_line.status_code);
+        printf("Thread HTTP (%s:%d): headers enviados:\n",
+               client_data->client_ipstr,
+               client_data->client_port);
+        log_headers(&entry->response->headers);
+
+        if (entry->response->body_length == 0)
+        {
+            if (entry->request == NULL && reset_http2_stream(client_data, entry->stream_id, HTTP2_NO_ERROR) != HTTP2_NO_ERROR)
+            {
+                // Rejected while reading, the rest of the request body is not wanted
+                return (void *)get_thread_result(THREAD_RESULT_ERROR);
+            }
+            release_http2_stream(entry);
+        }
+    }
+    if (http2_send_output(client_data->client_sockfd, connection) < 0)
+    {
+        fprintf(stderr, "server: error al enviar frames HTTP/2\n");
+        return (void *)get_thread_result(THREAD_RESULT_ERROR);
+    }
+
+    // Round robin over the bodies, a batch of frames goes out in one send
+    slot = 0;
+    idle = 0;
+    do
+    {
+        frame_count = 0;
+        while (frame_count < HTTP2_WRITE_BATCH && idle < HTTP_PIPELINE_DEPTH && connection->send_window > 0)
+        {
+            entry = &client_data->pipeline[slot];
+            slot = (slot + 1) % HTTP_PIPELINE_DEPTH;
+            if (entry->stream_id == 0 || !entry->headers_sent || entry->send_window <= 0 || entry->body_sent == entry->response->body_length)
+            {
+                idle++;
+                continue;
+            }
+            idle = 0;
+
+            frame_length = entry->response->body_length - entry->body_sent;
+            if (frame_length > connection->peer.max_frame_size)
+            {
+                frame_length = connection->peer.max_frame_size;
+            }
+            if (frame_length > entry->send_window)
+            {
+                frame_length = entry->send_window;
+            }
+            if (frame_length > connection->send_window)
+            {
+                frame_length = connection->send_window;
+            }
+            http2_write_frame_header(frame_headers[frame_count], (uint32_t)frame_length, HTTP2_FRAME_DATA,
+                                     entry->body_sent + frame_length == entry->response->body_length ? HTTP2_FLAG_END_STREAM : 0,
+                                     entry->stream_id);
+            iov[2 * frame_count].iov_base = frame_headers[frame_count];
+            iov[2 * frame_count].iov_len = HTTP2_FRAME_HEADER_SIZE;
+            iov[2 * frame_count + 1].iov_base = entry->response->body + entry->body_sent;
+            iov[2 * frame_count + 1].iov_len = (size_t)frame_length;
+            entry->body_sent += (int)frame_length;
+            entry->send_window -= frame_length;
+            connection->send_window -= frame_length;
+            frame_count++;
+        }
+        if (frame_count > 0 && sendall_iov_with_flags(client_data->client_sockfd, iov, 2 * frame_count, MSG_NOSIGNAL) < 0)
+        {
+            fprintf(stderr, "server: error al enviar frames HTTP/2\n");
+            return (void *)get_thread_result(THREAD_RESULT_ERROR);
+        }
+
+        // Streams whose last frame just went out are done, their bodies are no longer referenced
+        for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+        {
+            entry = &client_data->pipeline[i];
+            if (entry->stream_id != 0 && entry->headers_sent && entry->body_sent == entry->response->body_length)
+            {
+                printf("Thread HTTP (%s:%d): HTTP/2 body enviado (stream %u): %d bytes\n",
+                       client_data->client_ipstr,
+                       client_data->client_port,
+                       entry->stream_id,
+                       entry->body_sent);
+                release_http2_stream(entry);
+            }
+        }
+    } while (frame_count == HTTP2_WRITE_BATCH);
+
+    // Open after an error only long enough for the GOAWAY to arrive, and until the client that sent one has its responses
+    active = 0;
+    for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+    {
+        active |= client_data->pipeline[i].stream_id != 0;
+    }
+    client_data->keep_alive = !connection->goaway_sent && !(connection->goaway_received && !active);
+    if (connection->goaway_sent)
+    {
+        linger_http_close(client_data->client_sockfd);
+    }
+
+    // Print completion message
+    printf("Thread HTTP (%s:%d): escritura HTTP/2 fin\n", client_data->client_ipstr, client_data->client_port);
+
+    return (void *)get_thread_result(THREAD_RESULT_SUCCESS);
+}
+
+/* dispatch_http_responses:
+ * Adds one task per queued request without affinity, so independent file
+ * lookups run on different workers, and waits for all of them. Returns the
+ * first failure, or NULL if a task could not be added with none outstanding.
+ * Entries are visited from the oldest one, HTTP/2 streams may sit in any of
+ * them.
+ */
+Thread_Result *dispatch_http_responses(Client_Http_Data *client_data)
+{
+    int i, task_count, task_status, value;
+    unsigned long sequence, last;
+    Http_Pipeline_Entry *entry;
+    threadpool_task_t *tasks[HTTP_PIPELINE_DEPTH];
+    threadpool_options_t options;
+    Thread_Result *thread_result;
+
+    // Nobody left to read the responses
+    if (http_peer_gone(client_data->client_sockfd))
+    {
+        threadpool_cancel(&client_data->token);
+        return get_thread_result(THREAD_RESULT_CANCELLED);
+    }
+
+    options = http_task_options;
+    options.token = &client_data->token;
+    options.affinity_key = THREADPOOL_NO_AFFINITY;
+
+    value = THREAD_RESULT_SUCCESS;
+    sequence = client_data->send_sequence;
+    last = client_data->send_sequence + HTTP_PIPELINE_DEPTH;
+    while (sequence < last && value == THREAD_RESULT_SUCCESS)
+    {
+        task_count = 0;
+        while (sequence < last)
+        {
+            entry = &client_data->pipeline[sequence % HTTP_PIPELINE_DEPTH];
+            if (entry->request == NULL || entry->response != NULL || entry->receiving)
+            {
+                // Free, answered while reading over one of the request limits, or its body is still arriving
+                sequence++;
+                continue;
+            }
+            if (threadpool_add_with_options(pool, handle_client_http_response, (void *)entry, &tasks[task_count], 0, &options))
+            {
+                if (task_count == 0)
+                {
+                    fprintf(stderr, "server: no se pudo agregar task al threadpool\n");
+                    return NULL;
+                }
+                // Queue full: wait for the ones already added and try again
+                break;
+            }
+            task_count++;
+            sequence++;
+        }
+
+        // Every added task is waited for, they point into client_data
+        for (i = 0; i < task_count; i++)
+        {
+            thread_result = (Thread_Result *)threadpool_wait_with_status(tasks[i], &task_status);
+            if (value != THREAD_RESULT_SUCCESS)
+            {
+                continue;
+            }
+            if (task_status != 0)
+            {
+                // Dropped before running
+                value = THREAD_RESULT_CANCELLED;
+            }
+            else if (thread_result == NULL)
+            {
+                value = THREAD_RESULT_ERROR;
+            }
+            else
+            {
+                value = thread_result->value;
+            }
+        }
+    }
+
+    return get_thread_result(value);
+}
+
+/* stream_resource_list:
+ * Body of the resource list, one regular file name per line. Runs while the
+ * response is being sent, so only one chunk of names is in memory at a time.
+ */
+int stream_resource_list(HTTP_Body_Writer *writer, void *arg)
+{
+    struct dirent *entry;
+    DIR *dp;
+
+    dp = opendir(RESOURCES_FOLDER);
+    if (dp == NULL)
+    {
+        fprintf(stderr, "server: error al abrir carpeta de recursos: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // While not the end of the directory
+    while ((entry = readdir(dp)) != NULL)
+    {
+        // Regular files
+        // Regular files, their precompressed sidecars are the same file
+        if (entry->d_type == DT_REG && (variants == NULL || !http_variant_is_sidecar(variants, entry->d_name)))
+        {
+            if (http_body_write(writer, entry->d_name, strlen(entry->d_name)) < 0 || http_body_write(writer, "\r\n", 2) < 0)
+            {
+                closedir(dp);
+                return -1;
+            }
+        }
+    }
+    closedir(dp);
+    return 0;
+}
+
+/* start_http2:
+ * Switches the connection to HTTP/2 and queues our SETTINGS. upgraded is the
+ * request that asked for it with Upgrade: h2c, it becomes stream 1 and the
+ * 101 goes out first, NULL when the client started with the preface.
+ */
+int start_http2(Client_Http_Data *client_data, Http_Pipeline_Entry *upgraded)
+{
+    client_data->http2 = create_http2_connection(HTTP_PIPELINE_DEPTH, (uint32_t)max_header_size, upgraded != NULL);
+    if (client_data->http2 == NULL)
+    {
+        return -1;
+    }
+    if (upgraded != NULL)
+    {
+        if (http2_apply_settings_header(client_data->http2, find_known_header_value(&upgraded->request->headers, HTTP_HEADER_HTTP2_SETTINGS)) < 0)
+        {
+            // Answered over HTTP/1.1 instead, as if it had not asked
+            free_http2_connection(&client_data->http2);
+            return -1;
+        }
+        // Stream 1, with the whole request already received
+        upgraded->stream_id = 1;
+        upgraded->receiving = 0;
+        upgraded->headers_sent = 0;
+        upgraded->send_window = client_data->http2->peer.initial_window_size;
+        upgraded->body_sent = 0;
+        upgraded->keep_alive = 1;
+        client_data->http2->last_stream_id = 1;
+    }
+
+    printf("Thread HTTP (%s:%d): conexión HTTP/2 (%s)\n",
+           client_data->client_ipstr,
+           client_data->client_port,
+           upgraded != NULL ? "upgrade h2c" : "prior knowledge");
+    return 0;
+}
+
+/* read_http2_frames:
+ * Handles every whole frame received, the rest waits in the receive buffer.
+ * A connection error queues GOAWAY and ends the connection once it is sent.
+ * Returns THREAD_RESULT_SUCCESS when there is something to send.
+ */
+int read_http2_frames(Client_Http_Data *client_data)
+{
+    int i, active, error_code;
+    size_t available;
+    const unsigned char *data;
+    HTTP2_Frame_Header header;
+    HTTP2_Connection *connection;
+    HTTP_Receive_Buffer *buffer;
+
+    connection = client_data->http2;
+    buffer = client_data->receive_buffer;
+    available = buffer->data != NULL ? (size_t)(buffer->length - buffer->start) : 0;
+
+    // After an upgrade the preface follows the 101, it may not be here yet
+    if (!connection->preface_received && available > 0)
+    {
+        if (http2_match_preface(buffer->data + buffer->start, available) == HTTP2_PREFACE_NONE)
+        {
+            fprintf(stderr, "server: preface HTTP/2 inválido\n");
+            return THREAD_RESULT_ERROR;
+        }
+        if (available >= HTTP2_PREFACE_LENGTH)
+        {
+            buffer->start += HTTP2_PREFACE_LENGTH;
+            available -= HTTP2_PREFACE_LENGTH;
+            connection->preface_received = 1;
+        }
+    }
+
+    error_code = HTTP2_NO_ERROR;
+    while (connection->preface_received && !connection->goaway_sent && available >= HTTP2_FRAME_HEADER_SIZE)
+    {
+        data = (const unsigned char *)buffer->data + buffer->start;
+        http2_read_frame_header(data, &header);
+        if (header.length > connection->local.max_frame_size)
+        {
+            error_code = HTTP2_FRAME_SIZE_ERROR;
+            break;
+        }
+        if (available < HTTP2_FRAME_HEADER_SIZE + header.length)
+        {
+            break;
+        }
+        error_code = handle_http2_frame(client_data, &header, data + HTTP2_FRAME_HEADER_SIZE);
+        buffer->start += HTTP2_FRAME_HEADER_SIZE + header.length;
+        available -= HTTP2_FRAME_HEADER_SIZE + header.length;
+        if (error_code != HTTP2_NO_ERROR)
+        {
+            break;
+        }
+    }
+    if (buffer->data != NULL && buffer->start == buffer->length)
+    {
+        buffer->start = 0;
+        buffer->length = 0;
+    }
+
+    if (error_code != HTTP2_NO_ERROR)
+    {
+        fprintf(stderr, "server: error HTTP/2 de conexión: 0x%x\n", error_code);
+        if (http2_queue_goaway(connection, (uint32_t)error_code) < 0)
+        {
+            return THREAD_RESULT_ERROR;
+        }
+    }
+
+    if (connection->goaway_received && connection->output.length == 0)
+    {
+        active = 0;
+        for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+        {
+            active |= client_data->pipeline[i].stream_id != 0;
+        }
+        if (!active)
+        {
+            return THREAD_RESULT_CLOSED;
+        }
+    }
+    return pending_http2_work(client_data) ? THREAD_RESULT_SUCCESS : THREAD_RESULT_INCOMPLETE;
+}
+
+/* handle_http2_frame:
+ * Applies one frame to the connection. Returns HTTP2_NO_ERROR or the code of
+ * the connection error it caused, stream errors only reset their stream.
+ */
+int handle_http2_frame(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload)
+{
+    int error_code;
+    int64_t window_delta;
+    int i;
+    HTTP2_Connection *connection;
+
+    connection = client_data->http2;
+
+    // A header block is one unit, no other frame may come between its fragments
+    if (connection->header_stream != 0 && (header->type != HTTP2_FRAME_CONTINUATION || header->stream_id != connection->header_stream))
+    {
+        return HTTP2_PROTOCOL_ERROR;
+    }
+
+    switch (header->type)
+    {
+    case HTTP2_FRAME_DATA:
+        return handle_http2_data(client_data, header, payload);
+    case HTTP2_FRAME_HEADERS:
+        return handle_http2_headers(client_data, header, payload);
+    case HTTP2_FRAME_CONTINUATION:
+        if (connection->header_stream == 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (http2_append_header_fragment(connection, payload, header->length) < 0)
+        {
+            return HTTP2_ENHANCE_YOUR_CALM;
+        }
+        return (header->flags & HTTP2_FLAG_END_HEADERS) ? finish_http2_headers(client_data) : HTTP2_NO_ERROR;
+    case HTTP2_FRAME_PRIORITY:
+        // Responses are sent as they are built, priorities change nothing
+        if (header->stream_id == 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (header->length != 5)
+        {
+            return reset_http2_stream(client_data, header->stream_id, HTTP2_FRAME_SIZE_ERROR);
+        }
+        return HTTP2_NO_ERROR;
+    case HTTP2_FRAME_RST_STREAM:
+        if (header->stream_id == 0 || header->stream_id % 2 == 0 || header->stream_id > connection->last_stream_id)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (header->length != 4)
+        {
+            return HTTP2_FRAME_SIZE_ERROR;
+        }
+        release_http2_stream(find_http2_stream(client_data, header->stream_id));
+        return HTTP2_NO_ERROR;
+    case HTTP2_FRAME_SETTINGS:
+        if (header->stream_id != 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (header->flags & HTTP2_FLAG_ACK)
+        {
+            return header->length != 0 ? HTTP2_FRAME_SIZE_ERROR : HTTP2_NO_ERROR;
+        }
+        error_code = http2_apply_settings(connection, payload, header->length, &window_delta);
+        if (error_code != HTTP2_NO_ERROR)
+        {
+            return error_code;
+        }
+        // A new initial window moves the windows of the open streams by the difference
+        for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+        {
+            if (client_data->pipeline[i].stream_id != 0)
+            {
+                client_data->pipeline[i].send_window += window_delta;
+                if (client_data->pipeline[i].send_window > HTTP2_MAX_WINDOW)
+                {
+                    return HTTP2_FLOW_CONTROL_ERROR;
+                }
+            }
+        }
+        return http2_queue_frame(connection, HTTP2_FRAME_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0) < 0 ? HTTP2_INTERNAL_ERROR : HTTP2_NO_ERROR;
+    case HTTP2_FRAME_PUSH_PROMISE:
+        // Only servers push
+        return HTTP2_PROTOCOL_ERROR;
+    case HTTP2_FRAME_PING:
+        if (header->stream_id != 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (header->length != 8)
+        {
+            return HTTP2_FRAME_SIZE_ERROR;
+        }
+        if (!(header->flags & HTTP2_FLAG_ACK) && http2_queue_frame(connection, HTTP2_FRAME_PING, HTTP2_FLAG_ACK, 0, payload, 8) < 0)
+        {
+            return HTTP2_INTERNAL_ERROR;
+        }
+        return HTTP2_NO_ERROR;
+    case HTTP2_FRAME_GOAWAY:
+        if (header->stream_id != 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        printf("Thread HTTP (%s:%d): GOAWAY HTTP/2 recibido\n", client_data->client_ipstr, client_data->client_port);
+        connection->goaway_received = 1;
+        return HTTP2_NO_ERROR;
+    case HTTP2_FRAME_WINDOW_UPDATE:
+        return handle_http2_window_update(client_data, header, payload);
+    default:
+        // Unknown frame types must be ignored
+        return HTTP2_NO_ERROR;
+    }
+}
+
+/* handle_http2_headers:
+ * HEADERS opens a stream, or carries the trailers of one whose body is still
+ * arriving. The block is decoded once its last fragment is in.
+ */
+int handle_http2_headers(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload)
+{
+    uint32_t length;
+    Http_Pipeline_Entry *entry;
+    HTTP2_Connection *connection;
+
+    connection = client_data->http2;
+    if (header->stream_id == 0 || header->stream_id % 2 == 0 || strip_http2_padding(header, &payload, &length) < 0)
+    {
+        return HTTP2_PROTOCOL_ERROR;
+    }
+    if (header->flags & HTTP2_FLAG_PRIORITY)
+    {
+        // Stream dependency and weight, ignored like PRIORITY frames
+        if (length < 5)
+        {
+            return HTTP2_FRAME_SIZE_ERROR;
+        }
+        payload += 5;
+        length -= 5;
+    }
+
+    if (header->stream_id <= connection->last_stream_id)
+    {
+        // Only trailers may follow on a stream that is already open, and they end it
+        entry = find_http2_stream(client_data, header->stream_id);
+        if (entry == NULL || !entry->receiving || !(header->flags & HTTP2_FLAG_END_STREAM))
+        {
+            return HTTP2_STREAM_CLOSED;
+        }
+    }
+    else
+    {
+        connection->last_stream_id = header->stream_id;
+    }
+
+    if (http2_append_header_fragment(connection, payload, length) < 0)
+    {
+        return HTTP2_ENHANCE_YOUR_CALM;
+    }
+    connection->header_stream = header->stream_id;
+    connection->header_end_stream = (header->flags & HTTP2_FLAG_END_STREAM) != 0;
+    return (header->flags & HTTP2_FLAG_END_HEADERS) ? finish_http2_headers(client_data) : HTTP2_NO_ERROR;
+}
+
+/* finish_http2_headers:
+ * Decodes a complete header block into the request of a free entry. Every
+ * block goes through the decoder, also the ones that are refused, or its
+ * table would no longer match the client's.
+ */
+int finish_http2_headers(Client_Http_Data *client_data)
+{
+    int i, ret_val;
+    uint32_t stream_id;
+    HTTP_Request *request;
+    HTTP_Response *response;
+    Http_Pipeline_Entry *entry;
+    HTTP2_Connection *connection;
+
+    connection = client_data->http2;
+    stream_id = connection->header_stream;
+    connection->header_stream = 0;
+
+    entry = find_http2_stream(client_data, stream_id);
+    if (entry != NULL)
+    {
+        // Trailers, nothing in them changes the response
+        ret_val = http2_decode_request(connection, threadpool_arena(pool), &request);
+        free_http_request(&request);
+        if (ret_val == HTTP2_DECODE_ERROR)
+        {
+            return HTTP2_COMPRESSION_ERROR;
+        }
+        entry->receiving = 0;
+        return HTTP2_NO_ERROR;
+    }
+
+    for (i = 0; i < HTTP_PIPELINE_DEPTH && entry == NULL; i++)
+    {
+        if (client_data->pipeline[i].stream_id == 0)
+        {
+            entry = &client_data->pipeline[i];
+        }
+    }
+    if (entry == NULL)
+    {
+        // Over SETTINGS_MAX_CONCURRENT_STREAMS, the client may try it again
+        ret_val = http2_decode_request(connection, threadpool_arena(pool), &request);
+        free_http_request(&request);
+        if (ret_val == HTTP2_DECODE_ERROR)
+        {
+            return HTTP2_COMPRESSION_ERROR;
+        }
+        return reset_http2_stream(client_data, stream_id, HTTP2_REFUSED_STREAM);
+    }
+
+    if (entry->arena == NULL && (entry->arena = create_arena(HTTP_REQUEST_ARENA_SIZE)) == NULL)
+    {
+        fprintf(stderr, "server: error al crear arena de HTTP request\n");
+        return HTTP2_INTERNAL_ERROR;
+    }
+    ret_val = http2_decode_request(connection, entry->arena, &request);
+    if (ret_val == HTTP2_DECODE_ERROR || ret_val == HTTP2_DECODE_MALFORMED)
+    {
+        arena_reset(entry->arena);
+        if (ret_val == HTTP2_DECODE_ERROR)
+        {
+            return HTTP2_COMPRESSION_ERROR;
+        }
+        fprintf(stderr, "server: HTTP/2 request inválido (stream %u)\n", stream_id);
+        return reset_http2_stream(client_data, stream_id, HTTP2_PROTOCOL_ERROR);
+    }
+
+    entry->sequence = client_data->next_sequence++;
+    entry->client = client_data;
+    entry->request = request;
+    entry->response = NULL;
+    entry->keep_alive = 1;
+    entry->stream_id = stream_id;
+    entry->receiving = request != NULL && !connection->header_end_stream;
+    entry->headers_sent = 0;
+    entry->send_window = connection->peer.initial_window_size;
+    entry->body_sent = 0;
+
+    if (ret_val == HTTP2_DECODE_TOO_LARGE)
+    {
+        // Over the header list size, the client is told why
+        response = create_http_response_in_arena(entry->arena, DEFAULT_HTTP_VERSION, 431, HTTP_431_PHRASE, NULL);
+        if (finish_empty_http_response(entry, response) != THREAD_RESULT_SUCCESS)
+        {
+            return HTTP2_INTERNAL_ERROR;
+        }
+        printf("Thread HTTP (%s:%d): HTTP/2 request rechazado (stream %u): 431\n", client_data->client_ipstr, client_data->client_port, stream_id);
+        return HTTP2_NO_ERROR;
+    }
+
+    printf("Thread HTTP (%s:%d): HTTP/2 request recibido (stream %u): %s %s\n",
+           client_data->client_ipstr,
+           client_data->client_port,
+           stream_id,
+           request->request_line.method,
+           request->request_line.uri);
+    printf("Thread HTTP (%s:%d): HTTP request headers:\n",
+           client_data->client_ipstr,
+           client_data->client_port);
+    log_headers(&request->headers);
+    return HTTP2_NO_ERROR;
+}
+
+/* handle_http2_data:
+ * Appends a DATA frame to the body of its request. The receive windows are
+ * handed back as soon as the bytes are in, max_body_size is what bounds a
+ * body, not flow control.
+ */
+int handle_http2_data(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload)
+{
+    uint32_t length;
+    HTTP_Response *response;
+    Http_Pipeline_Entry *entry;
+    HTTP2_Connection *connection;
+
+    connection = client_data->http2;
+    if (header->stream_id == 0 || strip_http2_padding(header, &payload, &length) < 0)
+    {
+        return HTTP2_PROTOCOL_ERROR;
+    }
+    // Padding counts against the window as well
+    if (header->length > 0 && http2_queue_window_update(connection, 0, header->length) < 0)
+    {
+        return HTTP2_INTERNAL_ERROR;
+    }
+
+    entry = find_http2_stream(client_data, header->stream_id);
+    if (entry == NULL || !entry->receiving)
+    {
+        if (header->stream_id % 2 == 0 || header->stream_id > connection->last_stream_id)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        if (entry != NULL && entry->request != NULL)
+        {
+            // The request said it had ended
+            return reset_http2_stream(client_data, header->stream_id, HTTP2_STREAM_CLOSED);
+        }
+        // Reset or rejected, whatever was already on its way is dropped
+        return HTTP2_NO_ERROR;
+    }
+
+    if (!(header->flags & HTTP2_FLAG_END_STREAM) && header->length > 0 &&
+        http2_queue_window_update(connection, header->stream_id, header->length) < 0)
+    {
+        return HTTP2_INTERNAL_ERROR;
+    }
+
+    if ((uint64_t)entry->request->body_length + length > (uint64_t)max_body_size)
+    {
+        // Answered right away, the rest of the body is dropped
+        free_http_request(&entry->request);
+        entry->receiving = 0;
+        response = create_http_response_in_arena(entry->arena, DEFAULT_HTTP_VERSION, 413, HTTP_413_PHRASE, NULL);
+        if (finish_empty_http_response(entry, response) != THREAD_RESULT_SUCCESS)
+        {
+            return HTTP2_INTERNAL_ERROR;
+        }
+        printf("Thread HTTP (%s:%d): HTTP/2 request rechazado (stream %u): 413\n", client_data->client_ipstr, client_data->client_port, header->stream_id);
+        return HTTP2_NO_ERROR;
+    }
+    if (length > 0 && append_http2_body(entry, payload, length) < 0)
+    {
+        return HTTP2_INTERNAL_ERROR;
+    }
+    if (header->flags & HTTP2_FLAG_END_STREAM)
+    {
+        entry->receiving = 0;
+    }
+    return HTTP2_NO_ERROR;
+}
+
+// Widens the send window of the connection or of one stream
+int handle_http2_window_update(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload)
+{
+    uint32_t increment;
+    Http_Pipeline_Entry *entry;
+    HTTP2_Connection *connection;
+
+    connection = client_data->http2;
+    if (header->length != 4)
+    {
+        return HTTP2_FRAME_SIZE_ERROR;
+    }
+    increment = (((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) | ((uint32_t)payload[2] << 8) | payload[3]) & 0x7fffffff;
+
+    if (header->stream_id == 0)
+    {
+        if (increment == 0)
+        {
+            return HTTP2_PROTOCOL_ERROR;
+        }
+        connection->send_window += increment;
+        return connection->send_window > HTTP2_MAX_WINDOW ? HTTP2_FLOW_CONTROL_ERROR : HTTP2_NO_ERROR;
+    }
+
+    if (header->stream_id % 2 == 0 || header->stream_id > connection->last_stream_id)
+    {
+        return HTTP2_PROTOCOL_ERROR;
+    }
+    entry = find_http2_stream(client_data, header->stream_id);
+    if (entry == NULL)
+    {
+        // Closed, its window no longer matters
+        return HTTP2_NO_ERROR;
+    }
+    if (increment == 0)
+    {
+        return reset_http2_stream(client_data, header->stream_id, HTTP2_PROTOCOL_ERROR);
+    }
+    entry->send_window += increment;
+    if (entry->send_window > HTTP2_MAX_WINDOW)
+    {
+        return reset_http2_stream(client_data, header->stream_id, HTTP2_FLOW_CONTROL_ERROR);
+    }
+    return HTTP2_NO_ERROR;
+}
+
+// Leaves payload and length on the data of a frame that may be PADDED, -1 if the padding does not fit
+int strip_http2_padding(const HTTP2_Frame_Header *header, const unsigned char **payload, uint32_t *length)
+{
+    uint8_t padding;
+
+    *length = header->length;
+    if (!(header->flags & HTTP2_FLAG_PADDED))
+    {
+        return 0;
+    }
+    if (*length == 0)
+    {
+        return -1;
+    }
+    padding = (*payload)[0];
+    if (padding >= *length)
+    {
+        return -1;
+    }
+    (*payload)++;
+    *length -= 1 + padding;
+    return 0;
+}
+
+/* append_http2_body:
+ * Adds bytes to the body of a request. The body doubles in its arena from
+ * HTTP2_BODY_MIN_SIZE, its capacity follows from its length so the entry does
+ * not keep it.
+ */
+int append_http2_body(Http_Pipeline_Entry *pipeline_entry, const unsigned char *data, uint32_t length)
+{
+    char *body;
+    size_t capacity, needed;
+    HTTP_Request *request;
+
+    request = pipeline_entry->request;
+    capacity = 0;
+    if (request->body != NULL)
+    {
+        capacity = HTTP2_BODY_MIN_SIZE;
+        while (capacity < (size_t)request->body_length + 1)
+        {
+            capacity *= 2;
+        }
+    }
+    needed = (size_t)request->body_length + length + 1;
+    if (needed > capacity)
+    {
+        capacity = capacity > 0 ? capacity : HTTP2_BODY_MIN_SIZE;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        body = (char *)arena_alloc(pipeline_entry->arena, capacity);
+        if (body == NULL)
+        {
+            fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
+            return -1;
+        }
+        if (request->body_length > 0)
+        {
+            memcpy(body, request->body, request->body_length);
+        }
+        request->body = body;
+    }
+    memcpy(request->body + request->body_length, data, length);
+    request->body_length += length;
+    request->body[request->body_length] = '\0';
+    return 0;
+}
+
+/* collect_http_body:
+ * Runs the stream of a response into its body. DATA frames are cut to the
+ * flow control windows, so a body generated while it is sent is held whole
+ * in the arena of the entry instead.
+ */
+int collect_http_body(Http_Pipeline_Entry *pipeline_entry)
+{
+    HTTP_Body_Writer writer;
+    HTTP_Response *response;
+
+    response = pipeline_entry->response;
+    http_body_writer_init_buffer(&writer, pipeline_entry->arena);
+    if (response->stream(&writer, response->stream_arg) < 0 || http_body_finish(&writer) < 0 || writer.body_length > INT_MAX)
+    {
+        return THREAD_RESULT_ERROR;
+    }
+    response->body = writer.body;
+    response->body_length = (int)writer.body_length;
+    response->stream = NULL;
+    return THREAD_RESULT_SUCCESS;
+}
+
+// Entry of an open stream, NULL if it is closed or was never opened
+Http_Pipeline_Entry *find_http2_stream(Client_Http_Data *client_data, uint32_t stream_id)
+{
+    int i;
+
+    for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+    {
+        if (client_data->pipeline[i].stream_id == stream_id)
+        {
+            return &client_data->pipeline[i];
+        }
+    }
+    return NULL;
+}
+
+// Queues RST_STREAM and frees the entry of the stream, if it has one
+int reset_http2_stream(Client_Http_Data *client_data, uint32_t stream_id, uint32_t error_code)
+{
+    if (http2_queue_rst_stream(client_data->http2, stream_id, error_code) < 0)
+    {
+        return HTTP2_INTERNAL_ERROR;
+    }
+    release_http2_stream(find_http2_stream(client_data, stream_id));
+    return HTTP2_NO_ERROR;
+}
+
+// Closes a stream and leaves its entry free for the next one
+void release_http2_stream(Http_Pipeline_Entry *pipeline_entry)
+{
+    if (pipeline_entry == NULL)
+    {
+        return;
+    }
+    free_http_request(&pipeline_entry->request);
+    free_http_response(&pipeline_entry->response);
+    arena_reset(pipeline_entry->arena);
+    pipeline_entry->stream_id = 0;
+    pipeline_entry->receiving = 0;
+    pipeline_entry->headers_sent = 0;
+    pipeline_entry->body_sent = 0;
+}
+
+/* pending_http2_work:
+ * Whether the connection has something to build or send now: frames queued,
+ * requests without their response, or bodies the windows let through.
+ */
+int pending_http2_work(Client_Http_Data *client_data)
+{
+    int i;
+    Http_Pipeline_Entry *entry;
+
+    if (client_data->http2->output.length > 0)
+    {
+        return 1;
+    }
+    for (i = 0; i < HTTP_PIPELINE_DEPTH; i++)
+    {
+        entry = &client_data->pipeline[i];
+        if (entry->stream_id == 0 || entry->receiving)
+        {
+            continue;
+        }
+        if (entry->response == NULL || !entry->headers_sent)
+        {
+            return 1;
+        }
+        if (entry->body_sent < entry->response->body_length && entry->send_window > 0 && client_data->http2->send_window > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+Client_Tcp_Data *create_client_tcp_data(int sockfd, const char *ipstr, in_port_t port)
+{
+    Client_Tcp_Data *data;
+    if (sockfd <= 0 || ipstr == NULL || port <= 0)
+    {
+        return NULL;
+    }
+
+    data = (Client_Tcp_Data *)malloc(sizeof(Client_Tcp_Data));
+    if (data == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
         return NULL;
     }
     memset(data, 0, sizeof(Client_Tcp_Data));
@@ -1552,8 +3142,20 @@ Client_Http_Data *create_client_http_data(int sockfd, const char *ipstr, in_port
     data->client_sockfd = sockfd;
     strcpy(data->client_ipstr, ipstr);
     data->client_port = port;
-    data->request = NULL;
-    data->response = NULL;
+    data->receive_buffer = create_http_receive_buffer(max_header_size, max_body_size);
+    if (data->receive_buffer == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+    data->next_sequence = 0;
+    data->send_sequence = 0;
+    data->parse_pending = 0;
+    threadpool_token_init(&data->token);
+    data->state = HTTP_CONNECTION_READING;
+    data->keep_alive = 0;
+    data->last_active_ms = now_ms();
+    data->http2 = NULL;
 
     return data;
 }
@@ -1568,13 +3170,13 @@ Client_Http_Data **init_clients_http_data(int len)
         return NULL;
     }
 
-    clients = (Client_Http_Data **)malloc(len * sizeof(Client_Http_Data));
+    clients = (Client_Http_Data **)malloc(len * sizeof(Client_Http_Data *));
     if (clients == NULL)
     {
         fprintf(stderr, "server: error al asignar memoria: %s\n", strerror(errno));
         return NULL;
     }
-    memset(clients, 0, len * sizeof(Client_Http_Data));
+    memset(clients, 0, len * sizeof(Client_Http_Data *));
     return clients;
 }
 
@@ -1588,20 +3190,25 @@ void free_clients_http_data(Client_Http_Data **clients, int len)
 
 void free_client_http_data(Client_Http_Data **client)
 {
+    unsigned long sequence;
+
     if (client != NULL && *client != NULL)
     {
+        // Anything still working for the connection stops at its next check
+        threadpool_cancel(&(*client)->token);
         if ((*client)->client_sockfd > 0)
         {
             close((*client)->client_sockfd);
         }
-        if ((*client)->request != NULL)
-        {
-            free_http_request(&(*client)->request);
-        }
-        if ((*client)->response != NULL)
+        // Requests still in the pipeline, with or without their response, whichever entries they are in
+        for (sequence = 0; sequence < HTTP_PIPELINE_DEPTH; sequence++)
         {
-            free_http_response(&(*client)->response);
+            free_http_request(&(*client)->pipeline[sequence].request);
+            free_http_response(&(*client)->pipeline[sequence].response);
+            free_arena(&(*client)->pipeline[sequence].arena);
         }
+        free_http_receive_buffer(&(*client)->receive_buffer);
+        free_http2_connection(&(*client)->http2);
         free(*client);
         *client = NULL;
     }
@@ -1616,6 +3223,165 @@ int index_in_client_http_data_array(Client_Http_Data **array, int array_size, in
     return 1; // Index is within bounds and contains a value
 }
 
+/* http_keep_alive:
+ * HTTP/1.1 connections stay open unless the client sends "Connection: close",
+ * HTTP/1.0 ones only when it asks for "Connection: keep-alive". Either way the
+ * response to the keep_alive_max-th request, sequence keep_alive_max - 1,
+ * closes the connection.
+ */
+int http_keep_alive(const HTTP_Request *request, unsigned long sequence)
+{
+    const char *connection;
+
+    if (keep_alive_max <= 0 || sequence + 1 >= (unsigned long)keep_alive_max)
+    {
+        return 0;
+    }
+
+    connection = find_known_header_value(&request->headers, HTTP_HEADER_CONNECTION);
+    if (strcmp(request->request_line.version, "HTTP/1.0") == 0)
+    {
+        return header_has_token(connection, "keep-alive");
+    }
+    return !header_has_token(connection, "close");
+}
+
+/* linger_http_close:
+ * Ends the sending side and discards whatever the client still sends, until it
+ * closes or HTTP_LINGER_MS pass. Closing with unread bytes makes the kernel
+ * answer with a reset, which can destroy the last response before the client
+ * reads it.
+ */
+void linger_http_close(int sockfd)
+{
+    char discard[DEFAULT_BUFFER_SIZE];
+    struct timeval timeout;
+    uint64_t deadline;
+
+    if (shutdown(sockfd, SHUT_WR) < 0)
+    {
+        return;
+    }
+    timeout.tv_sec = HTTP_LINGER_MS / 1000;
+    timeout.tv_usec = (HTTP_LINGER_MS % 1000) * 1000;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    deadline = now_ms() + HTTP_LINGER_MS;
+    while (now_ms() < deadline && recv(sockfd, discard, sizeof(discard), 0) > 0)
+        ;
+}
+
+/* http_peer_gone:
+ * Whether the client reset the connection or it failed. A client that only
+ * shut down its side still reads, so its responses go on.
+ */
+int http_peer_gone(int sockfd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = sockfd;
+    pfd.events = 0; // POLLHUP and POLLERR are always reported
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Thread_Result *get_thread_result(int value)
+{
+    return &thread_results[value - THREAD_RESULT_EMPTY_REQUEST];
+}
+
+const char *task_function_name(void *(*function)(void *))
+{
+    if (function == handle_client_simple_read)
+    {
+        return "handle_client_simple_read";
+    }
+    if (function == handle_client_simple_write)
+    {
+        return "handle_client_simple_write";
+    }
+    if (function == handle_client_heartbeat_read)
+    {
+        return "handle_client_heartbeat_read";
+    }
+    if (function == handle_client_heartbeat_write)
+    {
+        return "handle_client_heartbeat_write";
+    }
+    if (function == handle_client_http_read)
+    {
+        return "handle_client_http_read";
+    }
+    if (function == handle_client_http_response)
+    {
+        return "handle_client_http_response";
+    }
+    if (function == handle_client_http_write)
+    {
+        return "handle_client_http_write";
+    }
+    if (function == handle_client_http2_write)
+    {
+        return "handle_client_http2_write";
+    }
+    return "desconocida";
+}
+
+/* handle_stuck_task:
+ * Called by the threadpool watchdog, with the pool lock held, for every task that
+ * has been running for too long. The task cannot finish while we are here, so its
+ * connection is still the one in the affinity key. When quarantine is on the
+ * connection is shut down: the blocked recv/send returns and the main loop closes it.
+ */
+void handle_stuck_task(const threadpool_stuck_t *stuck, void *user)
+{
+    int quarantine, sockfd;
+    Client_Http_Data *http_client;
+
+    quarantine = *(int *)user;
+
+    fprintf(stderr, "server: tarea trabada en worker %d: %s conexión %ld hace %ld ms\n",
+            stuck->worker, task_function_name(stuck->function), stuck->affinity_key, stuck->elapsed_ms);
+
+    if (!quarantine)
+    {
+        return;
+    }
+
+    sockfd = (int)stuck->affinity_key;
+    if (stuck->function == handle_client_http_response)
+    {
+        // Response tasks run without affinity, their pipeline entry knows the connection
+        http_client = ((Http_Pipeline_Entry *)stuck->argument)->client;
+        threadpool_cancel(&http_client->token);
+        sockfd = http_client->client_sockfd;
+    }
+    else if (stuck->affinity_key == THREADPOOL_NO_AFFINITY)
+    {
+        return;
+    }
+    else if (stuck->function == handle_client_http_read || stuck->function == handle_client_http_write ||
+             stuck->function == handle_client_http2_write)
+    {
+        http_client = (Client_Http_Data *)stuck->argument;
+        threadpool_cancel(&http_client->token);
+    }
+    if (shutdown(sockfd, SHUT_RDWR) != 0)
+    {
+        fprintf(stderr, "server: error al aislar conexión %d: %s\n", sockfd, strerror(errno));
+        return;
+    }
+    fprintf(stderr, "server: conexión %d en cuarentena\n", sockfd);
+}
+
 void setup_signals()
 {
     signal(SIGINT, handle_sigint);
@@ -1,6 +1,9 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+// Standard library headers
+#include <stdint.h>
+
 // Networking headers
 #include <sys/socket.h>
 #include <netdb.h>
@@ -9,8 +12,14 @@
 #include <sys/types.h>
 
 // Shared headers
+#include "../shared/arena.h"
 #include "../shared/common.h"
 #include "../shared/http.h"
+#include "../shared/http2.h"
+#include "../shared/http_mime.h"
+#include "../shared/http_router.h"
+#include "../shared/http_variants.h"
+#include "../shared/threadpool.h"
 
 // Constants
 #define BACKLOG 10                 // How many pending connections queue will hold
@@ -28,12 +37,27 @@
 #define THREAD_RESULT_ERROR -1
 #define THREAD_RESULT_SUCCESS 0
 #define THREAD_RESULT_CLOSED 1
-#define DEFAULT_HTTP_VERSION "HTTP/1.1"
-#define HTTP_200_PHRASE "OK"
-#define HTTP_400_PHRASE "Bad Request"
-#define HTTP_404_PHRASE "Not Found"
+#define THREAD_RESULT_CANCELLED 2
+#define THREAD_RESULT_INCOMPLETE 3 // Bytes read but no whole request yet
+#define DEFAULT_HTTP_VERSION HTTP_STATUS_LINE_VERSION
 #define DEFAULT_THREAD_COUNT 10
 #define DEFAULT_QUEUE_SIZE 20
+#define DEFAULT_TASK_TIMEOUT_MS 5000 // HTTP tasks not done by then are dropped or cancelled
+#define DEFAULT_WATCHDOG_MS 10000     // Tasks running longer than this are reported as stuck
+#define DEFAULT_KEEP_ALIVE_MAX 100    // Requests served on one HTTP connection before closing it
+#define DEFAULT_KEEP_ALIVE_TIMEOUT_MS 5000 // Idle HTTP connections are closed after this long
+#define SIMPLE_WRITE_INTERVAL_MS 1000 // The TCP and UDP sockets are offered for writing once per interval
+#define HTTP_PIPELINE_DEPTH 16        // Requests of one connection parsed ahead of their responses
+#define HTTP_LINGER_MS 500            // Input discarded after rejecting a request, before closing
+#define HTTP_FILE_READ_SIZE (1 << 20) // Bytes of a file read at a time, the client is checked between reads
+#define HTTP_REQUEST_ARENA_SIZE 4096  // Block size of each pipeline entry arena, fits a request, its response and their serialized head
+#define HTTP_SERVER_ALLOW "Allow: GET, HEAD, POST, OPTIONS\r\n" // Answer to OPTIONS *, every method some path takes
+#define HTTP_CONTENT_RANGE_SIZE 72    // "bytes <first>-<last>/<size>" with 64 bit values + '\0'
+#define HTTP_BOUNDARY_SIZE 71         // Multipart boundaries are at most 70 characters + '\0'
+#define HTTP_VARIANT_HEADERS_SIZE (sizeof("Vary: Accept-Encoding\r\nContent-Encoding: \r\n") + 8) // 8: longest coding name + '\0'
+#define HTTP_BYTERANGES_HEADER_SIZE (sizeof("Content-Type: multipart/byteranges; boundary=\r\n") + HTTP_BOUNDARY_SIZE)
+#define HTTP2_WRITE_BATCH 32         // DATA frames gathered into one send, one per stream per round
+#define HTTP2_BODY_MIN_SIZE 1024     // First block of a request body arriving in DATA frames
 
 typedef struct
 {
@@ -43,13 +67,51 @@ typedef struct
     Simple_Packet *packet;
 } Client_Tcp_Data;
 
+typedef enum
+{
+    HTTP_CONNECTION_READING, // Waiting for the next requests, the pipeline is empty
+    HTTP_CONNECTION_WRITING  // Requests read, responses pending
+} Http_Connection_State;
+
+/* Http_Pipeline_Entry:
+ * A request waiting for its response. Responses are built in parallel and may
+ * finish in any order, they are written by sequence number so the client gets
+ * them in the order it sent the requests.
+ *
+ * On an HTTP/2 connection each entry is a stream instead, any free entry
+ * takes the next stream and its response goes out as soon as it is built,
+ * interleaved with the others.
+ */
 typedef struct
+{
+    unsigned long sequence;          // Position of the request on its connection, starting at 0
+    struct Client_Http_Data *client; // Connection the request came from
+    HTTP_Request *request;
+    HTTP_Response *response; // NULL until the response task is done
+    int keep_alive;          // Whether the connection stays open after this response
+    Arena *arena;            // Holds request and response, reset once the response is sent. Created on first use
+    uint32_t stream_id;      // HTTP/2 stream of the request, 0 when the entry is free or the connection is HTTP/1.1
+    int receiving;           // HTTP/2: DATA of the request still arriving, the response waits for it
+    int headers_sent;        // HTTP/2: HEADERS of the response queued, DATA goes next
+    int64_t send_window;     // HTTP/2: bytes of DATA the client takes on this stream
+    int body_sent;           // HTTP/2: bytes of the response body already in DATA frames
+} Http_Pipeline_Entry;
+
+typedef struct Client_Http_Data
 {
     int client_sockfd;
     char client_ipstr[INET_ADDRSTRLEN];
     in_port_t client_port;
-    HTTP_Request *request;
-    HTTP_Response *response;
+    HTTP_Receive_Buffer *receive_buffer;               // Bytes received past the queued requests
+    Http_Pipeline_Entry pipeline[HTTP_PIPELINE_DEPTH]; // Request with sequence s is in pipeline[s % HTTP_PIPELINE_DEPTH]
+    unsigned long next_sequence;                       // Sequence of the next parsed request
+    unsigned long send_sequence;                       // Sequence of the next response to write
+    int parse_pending;                                 // receive_buffer may hold requests that did not fit in the pipeline
+    threadpool_token_t token;                          // Cancels the tasks of this connection
+    Http_Connection_State state;                       // Decides whether select waits to read or to write
+    int keep_alive;                                    // Whether the connection stays open after the responses sent
+    uint64_t last_active_ms;                           // When the connection last finished a response, for the idle timeout
+    HTTP2_Connection *http2;                           // NULL while the connection speaks HTTP/1.1
 } Client_Http_Data;
 
 typedef struct
@@ -63,9 +125,38 @@ void *handle_client_simple_write(void *arg);
 void *handle_client_heartbeat_read(void *arg);
 void *handle_client_heartbeat_write(void *arg);
 void *handle_client_http_read(void *arg);
+void *handle_client_http_response(void *arg);
 void *handle_client_http_write(void *arg);
+void *handle_client_http2_write(void *arg);
+Thread_Result *dispatch_http_responses(Client_Http_Data *client_data);
+HTTP_Router *setup_http_routes(void);
+int handle_http_options(HTTP_Request *request, const HTTP_Route_Match *match, void *arg);
+int handle_http_resource_list(HTTP_Request *request, const HTTP_Route_Match *match, void *arg);
+int handle_http_resource_file(HTTP_Request *request, const HTTP_Route_Match *match, void *arg);
+int finish_empty_http_response(Http_Pipeline_Entry *pipeline_entry, HTTP_Response *response);
+int finish_http_byteranges(Http_Pipeline_Entry *pipeline_entry, int file_fd, uint64_t size, const HTTP_Mime_Type *mime, const char *etag,
+                           const HTTP_Byte_Range *ranges, int range_count, char *validators, size_t validators_length);
+void start_gzip_variants(void);
+void *build_gzip_variant(void *arg);
+void rebuild_gzip_variant(HTTP_Variant_File *file);
+int read_http_file(Http_Pipeline_Entry *pipeline_entry, int file_fd, char *buffer, uint64_t offset, uint64_t length);
+int stream_resource_list(HTTP_Body_Writer *writer, void *arg);
+int start_http2(Client_Http_Data *client_data, Http_Pipeline_Entry *upgraded);
+int read_http2_frames(Client_Http_Data *client_data);
+int handle_http2_frame(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload);
+int handle_http2_headers(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload);
+int finish_http2_headers(Client_Http_Data *client_data);
+int handle_http2_data(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload);
+int handle_http2_window_update(Client_Http_Data *client_data, const HTTP2_Frame_Header *header, const unsigned char *payload);
+int strip_http2_padding(const HTTP2_Frame_Header *header, const unsigned char **payload, uint32_t *length);
+int append_http2_body(Http_Pipeline_Entry *pipeline_entry, const unsigned char *data, uint32_t length);
+int collect_http_body(Http_Pipeline_Entry *pipeline_entry);
+Http_Pipeline_Entry *find_http2_stream(Client_Http_Data *client_data, uint32_t stream_id);
+int reset_http2_stream(Client_Http_Data *client_data, uint32_t stream_id, uint32_t error_code);
+void release_http2_stream(Http_Pipeline_Entry *pipeline_entry);
+int pending_http2_work(Client_Http_Data *client_data);
 int handle_connections(int sockfd_tcp, int sockfd_udp, int sockfd_tcp_http);
-int parse_arguments(int argc, char *argv[], char *local_ip, char *local_port_tcp, char *local_port_udp, char *local_port_tcp_http, int *thread_count, int *queue_size);
+int parse_arguments(int argc, char *argv[], char *local_ip, char *local_port_tcp, char *local_port_udp, char *local_port_tcp_http, int *thread_count, int *queue_size, long *task_timeout_ms, long *watchdog_ms, int *watchdog_quarantine, long *keep_alive_max, long *keep_alive_timeout_ms, int *max_header_size, int *max_body_size, const char **mime_types_path, int *gzip_variants);
 int setup_server_tcp(char *local_ip, char *local_port);
 int setup_server_udp(char *local_ip, char *local_port);
 void show_help(void);
@@ -79,6 +170,13 @@ Client_Http_Data **init_clients_http_data(int len);
 void free_clients_http_data(Client_Http_Data **clients, int len);
 void free_client_http_data(Client_Http_Data **client);
 int index_in_client_http_data_array(Client_Http_Data **array, int array_size, int index);
+int http_keep_alive(const HTTP_Request *request, unsigned long sequence);
+void linger_http_close(int sockfd);
+int http_peer_gone(int sockfd);
+uint64_t now_ms(void);
+Thread_Result *get_thread_result(int value);
+const char *task_function_name(void *(*function)(void *));
+void handle_stuck_task(const threadpool_stuck_t *stuck, void *user);
 void setup_signals();
 void handle_sigint(int sig);
 
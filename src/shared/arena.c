@@ -0,0 +1,178 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator for short lived allocations
+ *
+ * Memory is handed out by moving a pointer forward inside a block. Nothing is
+ * freed individually: arena_reset() rewinds every block at once, so an owner
+ * (for example a threadpool worker) can drop all the memory used by a task in
+ * a single operation and without taking any lock.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project header
+#include "arena.h"
+
+// Static since it is only used inside this file
+static Arena_Block *create_arena_block(size_t size);
+
+Arena *create_arena(size_t block_size)
+{
+    Arena *arena;
+
+    if (block_size == 0)
+    {
+        block_size = ARENA_DEFAULT_BLOCK_SIZE;
+    }
+
+    arena = (Arena *)malloc(sizeof(Arena));
+    if (arena == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return NULL;
+    }
+    memset(arena, 0, sizeof(Arena));
+
+    arena->block_size = block_size;
+    arena->head = create_arena_block(block_size);
+    if (arena->head == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->head;
+
+    return arena;
+}
+
+// Important
+// Remember that every pointer returned by arena_alloc is invalid after this call
+void free_arena(Arena **arena)
+{
+    Arena_Block *block, *next;
+
+    if (arena == NULL || *arena == NULL)
+    {
+        return;
+    }
+
+    block = (*arena)->head;
+    while (block != NULL)
+    {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    free(*arena);
+    *arena = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size_t offset;
+    Arena_Block *block;
+
+    if (arena == NULL || size == 0)
+    {
+        return NULL;
+    }
+
+    // Round up so the next allocation stays aligned
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+
+    // Try the current block and any block left over from before the last reset
+    for (block = arena->current; block != NULL; block = block->next)
+    {
+        offset = block->used;
+        if (block->size - offset >= size)
+        {
+            block->used += size;
+            arena->current = block;
+            return block->data + offset;
+        }
+    }
+
+    // Nothing fits: chain a new block, oversized requests get a block of their own
+    block = create_arena_block(size > arena->block_size ? size : arena->block_size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    block->next = arena->current->next;
+    arena->current->next = block;
+    arena->current = block;
+
+    block->used = size;
+    return block->data;
+}
+
+char *arena_strdup(Arena *arena, const char *source)
+{
+    char *str;
+    size_t len;
+
+    if (source == NULL)
+    {
+        return NULL;
+    }
+
+    len = strlen(source) + 1; // +1 for the null terminator
+    str = (char *)arena_alloc(arena, len);
+    if (str == NULL)
+    {
+        return NULL;
+    }
+    memcpy(str, source, len);
+    return str;
+}
+
+/* arena_reset:
+ * Rewind the arena so its memory can be handed out again.
+ * The first block is kept, together with every block of the default size, so a
+ * steady workload stops calling malloc after warming up. Oversized blocks are
+ * released to avoid holding on to the peak of a single large task.
+ */
+void arena_reset(Arena *arena)
+{
+    Arena_Block *block, *prev;
+
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    prev = arena->head;
+    prev->used = 0;
+    while ((block = prev->next) != NULL)
+    {
+        if (block->size > arena->block_size)
+        {
+            prev->next = block->next;
+            free(block);
+            continue;
+        }
+        block->used = 0;
+        prev = block;
+    }
+    arena->current = arena->head;
+}
+
+static Arena_Block *create_arena_block(size_t size)
+{
+    Arena_Block *block;
+
+    block = (Arena_Block *)malloc(sizeof(Arena_Block) + size);
+    if (block == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
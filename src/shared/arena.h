@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Standard library headers
+#include <stddef.h>
+
+// Constants
+#define ARENA_DEFAULT_BLOCK_SIZE 16384 // Bytes reserved per block
+#define ARENA_ALIGNMENT 16             // Every allocation is aligned to this boundary
+
+// Structs
+typedef struct Arena_Block
+{
+    struct Arena_Block *next;
+    size_t size;    // Usable bytes in data
+    size_t used;    // Bytes already handed out
+    size_t padding; // Keeps data aligned to ARENA_ALIGNMENT
+    unsigned char data[];
+} Arena_Block;
+
+typedef struct
+{
+    Arena_Block *head;    // First block, kept across resets
+    Arena_Block *current; // Block we are bumping from
+    size_t block_size;
+} Arena;
+
+Arena *create_arena(size_t block_size);
+void free_arena(Arena **arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *source);
+void arena_reset(Arena *arena);
+
+#endif // ARENA_H
@@ -1,5 +1,6 @@
 // Standard library headers
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -127,6 +128,62 @@ ssize_t sendall_with_flags(int sockfd, const void *buf, size_t len, int flags)
     return total_sent;
 }
 
+/* sendall_iov:
+ * sendall for data spread over several buffers. The kernel gathers them, so
+ * they go out back to back without being copied into one buffer first. After a
+ * partial send the iovec array is advanced in place, past the buffers already
+ * sent and into the one that was cut, and the rest is sent from there.
+ */
+ssize_t sendall_iov(int sockfd, struct iovec *iov, int iovcnt)
+{
+    return sendall_iov_with_flags(sockfd, iov, iovcnt, 0);
+}
+
+ssize_t sendall_iov_with_flags(int sockfd, struct iovec *iov, int iovcnt, int flags)
+{
+    size_t total_sent;
+    ssize_t bytes_sent;
+    struct msghdr message;
+
+    memset(&message, 0, sizeof(message));
+    total_sent = 0;
+    while (iovcnt > 0)
+    {
+        // Empty buffers are skipped, a send with nothing left in them would return 0 forever
+        if (iov->iov_len == 0)
+        {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        message.msg_iov = iov;
+        message.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        bytes_sent = sendmsg(sockfd, &message, flags);
+        if (bytes_sent < 0)
+        {
+            fprintf(stderr, "Error al querer enviar datos: %s\n", strerror(errno));
+            return bytes_sent;
+        }
+        total_sent += bytes_sent;
+
+        while (iovcnt > 0 && (size_t)bytes_sent >= iov->iov_len)
+        {
+            bytes_sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + bytes_sent;
+            iov->iov_len -= bytes_sent;
+        }
+    }
+
+    printf("Total enviado: %ld bytes\n", total_sent);
+    return total_sent;
+}
+
 Simple_Packet *create_simple_packet(const char *data)
 {
     Simple_Packet *packet;
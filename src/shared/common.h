@@ -9,12 +9,16 @@
 
 // System headers
 #include <sys/types.h>
+#include <sys/uio.h>
 
 // Constants
 #define DEFAULT_BUFFER_SIZE 4096 // Default max number of bytes we can get at once
 #define HEARTBEAT_TIMEOUT_SEC 5
 #define HEARTBEAT_MAX_RETRIES 3
 #define HEARTBEAT_BUF_SIZE 1024
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // Buffers one send takes at most, the Linux limit when the headers do not define it
+#endif
 
 // Structs
 typedef struct
@@ -43,6 +47,8 @@ ssize_t recvall(int sockfd, void *buf, size_t len);
 ssize_t recvall_with_flags(int sockfd, void *buf, size_t len, int flags);
 ssize_t sendall(int sockfd, const void *buf, size_t len);
 ssize_t sendall_with_flags(int sockfd, const void *buf, size_t len, int flags);
+ssize_t sendall_iov(int sockfd, struct iovec *iov, int iovcnt);
+ssize_t sendall_iov_with_flags(int sockfd, struct iovec *iov, int iovcnt, int flags);
 Simple_Packet *create_simple_packet(const char *data);
 Simple_Packet *create_simple_packet_with_length(int32_t length);
 int free_simple_packet(Simple_Packet *packet);
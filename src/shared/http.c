@@ -1,9 +1,13 @@
 // Standard library headers
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 // Networking headers
@@ -15,129 +19,264 @@
 // System headers
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 // Other project headers
+#include "arena.h"
 #include "common.h"
+#include "http_parser.h"
 
 // Project header
 #include "http.h"
 
-Header *create_headers(int initial_count)
+// Free blocks of each pooled size, shared by every connection
+static HTTP_Buffer_Block *buffer_pool[HTTP_BUFFER_POOL_CLASSES];
+static int buffer_pool_free[HTTP_BUFFER_POOL_CLASSES];
+static pthread_mutex_t buffer_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Status lines put together by the compiler, one per status the server sends
+#define STATUS_LINE(code, phrase) \
+    {code, HTTP_STATUS_LINE_VERSION, phrase, HTTP_STATUS_LINE_VERSION " " #code " " phrase "\r\n", sizeof(HTTP_STATUS_LINE_VERSION " " #code " " phrase "\r\n") - 1}
+static const HTTP_Status_Line status_lines[] = {
+    STATUS_LINE(200, HTTP_200_PHRASE),
+    STATUS_LINE(206, HTTP_206_PHRASE),
+    STATUS_LINE(304, HTTP_304_PHRASE),
+    STATUS_LINE(400, HTTP_400_PHRASE),
+    STATUS_LINE(404, HTTP_404_PHRASE),
+    STATUS_LINE(405, HTTP_405_PHRASE),
+    STATUS_LINE(413, HTTP_413_PHRASE),
+    STATUS_LINE(416, HTTP_416_PHRASE),
+    STATUS_LINE(431, HTTP_431_PHRASE),
+    STATUS_LINE(503, HTTP_503_PHRASE),
+};
+
+/* Date header values:
+ * The current one is formatted once per second by http_date_update, every
+ * response in that second copies the same string. Each update writes the next
+ * slot and only then publishes it, so a reader never sees a half written date.
+ */
+static char date_slots[HTTP_DATE_SLOTS][HTTP_DATE_SIZE];
+static char *date_current;
+static time_t date_second = -1;
+static int date_slot;
+static pthread_mutex_t date_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Two decimal digits per entry, so integers are formatted two digits per step
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// Names as IMF-fixdate writes them, whatever the locale
+static const char *date_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *date_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// Static since it is only used inside this file
+static int reserve_headers(Header_List *headers, int count);
+static int reserve_header_strings(Header_List *headers, int length);
+static void index_known_headers(Header_List *headers);
+static int reserve_receive_buffer(HTTP_Receive_Buffer *buffer, int length);
+static long parse_content_length(const char *value, uint32_t length);
+static int decode_chunked_body(HTTP_Chunk_Decoder *decoder, char *body, size_t *length);
+static int receive_chunked_body(int sockfd, const char *extra, int extra_length, char **body, int *body_length);
+static int collect_body(HTTP_Body_Writer *writer, const char *data, size_t length);
+static void *allocate(Arena *arena, size_t size);
+static char *copy_string(Arena *arena, const char *source);
+static void write_two_digits(char *buffer, int value);
+static int read_digits(const char *buffer, int count);
+static int write_hex(char *buffer, uint64_t value);
+static int read_position(const char **ptr, uint64_t *value);
+
+void init_header_list(Header_List *headers)
 {
-    Header *headers;
-    headers = (Header *)malloc(initial_count * sizeof(Header));
-    if (headers == NULL)
-    {
-        fprintf(stderr, "Error al asignar memoria para headers\n");
-        return NULL;
-    }
-    memset(headers, 0, initial_count * sizeof(Header)); // Initialize memory to zero
-    return headers;
+    headers->items = headers->inline_items;
+    headers->count = 0;
+    headers->capacity = HEADER_LIST_INLINE_COUNT;
+    headers->strings = headers->inline_strings;
+    headers->strings_length = 0;
+    headers->strings_capacity = HEADER_LIST_INLINE_STRINGS;
+    memset(headers->known, -1, sizeof(headers->known));
 }
 
-void free_headers(Header **headers, int header_count)
+// Leaves the list empty and ready to be used again
+void free_header_list(Header_List *headers)
 {
-    int i;
-    if (headers == NULL || *headers == NULL)
+    if (headers == NULL)
     {
         return; // Nothing to free
     }
 
-    for (i = 0; i < header_count; i++)
+    if (headers->items != headers->inline_items)
+    {
+        free(headers->items);
+    }
+    if (headers->strings != headers->inline_strings)
     {
-        free_header(&((*headers)[i]));
+        free(headers->strings);
     }
-    free(*headers);  // Free the array of headers
-    *headers = NULL; // Set the original pointer to NULL
+    init_header_list(headers);
 }
 
-void free_header(Header *header)
+// Makes room for count more headers, doubling the array until they fit
+static int reserve_headers(Header_List *headers, int count)
 {
-    if (header != NULL)
+    int capacity;
+    Header *items;
+
+    if (headers->count + count <= headers->capacity)
     {
-        if (header->key != NULL)
-        {
-            free(header->key);
-        }
-        if (header->value != NULL)
+        return 0;
+    }
+
+    capacity = headers->capacity * 2;
+    while (capacity < headers->count + count)
+    {
+        capacity *= 2;
+    }
+    if (headers->items == headers->inline_items)
+    {
+        items = (Header *)malloc(capacity * sizeof(Header));
+        if (items != NULL)
         {
-            free(header->value);
+            memcpy(items, headers->inline_items, headers->count * sizeof(Header));
         }
     }
+    else
+    {
+        items = (Header *)realloc(headers->items, capacity * sizeof(Header));
+    }
+    if (items == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria para headers: %s\n", strerror(errno));
+        return -1;
+    }
+
+    headers->items = items;
+    headers->capacity = capacity;
+    return 0;
 }
 
-int add_header(Header **headers, int *header_index, int *header_count, const char *key, const char *value)
+/* reserve_header_strings:
+ * Makes room for length more bytes in the string block, doubling it until they
+ * fit. Keys and values already stored in the block are moved along with it.
+ */
+static int reserve_header_strings(Header_List *headers, int length)
 {
-    if (*header_index >= *header_count)
+    int capacity, i;
+    char *strings, *old_strings;
+
+    if (headers->strings_length + length <= headers->strings_capacity)
+    {
+        return 0;
+    }
+
+    capacity = headers->strings_capacity * 2;
+    while (capacity < headers->strings_length + length)
+    {
+        capacity *= 2;
+    }
+
+    old_strings = headers->strings;
+    strings = (char *)malloc(capacity);
+    if (strings == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria para headers: %s\n", strerror(errno));
+        return -1;
+    }
+    memcpy(strings, old_strings, headers->strings_length);
+
+    for (i = 0; i < headers->count; i++)
     {
-        *header_count += 1;
-        *headers = (Header *)realloc(*headers, (*header_count) * sizeof(Header));
-        if (*headers == NULL)
+        // Headers added in place point somewhere else and stay as they are
+        if (headers->items[i].key >= old_strings && headers->items[i].key < old_strings + headers->strings_length)
         {
-            fprintf(stderr, "server: error al reasignar memoria: %s\n", strerror(errno));
-            return -1;
+            headers->items[i].key = strings + (headers->items[i].key - old_strings);
+            headers->items[i].value = strings + (headers->items[i].value - old_strings);
         }
     }
 
-    (*headers)[*header_index].key = (char *)malloc(strlen(key) + 1);
-    if ((*headers)[*header_index].key == NULL)
+    if (old_strings != headers->inline_strings)
     {
-        fprintf(stderr, "Error al asignar memoria para key\n");
-        return -1;
+        free(old_strings);
     }
-    strcpy((*headers)[*header_index].key, key);
+    headers->strings = strings;
+    headers->strings_capacity = capacity;
+    return 0;
+}
+
+int add_header(Header_List *headers, const char *key, const char *value)
+{
+    int key_length, value_length;
+    char *key_copy;
+    HTTP_Known_Header known;
 
-    (*headers)[*header_index].value = (char *)malloc(strlen(value) + 1);
-    if ((*headers)[*header_index].value == NULL)
+    key_length = strlen(key) + 1;
+    value_length = strlen(value) + 1;
+    if (reserve_headers(headers, 1) < 0 || reserve_header_strings(headers, key_length + value_length) < 0)
     {
-        fprintf(stderr, "Error al asignar memoria para value\n");
-        free((*headers)[*header_index].key);
         return -1;
     }
-    strcpy((*headers)[*header_index].value, value);
 
-    (*header_index)++;
+    key_copy = headers->strings + headers->strings_length;
+    memcpy(key_copy, key, key_length);
+    memcpy(key_copy + key_length, value, value_length);
+    headers->strings_length += key_length + value_length;
+
+    known = http_known_header(key, key_length - 1);
+    if (known != HTTP_HEADER_UNKNOWN && headers->known[known] < 0 && headers->count <= INT16_MAX)
+    {
+        headers->known[known] = (int16_t)headers->count;
+    }
+
+    headers->items[headers->count].key = key_copy;
+    headers->items[headers->count].value = key_copy + key_length;
+    headers->count++;
     return 0;
 }
 
-int remove_header(Header **headers, int *header_index, int *header_count, const char *key)
+static void index_known_headers(Header_List *headers)
 {
-    int i, j;
-    Header *temp;
-    for (i = 0; i < *header_index; i++)
+    int i;
+    HTTP_Known_Header known;
+
+    memset(headers->known, -1, sizeof(headers->known));
+    for (i = 0; i < headers->count && i <= INT16_MAX; i++)
     {
-        if (strcmp((*headers)[i].key, key) == 0)
+        known = http_known_header(headers->items[i].key, strlen(headers->items[i].key));
+        if (known != HTTP_HEADER_UNKNOWN && headers->known[known] < 0)
         {
-            free_header(&(*headers)[i]);
-
-            // Shift remaining headers left
-            for (j = i; j < *header_index - 1; j++)
-            {
-                (*headers)[j] = (*headers)[j + 1];
-            }
-
-            (*header_index)--;
+            headers->known[known] = (int16_t)i;
+        }
+    }
+}
 
-            if (*header_index > 0 && *header_index < *header_count / 2)
-            {
-                *header_count /= 2;
-                temp = (Header *)realloc(*headers, (*header_count) * sizeof(Header));
-                if (temp == NULL)
-                {
-                    fprintf(stderr, "server: error al reasignar memoria: %s\n", strerror(errno));
-                    return -1;
-                }
-                *headers = temp;
-            }
+// The removed key and value stay in the string block until the list is freed
+int remove_header(Header_List *headers, const char *key)
+{
+    int i;
 
+    for (i = 0; i < headers->count; i++)
+    {
+        if (strcasecmp(headers->items[i].key, key) == 0)
+        {
+            // Shift remaining headers left
+            memmove(&headers->items[i], &headers->items[i + 1], (headers->count - i - 1) * sizeof(Header));
+            headers->count--;
+            index_known_headers(headers);
             return 0; // Success
         }
     }
     return -1; // Header not found
 }
 
-int serialize_headers(Header *headers, int header_count, char **buffer)
+int serialize_headers(const Header_List *headers, char **buffer)
 {
     const char *key_value_separator;
     const char *line_ending;
@@ -148,9 +287,9 @@ int serialize_headers(Header *headers, int header_count, char **buffer)
     size = 0;
 
     // Calculate the total size needed for the buffer
-    for (i = 0; i < header_count; i++)
+    for (i = 0; i < headers->count; i++)
     {
-        size += strlen(headers[i].key) + strlen(headers[i].value) + strlen(key_value_separator) + strlen(line_ending);
+        size += strlen(headers->items[i].key) + strlen(headers->items[i].value) + strlen(key_value_separator) + strlen(line_ending);
     }
 
     *buffer = (char *)malloc(sizeof(char) * size + 1); // +1 for the null terminator
@@ -163,64 +302,34 @@ int serialize_headers(Header *headers, int header_count, char **buffer)
     (*buffer)[0] = '\0'; // Initialize the buffer
 
     // Construct the headers string
-    for (i = 0; i < header_count; i++)
+    for (i = 0; i < headers->count; i++)
     {
         // Concat values
-        strcat(*buffer, headers[i].key);
+        strcat(*buffer, headers->items[i].key);
         strcat(*buffer, key_value_separator);
-        strcat(*buffer, headers[i].value);
+        strcat(*buffer, headers->items[i].value);
         strcat(*buffer, line_ending);
     }
     (*buffer)[size] = '\0';
     return size; // Return the size of the serialized headers
 }
 
-Header *deserialize_headers(const char *headers_str, int *header_count)
+// Appends the headers found in headers_str to an initialized list
+int deserialize_headers(const char *headers_str, Header_List *headers)
 {
-    int count, header_index, initial_count;
     char *colon, *headers_copy, *key, *line, *value;
-    const char *temp_str;
-    Header *headers;
-
-    // Count the number of headers
-    count = 0;
-    temp_str = headers_str;
-    while (*temp_str)
-    {
-        if (*temp_str == '\r' || *temp_str == '\n')
-        {
-            count++;
-            while (*temp_str == '\r' || *temp_str == '\n')
-                temp_str++;
-        }
-        else
-        {
-            temp_str++;
-        }
-    }
-
-    // Create initial headers array
-    initial_count = count > 0 ? count : 1; // Ensure at least one slot
-    headers = create_headers(initial_count);
-    if (headers == NULL)
-    {
-        return NULL;
-    }
 
     // Copy headers_str to a temporary buffer
     headers_copy = (char *)malloc(sizeof(char) * strlen(headers_str) + 1);
     if (headers_copy == NULL)
     {
         fprintf(stderr, "Error al asignar memoria\n");
-        free(headers);
-        return NULL;
+        return -1;
     }
     strcpy(headers_copy, headers_str);
 
     // Tokenize and parse each header
     line = strtok(headers_copy, "\r\n");
-    header_index = 0;
-    *header_count = initial_count;
     while (line != NULL)
     {
         colon = strchr(line, ':');
@@ -228,46 +337,100 @@ Header *deserialize_headers(const char *headers_str, int *header_count)
         {
             *colon = '\0'; // Terminate the key string
             key = line;
-            value = colon + 2; // Skip ": " to get the value
+            // Skip the whitespace after the colon, there may be none and the value may be empty
+            value = colon + 1;
+            while (*value == ' ' || *value == '\t')
+            {
+                value++;
+            }
 
-            if (add_header(&headers, &header_index, header_count, key, value) != 0)
+            if (add_header(headers, key, value) != 0)
             {
                 free(headers_copy);
-                free_headers(&headers, *header_count);
-                return NULL;
+                return -1;
             }
         }
         line = strtok(NULL, "\r\n");
     }
 
     free(headers_copy);
-    *header_count = header_index;
-    return headers;
+    return 0;
 }
 
-const char *find_header_value(Header *headers, int header_count, const char *key)
+const char *find_header_value(const Header_List *headers, const char *key)
 {
     int i;
-    for (i = 0; i < header_count; i++)
+    for (i = 0; i < headers->count; i++)
     {
-        if (strcmp(headers[i].key, key) == 0)
+        // Header names are case insensitive
+        if (strcasecmp(headers->items[i].key, key) == 0)
         {
-            return headers[i].value;
+            return headers->items[i].value;
         }
     }
     return NULL; // Return NULL if the header is not found
 }
 
-void log_headers(Header *headers, int header_count)
+// Constant time lookup for the headers the parser recognizes, see http_known_header
+const char *find_known_header_value(const Header_List *headers, HTTP_Known_Header header)
+{
+    if (header < 0 || header >= HTTP_HEADER_KNOWN_COUNT || headers->known[header] < 0)
+    {
+        return NULL;
+    }
+    return headers->items[headers->known[header]].value;
+}
+
+/* header_has_token:
+ * Checks whether a comma separated header value, such as the one of Connection,
+ * contains token. Tokens are compared ignoring case and surrounding whitespace.
+ */
+int header_has_token(const char *value, const char *token)
+{
+    size_t length, token_length;
+    const char *end;
+
+    if (value == NULL)
+    {
+        return 0;
+    }
+
+    token_length = strlen(token);
+    while (*value != '\0')
+    {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+        {
+            value++;
+        }
+        end = strchr(value, ',');
+        length = end != NULL ? (size_t)(end - value) : strlen(value);
+        while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+        {
+            length--;
+        }
+        if (length == token_length && strncasecmp(value, token, length) == 0)
+        {
+            return 1;
+        }
+        value += length;
+        while (*value != '\0' && *value != ',')
+        {
+            value++;
+        }
+    }
+    return 0;
+}
+
+void log_headers(const Header_List *headers)
 {
     int i;
-    for (i = 0; i < header_count; ++i)
+    for (i = 0; i < headers->count; ++i)
     {
-        printf("%s: %s\n", headers[i].key, headers[i].value);
+        printf("%s: %s\n", headers->items[i].key, headers->items[i].value);
     }
 }
 
-HTTP_Request *create_http_request(const char *method, const char *uri, const char *version, Header *headers, int header_count, const char *body)
+HTTP_Request *create_http_request(const char *method, const char *uri, const char *version, const char *body)
 {
     HTTP_Request *request;
 
@@ -284,6 +447,7 @@ HTTP_Request *create_http_request(const char *method, const char *uri, const cha
         return NULL;
     }
     memset(request, 0, sizeof(HTTP_Request));
+    init_header_list(&request->headers);
 
     request->request_line.method = (char *)malloc(strlen(method) + 1);
     if (request->request_line.method == NULL)
@@ -315,20 +479,6 @@ HTTP_Request *create_http_request(const char *method, const char *uri, const cha
     }
     strcpy(request->request_line.version, version);
 
-    if (headers != NULL)
-    {
-        request->headers = headers;
-    }
-
-    if (header_count >= 0)
-    {
-        request->header_count = header_count;
-    }
-    else
-    {
-        request->header_count = 0;
-    }
-
     if (body != NULL)
     {
         request->body = (char *)malloc(strlen(body) + 1);
@@ -351,6 +501,27 @@ void free_http_request(HTTP_Request **request)
 {
     if (request != NULL && *request != NULL)
     {
+        if ((*request)->arena != NULL)
+        {
+            // The request and its body go away with the arena, only what lives outside it is released
+            free_header_list(&(*request)->headers);
+            http_buffer_release((*request)->raw);
+            *request = NULL;
+            return;
+        }
+        if ((*request)->raw != NULL)
+        {
+            // Request line and headers live inside raw
+            free_header_list(&(*request)->headers);
+            http_buffer_release((*request)->raw);
+            if ((*request)->body != NULL)
+            {
+                free((*request)->body);
+            }
+            free(*request);
+            *request = NULL;
+            return;
+        }
         if ((*request)->request_line.method != NULL)
         {
             free((*request)->request_line.method);
@@ -363,7 +534,7 @@ void free_http_request(HTTP_Request **request)
         {
             free((*request)->request_line.version);
         }
-        free_headers(&((*request)->headers), (*request)->header_count);
+        free_header_list(&(*request)->headers);
         if ((*request)->body != NULL)
         {
             free((*request)->body);
@@ -383,7 +554,7 @@ int serialize_http_request_header(HTTP_Request *request, char **buffer)
     line_ending = "\r\n";
     space = " ";
 
-    size_headers_buffer = serialize_headers(request->headers, request->header_count, &headers_buffer);
+    size_headers_buffer = serialize_headers(&request->headers, &headers_buffer);
     if (size_headers_buffer < 0)
     {
         fprintf(stderr, "Error al serializar headers\n");
@@ -410,98 +581,90 @@ int serialize_http_request_header(HTTP_Request *request, char **buffer)
 
 HTTP_Request *deserialize_http_request_header(const char *buffer)
 {
-    char method[METHOD_SIZE], uri[URI_SIZE], version[VERSION_SIZE];
-    char *line, *temp_buffer;
-    char *header_end_ptr, *headers_part;
-    const char *line_ending;
-    int header_length;
+    char *raw;
+    HTTP_Parser parser;
     HTTP_Request *request;
 
-    line_ending = "\r\n";
-
-    request = (HTTP_Request *)malloc(sizeof(HTTP_Request));
-    if (request == NULL)
-    {
-        fprintf(stderr, "Error al asignar memoria\n");
-        return NULL;
-    }
-
-    temp_buffer = (char *)malloc(sizeof(char) * strlen(buffer) + 1);
-    if (temp_buffer == NULL)
+    http_parser_init(&parser);
+    if (http_parser_execute(&parser, buffer, strlen(buffer)) != HTTP_PARSE_DONE)
     {
-        fprintf(stderr, "Error al asignar memoria\n");
-        free(request);
+        fprintf(stderr, "Formato inválido de HTTP request\n");
         return NULL;
     }
-    strcpy(temp_buffer, buffer);
 
-    line = strtok(temp_buffer, "\r\n");
-    if (line == NULL)
+    // One copy of the header block, every field points into it
+    raw = http_buffer_alloc(parser.header_length + 1, NULL);
+    if (raw == NULL)
     {
-        fprintf(stderr, "strtok falló al tratar de tokenizar el buffer\n");
-        free(temp_buffer);
-        free(request);
         return NULL;
     }
+    memcpy(raw, buffer, parser.header_length);
+    raw[parser.header_length] = '\0';
 
-    if (sscanf(line, "%s %s %s", method, uri, version) != 3)
+    request = create_http_request_in_place(raw, &parser, NULL);
+    if (request == NULL)
     {
-        fprintf(stderr, "Error al parsear request line\n");
-        free(temp_buffer);
-        free(request);
-        return NULL;
+        http_buffer_release(raw);
     }
+    return request;
+}
 
-    request->request_line.method = (char *)malloc(strlen(method) + 1);
-    strcpy(request->request_line.method, method);
-
-    request->request_line.uri = (char *)malloc(strlen(uri) + 1);
-    strcpy(request->request_line.uri, uri);
-
-    request->request_line.version = (char *)malloc(strlen(version) + 1);
-    strcpy(request->request_line.version, version);
+/* create_http_request_in_place:
+ * Builds a request out of the slices found by the parser without copying them.
+ * Each field is terminated in place by overwriting the delimiter after it (space,
+ * colon or CR), so raw must be writable. On success the request owns raw and
+ * releases it in free_http_request. With an arena the request itself comes from
+ * it, otherwise from malloc.
+ */
+HTTP_Request *create_http_request_in_place(char *raw, const HTTP_Parser *parser, Arena *arena)
+{
+    int i;
+    HTTP_Request *request;
 
-    // Find the end of headers, marked by \r\n\r\n
-    header_end_ptr = strstr(buffer, "\r\n\r\n");
-    if (header_end_ptr == NULL)
+    request = (HTTP_Request *)allocate(arena, sizeof(HTTP_Request));
+    if (request == NULL)
     {
-        fprintf(stderr, "Formato inválido de HTTP request\n");
-        free(temp_buffer);
-        free_http_request(&request);
         return NULL;
     }
-
-    header_length = header_end_ptr - buffer + (strlen(line_ending) * 2); // move past \r\n\r\n
-    headers_part = (char *)malloc((header_length + 1) * sizeof(char));
-    if (headers_part == NULL)
+    memset(request, 0, sizeof(HTTP_Request));
+    init_header_list(&request->headers);
+    request->arena = arena;
+    if (reserve_headers(&request->headers, parser->header_count) < 0)
     {
-        fprintf(stderr, "Error al asignar memoria para headers_part\n");
-        free(temp_buffer);
-        free_http_request(&request);
+        if (arena == NULL)
+        {
+            free(request);
+        }
         return NULL;
     }
-    strncpy(headers_part, buffer, header_length);
-    headers_part[header_length] = '\0';
 
-    // Use the deserialize_headers function
-    request->headers = deserialize_headers(headers_part, &request->header_count);
-    if (request->headers == NULL)
+    request->raw = raw;
+    request->request_line.method = raw + parser->method.offset;
+    raw[parser->method.offset + parser->method.length] = '\0';
+    request->request_line.uri = raw + parser->uri.offset;
+    raw[parser->uri.offset + parser->uri.length] = '\0';
+    request->request_line.version = raw + parser->version.offset;
+    raw[parser->version.offset + parser->version.length] = '\0';
+
+    for (i = 0; i < parser->header_count; i++)
     {
-        free(headers_part);
-        free(temp_buffer);
-        free_http_request(&request);
-        return NULL;
+        raw[parser->headers[i].name.offset + parser->headers[i].name.length] = '\0';
+        raw[parser->headers[i].value.offset + parser->headers[i].value.length] = '\0';
+        request->headers.items[i].key = raw + parser->headers[i].name.offset;
+        request->headers.items[i].value = raw + parser->headers[i].value.offset;
     }
+    request->headers.count = parser->header_count;
+    // The parser already recognized the known headers, no need to look at the names again
+    memcpy(request->headers.known, parser->known, sizeof(request->headers.known));
 
-    free(headers_part);
-    free(temp_buffer);
     return request;
 }
 
 int send_http_request(int sockfd, HTTP_Request *request)
 {
     char *buffer;
-    int size;
+    int size, iovcnt;
+    struct iovec iov[2];
 
     // Serialize request line and headers
     size = serialize_http_request_header(request, &buffer);
@@ -510,167 +673,420 @@ int send_http_request(int sockfd, HTTP_Request *request)
         return -1;
     }
 
-    // Send request line and headers
-    if (sendall(sockfd, buffer, size) < 0)
+    // Request line, headers and body if it exists in one send
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = size;
+    iovcnt = 1;
+    if (request->body != NULL && request->body_length > 0)
+    {
+        iov[1].iov_base = request->body;
+        iov[1].iov_len = request->body_length;
+        iovcnt = 2;
+    }
+    if (sendall_iov(sockfd, iov, iovcnt) < 0)
     {
-        perror("send headers");
+        perror("send request");
         free(buffer);
         return -1;
     }
     free(buffer);
 
-    // Send body if it exists
-    if (request->body != NULL)
-    {
-        if (sendall(sockfd, request->body, request->body_length) < 0)
-        {
-            perror("send body");
-            return -1;
-        }
-    }
-
     return 0;
 }
 
+/* receive_http_request:
+ * Blocks until one whole request arrived. Bytes sent after it are dropped, a
+ * connection that can carry more requests should keep an HTTP_Receive_Buffer
+ * and call next_http_request instead.
+ */
 HTTP_Request *receive_http_request(int sockfd)
 {
-    char *buffer;
-    const char *content_length_str;
-    int size, extra_data_length;
+    ssize_t bytes_recv;
+    HTTP_Receive_Buffer *buffer;
     HTTP_Request *request;
 
-    buffer = (char *)malloc(DEFAULT_BUFFER_SIZE);
+    buffer = create_http_receive_buffer(HTTP_DEFAULT_MAX_HEADER_SIZE, HTTP_DEFAULT_MAX_BODY_SIZE);
     if (buffer == NULL)
     {
-        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
-    }
-
-    // Read headers first
-    size = read_until_double_end_line(sockfd, &buffer, DEFAULT_BUFFER_SIZE, &extra_data_length);
-    if (size <= 0)
-    {
-        free(buffer);
         return NULL;
     }
 
-    request = deserialize_http_request_header(buffer);
-
-    // Get the Content-Length header value
-    content_length_str = find_header_value(request->headers, request->header_count, "Content-Length");
-    request->body_length = 0;
-    if (content_length_str != NULL)
-    {
-        request->body_length = atoi(content_length_str); // Convert Content-Length to an integer
-    }
-
-    // Read the body if it exists
-    if (request->body_length > 0)
+    request = NULL;
+    while (next_http_request(buffer, &request, NULL) == HTTP_PARSE_INCOMPLETE)
     {
-        request->body = (char *)malloc(request->body_length + 1); // +1 for null-terminator
-        if (request->body == NULL)
-        {
-            fprintf(stderr, "Error allocating memory for body\n");
-            free(buffer);
-            free_http_request(&request);
-            return NULL;
-        }
-
-        // If extra data length is greater than 0, copy it to response body
-        if (extra_data_length > 0)
+        bytes_recv = fill_http_receive_buffer(sockfd, buffer);
+        if (bytes_recv == 0)
         {
-            memcpy(request->body, buffer + (size - extra_data_length), extra_data_length);
+            fprintf(stderr, "conexión cerrada al intentar leer\n");
         }
-
-        // Read the remaining body
-        int remaining_length = request->body_length - extra_data_length;
-        if (remaining_length > 0)
+        if (bytes_recv <= 0)
         {
-            if (recvall(sockfd, request->body + extra_data_length, remaining_length) <= 0)
-            {
-                free(buffer);
-                free_http_request(&request);
-                return NULL;
-            }
+            break;
         }
-
-        // Null-terminate the body
-        request->body[request->body_length] = '\0';
-    }
-    else
-    {
-        request->body = NULL;
     }
 
-    free(buffer); // Now it's safe to free buffer
+    free_http_receive_buffer(&buffer);
     return request;
 }
 
-HTTP_Response *create_http_response(const char *version, const int status_code, const char *reason_phrase, Header *headers, int header_count, const char *body)
+HTTP_Receive_Buffer *create_http_receive_buffer(int max_header_size, int max_body_size)
 {
-    HTTP_Response *response;
+    HTTP_Receive_Buffer *buffer;
 
-    if (version == NULL || status_code <= 0 || reason_phrase == NULL)
+    buffer = (HTTP_Receive_Buffer *)malloc(sizeof(HTTP_Receive_Buffer));
+    if (buffer == NULL)
     {
-        fprintf(stderr, "Uno o más valores de creación de HTTP Response es inválido\n");
+        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
         return NULL;
     }
+    buffer->data = NULL;
+    buffer->start = 0;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->max_header_size = max_header_size;
+    buffer->max_body_size = max_body_size;
+    http_parser_init(&buffer->parser);
+    http_chunk_decoder_init(&buffer->chunks);
+    return buffer;
+}
 
-    response = (HTTP_Response *)malloc(sizeof(HTTP_Response));
-    if (response == NULL)
+void free_http_receive_buffer(HTTP_Receive_Buffer **buffer)
+{
+    if (buffer != NULL && *buffer != NULL)
     {
-        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
-        return NULL;
+        http_buffer_release((*buffer)->data);
+        free(*buffer);
+        *buffer = NULL;
     }
-    memset(response, 0, sizeof(HTTP_Response));
+}
 
-    response->response_line.version = (char *)malloc(sizeof(char) * strlen(version) + 1);
-    if (response->response_line.version == NULL)
+/* fill_http_receive_buffer:
+ * One recv after the pending bytes. Returns the bytes received, 0 if the peer
+ * closed the connection and -1 on error. A buffer filled by the headers of one
+ * request moves to a block twice as large, next_http_request stops that growth
+ * at max_header_size.
+ */
+ssize_t fill_http_receive_buffer(int sockfd, HTTP_Receive_Buffer *buffer)
+{
+    ssize_t bytes_recv;
+
+    if (buffer->data == NULL && reserve_receive_buffer(buffer, DEFAULT_BUFFER_SIZE) < 0)
     {
-        fprintf(stderr, "Error al asignar memoria para version\n");
-        free(response);
-        return NULL;
+        return -1;
+    }
+    if (buffer->length == buffer->capacity)
+    {
+        // Room for one more byte: the requests before the pending bytes are gone or it has to grow
+        if (reserve_receive_buffer(buffer, buffer->start > 0 ? buffer->length - buffer->start + 1 : 2 * buffer->capacity) < 0)
+        {
+            return -1;
+        }
     }
-    strcpy(response->response_line.version, version);
 
-    response->response_line.status_code = status_code;
+    bytes_recv = recv(sockfd, buffer->data + buffer->length, buffer->capacity - buffer->length, 0);
+    if (bytes_recv == -1)
+    {
+        fprintf(stderr, "Error al intentar recibir datos: %s\n", strerror(errno));
+        return -1;
+    }
+    buffer->length += bytes_recv;
+    return bytes_recv;
+}
 
-    response->response_line.reason_phrase = (char *)malloc(sizeof(char) * strlen(reason_phrase) + 1);
-    if (response->response_line.reason_phrase == NULL)
+/* next_http_request:
+ * Takes the first whole request, headers and Content-Length body, out of the
+ * pending bytes. Returns HTTP_PARSE_DONE with *request set, HTTP_PARSE_INCOMPLETE
+ * when more bytes are needed or one of the HTTP_PARSE_* errors. Headers are only
+ * scanned once no matter how many recvs they take. With an arena the request and
+ * its body are allocated from it.
+ */
+int next_http_request(HTTP_Receive_Buffer *buffer, HTTP_Request **request, Arena *arena)
+{
+    char *pending, *raw;
+    int pending_length, parse_ret, body_length, request_length, header_length, header_index;
+    long content_length;
+    size_t body_available;
+
+    *request = NULL;
+    pending = buffer->data + buffer->start;
+    pending_length = buffer->length - buffer->start;
+    if (pending_length == 0)
     {
-        fprintf(stderr, "Error al asignar memoria para reason_phrase\n");
-        free(response->response_line.version);
-        free(response);
-        return NULL;
+        return HTTP_PARSE_INCOMPLETE;
     }
-    strcpy(response->response_line.reason_phrase, reason_phrase);
 
-    if (headers != NULL)
+    parse_ret = http_parser_execute(&buffer->parser, pending, pending_length);
+    if (parse_ret == HTTP_PARSE_INCOMPLETE && pending_length >= buffer->max_header_size)
+    {
+        fprintf(stderr, "HTTP request headers demasiado grandes\n");
+        return HTTP_PARSE_HEADERS_TOO_LARGE;
+    }
+    if (parse_ret == HTTP_PARSE_INCOMPLETE)
+    {
+        return parse_ret;
+    }
+    if (parse_ret != HTTP_PARSE_DONE)
     {
-        response->headers = headers;
+        fprintf(stderr, "Formato inválido de HTTP request\n");
+        return parse_ret;
     }
 
-    if (header_count >= 0)
+    header_length = buffer->parser.header_length;
+    if (header_length > buffer->max_header_size)
     {
-        response->header_count = header_count;
+        // Arrived whole in one recv, still over the limit
+        fprintf(stderr, "HTTP request headers demasiado grandes\n");
+        return HTTP_PARSE_HEADERS_TOO_LARGE;
+    }
+    body_length = 0;
+    header_index = buffer->parser.known[HTTP_HEADER_TRANSFER_ENCODING];
+    if (header_index >= 0)
+    {
+        // Transfer-Encoding wins over Content-Length, chunked is the only coding understood
+        if (!http_slice_equals_nocase(pending, buffer->parser.headers[header_index].value, "chunked"))
+        {
+            fprintf(stderr, "Transfer-Encoding no soportado en HTTP request\n");
+            return HTTP_PARSE_ERROR;
+        }
+
+        // Decoding drops the chunk framing, so fewer bytes are pending afterwards
+        body_available = pending_length - header_length;
+        parse_ret = decode_chunked_body(&buffer->chunks, pending + header_length, &body_available);
+        buffer->length = buffer->start + header_length + (int)body_available;
+        pending_length = buffer->length - buffer->start;
+        if (parse_ret != HTTP_PARSE_ERROR && buffer->chunks.written > (size_t)buffer->max_body_size)
+        {
+            fprintf(stderr, "HTTP request body demasiado grande\n");
+            return HTTP_PARSE_BODY_TOO_LARGE;
+        }
+        if (parse_ret == HTTP_PARSE_INCOMPLETE)
+        {
+            // The body length is not known up front, grow once the buffer is full
+            if (buffer->length == buffer->capacity && reserve_receive_buffer(buffer, 2 * pending_length) < 0)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            return parse_ret;
+        }
+        if (parse_ret != HTTP_PARSE_DONE)
+        {
+            fprintf(stderr, "Formato inválido de chunk en HTTP request\n");
+            return parse_ret;
+        }
+        body_length = (int)buffer->chunks.written;
+        request_length = header_length + (int)buffer->chunks.read;
     }
     else
     {
-        response->header_count = 0;
+        header_index = buffer->parser.known[HTTP_HEADER_CONTENT_LENGTH];
+        if (header_index >= 0)
+        {
+            content_length = parse_content_length(pending + buffer->parser.headers[header_index].value.offset,
+                                                  buffer->parser.headers[header_index].value.length);
+            if (content_length < 0)
+            {
+                fprintf(stderr, "Content-Length inválido en HTTP request\n");
+                return HTTP_PARSE_ERROR;
+            }
+            // Refused before any of it is buffered
+            if (content_length > buffer->max_body_size)
+            {
+                fprintf(stderr, "HTTP request body demasiado grande\n");
+                return HTTP_PARSE_BODY_TOO_LARGE;
+            }
+            body_length = (int)content_length;
+        }
+
+        request_length = header_length + body_length;
+        if (request_length > pending_length)
+        {
+            // Make room for the whole body so the next recvs can complete it
+            if (reserve_receive_buffer(buffer, request_length) < 0)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            return HTTP_PARSE_INCOMPLETE;
+        }
     }
 
-    if (body != NULL)
+    if (buffer->start == 0 && request_length == pending_length)
     {
-        response->body = (char *)malloc(sizeof(char) * strlen(body) + 1);
-        if (response->body == NULL)
+        // Nothing else pending, the request takes over the buffer without copying
+        raw = buffer->data;
+        buffer->data = NULL;
+        buffer->capacity = 0;
+        buffer->length = 0;
+    }
+    else
+    {
+        // Other requests share the buffer, copy only the bytes the headers point into
+        raw = http_buffer_alloc(header_length, NULL);
+        if (raw == NULL)
         {
-            fprintf(stderr, "Error al asignar memoria para body\n");
-            free(response->response_line.version);
-            free(response->response_line.reason_phrase);
-            free(response);
-            return NULL;
+            return HTTP_PARSE_ERROR;
+        }
+        memcpy(raw, pending, header_length);
+        buffer->start += request_length;
+        if (buffer->start == buffer->length)
+        {
+            buffer->start = 0;
+            buffer->length = 0;
         }
-        strcpy(response->body, body);
+    }
+
+    *request = create_http_request_in_place(raw, &buffer->parser, arena);
+    http_parser_init(&buffer->parser);
+    http_chunk_decoder_init(&buffer->chunks);
+    if (*request == NULL)
+    {
+        http_buffer_release(raw);
+        return HTTP_PARSE_ERROR;
+    }
+
+    if (body_length > 0)
+    {
+        (*request)->body = (char *)allocate(arena, body_length + 1); // +1 for null-terminator
+        if ((*request)->body == NULL)
+        {
+            free_http_request(request);
+            return HTTP_PARSE_ERROR;
+        }
+        // pending still points at the request bytes, either in raw or in buffer->data
+        memcpy((*request)->body, pending + header_length, body_length);
+        (*request)->body[body_length] = '\0';
+        (*request)->body_length = body_length;
+    }
+    return HTTP_PARSE_DONE;
+}
+
+// Makes room for length pending bytes, moving them to the front of the buffer first
+static int reserve_receive_buffer(HTTP_Receive_Buffer *buffer, int length)
+{
+    char *data;
+    size_t capacity;
+
+    if (buffer->start > 0 && buffer->start + length > buffer->capacity)
+    {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->length - buffer->start);
+        buffer->length -= buffer->start;
+        buffer->start = 0;
+    }
+    if (length <= buffer->capacity)
+    {
+        return 0;
+    }
+
+    // Past the compaction above the pending bytes start at the front
+    data = http_buffer_alloc(length, &capacity);
+    if (data == NULL)
+    {
+        return -1;
+    }
+    if (buffer->data != NULL)
+    {
+        memcpy(data, buffer->data, buffer->length);
+        http_buffer_release(buffer->data);
+    }
+    buffer->data = data;
+    buffer->capacity = (int)capacity;
+    return 0;
+}
+
+/* decode_chunked_body:
+ * Runs the decoder over body[0, *length) and drops the chunk framing it went
+ * past, so the decoded bytes are always directly followed by the ones still to
+ * decode. *length shrinks by the bytes dropped.
+ */
+static int decode_chunked_body(HTTP_Chunk_Decoder *decoder, char *body, size_t *length)
+{
+    int parse_ret;
+
+    parse_ret = http_chunk_decode(decoder, body, *length);
+    if (parse_ret != HTTP_PARSE_ERROR && decoder->read > decoder->written)
+    {
+        memmove(body + decoder->written, body + decoder->read, *length - decoder->read);
+        *length -= decoder->read - decoder->written;
+        decoder->read = decoder->written;
+    }
+    return parse_ret;
+}
+
+// Digits only, -1 if the value is empty or has other characters, anything past INT_MAX comes back as a larger value
+static long parse_content_length(const char *value, uint32_t length)
+{
+    uint32_t i;
+    long content_length;
+
+    if (length == 0)
+    {
+        return -1;
+    }
+    content_length = 0;
+    for (i = 0; i < length; i++)
+    {
+        if (value[i] < '0' || value[i] > '9')
+        {
+            return -1;
+        }
+        // Past INT_MAX it is too large anyway, keep checking the digits without overflowing
+        if (content_length <= INT_MAX)
+        {
+            content_length = content_length * 10 + (value[i] - '0');
+        }
+    }
+    return content_length;
+}
+
+HTTP_Response *create_http_response(const char *version, const int status_code, const char *reason_phrase, const char *body)
+{
+    return create_http_response_in_arena(NULL, version, status_code, reason_phrase, body);
+}
+
+/* create_http_response_in_arena:
+ * Like create_http_response, but the response and its strings come from the
+ * arena. They are never released one by one: free_http_response only drops
+ * what lives outside the arena and the rest goes away with arena_reset.
+ */
+HTTP_Response *create_http_response_in_arena(Arena *arena, const char *version, const int status_code, const char *reason_phrase, const char *body)
+{
+    HTTP_Response *response;
+
+    if (version == NULL || status_code <= 0 || reason_phrase == NULL)
+    {
+        fprintf(stderr, "Uno o más valores de creación de HTTP Response es inválido\n");
+        return NULL;
+    }
+
+    response = (HTTP_Response *)allocate(arena, sizeof(HTTP_Response));
+    if (response == NULL)
+    {
+        return NULL;
+    }
+    memset(response, 0, sizeof(HTTP_Response));
+    init_header_list(&response->headers);
+    response->arena = arena;
+    response->response_line.status_code = status_code;
+
+    // A common status points at its pre-rendered line, anything else gets copies
+    response->response_line.rendered = http_status_line(version, status_code, reason_phrase);
+    if (response->response_line.rendered != NULL)
+    {
+        response->response_line.version = (char *)response->response_line.rendered->version;
+        response->response_line.reason_phrase = (char *)response->response_line.rendered->reason_phrase;
+    }
+    else
+    {
+        response->response_line.version = copy_string(arena, version);
+        response->response_line.reason_phrase = copy_string(arena, reason_phrase);
+    }
+    if (body != NULL)
+    {
+        response->body = copy_string(arena, body);
+    }
+    if (response->response_line.version == NULL || response->response_line.reason_phrase == NULL || (body != NULL && response->body == NULL))
+    {
+        free_http_response(&response);
+        return NULL;
     }
 
     return response;
@@ -680,15 +1096,25 @@ void free_http_response(HTTP_Response **response)
 {
     if (response != NULL && *response != NULL)
     {
-        if ((*response)->response_line.version != NULL)
+        if ((*response)->arena != NULL)
         {
-            free((*response)->response_line.version);
+            // Only the header list can have grown outside the arena
+            free_header_list(&(*response)->headers);
+            *response = NULL;
+            return;
         }
-        if ((*response)->response_line.reason_phrase != NULL)
+        if ((*response)->response_line.rendered == NULL)
         {
-            free((*response)->response_line.reason_phrase);
+            if ((*response)->response_line.version != NULL)
+            {
+                free((*response)->response_line.version);
+            }
+            if ((*response)->response_line.reason_phrase != NULL)
+            {
+                free((*response)->response_line.reason_phrase);
+            }
         }
-        free_headers(&((*response)->headers), (*response)->header_count);
+        free_header_list(&(*response)->headers);
         if ((*response)->body != NULL)
         {
             free((*response)->body);
@@ -698,52 +1124,73 @@ void free_http_response(HTTP_Response **response)
     }
 }
 
-int serialize_http_response(HTTP_Response *response, char **buffer)
+/* serialize_http_response_header:
+ * Status line, headers and blank line in one block, the body is sent from where
+ * it is. The block comes from the response arena when it has one, and then must
+ * not be freed.
+ */
+int serialize_http_response_header(HTTP_Response *response, char **buffer)
 {
-    const char *line_ending, *space;
-    char *headers_buffer, *ptr;
-    int size_buffer, size_headers_buffer;
+    char *ptr;
+    int i, size_buffer;
+    size_t key_length, value_length;
+    const HTTP_Status_Line *rendered;
 
-    line_ending = "\r\n";
-    space = " ";
+    rendered = response->response_line.rendered;
 
-    size_headers_buffer = serialize_headers(response->headers, response->header_count, &headers_buffer);
-    if (size_headers_buffer < 0)
+    // Exact length of the status line, anything extra would be read as the start of the next response
+    if (rendered != NULL)
     {
-        fprintf(stderr, "Error al serializar headers\n");
-        return -1;
+        size_buffer = rendered->length;
     }
-
-    size_buffer = strlen(response->response_line.version) + sizeof(response->response_line.status_code) +
-                  strlen(response->response_line.reason_phrase) + strlen(space) * 2 + strlen(line_ending);
-    size_buffer += size_headers_buffer;
-    size_buffer += strlen(line_ending); // For \r\n after headers
-
-    if (response->body != NULL)
+    else
+    {
+        size_buffer = snprintf(NULL, 0, "%s %d %s\r\n", response->response_line.version, response->response_line.status_code, response->response_line.reason_phrase);
+    }
+    for (i = 0; i < response->headers.count; i++)
     {
-        size_buffer += response->body_length;
+        size_buffer += strlen(response->headers.items[i].key) + strlen(response->headers.items[i].value) + 4; // ": " and CRLF
     }
+    size_buffer += response->rendered_headers_length;
+    size_buffer += 2; // For \r\n after headers
 
-    *buffer = (char *)malloc(size_buffer);
+    // +1 since sprintf terminates the status line
+    *buffer = (char *)allocate(response->arena, size_buffer + 1);
     if (*buffer == NULL)
     {
-        fprintf(stderr, "Error al asignar memoria\n");
         return -1;
     }
 
+    // Headers are written straight into the block, no intermediate copy
     ptr = *buffer;
-    ptr += sprintf(ptr, "%s %d %s%s", response->response_line.version, response->response_line.status_code, response->response_line.reason_phrase, line_ending);
-    memcpy(ptr, headers_buffer, size_headers_buffer);
-    ptr += size_headers_buffer;
-    memcpy(ptr, line_ending, strlen(line_ending));
-    ptr += strlen(line_ending);
-
-    if (response->body != NULL)
+    if (rendered != NULL)
     {
-        memcpy(ptr, response->body, response->body_length);
+        memcpy(ptr, rendered->line, rendered->length);
+        ptr += rendered->length;
     }
-
-    free(headers_buffer);
+    else
+    {
+        ptr += sprintf(ptr, "%s %d %s\r\n", response->response_line.version, response->response_line.status_code, response->response_line.reason_phrase);
+    }
+    for (i = 0; i < response->headers.count; i++)
+    {
+        key_length = strlen(response->headers.items[i].key);
+        value_length = strlen(response->headers.items[i].value);
+        memcpy(ptr, response->headers.items[i].key, key_length);
+        ptr += key_length;
+        memcpy(ptr, ": ", 2);
+        ptr += 2;
+        memcpy(ptr, response->headers.items[i].value, value_length);
+        ptr += value_length;
+        memcpy(ptr, "\r\n", 2);
+        ptr += 2;
+    }
+    if (response->rendered_headers_length > 0)
+    {
+        memcpy(ptr, response->rendered_headers, response->rendered_headers_length);
+        ptr += response->rendered_headers_length;
+    }
+    memcpy(ptr, "\r\n", 2);
 
     return size_buffer;
 }
@@ -765,6 +1212,8 @@ HTTP_Response *deserialize_http_response_header(const char *buffer)
         fprintf(stderr, "Error al asignar memoria\n");
         return NULL;
     }
+    memset(response, 0, sizeof(HTTP_Response));
+    init_header_list(&response->headers);
 
     temp_buffer = (char *)malloc(sizeof(char) * strlen(buffer) + 1);
     if (temp_buffer == NULL)
@@ -783,7 +1232,8 @@ HTTP_Response *deserialize_http_response_header(const char *buffer)
         free(response);
         return NULL;
     }
-    if (sscanf(line, "%s %d", version, &status_code) != 2)
+    // %15s: VERSION_SIZE - 1, a longer version is not one we know anyway
+    if (strcspn(line, " ") >= VERSION_SIZE || sscanf(line, "%15s %d", version, &status_code) != 2)
     {
         fprintf(stderr, "Error al parsear response line\n");
         free(temp_buffer);
@@ -795,7 +1245,7 @@ HTTP_Response *deserialize_http_response_header(const char *buffer)
     if (reason_start != NULL)
     {
         reason_start = strchr(reason_start + 1, ' ');
-        if (reason_start != NULL)
+        if (reason_start != NULL && strlen(reason_start + 1) < REASON_PHRASE_SIZE)
         {
             strcpy(reason_phrase, reason_start + 1);
         }
@@ -846,8 +1296,7 @@ HTTP_Response *deserialize_http_response_header(const char *buffer)
     headers_part[header_length] = '\0';
 
     // Use the deserialize_headers function
-    response->headers = deserialize_headers(headers_part, &response->header_count);
-    if (response->headers == NULL)
+    if (deserialize_headers(headers_part, &response->headers) < 0)
     {
         free(headers_part);
         free(temp_buffer);
@@ -860,27 +1309,154 @@ HTTP_Response *deserialize_http_response_header(const char *buffer)
     return response;
 }
 
+/* send_http_response:
+ * Head and body leave in the same send, gathered by the kernel from the head
+ * block and the body wherever it lives, so the body is never copied. A client
+ * that closes early makes the send fail instead of raising SIGPIPE.
+ */
 int send_http_response(int sockfd, HTTP_Response *response)
 {
     char *buffer;
-    int size;
+    int size, iovcnt;
+    struct iovec iov[2];
+    HTTP_Body_Writer writer;
 
     // Serialize response line and headers
-    size = serialize_http_response(response, &buffer);
+    size = serialize_http_response_header(response, &buffer);
     if (size < 0)
     {
         return -1;
     }
 
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = size;
+    iovcnt = 1;
+    if (response->body != NULL && response->body_length > 0)
+    {
+        iov[1].iov_base = response->body;
+        iov[1].iov_len = response->body_length;
+        iovcnt = 2;
+    }
+
     // Send the complete response (headers + body)
-    if (sendall(sockfd, buffer, size) < 0)
+    if (sendall_iov_with_flags(sockfd, iov, iovcnt, MSG_NOSIGNAL) < 0)
     {
         perror("send response");
+        if (response->arena == NULL)
+        {
+            free(buffer);
+        }
+        return -1;
+    }
+    if (response->arena == NULL)
+    {
         free(buffer);
+    }
+
+    if (response->stream != NULL)
+    {
+        // The body is generated now, chunked unless the connection end delimits it
+        http_body_writer_init(&writer, sockfd, header_has_token(find_known_header_value(&response->headers, HTTP_HEADER_TRANSFER_ENCODING), "chunked"));
+        if (response->stream(&writer, response->stream_arg) < 0 || http_body_finish(&writer) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void http_body_writer_init(HTTP_Body_Writer *writer, int sockfd, int chunked)
+{
+    writer->sockfd = sockfd;
+    writer->chunked = chunked;
+    writer->length = 0;
+    writer->arena = NULL;
+    writer->body = NULL;
+    writer->body_length = 0;
+    writer->body_capacity = 0;
+}
+
+// Collects the whole body in arena, writer->body once the stream is finished
+void http_body_writer_init_buffer(HTTP_Body_Writer *writer, Arena *arena)
+{
+    http_body_writer_init(writer, -1, 0);
+    writer->arena = arena;
+}
+
+// Buffers data, sending a chunk every time HTTP_BODY_WRITER_SIZE bytes are waiting
+int http_body_write(HTTP_Body_Writer *writer, const char *data, size_t length)
+{
+    size_t n;
+
+    while (length > 0)
+    {
+        n = HTTP_BODY_WRITER_SIZE - writer->length;
+        if (n > length)
+        {
+            n = length;
+        }
+        memcpy(writer->data + HTTP_CHUNK_PREFIX_SIZE + writer->length, data, n);
+        writer->length += n;
+        data += n;
+        length -= n;
+        if (writer->length == HTTP_BODY_WRITER_SIZE && http_body_flush(writer) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sends the waiting bytes, framed as one chunk when chunked, in a single send
+int http_body_flush(HTTP_Body_Writer *writer)
+{
+    char size_line[HTTP_CHUNK_PREFIX_SIZE + 1];
+    char *start;
+    size_t size;
+    int size_line_length;
+
+    if (writer->length == 0)
+    {
+        return 0;
+    }
+
+    start = writer->data + HTTP_CHUNK_PREFIX_SIZE;
+    size = writer->length;
+    if (writer->chunked)
+    {
+        // The size line goes right before the data and CRLF right after it
+        size_line_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", writer->length);
+        start -= size_line_length;
+        memcpy(start, size_line, size_line_length);
+        memcpy(writer->data + HTTP_CHUNK_PREFIX_SIZE + writer->length, "\r\n", 2);
+        size += size_line_length + 2;
+    }
+
+    writer->length = 0;
+    if (writer->sockfd < 0)
+    {
+        return collect_body(writer, start, size);
+    }
+    if (sendall(writer->sockfd, start, size) < 0)
+    {
+        perror("send body");
         return -1;
     }
+    return 0;
+}
 
-    free(buffer);
+// Sends the waiting bytes and, when chunked, the last chunk that ends the body
+int http_body_finish(HTTP_Body_Writer *writer)
+{
+    if (http_body_flush(writer) < 0)
+    {
+        return -1;
+    }
+    if (writer->chunked && sendall(writer->sockfd, "0\r\n\r\n", 5) < 0)
+    {
+        perror("send body");
+        return -1;
+    }
     return 0;
 }
 
@@ -908,8 +1484,26 @@ HTTP_Response *receive_http_response(int sockfd)
 
     response = deserialize_http_response_header(buffer);
 
+    if (response == NULL)
+    {
+        free(buffer);
+        return NULL;
+    }
+
+    if (header_has_token(find_known_header_value(&response->headers, HTTP_HEADER_TRANSFER_ENCODING), "chunked"))
+    {
+        if (receive_chunked_body(sockfd, buffer + (size - extra_data_length), extra_data_length, &response->body, &response->body_length) < 0)
+        {
+            free(buffer);
+            free_http_response(&response);
+            return NULL;
+        }
+        free(buffer);
+        return response;
+    }
+
     // Get the Content-Length header value
-    content_length_str = find_header_value(response->headers, response->header_count, "Content-Length");
+    content_length_str = find_known_header_value(&response->headers, HTTP_HEADER_CONTENT_LENGTH);
     response->body_length = 0;
     if (content_length_str != NULL)
     {
@@ -958,18 +1552,211 @@ HTTP_Response *receive_http_response(int sockfd)
     return response;
 }
 
+/* receive_chunked_body:
+ * Reads and decodes a chunked body into a new NUL terminated block. The first
+ * extra_length bytes came in with the headers. Bytes after the body are dropped.
+ */
+static int receive_chunked_body(int sockfd, const char *extra, int extra_length, char **body, int *body_length)
+{
+    char *data, *grown;
+    size_t length, capacity;
+    ssize_t bytes_recv;
+    int parse_ret;
+    HTTP_Chunk_Decoder decoder;
+
+    capacity = DEFAULT_BUFFER_SIZE;
+    while (capacity <= (size_t)extra_length)
+    {
+        capacity *= 2;
+    }
+    data = (char *)malloc(capacity);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Error allocating memory for body\n");
+        return -1;
+    }
+    memcpy(data, extra, extra_length);
+    length = extra_length;
+
+    http_chunk_decoder_init(&decoder);
+    while ((parse_ret = decode_chunked_body(&decoder, data, &length)) == HTTP_PARSE_INCOMPLETE)
+    {
+        // Keep one byte for the null terminator
+        if (length + 1 >= capacity)
+        {
+            grown = (char *)realloc(data, capacity * 2);
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Error allocating memory for body\n");
+                free(data);
+                return -1;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        bytes_recv = recv(sockfd, data + length, capacity - 1 - length, 0);
+        if (bytes_recv <= 0)
+        {
+            fprintf(stderr, "conexión cerrada al intentar leer body\n");
+            free(data);
+            return -1;
+        }
+        length += bytes_recv;
+    }
+    if (parse_ret != HTTP_PARSE_DONE)
+    {
+        fprintf(stderr, "Formato inválido de chunk en HTTP response\n");
+        free(data);
+        return -1;
+    }
+
+    data[decoder.written] = '\0';
+    *body = data;
+    *body_length = (int)decoder.written;
+    return 0;
+}
+
+/* http_buffer_alloc:
+ * Block of at least size bytes, rounded up to the next pooled size when it fits
+ * one so a released block serves any later request of that size. The usable
+ * bytes are stored in *capacity when it is not NULL.
+ */
+char *http_buffer_alloc(size_t size, size_t *capacity)
+{
+    HTTP_Buffer_Block *block;
+    size_t block_size;
+    int size_class;
+
+    size_class = 0;
+    block_size = HTTP_BUFFER_POOL_MIN_SIZE;
+    while (block_size < size && size_class < HTTP_BUFFER_POOL_CLASSES)
+    {
+        block_size *= 2;
+        size_class++;
+    }
+
+    block = NULL;
+    if (size_class == HTTP_BUFFER_POOL_CLASSES)
+    {
+        // Large bodies are rare, they get exactly what they need
+        size_class = -1;
+        block_size = size;
+    }
+    else
+    {
+        pthread_mutex_lock(&buffer_pool_lock);
+        block = buffer_pool[size_class];
+        if (block != NULL)
+        {
+            buffer_pool[size_class] = block->next;
+            buffer_pool_free[size_class]--;
+        }
+        pthread_mutex_unlock(&buffer_pool_lock);
+    }
+
+    if (block == NULL)
+    {
+        block = (HTTP_Buffer_Block *)malloc(sizeof(HTTP_Buffer_Block) + block_size);
+        if (block == NULL)
+        {
+            fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+            return NULL;
+        }
+        block->capacity = block_size;
+        block->size_class = size_class;
+    }
+    block->next = NULL;
+
+    if (capacity != NULL)
+    {
+        *capacity = block->capacity;
+    }
+    return (char *)(block + 1);
+}
+
+void http_buffer_release(char *data)
+{
+    HTTP_Buffer_Block *block;
+
+    if (data == NULL)
+    {
+        return;
+    }
+
+    block = (HTTP_Buffer_Block *)data - 1;
+    if (block->size_class >= 0)
+    {
+        pthread_mutex_lock(&buffer_pool_lock);
+        if (buffer_pool_free[block->size_class] < HTTP_BUFFER_POOL_MAX_FREE)
+        {
+            block->next = buffer_pool[block->size_class];
+            buffer_pool[block->size_class] = block;
+            buffer_pool_free[block->size_class]++;
+            block = NULL;
+        }
+        pthread_mutex_unlock(&buffer_pool_lock);
+    }
+    free(block);
+}
+
+// Gives the free blocks back to the system, the ones still in use are released as usual
+void http_buffer_pool_clear(void)
+{
+    HTTP_Buffer_Block *block;
+    int i;
+
+    pthread_mutex_lock(&buffer_pool_lock);
+    for (i = 0; i < HTTP_BUFFER_POOL_CLASSES; i++)
+    {
+        while ((block = buffer_pool[i]) != NULL)
+        {
+            buffer_pool[i] = block->next;
+            free(block);
+        }
+        buffer_pool_free[i] = 0;
+    }
+    pthread_mutex_unlock(&buffer_pool_lock);
+}
+
+/* read_until_double_end_line:
+ * Receives until the blank line after the headers. *buffer_ptr holds length
+ * bytes and is reallocated, doubling, while the headers do not fit, up to
+ * HTTP_DEFAULT_MAX_HEADER_SIZE. Returns the bytes received, 0 if the peer closed
+ * the connection first and -1 on error or when the headers are too large.
+ */
 int read_until_double_end_line(int sockfd, char **buffer_ptr, int length, int *extra_data_length)
 {
     int total_bytes = 0; // Total bytes received
     int bytes_recv;
-    char *buffer, *end_of_headers;
+    size_t scanned, headers_end;
+    char *buffer, *grown;
 
     buffer = *buffer_ptr;
     *extra_data_length = 0; // Initialize extra data length
+    scanned = 0;            // Bytes already searched for the blank line
 
-    while (total_bytes < length)
+    for (;;)
     {
-        bytes_recv = recv(sockfd, buffer + total_bytes, length - total_bytes, 0);
+        // Keep one byte for the null terminator
+        if (total_bytes == length - 1)
+        {
+            if (length >= HTTP_DEFAULT_MAX_HEADER_SIZE)
+            {
+                fprintf(stderr, "HTTP headers demasiado grandes\n");
+                return -1;
+            }
+            grown = (char *)realloc(buffer, 2 * length);
+            if (grown == NULL)
+            {
+                fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+                return -1;
+            }
+            buffer = grown;
+            *buffer_ptr = buffer;
+            length *= 2;
+        }
+
+        bytes_recv = recv(sockfd, buffer + total_bytes, length - 1 - total_bytes, 0);
         if (bytes_recv == -1)
         {
             fprintf(stderr, "Error al intentar recibir datos: %s\n", strerror(errno));
@@ -985,12 +1772,12 @@ int read_until_double_end_line(int sockfd, char **buffer_ptr, int length, int *e
         total_bytes += bytes_recv;
         buffer[total_bytes] = '\0'; // Null-terminate the buffer
 
-        // Check if we've received two consecutive CRLF
-        end_of_headers = strstr(buffer, "\r\n\r\n");
-        if (end_of_headers != NULL)
+        // Only the new bytes are searched for two consecutive CRLF
+        headers_end = http_find_headers_end(buffer, &scanned, total_bytes);
+        if (headers_end > 0)
         {
             // Found the end of headers
-            *extra_data_length = total_bytes - (end_of_headers - buffer + 4); // 4 for "\r\n\r\n"
+            *extra_data_length = total_bytes - headers_end;
             break;
         }
     }
@@ -998,82 +1785,476 @@ int read_until_double_end_line(int sockfd, char **buffer_ptr, int length, int *e
     return total_bytes; // Return total bytes received
 }
 
-const char *get_extension(const char *content_type)
+/* http_status_line:
+ * Pre-rendered line of a status, NULL if it has none or the version or reason
+ * phrase differ from the rendered ones.
+ */
+const HTTP_Status_Line *http_status_line(const char *version, int status_code, const char *reason_phrase)
 {
-    if (strstr(content_type, "image/jpeg") != NULL)
+    size_t i;
+
+    for (i = 0; i < sizeof(status_lines) / sizeof(status_lines[0]); i++)
     {
-        return ".jpg";
+        if (status_lines[i].status_code == status_code)
+        {
+            if (strcmp(version, status_lines[i].version) == 0 && strcmp(reason_phrase, status_lines[i].reason_phrase) == 0)
+            {
+                return &status_lines[i];
+            }
+            return NULL;
+        }
     }
-    else if (strstr(content_type, "image/png") != NULL)
+    return NULL;
+}
+
+/* http_format_uint:
+ * Writes value in decimal and a '\0' into buffer, which must hold
+ * HTTP_UINT_STR_LEN bytes. Returns the number of digits.
+ */
+int http_format_uint(char *buffer, uint64_t value)
+{
+    char digits[HTTP_UINT_STR_LEN];
+    char *ptr;
+    int length, pair;
+
+    // Filled from the end, the lowest digits are known first
+    ptr = digits + sizeof(digits) - 1;
+    *ptr = '\0';
+    while (value >= 100)
     {
-        return ".png";
+        pair = (int)(value % 100) * 2;
+        value /= 100;
+        ptr -= 2;
+        ptr[0] = digit_pairs[pair];
+        ptr[1] = digit_pairs[pair + 1];
     }
-    else if (strstr(content_type, "image/gif") != NULL)
+    if (value >= 10)
     {
-        return ".gif";
+        pair = (int)value * 2;
+        ptr -= 2;
+        ptr[0] = digit_pairs[pair];
+        ptr[1] = digit_pairs[pair + 1];
     }
-    else if (strstr(content_type, "image/bmp") != NULL)
+    else
     {
-        return ".bmp";
+        *--ptr = (char)('0' + value);
     }
-    else if (strstr(content_type, "image/tiff") != NULL)
+
+    length = (int)(digits + sizeof(digits) - 1 - ptr);
+    memcpy(buffer, ptr, length + 1);
+    return length;
+}
+
+/* http_date_update:
+ * Formats the current time as an IMF-fixdate (RFC 7231) if the second changed
+ * since the last call. Meant to be called by the event loop on every wake up.
+ */
+void http_date_update(void)
+{
+    time_t now;
+    int next;
+
+    now = time(NULL);
+    pthread_mutex_lock(&date_lock);
+    if (now != date_second)
     {
-        return ".tiff";
+        next = (date_slot + 1) % HTTP_DATE_SLOTS;
+        if (http_format_date(date_slots[next], now) > 0)
+        {
+            date_slot = next;
+            date_second = now;
+            __atomic_store_n(&date_current, date_slots[next], __ATOMIC_RELEASE);
+        }
     }
-    else if (strstr(content_type, "text/plain") != NULL)
+    pthread_mutex_unlock(&date_lock);
+}
+
+/* http_date:
+ * Value for the Date header as of the last http_date_update. The string stays
+ * valid for HTTP_DATE_SLOTS seconds, it must be copied rather than kept.
+ */
+const char *http_date(void)
+{
+    char *date;
+
+    date = __atomic_load_n(&date_current, __ATOMIC_ACQUIRE);
+    if (date == NULL)
     {
-        return ".txt";
+        // Nobody updated it yet
+        http_date_update();
+        date = __atomic_load_n(&date_current, __ATOMIC_ACQUIRE);
     }
-    else if (strstr(content_type, "application/pdf") != NULL)
+    return date;
+}
+
+/* http_format_date:
+ * Writes a time as IMF-fixdate, the format of Date and Last-Modified, into a
+ * buffer of HTTP_DATE_SIZE bytes. Written by hand, strftime would follow the
+ * locale for the names. Returns the length written or -1.
+ */
+int http_format_date(char *buffer, time_t seconds)
+{
+    struct tm tm;
+
+    if (gmtime_r(&seconds, &tm) == NULL || tm.tm_year + 1900 > 9999)
     {
-        return ".pdf";
+        return -1;
     }
-    else
+    memcpy(buffer, date_days[tm.tm_wday], 3);
+    memcpy(buffer + 3, ", ", 2);
+    write_two_digits(buffer + 5, tm.tm_mday);
+    buffer[7] = ' ';
+    memcpy(buffer + 8, date_months[tm.tm_mon], 3);
+    buffer[11] = ' ';
+    write_two_digits(buffer + 12, ((tm.tm_year + 1900) / 100) % 100);
+    write_two_digits(buffer + 14, (tm.tm_year + 1900) % 100);
+    buffer[16] = ' ';
+    write_two_digits(buffer + 17, tm.tm_hour);
+    buffer[19] = ':';
+    write_two_digits(buffer + 20, tm.tm_min);
+    buffer[22] = ':';
+    write_two_digits(buffer + 23, tm.tm_sec);
+    memcpy(buffer + 25, " GMT", 5);
+    return HTTP_DATE_SIZE - 1;
+}
+
+/* http_parse_date:
+ * Reads an IMF-fixdate such as the one of If-Modified-Since. The obsolete
+ * RFC 850 and asctime formats are not accepted, a header carrying them is
+ * treated as invalid and so ignored. Returns 0 or -1.
+ */
+int http_parse_date(const char *value, time_t *seconds)
+{
+    struct tm tm;
+    int month, year;
+
+    if (strlen(value) != HTTP_DATE_SIZE - 1 || memcmp(value + 3, ", ", 2) != 0 || value[7] != ' ' || value[11] != ' ' ||
+        value[16] != ' ' || value[19] != ':' || value[22] != ':' || memcmp(value + 25, " GMT", 4) != 0)
     {
-        return NULL;
+        return -1;
     }
+    for (month = 0; month < 12 && memcmp(value + 8, date_months[month], 3) != 0; month++)
+    {
+    }
+    year = read_digits(value + 12, 4);
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mday = read_digits(value + 5, 2);
+    tm.tm_hour = read_digits(value + 17, 2);
+    tm.tm_min = read_digits(value + 20, 2);
+    tm.tm_sec = read_digits(value + 23, 2);
+    if (month == 12 || year < 0 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour < 0 || tm.tm_hour > 23 ||
+        tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 || tm.tm_sec > 60)
+    {
+        return -1;
+    }
+    tm.tm_mon = month;
+    tm.tm_year = year - 1900;
+    *seconds = timegm(&tm);
+    return *seconds == (time_t)-1 ? -1 : 0;
+}
+
+/* http_format_etag:
+ * Strong validator of a file, quoted, from its inode, size and modification
+ * time in nanoseconds. Any change that stat can see gives another one.
+ * buffer needs HTTP_ETAG_SIZE bytes. Returns the length written.
+ */
+int http_format_etag(char *buffer, uint64_t inode, uint64_t size, uint64_t mtime_ns)
+{
+    char *ptr;
+
+    ptr = buffer;
+    *ptr++ = '"';
+    ptr += write_hex(ptr, inode);
+    *ptr++ = '-';
+    ptr += write_hex(ptr, size);
+    *ptr++ = '-';
+    ptr += write_hex(ptr, mtime_ns);
+    *ptr++ = '"';
+    *ptr = '\0';
+    return ptr - buffer;
 }
 
-const char *get_content_type(const char *extension)
+/* http_etag_matches:
+ * Whether an If-None-Match list ("*" or entity tags separated by commas)
+ * names etag. The comparison is the weak one, W/ is ignored on both sides.
+ */
+int http_etag_matches(const char *list, const char *etag)
 {
-    if (strcmp(extension, ".jpg") == 0)
+    const char *end;
+    size_t etag_length;
+
+    if (etag[0] == 'W' && etag[1] == '/')
     {
-        return "image/jpeg";
+        etag += 2;
     }
-    else if (strcmp(extension, ".jpeg") == 0)
+    etag_length = strlen(etag);
+    for (list += strspn(list, " \t,"); *list != '\0'; list += strspn(list, " \t,"))
     {
-        return "image/jpeg";
+        if (*list == '*')
+        {
+            return 1;
+        }
+        if (list[0] == 'W' && list[1] == '/')
+        {
+            list += 2;
+        }
+        if (*list != '"' || (end = strchr(list + 1, '"')) == NULL)
+        {
+            return 0; // Malformed, nothing after it can be trusted
+        }
+        if ((size_t)(end + 1 - list) == etag_length && memcmp(list, etag, etag_length) == 0)
+        {
+            return 1;
+        }
+        list = end + 1;
     }
-    else if (strcmp(extension, ".png") == 0)
+    return 0;
+}
+
+/* http_not_modified:
+ * Evaluates If-None-Match and If-Modified-Since of a GET or HEAD against the
+ * validators of the selected representation. When both are present only
+ * If-None-Match counts, and an invalid date is ignored. Returns 1 when the
+ * client copy is current and a 304 can be sent instead.
+ */
+int http_not_modified(const Header_List *headers, const char *etag, time_t last_modified)
+{
+    const char *value;
+    time_t since;
+
+    value = find_known_header_value(headers, HTTP_HEADER_IF_NONE_MATCH);
+    if (value != NULL)
     {
-        return "image/png";
+        return http_etag_matches(value, etag);
     }
-    else if (strcmp(extension, ".gif") == 0)
+    value = find_known_header_value(headers, HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (value != NULL && http_parse_date(value, &since) == 0)
     {
-        return "image/gif";
+        return last_modified <= since;
     }
-    else if (strcmp(extension, ".bmp") == 0)
+    return 0;
+}
+
+/* http_parse_range:
+ * Reads a "bytes=" Range header against a representation of size bytes into
+ * ranges, clamped to it, in the order the client asked. Ranges that start past
+ * the end are dropped. Returns how many are left, HTTP_RANGE_UNSATISFIABLE if
+ * that is none, or HTTP_RANGE_NONE when the header must be ignored: another
+ * unit, a syntax error, more than max_ranges, or ranges adding up to more than
+ * the representation, which only a client asking for the same bytes over and
+ * over would send.
+ */
+int http_parse_range(const char *value, uint64_t size, HTTP_Byte_Range *ranges, int max_ranges)
+{
+    const char *ptr;
+    uint64_t first, last, total;
+    int count, has_first, has_last;
+
+    if (strncasecmp(value, "bytes=", 6) != 0)
     {
-        return "image/bmp";
+        return HTTP_RANGE_NONE;
     }
-    else if (strcmp(extension, ".tiff") == 0)
+    ptr = value + 6;
+    count = 0;
+    total = 0;
+    while (1)
     {
-        return "image/tiff";
+        ptr += strspn(ptr, " \t");
+        has_first = read_position(&ptr, &first);
+        if (has_first < 0 || *ptr++ != '-')
+        {
+            return HTTP_RANGE_NONE;
+        }
+        has_last = read_position(&ptr, &last);
+        if (has_last < 0 || (!has_first && !has_last) || (has_first && has_last && last < first))
+        {
+            return HTTP_RANGE_NONE;
+        }
+
+        if (!has_first)
+        {
+            // Suffix range, the last bytes
+            if (last > 0 && size > 0)
+            {
+                first = last >= size ? 0 : size - last;
+                last = size - 1;
+                has_first = 1;
+            }
+        }
+        else if (!has_last || last >= size)
+        {
+            last = size - 1;
+        }
+        if (has_first && first < size)
+        {
+            if (count == max_ranges)
+            {
+                return HTTP_RANGE_NONE;
+            }
+            total += last - first + 1;
+            if (total > size)
+            {
+                return HTTP_RANGE_NONE;
+            }
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+        }
+
+        ptr += strspn(ptr, " \t");
+        if (*ptr == '\0')
+        {
+            break;
+        }
+        if (*ptr++ != ',')
+        {
+            return HTTP_RANGE_NONE;
+        }
     }
-    else if (strcmp(extension, ".txt") == 0)
+    return count > 0 ? count : HTTP_RANGE_UNSATISFIABLE;
+}
+
+/* http_if_range_matches:
+ * Whether the Range of a request still applies under its If-Range, which
+ * holds an entity tag or a date. A tag must be strongly equal to etag and a
+ * date exactly last_modified, anything else means the client copy changed and
+ * the whole representation is sent. True when there is no If-Range.
+ */
+int http_if_range_matches(const char *value, const char *etag, time_t last_modified)
+{
+    time_t since;
+
+    if (value == NULL)
     {
-        return "text/plain";
+        return 1;
     }
-    else if (strcmp(extension, ".pdf") == 0)
+    if (value[0] == '"')
     {
-        return "application/pdf";
+        return strcmp(value, etag) == 0;
     }
-    else if (strcmp(extension, ".html") == 0)
+    if (value[0] == 'W' && value[1] == '/')
     {
-        return "text/html";
+        return 0; // Weak tags never match here
     }
-    else
+    return http_parse_date(value, &since) == 0 && since == last_modified;
+}
+
+// Appends flushed bytes to the collected body, moving it to a block twice as large when full
+static int collect_body(HTTP_Body_Writer *writer, const char *data, size_t length)
+{
+    char *body;
+    size_t capacity;
+
+    if (writer->body_length + length + 1 > writer->body_capacity)
     {
-        return "application/octet-stream"; // Default for unknown types
+        capacity = writer->body_capacity > 0 ? writer->body_capacity : HTTP_BODY_WRITER_SIZE;
+        while (capacity < writer->body_length + length + 1)
+        {
+            capacity *= 2;
+        }
+        body = (char *)allocate(writer->arena, capacity);
+        if (body == NULL)
+        {
+            return -1;
+        }
+        if (writer->body_length > 0)
+        {
+            memcpy(body, writer->body, writer->body_length);
+        }
+        writer->body = body;
+        writer->body_capacity = capacity;
     }
-}
\ No newline at end of file
+    memcpy(writer->body + writer->body_length, data, length);
+    writer->body_length += length;
+    writer->body[writer->body_length] = '\0';
+    return 0;
+}
+
+// From the arena when there is one, otherwise from malloc
+static void *allocate(Arena *arena, size_t size)
+{
+    void *memory;
+
+    memory = arena != NULL ? arena_alloc(arena, size) : malloc(size);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+    }
+    return memory;
+}
+
+static char *copy_string(Arena *arena, const char *source)
+{
+    char *copy;
+    size_t length;
+
+    length = strlen(source) + 1; // +1 for the null terminator
+    copy = (char *)allocate(arena, length);
+    if (copy != NULL)
+    {
+        memcpy(copy, source, length);
+    }
+    return copy;
+}
+
+static void write_two_digits(char *buffer, int value)
+{
+    buffer[0] = digit_pairs[value * 2];
+    buffer[1] = digit_pairs[value * 2 + 1];
+}
+
+// Value of count decimal digits, -1 if any of them is not one
+static int read_digits(const char *buffer, int count)
+{
+    int i, value;
+
+    value = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (buffer[i] < '0' || buffer[i] > '9')
+        {
+            return -1;
+        }
+        value = value * 10 + (buffer[i] - '0');
+    }
+    return value;
+}
+
+// Lowercase hexadecimal without leading zeros, not terminated, returns its length
+static int write_hex(char *buffer, uint64_t value)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    int length, shift;
+
+    length = 0;
+    for (shift = 60; shift > 0 && (value >> shift) == 0; shift -= 4)
+    {
+    }
+    for (; shift >= 0; shift -= 4)
+    {
+        buffer[length++] = hex_digits[(value >> shift) & 0xf];
+    }
+    return length;
+}
+
+// Decimal position of a range, 1 if there was one, 0 if none, -1 if it overflows
+static int read_position(const char **ptr, uint64_t *value)
+{
+    const char *p;
+
+    *value = 0;
+    for (p = *ptr; *p >= '0' && *p <= '9'; p++)
+    {
+        if (*value > (UINT64_MAX - (uint64_t)(*p - '0')) / 10)
+        {
+            return -1;
+        }
+        *value = *value * 10 + (uint64_t)(*p - '0');
+    }
+    if (p == *ptr)
+    {
+        return 0;
+    }
+    *ptr = p;
+    return 1;
+}
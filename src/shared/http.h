@@ -1,11 +1,48 @@
 #ifndef HTTP_H
 #define HTTP_H
 
-#define INITIAL_HEADER_COUNT 1
+// System headers
+#include <sys/types.h>
+
+// Shared headers
+#include "arena.h"
+#include "http_parser.h"
+
+#define HEADER_LIST_INLINE_COUNT 16    // Headers stored inside the list before it allocates
+#define HEADER_LIST_INLINE_STRINGS 512 // Bytes of keys and values stored inside the list before it allocates
 #define METHOD_SIZE 16
 #define URI_SIZE 256
 #define VERSION_SIZE 16
 #define REASON_PHRASE_SIZE 256
+#define HTTP_BODY_WRITER_SIZE 4096 // Bytes of a streamed body buffered before they go out as one chunk
+#define HTTP_CHUNK_PREFIX_SIZE 18  // Enough for a 64 bit size in hexadecimal + CRLF
+#define HTTP_BUFFER_POOL_MIN_SIZE 1024          // Smallest pooled block
+#define HTTP_BUFFER_POOL_CLASSES 7              // Pooled block sizes, doubling from HTTP_BUFFER_POOL_MIN_SIZE up to 64 KB
+#define HTTP_BUFFER_POOL_MAX_FREE 64            // Free blocks kept per size, the rest go back to the system
+#define HTTP_DEFAULT_MAX_HEADER_SIZE 32768      // Request line and headers of one request
+#define HTTP_DEFAULT_MAX_BODY_SIZE (16 << 20)   // Body of one request
+#define HTTP_UINT_STR_LEN 21                    // Enough to hold any 64 bit unsigned integer + '\0'
+#define HTTP_DATE_SIZE 30                       // "Sun, 06 Nov 1994 08:49:37 GMT" + '\0'
+#define HTTP_ETAG_SIZE 56                       // Quotes, three 64 bit values in hexadecimal, two dashes + '\0'
+#define HTTP_RANGE_MAX 16                       // Ranges served from one Range header, more and the whole file is sent
+#define HTTP_DATE_SLOTS 4                       // Date values kept, a slot is rewritten this many seconds after it was published
+
+// Results of http_parse_range
+#define HTTP_RANGE_NONE 0           // No usable Range, the whole representation is sent
+#define HTTP_RANGE_UNSATISFIABLE -1 // Valid, but none of its ranges overlaps the representation: 416
+
+// Status lines pre-rendered by http_status_line
+#define HTTP_STATUS_LINE_VERSION "HTTP/1.1"
+#define HTTP_200_PHRASE "OK"
+#define HTTP_206_PHRASE "Partial Content"
+#define HTTP_304_PHRASE "Not Modified"
+#define HTTP_400_PHRASE "Bad Request"
+#define HTTP_404_PHRASE "Not Found"
+#define HTTP_405_PHRASE "Method Not Allowed"
+#define HTTP_413_PHRASE "Content Too Large"
+#define HTTP_416_PHRASE "Range Not Satisfiable"
+#define HTTP_431_PHRASE "Request Header Fields Too Large"
+#define HTTP_503_PHRASE "Service Unavailable"
 
 typedef struct
 {
@@ -13,6 +50,27 @@ typedef struct
     char *value;
 } Header;
 
+/* Header_List:
+ * Up to HEADER_LIST_INLINE_COUNT headers and HEADER_LIST_INLINE_STRINGS bytes of
+ * keys and values live inside the list itself, past that each part moves to
+ * the heap and doubles when full. add_header copies keys and values one after
+ * the other into a single string block instead of allocating each of them.
+ * items and strings may point inside the list, so it must not be copied once
+ * initialized.
+ */
+typedef struct
+{
+    Header *items; // inline_items or a heap array
+    int count;
+    int capacity;
+    char *strings; // inline_strings or a heap block, "key\0value\0" per header added with add_header
+    int strings_length;
+    int strings_capacity;
+    int16_t known[HTTP_HEADER_KNOWN_COUNT]; // Index in items of each known header, -1 if absent
+    Header inline_items[HEADER_LIST_INLINE_COUNT];
+    char inline_strings[HEADER_LIST_INLINE_STRINGS];
+} Header_List;
+
 typedef struct
 {
     char *method;  // HTTP method (GET, POST, etc.)
@@ -23,54 +81,160 @@ typedef struct
 typedef struct
 {
     Request_Line request_line; // Request line containing method, URI, and version
-    Header *headers;           // Array of headers
-    int header_count;          // Number of headers
+    Header_List headers;       // Headers in the order they were received or added
     char *body;                // Request or response body
     int body_length;           // Length of the body
+    char *raw;                 // Received bytes the request line and headers point into, NULL if they own their memory
+    Arena *arena;              // Holds the request and its body when set, they go away with its next reset
 } HTTP_Request;
 
+/* HTTP_Buffer_Block:
+ * Sits in front of every block handed out by http_buffer_alloc. Blocks of a
+ * pooled size go back to a free list when released, so connections keep reusing
+ * the same few blocks for their requests instead of allocating new ones.
+ */
+typedef struct HTTP_Buffer_Block
+{
+    struct HTTP_Buffer_Block *next; // Next free block of the same size, only used while pooled
+    size_t capacity;                // Usable bytes right after this header
+    int size_class;                 // Free list the block returns to, -1 if it is too large to pool
+} HTTP_Buffer_Block;
+
+/* HTTP_Receive_Buffer:
+ * Bytes received on a connection that no request has taken yet. A pipelining
+ * client sends several requests without waiting for the responses, so one recv
+ * can hold more than one of them and whatever follows the current request stays
+ * here for the next call. The parser keeps its progress between recvs.
+ *
+ * data is a pooled block that doubles while the headers of a large request keep
+ * arriving, up to max_header_size. The parser slices are offsets into it, so it
+ * stays one contiguous block however many recvs the request takes.
+ */
+typedef struct
+{
+    char *data;         // NULL until the first recv and after the last request took it over
+    int start;          // First byte not taken by a request
+    int length;         // Bytes received, data[start, length) are pending
+    int capacity;
+    int max_header_size;       // Larger request lines and headers fail with HTTP_PARSE_HEADERS_TOO_LARGE
+    int max_body_size;         // Larger bodies fail with HTTP_PARSE_BODY_TOO_LARGE
+    HTTP_Parser parser;        // Progress on the request that begins at start
+    HTTP_Chunk_Decoder chunks; // Progress on its body when it is chunked
+} HTTP_Receive_Buffer;
+
+/* HTTP_Body_Writer:
+ * Sends a body as it is generated, holding at most HTTP_BODY_WRITER_SIZE bytes.
+ * With chunked set every flush goes out as one chunk, otherwise the bytes go
+ * out as they are and the body ends when the connection closes. Without a
+ * socket every flush is appended to body instead, for protocols that frame
+ * the body themselves.
+ */
+typedef struct
+{
+    int sockfd; // -1 when collecting into body
+    int chunked;
+    size_t length; // Bytes waiting in data
+    char data[HTTP_CHUNK_PREFIX_SIZE + HTTP_BODY_WRITER_SIZE + 2]; // Room for the chunk size line before and CRLF after
+    Arena *arena;         // Holds body, every time it doubles
+    char *body;           // Flushed bytes when collecting
+    size_t body_length;
+    size_t body_capacity;
+} HTTP_Body_Writer;
+
+// Generates a body through the writer, returns 0 or -1 to abort the response
+typedef int (*HTTP_Body_Stream)(HTTP_Body_Writer *writer, void *arg);
+
+// Inclusive byte positions, as Range and Content-Range write them
+typedef struct
+{
+    uint64_t first;
+    uint64_t last;
+} HTTP_Byte_Range;
+
+/* HTTP_Status_Line:
+ * A status line rendered at compile time, CRLF included, so responses with a
+ * common status neither copy its parts nor format it again for every send.
+ */
+typedef struct
+{
+    int status_code;
+    const char *version;
+    const char *reason_phrase;
+    const char *line;
+    size_t length;
+} HTTP_Status_Line;
+
 typedef struct
 {
     char *version;       // HTTP version (e.g., HTTP/1.1)
     int status_code;     // Status code (e.g., 200, 404)
     char *reason_phrase; // Reason phrase (e.g., OK, Not Found)
+    const HTTP_Status_Line *rendered; // Pre-rendered line, version and reason_phrase point into it, NULL if they are owned copies
 } Response_Line;
 
 typedef struct
 {
     Response_Line response_line; // Response line containing version, status code, and reason phrase
-    Header *headers;             // Array of headers
-    int header_count;            // Number of headers
+    Header_List headers;         // Headers in the order they were added or received
+    const char *rendered_headers; // Header lines already in wire format, sent after headers, not owned
+    size_t rendered_headers_length;
     char *body;                  // Response body
     int body_length;             // Length of the body
+    HTTP_Body_Stream stream;     // Generates the body while it is sent instead of body, NULL if not streamed
+    void *stream_arg;
+    Arena *arena;                // Holds the response, its strings, body and serialized head when set, they go away with its next reset
 } HTTP_Response;
 
-Header *create_headers(int initial_count);
-void free_headers(Header **headers, int header_count);
-void free_header(Header *header);
-int add_header(Header **headers, int *header_index, int *header_count, const char *key, const char *value);
-int remove_header(Header **headers, int *header_index, int *header_count, const char *key);
-int serialize_headers(Header *headers, int header_count, char **buffer);
-Header *deserialize_headers(const char *headers_str, int *header_count);
-const char *find_header_value(Header *headers, int header_count, const char *key);
-void log_headers(Header *headers, int header_count);
-
-HTTP_Request *create_http_request(const char *method, const char *uri, const char *version, Header *headers, int header_count, const char *body);
+void init_header_list(Header_List *headers);
+void free_header_list(Header_List *headers);
+int add_header(Header_List *headers, const char *key, const char *value);
+int remove_header(Header_List *headers, const char *key);
+int serialize_headers(const Header_List *headers, char **buffer);
+int deserialize_headers(const char *headers_str, Header_List *headers);
+const char *find_header_value(const Header_List *headers, const char *key);
+const char *find_known_header_value(const Header_List *headers, HTTP_Known_Header header);
+int header_has_token(const char *value, const char *token);
+void log_headers(const Header_List *headers);
+
+HTTP_Request *create_http_request(const char *method, const char *uri, const char *version, const char *body);
 void free_http_request(HTTP_Request **request);
 int serialize_http_request_header(HTTP_Request *request, char **buffer);
 HTTP_Request *deserialize_http_request_header(const char *buffer);
+HTTP_Request *create_http_request_in_place(char *raw, const HTTP_Parser *parser, Arena *arena);
 int send_http_request(int sockfd, HTTP_Request *request);
 HTTP_Request *receive_http_request(int sockfd);
+HTTP_Receive_Buffer *create_http_receive_buffer(int max_header_size, int max_body_size);
+void free_http_receive_buffer(HTTP_Receive_Buffer **buffer);
+ssize_t fill_http_receive_buffer(int sockfd, HTTP_Receive_Buffer *buffer);
+int next_http_request(HTTP_Receive_Buffer *buffer, HTTP_Request **request, Arena *arena);
 
-HTTP_Response *create_http_response(const char *version, const int status_code, const char *reason_phrase, Header *headers, int header_count, const char *body);
+HTTP_Response *create_http_response(const char *version, const int status_code, const char *reason_phrase, const char *body);
+HTTP_Response *create_http_response_in_arena(Arena *arena, const char *version, const int status_code, const char *reason_phrase, const char *body);
 void free_http_response(HTTP_Response **response);
-int serialize_http_response(HTTP_Response *response, char **buffer);
+int serialize_http_response_header(HTTP_Response *response, char **buffer);
 HTTP_Response *deserialize_http_response_header(const char *buffer);
 int send_http_response(int sockfd, HTTP_Response *response);
+void http_body_writer_init(HTTP_Body_Writer *writer, int sockfd, int chunked);
+void http_body_writer_init_buffer(HTTP_Body_Writer *writer, Arena *arena);
+int http_body_write(HTTP_Body_Writer *writer, const char *data, size_t length);
+int http_body_flush(HTTP_Body_Writer *writer);
+int http_body_finish(HTTP_Body_Writer *writer);
 HTTP_Response *receive_http_response(int sockfd);
+const HTTP_Status_Line *http_status_line(const char *version, int status_code, const char *reason_phrase);
+int http_format_uint(char *buffer, uint64_t value);
+void http_date_update(void);
+const char *http_date(void);
+int http_format_date(char *buffer, time_t seconds);
+int http_parse_date(const char *value, time_t *seconds);
+int http_format_etag(char *buffer, uint64_t inode, uint64_t size, uint64_t mtime_ns);
+int http_etag_matches(const char *list, const char *etag);
+int http_not_modified(const Header_List *headers, const char *etag, time_t last_modified);
+int http_parse_range(const char *value, uint64_t size, HTTP_Byte_Range *ranges, int max_ranges);
+int http_if_range_matches(const char *value, const char *etag, time_t last_modified);
 
+char *http_buffer_alloc(size_t size, size_t *capacity);
+void http_buffer_release(char *data);
+void http_buffer_pool_clear(void);
 int read_until_double_end_line(int sockfd, char **buffer_ptr, int length, int *extra_data_length);
-const char *get_extension(const char *content_type);
-const char *get_content_type(const char *extension);
 
 #endif // HTTP_H
\ No newline at end of file
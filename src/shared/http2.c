@@ -0,0 +1,722 @@
+/**
+ * @file http2.c
+ * @brief HTTP/2 framing over cleartext connections (h2c)
+ *
+ * Frames, settings and the conversion between header blocks and the
+ * HTTP_Request and HTTP_Response the rest of the server works with. A client
+ * gets here by sending the connection preface right away (prior knowledge) or
+ * by asking an HTTP/1.1 request to be upgraded with "Upgrade: h2c". Which
+ * stream goes out when is up to the server.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Networking headers
+#include <sys/socket.h>
+
+// Other project headers
+#include "arena.h"
+#include "common.h"
+#include "http.h"
+#include "http_hpack.h"
+
+// Project header
+#include "http2.h"
+
+// Progress of http2_decode_request through the fields of a header block
+typedef struct
+{
+    HTTP_Request *request;
+    Arena *arena;
+    const char *authority;
+    const char *scheme;
+    size_t list_size;     // Decoded size as SETTINGS_MAX_HEADER_LIST_SIZE counts it
+    size_t max_list_size;
+    int regular_seen; // Pseudo-headers must all come before the first regular field
+    int malformed;
+    int too_large;
+    int failed; // Out of memory
+} Request_Fields;
+
+// Static since it is only used inside this file
+static void add_request_field(void *arg, const char *name, size_t name_length, const char *value, size_t value_length);
+static size_t encode_response_field(HTTP_Hpack_Table *table, unsigned char *out, const char *name, size_t name_length, const char *value, size_t value_length);
+static int is_connection_specific(const char *name, size_t length);
+static int is_volatile(const char *name, size_t length);
+static int set_pseudo_header(Request_Fields *fields, const char **target, const char *value);
+static int decode_base64url(const char *value, unsigned char *out, size_t *length);
+static int reserve_buffer(HTTP2_Buffer *buffer, size_t length);
+static void write_uint32(unsigned char *data, uint32_t value);
+
+/* create_http2_connection:
+ * State for a connection that just switched to HTTP/2, with our SETTINGS,
+ * the server preface, already queued. After an upgrade the 101 response goes
+ * before it. Both HPACK tables start at their default size.
+ */
+HTTP2_Connection *create_http2_connection(uint32_t max_concurrent_streams, uint32_t max_header_list_size, int upgraded)
+{
+    unsigned char settings[2 * HTTP2_SETTINGS_SIZE];
+    HTTP2_Connection *connection;
+
+    connection = (HTTP2_Connection *)malloc(sizeof(HTTP2_Connection));
+    if (connection == NULL)
+    {
+        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+        return NULL;
+    }
+    memset(connection, 0, sizeof(HTTP2_Connection));
+
+    // Defaults of RFC 9113 until a SETTINGS frame says otherwise
+    connection->peer.header_table_size = HTTP_HPACK_TABLE_SIZE;
+    connection->peer.enable_push = 1;
+    connection->peer.max_concurrent_streams = UINT32_MAX;
+    connection->peer.initial_window_size = HTTP2_DEFAULT_WINDOW;
+    connection->peer.max_frame_size = HTTP2_DEFAULT_FRAME_SIZE;
+    connection->peer.max_header_list_size = UINT32_MAX;
+    connection->local = connection->peer;
+    connection->local.enable_push = 0;
+    connection->local.max_concurrent_streams = max_concurrent_streams;
+    connection->local.max_header_list_size = max_header_list_size;
+    http_hpack_table_init(&connection->decoder, HTTP_HPACK_TABLE_SIZE);
+    http_hpack_table_init(&connection->encoder, HTTP_HPACK_TABLE_SIZE);
+    connection->send_window = HTTP2_DEFAULT_WINDOW;
+
+    if (upgraded)
+    {
+        if (reserve_buffer(&connection->output, sizeof(HTTP2_SWITCHING_PROTOCOLS) - 1) < 0)
+        {
+            free_http2_connection(&connection);
+            return NULL;
+        }
+        memcpy(connection->output.data, HTTP2_SWITCHING_PROTOCOLS, sizeof(HTTP2_SWITCHING_PROTOCOLS) - 1);
+        connection->output.length = sizeof(HTTP2_SWITCHING_PROTOCOLS) - 1;
+    }
+
+    // Only what differs from the defaults
+    settings[0] = 0;
+    settings[1] = HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_uint32(settings + 2, max_concurrent_streams);
+    settings[6] = 0;
+    settings[7] = HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    write_uint32(settings + 8, max_header_list_size);
+    if (http2_queue_frame(connection, HTTP2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) < 0)
+    {
+        free_http2_connection(&connection);
+        return NULL;
+    }
+    return connection;
+}
+
+void free_http2_connection(HTTP2_Connection **connection)
+{
+    if (connection != NULL && *connection != NULL)
+    {
+        http_hpack_table_clear(&(*connection)->decoder);
+        http_hpack_table_clear(&(*connection)->encoder);
+        free((*connection)->header_block.data);
+        free((*connection)->output.data);
+        free(*connection);
+        *connection = NULL;
+    }
+}
+
+/* http2_match_preface:
+ * Whether the first bytes of a connection are the HTTP/2 preface. The preface
+ * is also a valid HTTP/1.1 request line, so it has to be told apart before
+ * the HTTP/1.1 parser sees it.
+ */
+int http2_match_preface(const char *data, size_t length)
+{
+    if (memcmp(data, HTTP2_PREFACE, length < HTTP2_PREFACE_LENGTH ? length : HTTP2_PREFACE_LENGTH) != 0)
+    {
+        return HTTP2_PREFACE_NONE;
+    }
+    return length < HTTP2_PREFACE_LENGTH ? HTTP2_PREFACE_PARTIAL : HTTP2_PREFACE_FOUND;
+}
+
+/* http2_upgrade_requested:
+ * An HTTP/1.1 request asking to continue as h2c, with its HTTP2-Settings.
+ * Requests with a body are served as they are, the body would have to be
+ * read before the switch.
+ */
+int http2_upgrade_requested(const HTTP_Request *request)
+{
+    const char *connection;
+
+    connection = find_known_header_value(&request->headers, HTTP_HEADER_CONNECTION);
+    return strcmp(request->request_line.version, "HTTP/1.1") == 0 &&
+           request->body_length == 0 &&
+           header_has_token(find_known_header_value(&request->headers, HTTP_HEADER_UPGRADE), "h2c") &&
+           header_has_token(connection, "upgrade") &&
+           header_has_token(connection, "http2-settings") &&
+           find_known_header_value(&request->headers, HTTP_HEADER_HTTP2_SETTINGS) != NULL;
+}
+
+void http2_read_frame_header(const unsigned char *data, HTTP2_Frame_Header *header)
+{
+    header->length = ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+    header->type = data[3];
+    header->flags = data[4];
+    // The reserved bit is ignored
+    header->stream_id = (((uint32_t)data[5] & 0x7f) << 24) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 8) | data[8];
+}
+
+void http2_write_frame_header(unsigned char *data, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    data[0] = (unsigned char)(length >> 16);
+    data[1] = (unsigned char)(length >> 8);
+    data[2] = (unsigned char)length;
+    data[3] = type;
+    data[4] = flags;
+    write_uint32(data + 5, stream_id & 0x7fffffff);
+}
+
+/* http2_apply_settings:
+ * Takes the payload of a SETTINGS frame from the client. window_delta gets
+ * how much SETTINGS_INITIAL_WINDOW_SIZE changed, every open stream window
+ * moves by it. Returns HTTP2_NO_ERROR or the error code of the connection
+ * error the frame causes.
+ */
+int http2_apply_settings(HTTP2_Connection *connection, const unsigned char *payload, size_t length, int64_t *window_delta)
+{
+    size_t i;
+    uint16_t identifier;
+    uint32_t value, initial_window_size;
+
+    if (length % HTTP2_SETTINGS_SIZE != 0)
+    {
+        return HTTP2_FRAME_SIZE_ERROR;
+    }
+
+    initial_window_size = connection->peer.initial_window_size;
+    for (i = 0; i < length; i += HTTP2_SETTINGS_SIZE)
+    {
+        identifier = (uint16_t)((payload[i] << 8) | payload[i + 1]);
+        value = ((uint32_t)payload[i + 2] << 24) | ((uint32_t)payload[i + 3] << 16) | ((uint32_t)payload[i + 4] << 8) | payload[i + 5];
+        switch (identifier)
+        {
+        case HTTP2_SETTINGS_HEADER_TABLE_SIZE:
+            connection->peer.header_table_size = value;
+            http_hpack_table_limit(&connection->encoder, value);
+            break;
+        case HTTP2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+            {
+                return HTTP2_PROTOCOL_ERROR;
+            }
+            connection->peer.enable_push = value;
+            break;
+        case HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS:
+            connection->peer.max_concurrent_streams = value;
+            break;
+        case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > HTTP2_MAX_WINDOW)
+            {
+                return HTTP2_FLOW_CONTROL_ERROR;
+            }
+            connection->peer.initial_window_size = value;
+            break;
+        case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < HTTP2_DEFAULT_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE)
+            {
+                return HTTP2_PROTOCOL_ERROR;
+            }
+            connection->peer.max_frame_size = value;
+            break;
+        case HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE:
+            connection->peer.max_header_list_size = value;
+            break;
+        default:
+            // Unknown settings must be ignored
+            break;
+        }
+    }
+    *window_delta = (int64_t)connection->peer.initial_window_size - (int64_t)initial_window_size;
+    return HTTP2_NO_ERROR;
+}
+
+/* http2_apply_settings_header:
+ * HTTP2-Settings of an upgrade request: the payload of a SETTINGS frame in
+ * base64url, applied as if the client had sent it first. Returns 0 or -1, and
+ * then the request is served without upgrading.
+ */
+int http2_apply_settings_header(HTTP2_Connection *connection, const char *value)
+{
+    int64_t window_delta;
+    size_t length;
+    unsigned char *payload;
+    int ret_val;
+
+    payload = (unsigned char *)malloc(strlen(value) * 3 / 4 + 1);
+    if (payload == NULL)
+    {
+        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    ret_val = -1;
+    if (decode_base64url(value, payload, &length) == 0 &&
+        http2_apply_settings(connection, payload, length, &window_delta) == HTTP2_NO_ERROR)
+    {
+        ret_val = 0;
+    }
+    free(payload);
+    return ret_val;
+}
+
+int http2_queue_frame(HTTP2_Connection *connection, uint8_t type, uint8_t flags, uint32_t stream_id, const void *payload, size_t length)
+{
+    if (reserve_buffer(&connection->output, HTTP2_FRAME_HEADER_SIZE + length) < 0)
+    {
+        return -1;
+    }
+    http2_write_frame_header((unsigned char *)connection->output.data + connection->output.length, (uint32_t)length, type, flags, stream_id);
+    if (length > 0)
+    {
+        memcpy(connection->output.data + connection->output.length + HTTP2_FRAME_HEADER_SIZE, payload, length);
+    }
+    connection->output.length += HTTP2_FRAME_HEADER_SIZE + length;
+    return 0;
+}
+
+int http2_queue_window_update(HTTP2_Connection *connection, uint32_t stream_id, uint32_t increment)
+{
+    unsigned char payload[4];
+
+    write_uint32(payload, increment);
+    return http2_queue_frame(connection, HTTP2_FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+int http2_queue_rst_stream(HTTP2_Connection *connection, uint32_t stream_id, uint32_t error_code)
+{
+    unsigned char payload[4];
+
+    write_uint32(payload, error_code);
+    return http2_queue_frame(connection, HTTP2_FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+// Closes the connection: streams after last_stream_id were never processed and can be retried
+int http2_queue_goaway(HTTP2_Connection *connection, uint32_t error_code)
+{
+    unsigned char payload[8];
+
+    write_uint32(payload, connection->last_stream_id);
+    write_uint32(payload + 4, error_code);
+    connection->goaway_sent = 1;
+    return http2_queue_frame(connection, HTTP2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/* http2_queue_headers:
+ * A header block as a HEADERS frame followed by as many CONTINUATION frames
+ * as the client frame size asks for. Nothing may go between them, so the
+ * whole block is queued at once.
+ */
+int http2_queue_headers(HTTP2_Connection *connection, uint32_t stream_id, const char *block, size_t length, int end_stream)
+{
+    size_t fragment_length, offset;
+    uint8_t flags, type;
+
+    offset = 0;
+    type = HTTP2_FRAME_HEADERS;
+    flags = end_stream ? HTTP2_FLAG_END_STREAM : 0;
+    do
+    {
+        fragment_length = length - offset;
+        if (fragment_length > connection->peer.max_frame_size)
+        {
+            fragment_length = connection->peer.max_frame_size;
+        }
+        if (offset + fragment_length == length)
+        {
+            flags |= HTTP2_FLAG_END_HEADERS;
+        }
+        if (http2_queue_frame(connection, type, flags, stream_id, block + offset, fragment_length) < 0)
+        {
+            return -1;
+        }
+        offset += fragment_length;
+        type = HTTP2_FRAME_CONTINUATION;
+        flags = 0;
+    } while (offset < length);
+    return 0;
+}
+
+/* http2_append_header_fragment:
+ * Collects the fragments of a header block. A block somewhat over
+ * SETTINGS_MAX_HEADER_LIST_SIZE is still kept, decoding it answers 431 and
+ * keeps the decoder table in step, one far over it is refused.
+ */
+int http2_append_header_fragment(HTTP2_Connection *connection, const unsigned char *fragment, size_t length)
+{
+    if (connection->header_block.length + length > (size_t)connection->local.max_header_list_size * HTTP2_HEADER_BLOCK_FACTOR ||
+        reserve_buffer(&connection->header_block, length) < 0)
+    {
+        return -1;
+    }
+    if (length > 0)
+    {
+        memcpy(connection->header_block.data + connection->header_block.length, fragment, length);
+        connection->header_block.length += length;
+    }
+    return 0;
+}
+
+/* http2_decode_request:
+ * Turns the header block collected with http2_append_header_fragment into a
+ * request allocated from arena, with the pseudo-headers as its request line.
+ * The block is decoded whole whatever the result, the HPACK table depends on
+ * it. Returns one of the HTTP2_DECODE_* results.
+ */
+int http2_decode_request(HTTP2_Connection *connection, Arena *arena, HTTP_Request **request)
+{
+    int ret_val;
+    Request_Fields fields;
+
+    *request = NULL;
+    memset(&fields, 0, sizeof(fields));
+    fields.arena = arena;
+    fields.max_list_size = connection->local.max_header_list_size;
+    fields.request = (HTTP_Request *)arena_alloc(arena, sizeof(HTTP_Request));
+    if (fields.request == NULL)
+    {
+        connection->header_block.length = 0;
+        return HTTP2_DECODE_ERROR;
+    }
+    memset(fields.request, 0, sizeof(HTTP_Request));
+    init_header_list(&fields.request->headers);
+    fields.request->arena = arena;
+
+    ret_val = http_hpack_decode(&connection->decoder, (const unsigned char *)connection->header_block.data, connection->header_block.length,
+                                arena, add_request_field, &fields);
+    connection->header_block.length = 0;
+    if (ret_val < 0 || fields.failed)
+    {
+        free_http_request(&fields.request);
+        return HTTP2_DECODE_ERROR;
+    }
+    if (fields.too_large)
+    {
+        free_http_request(&fields.request);
+        return HTTP2_DECODE_TOO_LARGE;
+    }
+    if (fields.malformed || fields.request->request_line.method == NULL || fields.request->request_line.uri == NULL || fields.scheme == NULL)
+    {
+        free_http_request(&fields.request);
+        return HTTP2_DECODE_MALFORMED;
+    }
+
+    fields.request->request_line.version = arena_strdup(arena, HTTP2_VERSION);
+    // :authority takes the place of Host, which the handlers may look for
+    if (fields.request->request_line.version == NULL ||
+        (fields.authority != NULL && find_known_header_value(&fields.request->headers, HTTP_HEADER_HOST) == NULL &&
+         add_header(&fields.request->headers, "host", fields.authority) < 0))
+    {
+        free_http_request(&fields.request);
+        return HTTP2_DECODE_ERROR;
+    }
+    *request = fields.request;
+    return HTTP2_DECODE_DONE;
+}
+
+/* http2_encode_response:
+ * Header block of a response: :status, the header list and the rendered
+ * header lines, without the fields HTTP/2 leaves to the framing, such as
+ * Connection and Transfer-Encoding. The block comes from the response arena
+ * like the HTTP/1.1 head does. Returns its length or -1.
+ */
+int http2_encode_response(HTTP2_Connection *connection, HTTP_Response *response, char **block)
+{
+    char status[HTTP_UINT_STR_LEN];
+    const char *line, *end, *colon, *value;
+    int i;
+    size_t bound, length, key_length, value_length;
+    unsigned char *out;
+
+    bound = HTTP_HPACK_SIZE_UPDATE_BOUND + http_hpack_field_bound(sizeof(":status") - 1, HTTP_UINT_STR_LEN);
+    for (i = 0; i < response->headers.count; i++)
+    {
+        bound += http_hpack_field_bound(strlen(response->headers.items[i].key), strlen(response->headers.items[i].value));
+    }
+    // Every rendered line is at least the 4 bytes of ": " and CRLF
+    bound += http_hpack_field_bound(0, 0) * (response->rendered_headers_length / 4) + response->rendered_headers_length;
+    out = (unsigned char *)arena_alloc(response->arena, bound);
+    if (out == NULL)
+    {
+        return -1;
+    }
+
+    length = http_hpack_encode_size_update(&connection->encoder, out);
+    http_format_uint(status, (uint64_t)response->response_line.status_code);
+    length += http_hpack_encode_field(&connection->encoder, out + length, ":status", sizeof(":status") - 1, status, strlen(status), 1);
+    for (i = 0; i < response->headers.count; i++)
+    {
+        key_length = strlen(response->headers.items[i].key);
+        length += encode_response_field(&connection->encoder, out + length, response->headers.items[i].key, key_length,
+                                        response->headers.items[i].value, strlen(response->headers.items[i].value));
+    }
+
+    // "Name: value\r\n" lines, as the handlers rendered them for HTTP/1.1
+    line = response->rendered_headers;
+    end = line + response->rendered_headers_length;
+    while (line < end)
+    {
+        colon = memchr(line, ':', end - line);
+        if (colon == NULL)
+        {
+            break;
+        }
+        value = colon + 1;
+        while (value < end && (*value == ' ' || *value == '\t'))
+        {
+            value++;
+        }
+        value_length = 0;
+        while (value + value_length < end && value[value_length] != '\r')
+        {
+            value_length++;
+        }
+        length += encode_response_field(&connection->encoder, out + length, line, colon - line, value, value_length);
+        line = value + value_length + 2;
+    }
+
+    *block = (char *)out;
+    return (int)length;
+}
+
+// Sends the queued frames, in one send whenever the socket takes them
+int http2_send_output(int sockfd, HTTP2_Connection *connection)
+{
+    if (connection->output.length == 0)
+    {
+        return 0;
+    }
+    if (sendall_with_flags(sockfd, connection->output.data, connection->output.length, MSG_NOSIGNAL) < 0)
+    {
+        perror("send frames");
+        return -1;
+    }
+    connection->output.length = 0;
+    return 0;
+}
+
+// HTTP_Hpack_Field_Handler of http2_decode_request
+static void add_request_field(void *arg, const char *name, size_t name_length, const char *value, size_t value_length)
+{
+    size_t i;
+    Request_Fields *fields;
+
+    fields = (Request_Fields *)arg;
+    if (fields->malformed || fields->too_large || fields->failed)
+    {
+        // Refused already, the rest of the block is only decoded for the table
+        return;
+    }
+    fields->list_size += name_length + value_length + HTTP_HPACK_ENTRY_OVERHEAD;
+    if (fields->list_size > fields->max_list_size)
+    {
+        fields->too_large = 1;
+        return;
+    }
+
+    // Names are lowercase in HTTP/2, and neither part may hide a line break or a null byte
+    if (name_length == 0 || memchr(name, '\0', name_length) != NULL || memchr(value, '\0', value_length) != NULL ||
+        memchr(value, '\r', value_length) != NULL || memchr(value, '\n', value_length) != NULL)
+    {
+        fields->malformed = 1;
+        return;
+    }
+    for (i = 0; i < name_length; i++)
+    {
+        if (name[i] >= 'A' && name[i] <= 'Z')
+        {
+            fields->malformed = 1;
+            return;
+        }
+    }
+
+    if (name[0] == ':')
+    {
+        if (fields->regular_seen)
+        {
+            fields->malformed = 1;
+        }
+        else if (strcmp(name, ":method") == 0)
+        {
+            fields->malformed = set_pseudo_header(fields, (const char **)&fields->request->request_line.method, value);
+        }
+        else if (strcmp(name, ":path") == 0)
+        {
+            fields->malformed = value_length == 0 || set_pseudo_header(fields, (const char **)&fields->request->request_line.uri, value);
+        }
+        else if (strcmp(name, ":scheme") == 0)
+        {
+            fields->malformed = set_pseudo_header(fields, &fields->scheme, value);
+        }
+        else if (strcmp(name, ":authority") == 0)
+        {
+            fields->malformed = set_pseudo_header(fields, &fields->authority, value);
+        }
+        else
+        {
+            fields->malformed = 1;
+        }
+        return;
+    }
+
+    fields->regular_seen = 1;
+    if (is_connection_specific(name, name_length) || (strcmp(name, "te") == 0 && strcmp(value, "trailers") != 0))
+    {
+        fields->malformed = 1;
+        return;
+    }
+    if (add_header(&fields->request->headers, name, value) < 0)
+    {
+        fields->failed = 1;
+    }
+}
+
+// Copies a pseudo-header into the arena, returns 1 when it was already set
+static int set_pseudo_header(Request_Fields *fields, const char **target, const char *value)
+{
+    char *copy;
+
+    if (*target != NULL)
+    {
+        return 1;
+    }
+    copy = arena_strdup(fields->arena, value);
+    if (copy == NULL)
+    {
+        fields->failed = 1;
+        return 0;
+    }
+    *target = copy;
+    return 0;
+}
+
+// Fields that change with every response are not worth a table entry
+static size_t encode_response_field(HTTP_Hpack_Table *table, unsigned char *out, const char *name, size_t name_length, const char *value, size_t value_length)
+{
+    if (is_connection_specific(name, name_length))
+    {
+        return 0;
+    }
+    return http_hpack_encode_field(table, out, name, name_length, value, value_length, !is_volatile(name, name_length));
+}
+
+static int is_connection_specific(const char *name, size_t length)
+{
+    static const char *names[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"};
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strlen(names[i]) == length && strncasecmp(names[i], name, length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_volatile(const char *name, size_t length)
+{
+    static const char *names[] = {"date", "content-length", "content-range", "etag", "last-modified"};
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strlen(names[i]) == length && strncasecmp(names[i], name, length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// base64url without padding, as HTTP2-Settings carries it. Plain base64 and padding are tolerated
+static int decode_base64url(const char *value, unsigned char *out, size_t *length)
+{
+    int digit, bit_count;
+    uint32_t bits;
+    size_t written;
+
+    bits = 0;
+    bit_count = 0;
+    written = 0;
+    for (; *value != '\0' && *value != '='; value++)
+    {
+        if (*value >= 'A' && *value <= 'Z')
+        {
+            digit = *value - 'A';
+        }
+        else if (*value >= 'a' && *value <= 'z')
+        {
+            digit = *value - 'a' + 26;
+        }
+        else if (*value >= '0' && *value <= '9')
+        {
+            digit = *value - '0' + 52;
+        }
+        else if (*value == '-' || *value == '+')
+        {
+            digit = 62;
+        }
+        else if (*value == '_' || *value == '/')
+        {
+            digit = 63;
+        }
+        else
+        {
+            return -1;
+        }
+        bits = (bits << 6) | (uint32_t)digit;
+        bit_count += 6;
+        if (bit_count >= 8)
+        {
+            bit_count -= 8;
+            out[written++] = (unsigned char)(bits >> bit_count);
+        }
+    }
+    *length = written;
+    return 0;
+}
+
+// Room for length more bytes, doubling from HTTP2_BUFFER_MIN_SIZE
+static int reserve_buffer(HTTP2_Buffer *buffer, size_t length)
+{
+    char *data;
+    size_t capacity;
+
+    if (buffer->length + length <= buffer->capacity)
+    {
+        return 0;
+    }
+    capacity = buffer->capacity > 0 ? buffer->capacity : HTTP2_BUFFER_MIN_SIZE;
+    while (capacity < buffer->length + length)
+    {
+        capacity *= 2;
+    }
+    data = (char *)realloc(buffer->data, capacity);
+    if (data == NULL)
+    {
+        fprintf(stderr, "error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static void write_uint32(unsigned char *data, uint32_t value)
+{
+    data[0] = (unsigned char)(value >> 24);
+    data[1] = (unsigned char)(value >> 16);
+    data[2] = (unsigned char)(value >> 8);
+    data[3] = (unsigned char)value;
+}
@@ -0,0 +1,143 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared headers
+#include "arena.h"
+#include "http.h"
+#include "http_hpack.h"
+
+// Constants
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" // First bytes of the client, with prior knowledge or after the upgrade
+#define HTTP2_PREFACE_LENGTH (sizeof(HTTP2_PREFACE) - 1)
+#define HTTP2_SWITCHING_PROTOCOLS "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+#define HTTP2_VERSION "HTTP/2.0"      // Version of the requests of an HTTP/2 connection
+#define HTTP2_FRAME_HEADER_SIZE 9
+#define HTTP2_DEFAULT_FRAME_SIZE 16384 // Largest frame payload until SETTINGS_MAX_FRAME_SIZE says otherwise, also ours
+#define HTTP2_MAX_FRAME_SIZE 16777215
+#define HTTP2_DEFAULT_WINDOW 65535     // Flow control window of the connection and of every new stream
+#define HTTP2_MAX_WINDOW 2147483647
+#define HTTP2_SETTINGS_SIZE 6          // Identifier and value of one setting
+#define HTTP2_BUFFER_MIN_SIZE 1024     // First allocation of an output or header block buffer
+#define HTTP2_HEADER_BLOCK_FACTOR 2    // Header blocks up to this many times SETTINGS_MAX_HEADER_LIST_SIZE are decoded, and answered with 431
+
+// Results of http2_match_preface
+#define HTTP2_PREFACE_FOUND 1
+#define HTTP2_PREFACE_PARTIAL 0 // Too few bytes to tell yet
+#define HTTP2_PREFACE_NONE -1
+
+// Results of http2_decode_request
+#define HTTP2_DECODE_DONE 0
+#define HTTP2_DECODE_MALFORMED 1 // The block decoded, the request in it is not valid: reset the stream
+#define HTTP2_DECODE_TOO_LARGE 2 // Over the header list size, answered with 431
+#define HTTP2_DECODE_ERROR -1    // Not valid HPACK, the connection cannot go on
+
+// Frame types
+#define HTTP2_FRAME_DATA 0x0
+#define HTTP2_FRAME_HEADERS 0x1
+#define HTTP2_FRAME_PRIORITY 0x2
+#define HTTP2_FRAME_RST_STREAM 0x3
+#define HTTP2_FRAME_SETTINGS 0x4
+#define HTTP2_FRAME_PUSH_PROMISE 0x5
+#define HTTP2_FRAME_PING 0x6
+#define HTTP2_FRAME_GOAWAY 0x7
+#define HTTP2_FRAME_WINDOW_UPDATE 0x8
+#define HTTP2_FRAME_CONTINUATION 0x9
+
+// Frame flags
+#define HTTP2_FLAG_END_STREAM 0x1
+#define HTTP2_FLAG_ACK 0x1
+#define HTTP2_FLAG_END_HEADERS 0x4
+#define HTTP2_FLAG_PADDED 0x8
+#define HTTP2_FLAG_PRIORITY 0x20
+
+// Error codes
+#define HTTP2_NO_ERROR 0x0
+#define HTTP2_PROTOCOL_ERROR 0x1
+#define HTTP2_INTERNAL_ERROR 0x2
+#define HTTP2_FLOW_CONTROL_ERROR 0x3
+#define HTTP2_STREAM_CLOSED 0x5
+#define HTTP2_FRAME_SIZE_ERROR 0x6
+#define HTTP2_REFUSED_STREAM 0x7
+#define HTTP2_CANCEL 0x8
+#define HTTP2_COMPRESSION_ERROR 0x9
+#define HTTP2_ENHANCE_YOUR_CALM 0xb
+
+// Setting identifiers
+#define HTTP2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define HTTP2_SETTINGS_ENABLE_PUSH 0x2
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define HTTP2_SETTINGS_MAX_FRAME_SIZE 0x5
+#define HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE 0x6
+
+typedef struct
+{
+    uint32_t length; // Payload bytes after the 9 of the header
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+} HTTP2_Frame_Header;
+
+typedef struct
+{
+    uint32_t header_table_size;
+    uint32_t enable_push;
+    uint32_t max_concurrent_streams;
+    uint32_t initial_window_size;
+    uint32_t max_frame_size;
+    uint32_t max_header_list_size;
+} HTTP2_Settings;
+
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} HTTP2_Buffer;
+
+/* HTTP2_Connection:
+ * State of an HTTP/2 connection that is not tied to one stream: the settings
+ * of each side, the HPACK tables of each direction, the connection flow
+ * control window and the frames waiting to go out. Streams themselves are
+ * up to the server, which keeps them with their requests.
+ */
+typedef struct
+{
+    HTTP2_Settings local; // Ours, as sent in our SETTINGS
+    HTTP2_Settings peer;  // The client's, defaults until its SETTINGS arrive
+    HTTP_Hpack_Table decoder; // Fields the client indexed
+    HTTP_Hpack_Table encoder; // Fields we indexed
+    int64_t send_window;      // Bytes of DATA the client takes on the whole connection
+    uint32_t last_stream_id;  // Highest stream the client opened
+    uint32_t header_stream;   // Stream whose header block continues in CONTINUATION frames, 0 if none
+    int header_end_stream;    // Whether the HEADERS frame of that block ended the stream
+    HTTP2_Buffer header_block; // Fragments of that block
+    HTTP2_Buffer output;       // Frames waiting to be sent, in order
+    int preface_received;
+    int goaway_sent;     // The connection is closing, no new streams
+    int goaway_received; // The client is closing it, finish the open streams
+} HTTP2_Connection;
+
+HTTP2_Connection *create_http2_connection(uint32_t max_concurrent_streams, uint32_t max_header_list_size, int upgraded);
+void free_http2_connection(HTTP2_Connection **connection);
+int http2_match_preface(const char *data, size_t length);
+int http2_upgrade_requested(const HTTP_Request *request);
+void http2_read_frame_header(const unsigned char *data, HTTP2_Frame_Header *header);
+void http2_write_frame_header(unsigned char *data, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id);
+int http2_apply_settings(HTTP2_Connection *connection, const unsigned char *payload, size_t length, int64_t *window_delta);
+int http2_apply_settings_header(HTTP2_Connection *connection, const char *value);
+int http2_queue_frame(HTTP2_Connection *connection, uint8_t type, uint8_t flags, uint32_t stream_id, const void *payload, size_t length);
+int http2_queue_window_update(HTTP2_Connection *connection, uint32_t stream_id, uint32_t increment);
+int http2_queue_rst_stream(HTTP2_Connection *connection, uint32_t stream_id, uint32_t error_code);
+int http2_queue_goaway(HTTP2_Connection *connection, uint32_t error_code);
+int http2_queue_headers(HTTP2_Connection *connection, uint32_t stream_id, const char *block, size_t length, int end_stream);
+int http2_append_header_fragment(HTTP2_Connection *connection, const unsigned char *fragment, size_t length);
+int http2_decode_request(HTTP2_Connection *connection, Arena *arena, HTTP_Request **request);
+int http2_encode_response(HTTP2_Connection *connection, HTTP_Response *response, char **block);
+int http2_send_output(int sockfd, HTTP2_Connection *connection);
+
+#endif // HTTP2_H
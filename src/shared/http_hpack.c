@@ -0,0 +1,629 @@
+/**
+ * @file http_hpack.c
+ * @brief HPACK, the header compression of HTTP/2
+ *
+ * Fields are sent as indices into a table both sides keep: the static table of
+ * the specification plus a dynamic one each side fills with the fields it
+ * chose to index. The decoder takes the whole format, Huffman coded strings
+ * included. The encoder indexes fields and writes strings as they are, since
+ * after the first response a repeated field costs one byte anyway.
+ */
+
+// Standard library headers
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Other project headers
+#include "arena.h"
+
+// Project header
+#include "http_hpack.h"
+
+typedef struct
+{
+    const char *name;
+    size_t name_length;
+    const char *value;
+    size_t value_length;
+} Static_Field;
+
+// RFC 7541, Appendix A. Index i of the specification is static_table[i - 1]
+#define STATIC_FIELD(name, value) {name, sizeof(name) - 1, value, sizeof(value) - 1}
+static const Static_Field static_table[HTTP_HPACK_STATIC_COUNT] = {
+    STATIC_FIELD(":authority", ""),
+    STATIC_FIELD(":method", "GET"),
+    STATIC_FIELD(":method", "POST"),
+    STATIC_FIELD(":path", "/"),
+    STATIC_FIELD(":path", "/index.html"),
+    STATIC_FIELD(":scheme", "http"),
+    STATIC_FIELD(":scheme", "https"),
+    STATIC_FIELD(":status", "200"),
+    STATIC_FIELD(":status", "204"),
+    STATIC_FIELD(":status", "206"),
+    STATIC_FIELD(":status", "304"),
+    STATIC_FIELD(":status", "400"),
+    STATIC_FIELD(":status", "404"),
+    STATIC_FIELD(":status", "500"),
+    STATIC_FIELD("accept-charset", ""),
+    STATIC_FIELD("accept-encoding", "gzip, deflate"),
+    STATIC_FIELD("accept-language", ""),
+    STATIC_FIELD("accept-ranges", ""),
+    STATIC_FIELD("accept", ""),
+    STATIC_FIELD("access-control-allow-origin", ""),
+    STATIC_FIELD("age", ""),
+    STATIC_FIELD("allow", ""),
+    STATIC_FIELD("authorization", ""),
+    STATIC_FIELD("cache-control", ""),
+    STATIC_FIELD("content-disposition", ""),
+    STATIC_FIELD("content-encoding", ""),
+    STATIC_FIELD("content-language", ""),
+    STATIC_FIELD("content-length", ""),
+    STATIC_FIELD("content-location", ""),
+    STATIC_FIELD("content-range", ""),
+    STATIC_FIELD("content-type", ""),
+    STATIC_FIELD("cookie", ""),
+    STATIC_FIELD("date", ""),
+    STATIC_FIELD("etag", ""),
+    STATIC_FIELD("expect", ""),
+    STATIC_FIELD("expires", ""),
+    STATIC_FIELD("from", ""),
+    STATIC_FIELD("host", ""),
+    STATIC_FIELD("if-match", ""),
+    STATIC_FIELD("if-modified-since", ""),
+    STATIC_FIELD("if-none-match", ""),
+    STATIC_FIELD("if-range", ""),
+    STATIC_FIELD("if-unmodified-since", ""),
+    STATIC_FIELD("last-modified", ""),
+    STATIC_FIELD("link", ""),
+    STATIC_FIELD("location", ""),
+    STATIC_FIELD("max-forwards", ""),
+    STATIC_FIELD("proxy-authenticate", ""),
+    STATIC_FIELD("proxy-authorization", ""),
+    STATIC_FIELD("range", ""),
+    STATIC_FIELD("referer", ""),
+    STATIC_FIELD("refresh", ""),
+    STATIC_FIELD("retry-after", ""),
+    STATIC_FIELD("server", ""),
+    STATIC_FIELD("set-cookie", ""),
+    STATIC_FIELD("strict-transport-security", ""),
+    STATIC_FIELD("transfer-encoding", ""),
+    STATIC_FIELD("user-agent", ""),
+    STATIC_FIELD("vary", ""),
+    STATIC_FIELD("via", ""),
+    STATIC_FIELD("www-authenticate", ""),
+};
+
+/* Huffman code of RFC 7541, Appendix B:
+ * The code is canonical, so the number of codes of each length and the
+ * symbols sorted by code are enough to decode it. Codes of one length are
+ * consecutive numbers, the first one being the code after the last one of
+ * the previous length, shifted one bit to the left.
+ */
+#define HUFFMAN_MAX_BITS 30
+#define HUFFMAN_EOS 256
+static const uint8_t huffman_counts[HUFFMAN_MAX_BITS + 1] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4};
+static const uint16_t huffman_symbols[HUFFMAN_EOS + 1] = {
+    // 5 bits
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116,
+    // 6 bits
+    32, 37, 45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    // 7 bits
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122,
+    // 8 bits
+    38, 42, 44, 59, 88, 90,
+    // 10 bits
+    33, 34, 40, 41, 63,
+    // 11 bits
+    39, 43, 124,
+    // 12 bits
+    35, 62,
+    // 13 bits
+    0, 36, 64, 91, 93, 126,
+    // 14 bits
+    94, 125,
+    // 15 bits
+    60, 96, 123,
+    // 19 bits
+    92, 195, 208,
+    // 20 bits
+    128, 130, 131, 162, 184, 194, 224, 226,
+    // 21 bits
+    153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230,
+    // 22 bits
+    129, 132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232, 233,
+    // 23 bits
+    1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,
+    // 24 bits
+    9, 142, 144, 145, 148, 159, 171, 206, 215, 225, 236, 237,
+    // 25 bits
+    199, 207, 234, 235,
+    // 26 bits
+    192, 193, 200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255,
+    // 27 bits
+    203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    // 28 bits
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249,
+    // 30 bits
+    10, 13, 22, HUFFMAN_EOS};
+
+// Static since it is only used inside this file
+static int decode_integer(const unsigned char **ptr, const unsigned char *end, int prefix_bits, uint32_t *value);
+static size_t encode_integer(unsigned char *out, unsigned char first, int prefix_bits, uint32_t value);
+static int decode_string(const unsigned char **ptr, const unsigned char *end, Arena *arena, char **string, size_t *length);
+static size_t encode_string(unsigned char *out, const char *string, size_t length);
+static int lookup_field(const HTTP_Hpack_Table *table, uint32_t index, const char **name, size_t *name_length, const char **value, size_t *value_length);
+static HTTP_Hpack_Entry *dynamic_entry(HTTP_Hpack_Table *table, int position);
+static int add_entry(HTTP_Hpack_Table *table, const char *name, size_t name_length, const char *value, size_t value_length);
+static void evict_entries(HTTP_Hpack_Table *table, size_t size);
+
+/* http_hpack_table_init:
+ * Empty table. limit is the size the other side lets it grow to: the one we
+ * advertise for the decoder, the one the client advertises for the encoder.
+ */
+void http_hpack_table_init(HTTP_Hpack_Table *table, size_t limit)
+{
+    memset(table, 0, sizeof(HTTP_Hpack_Table));
+    table->newest = HTTP_HPACK_MAX_ENTRIES - 1;
+    table->max_size = limit;
+    table->limit = limit;
+    table->size_update_min = limit;
+}
+
+void http_hpack_table_clear(HTTP_Hpack_Table *table)
+{
+    evict_entries(table, 0);
+}
+
+/* http_hpack_table_limit:
+ * New SETTINGS_HEADER_TABLE_SIZE of the client for the encoder table. Past
+ * HTTP_HPACK_TABLE_SIZE the table does not grow, a larger table only takes
+ * memory. The decoder learns about the change from the next header block.
+ */
+void http_hpack_table_limit(HTTP_Hpack_Table *table, size_t limit)
+{
+    if (limit > HTTP_HPACK_TABLE_SIZE)
+    {
+        limit = HTTP_HPACK_TABLE_SIZE;
+    }
+    table->limit = limit;
+    if (limit == table->max_size)
+    {
+        return;
+    }
+    if (!table->size_update || limit < table->size_update_min)
+    {
+        table->size_update_min = limit;
+    }
+    table->max_size = limit;
+    table->size_update = 1;
+    evict_entries(table, limit);
+}
+
+/* http_hpack_decode:
+ * Decodes a whole header block, calling handler once per field in order. The
+ * table is updated even when the caller ends up refusing the fields, the
+ * client already counts on it. Strings are decoded into arena. Returns 0 or
+ * -1 when the block is not valid HPACK, a connection error.
+ */
+int http_hpack_decode(HTTP_Hpack_Table *table, const unsigned char *block, size_t length, Arena *arena, HTTP_Hpack_Field_Handler handler, void *arg)
+{
+    char *literal_name, *literal_value;
+    const char *name, *value;
+    size_t name_length, value_length;
+    uint32_t index;
+    int indexing, fields;
+    const unsigned char *ptr, *end;
+
+    ptr = block;
+    end = block + length;
+    fields = 0;
+    while (ptr < end)
+    {
+        if (*ptr & 0x80)
+        {
+            // Indexed field: 1xxxxxxx
+            if (decode_integer(&ptr, end, 7, &index) < 0 ||
+                lookup_field(table, index, &name, &name_length, &value, &value_length) < 0)
+            {
+                return -1;
+            }
+            handler(arg, name, name_length, value, value_length);
+        }
+        else if ((*ptr & 0xe0) == 0x20)
+        {
+            // Dynamic table size update: 001xxxxx, only before the first field
+            if (fields > 0 || decode_integer(&ptr, end, 5, &index) < 0 || index > table->limit)
+            {
+                return -1;
+            }
+            table->max_size = index;
+            evict_entries(table, index);
+            continue;
+        }
+        else
+        {
+            // Literal: 01xxxxxx adds it to the table, 0000xxxx and 0001xxxx do not
+            indexing = (*ptr & 0xc0) == 0x40;
+            if (decode_integer(&ptr, end, indexing ? 6 : 4, &index) < 0)
+            {
+                return -1;
+            }
+            if (index == 0)
+            {
+                if (decode_string(&ptr, end, arena, &literal_name, &name_length) < 0)
+                {
+                    return -1;
+                }
+                name = literal_name;
+            }
+            else if (lookup_field(table, index, &name, &name_length, &value, &value_length) < 0)
+            {
+                return -1;
+            }
+            if (decode_string(&ptr, end, arena, &literal_value, &value_length) < 0)
+            {
+                return -1;
+            }
+            handler(arg, name, name_length, literal_value, value_length);
+            // The name may be an entry this addition evicts, add_entry copies it first
+            if (indexing && add_entry(table, name, name_length, literal_value, value_length) < 0)
+            {
+                return -1;
+            }
+        }
+        fields++;
+    }
+    return 0;
+}
+
+// Bytes http_hpack_encode_field writes at most for a field of these lengths
+size_t http_hpack_field_bound(size_t name_length, size_t value_length)
+{
+    return 6 + 5 + name_length + 5 + value_length; // Index and two string lengths of up to 5 bytes each
+}
+
+/* http_hpack_encode_size_update:
+ * Size updates the next block must start with after the client changed its
+ * table size, at most HTTP_HPACK_SIZE_UPDATE_BOUND bytes. Returns the bytes
+ * written, 0 when the size did not change.
+ */
+size_t http_hpack_encode_size_update(HTTP_Hpack_Table *table, unsigned char *out)
+{
+    size_t length;
+
+    if (!table->size_update)
+    {
+        return 0;
+    }
+    length = 0;
+    if (table->size_update_min < table->max_size)
+    {
+        // Shrunk and grown again, the decoder has to evict what the smallest size left out
+        length += encode_integer(out, 0x20, 5, (uint32_t)table->size_update_min);
+    }
+    length += encode_integer(out + length, 0x20, 5, (uint32_t)table->max_size);
+    table->size_update = 0;
+    return length;
+}
+
+/* http_hpack_encode_field:
+ * Writes one field, as an index when the table has it whole, otherwise as a
+ * literal that reuses an indexed name. With indexing the literal is added to
+ * the table, so the next response with the same field sends its index. Names
+ * are written in lowercase, as HTTP/2 requires. Returns the bytes written.
+ */
+size_t http_hpack_encode_field(HTTP_Hpack_Table *table, unsigned char *out, const char *name, size_t name_length, const char *value, size_t value_length, int indexing)
+{
+    int i;
+    uint32_t name_index;
+    size_t length;
+    const char *indexed_name;
+    HTTP_Hpack_Entry *entry;
+
+    name_index = 0;
+    indexed_name = NULL;
+    for (i = 0; i < HTTP_HPACK_STATIC_COUNT; i++)
+    {
+        if (static_table[i].name_length == name_length && strncasecmp(static_table[i].name, name, name_length) == 0)
+        {
+            if (static_table[i].value_length == value_length && memcmp(static_table[i].value, value, value_length) == 0)
+            {
+                return encode_integer(out, 0x80, 7, (uint32_t)i + 1);
+            }
+            if (name_index == 0)
+            {
+                name_index = (uint32_t)i + 1;
+                indexed_name = static_table[i].name;
+            }
+        }
+    }
+    for (i = 0; i < table->count; i++)
+    {
+        entry = dynamic_entry(table, i);
+        if (entry->name_length == name_length && strncasecmp(entry->name, name, name_length) == 0)
+        {
+            if (entry->value_length == value_length && memcmp(entry->value, value, value_length) == 0)
+            {
+                return encode_integer(out, 0x80, 7, HTTP_HPACK_STATIC_COUNT + 1 + (uint32_t)i);
+            }
+            if (name_index == 0)
+            {
+                name_index = HTTP_HPACK_STATIC_COUNT + 1 + (uint32_t)i;
+                indexed_name = entry->name;
+            }
+        }
+    }
+
+    length = encode_integer(out, indexing ? 0x40 : 0x00, indexing ? 6 : 4, name_index);
+    if (name_index == 0)
+    {
+        // Lowercased where it is written, the table entry copies it from there
+        length += encode_string(out + length, name, name_length);
+        indexed_name = (const char *)out + length - name_length;
+        for (i = 0; i < (int)name_length; i++)
+        {
+            out[length - name_length + i] = (unsigned char)tolower((unsigned char)name[i]);
+        }
+    }
+    length += encode_string(out + length, value, value_length);
+    if (indexing)
+    {
+        add_entry(table, indexed_name, name_length, value, value_length);
+    }
+    return length;
+}
+
+/* http_hpack_huffman_decode:
+ * Decodes length bytes of Huffman code into out, which needs room for
+ * length * 8 / 5 bytes, the shortest code being 5 bits. The last byte is
+ * padded with the most significant bits of EOS, up to 7 bits of ones, which
+ * is the only thing allowed to be left over. Returns the decoded length or -1.
+ */
+int http_hpack_huffman_decode(const unsigned char *data, size_t length, char *out)
+{
+    int bit, bits, count, first, code, index, ones, written;
+    size_t i;
+
+    written = 0;
+    code = first = index = bits = 0;
+    ones = 1;
+    for (i = 0; i < length; i++)
+    {
+        for (bit = 7; bit >= 0; bit--)
+        {
+            // One more bit of the code, compared against the codes of that length
+            code |= (data[i] >> bit) & 1;
+            ones &= (data[i] >> bit) & 1;
+            bits++;
+            count = huffman_counts[bits];
+            if (code - count < first)
+            {
+                if (huffman_symbols[index + code - first] == HUFFMAN_EOS)
+                {
+                    return -1;
+                }
+                out[written++] = (char)huffman_symbols[index + code - first];
+                code = first = index = bits = 0;
+                ones = 1;
+                continue;
+            }
+            if (bits == HUFFMAN_MAX_BITS)
+            {
+                return -1;
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+    }
+    if (bits > 7 || !ones)
+    {
+        return -1;
+    }
+    return written;
+}
+
+static int decode_integer(const unsigned char **ptr, const unsigned char *end, int prefix_bits, uint32_t *value)
+{
+    uint32_t mask, result;
+    int shift;
+    const unsigned char *p;
+
+    p = *ptr;
+    if (p == end)
+    {
+        return -1;
+    }
+    mask = (1u << prefix_bits) - 1;
+    result = *p++ & mask;
+    if (result == mask)
+    {
+        // Continuation bytes, 7 bits each, least significant first. Four are plenty for any size here
+        shift = 0;
+        do
+        {
+            if (p == end || shift > 21)
+            {
+                return -1;
+            }
+            result += (uint32_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+    }
+    *ptr = p;
+    *value = result;
+    return 0;
+}
+
+static size_t encode_integer(unsigned char *out, unsigned char first, int prefix_bits, uint32_t value)
+{
+    uint32_t mask;
+    size_t length;
+
+    mask = (1u << prefix_bits) - 1;
+    if (value < mask)
+    {
+        out[0] = first | (unsigned char)value;
+        return 1;
+    }
+    out[0] = first | (unsigned char)mask;
+    value -= mask;
+    length = 1;
+    while (value >= 0x80)
+    {
+        out[length++] = (unsigned char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// String literal, Huffman coded or not, decoded into arena and null-terminated
+static int decode_string(const unsigned char **ptr, const unsigned char *end, Arena *arena, char **string, size_t *length)
+{
+    int huffman, decoded;
+    uint32_t encoded_length;
+    const unsigned char *p;
+
+    p = *ptr;
+    if (p == end)
+    {
+        return -1;
+    }
+    huffman = *p & 0x80;
+    if (decode_integer(&p, end, 7, &encoded_length) < 0 || encoded_length > (size_t)(end - p) || encoded_length > HTTP_HPACK_MAX_STRING)
+    {
+        return -1;
+    }
+
+    if (huffman)
+    {
+        *string = (char *)arena_alloc(arena, (size_t)encoded_length * 8 / 5 + 1);
+        if (*string == NULL)
+        {
+            return -1;
+        }
+        decoded = http_hpack_huffman_decode(p, encoded_length, *string);
+        if (decoded < 0)
+        {
+            return -1;
+        }
+        *length = (size_t)decoded;
+    }
+    else
+    {
+        *string = (char *)arena_alloc(arena, (size_t)encoded_length + 1);
+        if (*string == NULL)
+        {
+            return -1;
+        }
+        memcpy(*string, p, encoded_length);
+        *length = encoded_length;
+    }
+    (*string)[*length] = '\0';
+    *ptr = p + encoded_length;
+    return 0;
+}
+
+static size_t encode_string(unsigned char *out, const char *string, size_t length)
+{
+    size_t prefix_length;
+
+    prefix_length = encode_integer(out, 0x00, 7, (uint32_t)length);
+    memcpy(out + prefix_length, string, length);
+    return prefix_length + length;
+}
+
+// Name and value of an index, 1 to 61 in the static table, from 62 in the dynamic one
+static int lookup_field(const HTTP_Hpack_Table *table, uint32_t index, const char **name, size_t *name_length, const char **value, size_t *value_length)
+{
+    const HTTP_Hpack_Entry *entry;
+
+    if (index == 0)
+    {
+        return -1;
+    }
+    if (index <= HTTP_HPACK_STATIC_COUNT)
+    {
+        *name = static_table[index - 1].name;
+        *name_length = static_table[index - 1].name_length;
+        *value = static_table[index - 1].value;
+        *value_length = static_table[index - 1].value_length;
+        return 0;
+    }
+    if (index - HTTP_HPACK_STATIC_COUNT - 1 >= (uint32_t)table->count)
+    {
+        return -1;
+    }
+    entry = dynamic_entry((HTTP_Hpack_Table *)table, (int)(index - HTTP_HPACK_STATIC_COUNT - 1));
+    *name = entry->name;
+    *name_length = entry->name_length;
+    *value = entry->value;
+    *value_length = entry->value_length;
+    return 0;
+}
+
+// position 0 is the newest entry
+static HTTP_Hpack_Entry *dynamic_entry(HTTP_Hpack_Table *table, int position)
+{
+    return &table->entries[(table->newest - position + HTTP_HPACK_MAX_ENTRIES) % HTTP_HPACK_MAX_ENTRIES];
+}
+
+/* add_entry:
+ * Makes room by evicting the oldest entries and adds the field as the newest.
+ * A field larger than the whole table empties it and is not added.
+ */
+static int add_entry(HTTP_Hpack_Table *table, const char *name, size_t name_length, const char *value, size_t value_length)
+{
+    char *block;
+    size_t size;
+    HTTP_Hpack_Entry *entry;
+
+    size = name_length + value_length + HTTP_HPACK_ENTRY_OVERHEAD;
+    if (size > table->max_size)
+    {
+        evict_entries(table, 0);
+        return 0;
+    }
+
+    // Copied before evicting, name may belong to one of the evicted entries
+    block = (char *)malloc(name_length + value_length + 2);
+    if (block == NULL)
+    {
+        return -1;
+    }
+    memcpy(block, name, name_length);
+    block[name_length] = '\0';
+    memcpy(block + name_length + 1, value, value_length);
+    block[name_length + 1 + value_length] = '\0';
+
+    evict_entries(table, table->max_size - size);
+    table->newest = (table->newest + 1) % HTTP_HPACK_MAX_ENTRIES;
+    entry = &table->entries[table->newest];
+    entry->name = block;
+    entry->name_length = name_length;
+    entry->value = block + name_length + 1;
+    entry->value_length = value_length;
+    table->count++;
+    table->size += size;
+    return 0;
+}
+
+// Evicts the oldest entries until the table takes at most size bytes
+static void evict_entries(HTTP_Hpack_Table *table, size_t size)
+{
+    HTTP_Hpack_Entry *entry;
+
+    while (table->count > 0 && table->size > size)
+    {
+        entry = dynamic_entry(table, table->count - 1);
+        table->size -= entry->name_length + entry->value_length + HTTP_HPACK_ENTRY_OVERHEAD;
+        free(entry->name);
+        entry->name = NULL;
+        table->count--;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef HTTP_HPACK_H
+#define HTTP_HPACK_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared headers
+#include "arena.h"
+
+// Constants
+#define HTTP_HPACK_TABLE_SIZE 4096     // Dynamic table size of both directions, the default SETTINGS_HEADER_TABLE_SIZE
+#define HTTP_HPACK_ENTRY_OVERHEAD 32   // Added to the name and value lengths to size an entry
+#define HTTP_HPACK_MAX_ENTRIES (HTTP_HPACK_TABLE_SIZE / HTTP_HPACK_ENTRY_OVERHEAD) // Smallest entries, fullest table
+#define HTTP_HPACK_STATIC_COUNT 61     // Index 62 is the newest dynamic entry
+#define HTTP_HPACK_MAX_STRING 65536    // Longer names or values are refused while decoding
+#define HTTP_HPACK_SIZE_UPDATE_BOUND 12 // Two size updates, the smallest size and the final one
+
+typedef struct
+{
+    char *name; // "name\0value\0" in one allocation, name is its start
+    size_t name_length;
+    char *value;
+    size_t value_length;
+} HTTP_Hpack_Entry;
+
+/* HTTP_Hpack_Table:
+ * Dynamic table of one direction of a connection, the client's fields for the
+ * decoder and ours for the encoder. Entries are kept in a ring, the newest at
+ * newest, so adding one and evicting the oldest never move the others.
+ */
+typedef struct
+{
+    HTTP_Hpack_Entry entries[HTTP_HPACK_MAX_ENTRIES];
+    int newest; // Slot of the newest entry
+    int count;
+    size_t size;     // Sum of the entry sizes
+    size_t max_size; // Entries are evicted to keep size within it
+    size_t limit;    // Largest max_size the other side allows
+    int size_update;        // Encoder: the next block starts with size updates
+    size_t size_update_min; // Encoder: smallest max_size since the last block
+} HTTP_Hpack_Table;
+
+// Called for each decoded field, name and value are only valid during the call
+typedef void (*HTTP_Hpack_Field_Handler)(void *arg, const char *name, size_t name_length, const char *value, size_t value_length);
+
+void http_hpack_table_init(HTTP_Hpack_Table *table, size_t limit);
+void http_hpack_table_clear(HTTP_Hpack_Table *table);
+void http_hpack_table_limit(HTTP_Hpack_Table *table, size_t limit);
+int http_hpack_decode(HTTP_Hpack_Table *table, const unsigned char *block, size_t length, Arena *arena, HTTP_Hpack_Field_Handler handler, void *arg);
+size_t http_hpack_field_bound(size_t name_length, size_t value_length);
+size_t http_hpack_encode_size_update(HTTP_Hpack_Table *table, unsigned char *out);
+size_t http_hpack_encode_field(HTTP_Hpack_Table *table, unsigned char *out, const char *name, size_t name_length, const char *value, size_t value_length, int indexing);
+int http_hpack_huffman_decode(const unsigned char *data, size_t length, char *out);
+
+#endif // HTTP_HPACK_H
@@ -0,0 +1,488 @@
+/**
+ * @file http_mime.c
+ * @brief Content types by file extension, loaded from a mime.types file
+ *
+ * http_mime_load reads a file in the mime.types format ("type ext ext ...",
+ * '#' starts a comment) and builds a minimal perfect hash of its extensions
+ * once, at startup. A lookup then costs one or two hashes of the extension and
+ * one comparison, however many types were loaded. Every type keeps its
+ * Content-Type header line already rendered, so a response can send it as is.
+ *
+ * The built-in types below are always there, a file only adds to them or
+ * overrides them. They are also what lookups use before anything is loaded.
+ */
+
+// Standard library headers
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Other project headers
+#include "arena.h"
+
+// Project header
+#include "http_mime.h"
+
+// The extension is preceded by its dot in memory, get_extension returns it with the dot
+#define MIME_TYPE(extension, type) \
+    {("." extension) + 1, sizeof(extension) - 1, type, "Content-Type: " type "\r\n", sizeof("Content-Type: " type "\r\n") - 1}
+
+static const HTTP_Mime_Type builtin_types[] = {
+    MIME_TYPE("html", "text/html"),
+    MIME_TYPE("txt", "text/plain"),
+    MIME_TYPE("jpg", "image/jpeg"),
+    MIME_TYPE("jpeg", "image/jpeg"),
+    MIME_TYPE("png", "image/png"),
+    MIME_TYPE("gif", "image/gif"),
+    MIME_TYPE("bmp", "image/bmp"),
+    MIME_TYPE("tiff", "image/tiff"),
+    MIME_TYPE("pdf", "application/pdf"),
+};
+static const HTTP_Mime_Type default_type = MIME_TYPE("", HTTP_MIME_DEFAULT_TYPE);
+
+// Written once by http_mime_load before the server starts, only read afterwards
+static HTTP_Mime_Table *mime_table;
+
+typedef struct
+{
+    int bucket;
+    int size;
+} Mime_Bucket;
+
+// Static since it is only used inside this file
+static uint32_t mime_hash(uint32_t seed, const char *key, size_t length);
+static int add_mime_type(HTTP_Mime_Type **types, int *count, int *capacity, const HTTP_Mime_Type *type);
+static int add_mime_line(HTTP_Mime_Type **types, int *count, int *capacity, Arena *strings, char *line);
+static int remove_duplicate_types(HTTP_Mime_Type *types, int count);
+static int build_mime_table(HTTP_Mime_Table *table, const HTTP_Mime_Type *types, int count);
+static int compare_buckets(const void *a, const void *b);
+static void free_mime_table(HTTP_Mime_Table **table);
+
+/* http_mime_load:
+ * Replaces the table with the built-in types plus those of the file at path.
+ * A file that cannot be read only leaves the built-in types. Returns the
+ * number of extensions in the table or -1 if it could not be built, in which
+ * case the previous table stays. Not thread safe, meant for startup.
+ */
+int http_mime_load(const char *path)
+{
+    char line[HTTP_MIME_LINE_SIZE];
+    int count, capacity, ret_val;
+    size_t i;
+    FILE *file;
+    HTTP_Mime_Type *types;
+    HTTP_Mime_Table *table;
+
+    table = (HTTP_Mime_Table *)calloc(1, sizeof(HTTP_Mime_Table));
+    if (table == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    table->strings = create_arena(0);
+    if (table->strings == NULL)
+    {
+        free(table);
+        return -1;
+    }
+
+    types = NULL;
+    count = 0;
+    capacity = 0;
+    ret_val = 0;
+
+    // The file goes first, so its types win over the built-in ones
+    file = path != NULL ? fopen(path, "r") : NULL;
+    if (path != NULL && file == NULL)
+    {
+        fprintf(stderr, "No se pudo abrir %s: %s, solo se usan los tipos incluidos\n", path, strerror(errno));
+    }
+    while (file != NULL && ret_val == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        ret_val = add_mime_line(&types, &count, &capacity, table->strings, line);
+    }
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    for (i = 0; ret_val == 0 && i < sizeof(builtin_types) / sizeof(builtin_types[0]); i++)
+    {
+        ret_val = add_mime_type(&types, &count, &capacity, &builtin_types[i]);
+    }
+
+    if (ret_val == 0)
+    {
+        count = remove_duplicate_types(types, count);
+        ret_val = count < 0 ? -1 : build_mime_table(table, types, count);
+    }
+    free(types);
+    if (ret_val < 0)
+    {
+        free_mime_table(&table);
+        return -1;
+    }
+
+    free_mime_table(&mime_table);
+    mime_table = table;
+    return mime_table->count;
+}
+
+void http_mime_clear(void)
+{
+    free_mime_table(&mime_table);
+}
+
+/* http_mime_type:
+ * Type of an extension, with or without its dot and in any case. Unknown
+ * extensions get HTTP_MIME_DEFAULT_TYPE, never NULL.
+ */
+const HTTP_Mime_Type *http_mime_type(const char *extension)
+{
+    size_t i, length;
+    int32_t displacement;
+    uint32_t slot;
+    const HTTP_Mime_Type *type;
+
+    if (extension == NULL)
+    {
+        return &default_type;
+    }
+    if (extension[0] == '.')
+    {
+        extension++;
+    }
+    length = strlen(extension);
+
+    if (mime_table == NULL)
+    {
+        // Nothing loaded, the built-in types are few enough to walk
+        for (i = 0; i < sizeof(builtin_types) / sizeof(builtin_types[0]); i++)
+        {
+            if (strcasecmp(builtin_types[i].extension, extension) == 0)
+            {
+                return &builtin_types[i];
+            }
+        }
+        return &default_type;
+    }
+
+    displacement = mime_table->displacements[mime_hash(0, extension, length) % mime_table->count];
+    slot = displacement < 0 ? (uint32_t)(-displacement - 1) : mime_hash((uint32_t)displacement, extension, length) % mime_table->count;
+    type = &mime_table->types[slot];
+    if (type->extension_length == length && strncasecmp(type->extension, extension, length) == 0)
+    {
+        return type;
+    }
+    return &default_type;
+}
+
+const char *get_content_type(const char *extension)
+{
+    return http_mime_type(extension)->type;
+}
+
+/* get_extension:
+ * Extension with its dot for a content type, parameters such as charset are
+ * ignored. Walks every type, so it is not meant for the request path.
+ */
+const char *get_extension(const char *content_type)
+{
+    int i;
+    size_t n, length;
+
+    length = strcspn(content_type, "; \t");
+    // The built-in types first, they have the usual extension of each type
+    for (n = 0; n < sizeof(builtin_types) / sizeof(builtin_types[0]); n++)
+    {
+        if (strlen(builtin_types[n].type) == length && strncasecmp(builtin_types[n].type, content_type, length) == 0)
+        {
+            return builtin_types[n].extension - 1;
+        }
+    }
+    for (i = 0; mime_table != NULL && i < mime_table->count; i++)
+    {
+        if (strlen(mime_table->types[i].type) == length && strncasecmp(mime_table->types[i].type, content_type, length) == 0)
+        {
+            return mime_table->types[i].extension - 1;
+        }
+    }
+    return NULL;
+}
+
+// FNV-1a over the lowercase key, seed 0 is the first hash of every lookup
+static uint32_t mime_hash(uint32_t seed, const char *key, size_t length)
+{
+    uint32_t hash;
+    size_t i;
+
+    hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)key[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int add_mime_type(HTTP_Mime_Type **types, int *count, int *capacity, const HTTP_Mime_Type *type)
+{
+    HTTP_Mime_Type *grown;
+
+    if (*count == *capacity)
+    {
+        grown = (HTTP_Mime_Type *)realloc(*types, sizeof(HTTP_Mime_Type) * (*capacity > 0 ? *capacity * 2 : 256));
+        if (grown == NULL)
+        {
+            fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+            return -1;
+        }
+        *types = grown;
+        *capacity = *capacity > 0 ? *capacity * 2 : 256;
+    }
+    (*types)[(*count)++] = *type;
+    return 0;
+}
+
+// One line of a mime.types file: a type and its extensions, or a comment
+static int add_mime_line(HTTP_Mime_Type **types, int *count, int *capacity, Arena *strings, char *line)
+{
+    char *token, *save, *copy, *header;
+    size_t i, length, type_length, header_length;
+    HTTP_Mime_Type type;
+
+    token = strtok_r(line, " \t\r\n", &save);
+    if (token == NULL || token[0] == '#')
+    {
+        return 0;
+    }
+
+    // Type and header line are shared by every extension of the line
+    type_length = strlen(token);
+    header_length = sizeof("Content-Type: \r\n") - 1 + type_length;
+    copy = (char *)arena_alloc(strings, type_length + 1 + header_length + 1);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(copy, token, type_length + 1);
+    header = copy + type_length + 1;
+    memcpy(header, "Content-Type: ", 14);
+    memcpy(header + 14, token, type_length);
+    memcpy(header + 14 + type_length, "\r\n", 3);
+    type.type = copy;
+    type.header = header;
+    type.header_length = header_length;
+
+    for (token = strtok_r(NULL, " \t\r\n", &save); token != NULL && token[0] != '#'; token = strtok_r(NULL, " \t\r\n", &save))
+    {
+        length = strlen(token);
+        if (length > HTTP_MIME_MAX_EXTENSION)
+        {
+            continue;
+        }
+        // Stored as ".ext", the extension itself starts after the dot
+        copy = (char *)arena_alloc(strings, length + 2);
+        if (copy == NULL)
+        {
+            return -1;
+        }
+        copy[0] = '.';
+        for (i = 0; i <= length; i++)
+        {
+            copy[i + 1] = (char)tolower((unsigned char)token[i]);
+        }
+        type.extension = copy + 1;
+        type.extension_length = length;
+        if (add_mime_type(types, count, capacity, &type) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Keeps the first occurrence of each extension, returns how many are left
+static int remove_duplicate_types(HTTP_Mime_Type *types, int count)
+{
+    int i, j, kept, bucket;
+    int *heads, *next;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    heads = (int *)malloc(sizeof(int) * count);
+    next = (int *)malloc(sizeof(int) * count);
+    if (heads == NULL || next == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        free(heads);
+        free(next);
+        return -1;
+    }
+    memset(heads, -1, sizeof(int) * count);
+
+    // Equal extensions hash to the same bucket, so only its chain is compared
+    kept = 0;
+    for (i = 0; i < count; i++)
+    {
+        bucket = mime_hash(0, types[i].extension, types[i].extension_length) % count;
+        for (j = heads[bucket]; j >= 0; j = next[j])
+        {
+            if (types[j].extension_length == types[i].extension_length && memcmp(types[j].extension, types[i].extension, types[i].extension_length) == 0)
+            {
+                break;
+            }
+        }
+        if (j >= 0)
+        {
+            continue;
+        }
+        types[kept] = types[i];
+        next[kept] = heads[bucket];
+        heads[bucket] = kept;
+        kept++;
+    }
+
+    free(heads);
+    free(next);
+    return kept;
+}
+
+/* build_mime_table:
+ * Hash and displace: extensions are put in buckets by their first hash, and
+ * buckets are placed largest first. A bucket of several extensions tries seeds
+ * for the second hash until all of them land on free slots, a bucket of one
+ * takes any free slot directly.
+ */
+static int build_mime_table(HTTP_Mime_Table *table, const HTTP_Mime_Type *types, int count)
+{
+    int i, j, b, next_free, placed, ret_val;
+    int *members, *starts, *tried;
+    uint32_t seed, slot;
+    char *used;
+    Mime_Bucket *buckets;
+
+    if (count == 0)
+    {
+        fprintf(stderr, "No hay tipos MIME para cargar\n");
+        return -1;
+    }
+    table->count = count;
+    table->types = (HTTP_Mime_Type *)calloc(count, sizeof(HTTP_Mime_Type));
+    table->displacements = (int32_t *)calloc(count, sizeof(int32_t));
+    buckets = (Mime_Bucket *)calloc(count, sizeof(Mime_Bucket));
+    members = (int *)malloc(sizeof(int) * count);
+    starts = (int *)calloc(count + 1, sizeof(int));
+    tried = (int *)calloc(count, sizeof(int));
+    used = (char *)calloc(count, sizeof(char));
+    if (table->types == NULL || table->displacements == NULL || buckets == NULL || members == NULL || starts == NULL || tried == NULL || used == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        free(buckets);
+        free(members);
+        free(starts);
+        free(tried);
+        free(used);
+        return -1;
+    }
+
+    // Extensions grouped by bucket: members[starts[b], starts[b + 1]) are those of bucket b
+    for (i = 0; i < count; i++)
+    {
+        buckets[mime_hash(0, types[i].extension, types[i].extension_length) % count].size++;
+    }
+    for (b = 0; b < count; b++)
+    {
+        buckets[b].bucket = b;
+        starts[b + 1] = starts[b] + buckets[b].size;
+    }
+    for (i = 0; i < count; i++)
+    {
+        b = mime_hash(0, types[i].extension, types[i].extension_length) % count;
+        members[starts[b] + --buckets[b].size] = i;
+    }
+    for (b = 0; b < count; b++)
+    {
+        buckets[b].size = starts[b + 1] - starts[b];
+    }
+    qsort(buckets, count, sizeof(Mime_Bucket), compare_buckets);
+
+    ret_val = 0;
+    next_free = 0;
+    for (i = 0; i < count && buckets[i].size > 0 && ret_val == 0; i++)
+    {
+        b = buckets[i].bucket;
+        if (buckets[i].size == 1)
+        {
+            while (used[next_free])
+            {
+                next_free++;
+            }
+            used[next_free] = 1;
+            table->types[next_free] = types[members[starts[b]]];
+            table->displacements[b] = -next_free - 1;
+            continue;
+        }
+
+        // tried marks the slots taken by this seed, so two members cannot share one
+        for (seed = 1; seed < INT32_MAX; seed++)
+        {
+            for (placed = 0, j = starts[b]; j < starts[b + 1]; j++, placed++)
+            {
+                slot = mime_hash(seed, types[members[j]].extension, types[members[j]].extension_length) % count;
+                if (used[slot] || tried[slot] == (int)seed)
+                {
+                    break;
+                }
+                tried[slot] = (int)seed;
+            }
+            if (placed == buckets[i].size)
+            {
+                break;
+            }
+        }
+        if (seed == INT32_MAX)
+        {
+            fprintf(stderr, "No se pudo armar la tabla de tipos MIME\n");
+            ret_val = -1;
+            break;
+        }
+        for (j = starts[b]; j < starts[b + 1]; j++)
+        {
+            slot = mime_hash(seed, types[members[j]].extension, types[members[j]].extension_length) % count;
+            used[slot] = 1;
+            table->types[slot] = types[members[j]];
+        }
+        table->displacements[b] = (int32_t)seed;
+    }
+
+    free(buckets);
+    free(members);
+    free(starts);
+    free(tried);
+    free(used);
+    return ret_val;
+}
+
+// Largest buckets first, they are the hardest to place
+static int compare_buckets(const void *a, const void *b)
+{
+    return ((const Mime_Bucket *)b)->size - ((const Mime_Bucket *)a)->size;
+}
+
+static void free_mime_table(HTTP_Mime_Table **table)
+{
+    if (table != NULL && *table != NULL)
+    {
+        free((*table)->types);
+        free((*table)->displacements);
+        free_arena(&(*table)->strings);
+        free(*table);
+        *table = NULL;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef HTTP_MIME_H
+#define HTTP_MIME_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared headers
+#include "arena.h"
+
+// Constants
+#define HTTP_MIME_DEFAULT_TYPES_FILE "/etc/mime.types"
+#define HTTP_MIME_DEFAULT_TYPE "application/octet-stream" // For extensions nobody registered
+#define HTTP_MIME_MAX_EXTENSION 32                        // Longer extensions are skipped when loading
+#define HTTP_MIME_LINE_SIZE 1024                          // Longest line read from a mime.types file
+
+typedef struct
+{
+    const char *extension; // Lowercase, without the dot (which is stored right before it)
+    size_t extension_length;
+    const char *type;
+    const char *header; // "Content-Type: <type>\r\n", ready to be sent
+    size_t header_length;
+} HTTP_Mime_Type;
+
+/* HTTP_Mime_Table:
+ * Minimal perfect hash of the extensions: count slots for count extensions
+ * and no collisions. The first hash picks a bucket, whose displacement either
+ * is the slot itself (stored as -slot - 1) or seeds a second hash that gives
+ * it. The extension in the slot is then compared once, since an unknown one
+ * lands on the slot of some other extension.
+ */
+typedef struct
+{
+    HTTP_Mime_Type *types; // Indexed by slot
+    int32_t *displacements; // Indexed by bucket, one bucket per extension
+    int count;
+    Arena *strings; // Extensions, types and header lines
+} HTTP_Mime_Table;
+
+int http_mime_load(const char *path);
+void http_mime_clear(void);
+const HTTP_Mime_Type *http_mime_type(const char *extension);
+const char *get_content_type(const char *extension);
+const char *get_extension(const char *content_type);
+
+#endif // HTTP_MIME_H
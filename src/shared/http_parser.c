@@ -0,0 +1,707 @@
+/**
+ * @file http_parser.c
+ * @brief Single pass, resumable HTTP/1.x request parser
+ *
+ * The parser never allocates and never copies: it records where the method,
+ * URI, version and every header name/value are inside the caller's buffer.
+ * When the request is not complete it remembers how far it got, so calling it
+ * again after more bytes arrive only looks at the new bytes. Chunked bodies
+ * are decoded the same way, resuming where the last call stopped.
+ */
+
+// Standard library headers
+#include <string.h>
+#include <strings.h>
+
+// The long runs (URI, header values, line ends) are scanned 32 or 16 bytes at a time
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Project header
+#include "http_parser.h"
+
+#define CHAR_TOKEN 1 // RFC 9110 tchar, valid in methods and header names
+#define CHAR_URI 2   // Visible ASCII, valid in the request target
+#define CHAR_VALUE 4 // HTAB, SP, visible ASCII and obs-text, valid in header values
+
+static const unsigned char char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    4, 7, 6, 7, 7, 7, 7, 7, 6, 6, 7, 7, 6, 7, 7, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 6, 6, 6,
+    6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 7, 6, 7, 0,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+};
+
+// Static since it is only used inside this file
+static size_t scan_uri(const unsigned char *buf, size_t p, size_t length);
+static size_t scan_value(const unsigned char *buf, size_t p, size_t length);
+static size_t scan_lf(const unsigned char *buf, size_t p, size_t length);
+static HTTP_Slice make_slice(size_t start, size_t end);
+static int valid_version(const unsigned char *version, size_t length);
+static int hex_value(unsigned char c);
+
+// The header array is left as is, entries are only valid up to header_count
+void http_parser_init(HTTP_Parser *parser)
+{
+    parser->state = HTTP_PARSER_METHOD;
+    parser->position = 0;
+    parser->token_start = 0;
+    memset(&parser->method, 0, sizeof(HTTP_Slice));
+    memset(&parser->uri, 0, sizeof(HTTP_Slice));
+    memset(&parser->version, 0, sizeof(HTTP_Slice));
+    parser->header_count = 0;
+    memset(parser->known, -1, sizeof(parser->known));
+    parser->header_length = 0;
+}
+
+/* http_parser_execute:
+ * Parses buffer[0, length), where the first parser->position bytes were already
+ * seen by a previous call. The buffer may move between calls (for example after
+ * a realloc) as long as its contents are kept, since only offsets are stored.
+ * Returns HTTP_PARSE_DONE once the blank line is found; parser->header_length
+ * then tells where the body starts.
+ */
+int http_parser_execute(HTTP_Parser *parser, const char *buffer, size_t length)
+{
+    const unsigned char *buf;
+    size_t p, end;
+    HTTP_Known_Header known;
+
+    buf = (const unsigned char *)buffer;
+    p = parser->position;
+
+    while (p < length)
+    {
+        switch (parser->state)
+        {
+        case HTTP_PARSER_METHOD:
+            while (p < length && (char_class[buf[p]] & CHAR_TOKEN))
+            {
+                p++;
+            }
+            if (p == length)
+            {
+                break;
+            }
+            if (buf[p] != ' ' || p == parser->token_start)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->method = make_slice(parser->token_start, p);
+            p++;
+            parser->token_start = p;
+            parser->state = HTTP_PARSER_URI;
+            break;
+
+        case HTTP_PARSER_URI:
+            p = scan_uri(buf, p, length);
+            if (p == length)
+            {
+                break;
+            }
+            if (buf[p] != ' ' || p == parser->token_start)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->uri = make_slice(parser->token_start, p);
+            p++;
+            parser->token_start = p;
+            parser->state = HTTP_PARSER_VERSION;
+            break;
+
+        case HTTP_PARSER_VERSION:
+            while (p < length && ((char_class[buf[p]] & CHAR_TOKEN) || buf[p] == '/'))
+            {
+                p++;
+            }
+            if (p == length)
+            {
+                break;
+            }
+            if (buf[p] != '\r' || !valid_version(buf + parser->token_start, p - parser->token_start))
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->version = make_slice(parser->token_start, p);
+            p++;
+            parser->state = HTTP_PARSER_REQUEST_LINE_LF;
+            break;
+
+        case HTTP_PARSER_REQUEST_LINE_LF:
+        case HTTP_PARSER_HEADER_LF:
+            if (buf[p] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            parser->state = HTTP_PARSER_HEADER_START;
+            break;
+
+        case HTTP_PARSER_HEADER_START:
+            if (buf[p] == '\r')
+            {
+                p++;
+                parser->state = HTTP_PARSER_HEADERS_END_LF;
+                break;
+            }
+            if (parser->header_count == HTTP_PARSER_MAX_HEADERS)
+            {
+                return HTTP_PARSE_TOO_MANY;
+            }
+            parser->token_start = p;
+            parser->state = HTTP_PARSER_HEADER_NAME;
+            break;
+
+        case HTTP_PARSER_HEADER_NAME:
+            while (p < length && (char_class[buf[p]] & CHAR_TOKEN))
+            {
+                p++;
+            }
+            if (p == length)
+            {
+                break;
+            }
+            // Also rejects whitespace before the colon and obsolete line folding
+            if (buf[p] != ':' || p == parser->token_start)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->headers[parser->header_count].name = make_slice(parser->token_start, p);
+            known = http_known_header(buffer + parser->token_start, p - parser->token_start);
+            if (known != HTTP_HEADER_UNKNOWN && parser->known[known] < 0)
+            {
+                parser->known[known] = (int16_t)parser->header_count;
+            }
+            p++;
+            parser->state = HTTP_PARSER_HEADER_VALUE_START;
+            break;
+
+        case HTTP_PARSER_HEADER_VALUE_START:
+            while (p < length && (buf[p] == ' ' || buf[p] == '\t'))
+            {
+                p++;
+            }
+            if (p == length)
+            {
+                break;
+            }
+            parser->token_start = p;
+            parser->state = HTTP_PARSER_HEADER_VALUE;
+            break;
+
+        case HTTP_PARSER_HEADER_VALUE:
+            p = scan_value(buf, p, length);
+            if (p == length)
+            {
+                break;
+            }
+            if (buf[p] != '\r')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            end = p;
+            while (end > parser->token_start && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+            {
+                end--;
+            }
+            parser->headers[parser->header_count].value = make_slice(parser->token_start, end);
+            parser->header_count++;
+            p++;
+            parser->state = HTTP_PARSER_HEADER_LF;
+            break;
+
+        case HTTP_PARSER_HEADERS_END_LF:
+            if (buf[p] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            parser->header_length = p;
+            parser->state = HTTP_PARSER_DONE;
+            parser->position = p;
+            return HTTP_PARSE_DONE;
+
+        case HTTP_PARSER_DONE:
+            return HTTP_PARSE_DONE;
+        }
+    }
+
+    parser->position = p;
+    return parser->state == HTTP_PARSER_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_INCOMPLETE;
+}
+
+/* http_known_header:
+ * Maps a header name to its HTTP_Known_Header, ignoring case. The length and
+ * first byte leave at most one candidate, so a single comparison confirms it.
+ */
+HTTP_Known_Header http_known_header(const char *name, size_t length)
+{
+    HTTP_Known_Header known;
+    const char *candidate;
+
+    switch (length)
+    {
+    case 4:
+        known = HTTP_HEADER_HOST;
+        candidate = "host";
+        break;
+    case 5:
+        known = HTTP_HEADER_RANGE;
+        candidate = "range";
+        break;
+    case 6:
+        known = HTTP_HEADER_EXPECT;
+        candidate = "expect";
+        break;
+    case 7:
+        known = HTTP_HEADER_UPGRADE;
+        candidate = "upgrade";
+        break;
+    case 8:
+        known = HTTP_HEADER_IF_RANGE;
+        candidate = "if-range";
+        break;
+    case 10:
+        known = HTTP_HEADER_CONNECTION;
+        candidate = "connection";
+        break;
+    case 12:
+        known = HTTP_HEADER_CONTENT_TYPE;
+        candidate = "content-type";
+        break;
+    case 13:
+        known = HTTP_HEADER_IF_NONE_MATCH;
+        candidate = "if-none-match";
+        break;
+    case 14:
+        // Letters only differ from their lowercase form in bit 0x20
+        if ((name[0] | 0x20) == 'c')
+        {
+            known = HTTP_HEADER_CONTENT_LENGTH;
+            candidate = "content-length";
+        }
+        else
+        {
+            known = HTTP_HEADER_HTTP2_SETTINGS;
+            candidate = "http2-settings";
+        }
+        break;
+    case 15:
+        known = HTTP_HEADER_ACCEPT_ENCODING;
+        candidate = "accept-encoding";
+        break;
+    case 17:
+        if ((name[0] | 0x20) == 't')
+        {
+            known = HTTP_HEADER_TRANSFER_ENCODING;
+            candidate = "transfer-encoding";
+        }
+        else
+        {
+            known = HTTP_HEADER_IF_MODIFIED_SINCE;
+            candidate = "if-modified-since";
+        }
+        break;
+    default:
+        return HTTP_HEADER_UNKNOWN;
+    }
+
+    return strncasecmp(name, candidate, length) == 0 ? known : HTTP_HEADER_UNKNOWN;
+}
+
+/* http_find_headers_end:
+ * Looks for the blank line ending the header block in buffer[0, length) without
+ * going over the bytes checked by previous calls, *position keeps track of that.
+ * Unlike strstr it does not stop at a NUL byte. Returns the number of bytes up to
+ * and including the blank line, or 0 if it has not arrived yet.
+ */
+size_t http_find_headers_end(const char *buffer, size_t *position, size_t length)
+{
+    const unsigned char *buf;
+    size_t p;
+
+    buf = (const unsigned char *)buffer;
+
+    // Earlier bytes are still in the buffer, so a blank line split between two calls is found too
+    p = *position > 3 ? *position : 3;
+    while ((p = scan_lf(buf, p, length)) < length)
+    {
+        if (buf[p - 1] == '\r' && buf[p - 2] == '\n' && buf[p - 3] == '\r')
+        {
+            *position = p + 1;
+            return p + 1;
+        }
+        p++;
+    }
+
+    *position = length;
+    return 0;
+}
+
+int http_slice_equals(const char *buffer, HTTP_Slice slice, const char *str)
+{
+    return strlen(str) == slice.length && memcmp(buffer + slice.offset, str, slice.length) == 0;
+}
+
+// Header names are case insensitive
+int http_slice_equals_nocase(const char *buffer, HTTP_Slice slice, const char *str)
+{
+    return strlen(str) == slice.length && strncasecmp(buffer + slice.offset, str, slice.length) == 0;
+}
+
+void http_chunk_decoder_init(HTTP_Chunk_Decoder *decoder)
+{
+    decoder->state = HTTP_CHUNK_SIZE;
+    decoder->read = 0;
+    decoder->written = 0;
+    decoder->remaining = 0;
+    decoder->size_digits = 0;
+}
+
+/* http_chunk_decode:
+ * Decodes body[read, length) in place. Returns HTTP_PARSE_DONE after the last
+ * chunk and its trailer section, read then being the length of the chunked
+ * body, HTTP_PARSE_INCOMPLETE when it needs more bytes or HTTP_PARSE_ERROR.
+ * The caller may drop body[written, read) between calls as long as it moves
+ * the rest down and sets read to written.
+ */
+int http_chunk_decode(HTTP_Chunk_Decoder *decoder, char *body, size_t length)
+{
+    size_t p, n;
+    int digit;
+
+    p = decoder->read;
+    while (p < length && decoder->state != HTTP_CHUNK_DONE)
+    {
+        switch (decoder->state)
+        {
+        case HTTP_CHUNK_SIZE:
+            digit = hex_value((unsigned char)body[p]);
+            if (digit >= 0)
+            {
+                if (decoder->remaining > (HTTP_CHUNKED_MAX_BODY >> 4))
+                {
+                    return HTTP_PARSE_ERROR;
+                }
+                decoder->remaining = decoder->remaining * 16 + digit;
+                decoder->size_digits++;
+                p++;
+                break;
+            }
+            if (decoder->size_digits == 0)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            if (body[p] == '\r')
+            {
+                decoder->state = HTTP_CHUNK_SIZE_LF;
+            }
+            else if (body[p] == ';' || body[p] == ' ' || body[p] == '\t')
+            {
+                decoder->state = HTTP_CHUNK_EXTENSION;
+            }
+            else
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            break;
+
+        case HTTP_CHUNK_EXTENSION:
+            if (body[p] == '\r')
+            {
+                decoder->state = HTTP_CHUNK_SIZE_LF;
+            }
+            else if (body[p] == '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            break;
+
+        case HTTP_CHUNK_SIZE_LF:
+            if (body[p] != '\n' || decoder->written + decoder->remaining > HTTP_CHUNKED_MAX_BODY)
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            decoder->state = decoder->remaining == 0 ? HTTP_CHUNK_TRAILER_START : HTTP_CHUNK_DATA;
+            break;
+
+        case HTTP_CHUNK_DATA:
+            // The data is the only long run, move as much of it as arrived at once
+            n = length - p;
+            if (n > decoder->remaining)
+            {
+                n = decoder->remaining;
+            }
+            if (decoder->written != p)
+            {
+                memmove(body + decoder->written, body + p, n);
+            }
+            decoder->written += n;
+            decoder->remaining -= n;
+            p += n;
+            if (decoder->remaining == 0)
+            {
+                decoder->state = HTTP_CHUNK_DATA_CR;
+            }
+            break;
+
+        case HTTP_CHUNK_DATA_CR:
+            if (body[p] != '\r')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            decoder->state = HTTP_CHUNK_DATA_LF;
+            break;
+
+        case HTTP_CHUNK_DATA_LF:
+            if (body[p] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            decoder->size_digits = 0;
+            decoder->state = HTTP_CHUNK_SIZE;
+            break;
+
+        case HTTP_CHUNK_TRAILER_START:
+            // After the last chunk: an empty line ends the body, anything else is a trailer field
+            if (body[p] == '\r')
+            {
+                decoder->state = HTTP_CHUNK_END_LF;
+                p++;
+            }
+            else
+            {
+                decoder->state = HTTP_CHUNK_TRAILER;
+            }
+            break;
+
+        case HTTP_CHUNK_TRAILER:
+            if (body[p] == '\r')
+            {
+                decoder->state = HTTP_CHUNK_TRAILER_LF;
+            }
+            p++;
+            break;
+
+        case HTTP_CHUNK_TRAILER_LF:
+            if (body[p] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            decoder->state = HTTP_CHUNK_TRAILER_START;
+            break;
+
+        case HTTP_CHUNK_END_LF:
+            if (body[p] != '\n')
+            {
+                return HTTP_PARSE_ERROR;
+            }
+            p++;
+            decoder->state = HTTP_CHUNK_DONE;
+            break;
+
+        case HTTP_CHUNK_DONE:
+            break;
+        }
+    }
+
+    decoder->read = p;
+    return decoder->state == HTTP_CHUNK_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_INCOMPLETE;
+}
+
+/* scan_uri:
+ * Returns the position of the first byte from p that cannot be part of the
+ * request target (space, control or non ASCII), or length if there is none.
+ */
+static size_t scan_uri(const unsigned char *buf, size_t p, size_t length)
+{
+#if defined(__AVX2__)
+    __m256i chunk, low, high;
+    unsigned int mask;
+
+    // Unsigned compares through min/max: byte <= 0x20 or byte >= 0x7f ends the URI
+    low = _mm256_set1_epi8(0x20);
+    high = _mm256_set1_epi8(0x7f);
+    while (p + 32 <= length)
+    {
+        chunk = _mm256_loadu_si256((const __m256i *)(buf + p));
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, low), chunk),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, high), chunk)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    __m128i chunk, low, high;
+    unsigned int mask;
+
+    // Unsigned compares through min/max: byte <= 0x20 or byte >= 0x7f ends the URI
+    low = _mm_set1_epi8(0x20);
+    high = _mm_set1_epi8(0x7f);
+    while (p + 16 <= length)
+    {
+        chunk = _mm_loadu_si128((const __m128i *)(buf + p));
+        mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(chunk, low), chunk),
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, high), chunk)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < length && (char_class[buf[p]] & CHAR_URI))
+    {
+        p++;
+    }
+    return p;
+}
+
+/* scan_value:
+ * Returns the position of the first control byte from p other than HTAB (so
+ * the CR ending the value or an invalid byte), or length if there is none.
+ */
+static size_t scan_value(const unsigned char *buf, size_t p, size_t length)
+{
+#if defined(__AVX2__)
+    __m256i chunk, ctl, tab, del;
+    unsigned int mask;
+
+    ctl = _mm256_set1_epi8(0x1f);
+    tab = _mm256_set1_epi8('\t');
+    del = _mm256_set1_epi8(0x7f);
+    while (p + 32 <= length)
+    {
+        chunk = _mm256_loadu_si256((const __m256i *)(buf + p));
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, ctl), chunk)),
+            _mm256_cmpeq_epi8(chunk, del)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    __m128i chunk, ctl, tab, del;
+    unsigned int mask;
+
+    ctl = _mm_set1_epi8(0x1f);
+    tab = _mm_set1_epi8('\t');
+    del = _mm_set1_epi8(0x7f);
+    while (p + 16 <= length)
+    {
+        chunk = _mm_loadu_si128((const __m128i *)(buf + p));
+        mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_andnot_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(_mm_min_epu8(chunk, ctl), chunk)),
+            _mm_cmpeq_epi8(chunk, del)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < length && (char_class[buf[p]] & CHAR_VALUE))
+    {
+        p++;
+    }
+    return p;
+}
+
+// Returns the position of the first LF from p, or length if there is none
+static size_t scan_lf(const unsigned char *buf, size_t p, size_t length)
+{
+#if defined(__AVX2__)
+    __m256i lf;
+    unsigned int mask;
+
+    lf = _mm256_set1_epi8('\n');
+    while (p + 32 <= length)
+    {
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + p)), lf));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    __m128i lf;
+    unsigned int mask;
+
+    lf = _mm_set1_epi8('\n');
+    while (p + 16 <= length)
+    {
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + p)), lf));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < length && buf[p] != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+static HTTP_Slice make_slice(size_t start, size_t end)
+{
+    HTTP_Slice slice;
+
+    slice.offset = (uint32_t)start;
+    slice.length = (uint32_t)(end - start);
+    return slice;
+}
+
+// Only HTTP/<digit>.<digit> is accepted
+static int valid_version(const unsigned char *version, size_t length)
+{
+    return length == 8 &&
+           memcmp(version, "HTTP/", 5) == 0 &&
+           version[5] >= '0' && version[5] <= '9' &&
+           version[6] == '.' &&
+           version[7] >= '0' && version[7] <= '9';
+}
+
+// Value of a hexadecimal digit, -1 for any other character
+static int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20; // Lowercase
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
@@ -0,0 +1,123 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+// Standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define HTTP_PARSER_MAX_HEADERS 64 // Requests with more header lines are rejected
+#define HTTP_CHUNKED_MAX_BODY 0x7fffffff // Decoded chunked bodies must fit in an int
+
+// Results of http_parser_execute
+#define HTTP_PARSE_DONE 0        // Request line and every header parsed
+#define HTTP_PARSE_INCOMPLETE 1  // Need more bytes, call again with the grown buffer
+#define HTTP_PARSE_ERROR -1      // Malformed request
+#define HTTP_PARSE_TOO_MANY -2   // More than HTTP_PARSER_MAX_HEADERS headers
+
+// Limits enforced on top of them by next_http_request
+#define HTTP_PARSE_HEADERS_TOO_LARGE -3 // Request line and headers longer than the receive buffer allows
+#define HTTP_PARSE_BODY_TOO_LARGE -4    // Body longer than the receive buffer allows
+
+// Headers recognized while parsing, so looking them up does not walk the header list
+typedef enum
+{
+    HTTP_HEADER_UNKNOWN = -1,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_HTTP2_SETTINGS,
+    HTTP_HEADER_KNOWN_COUNT
+} HTTP_Known_Header;
+
+typedef enum
+{
+    HTTP_PARSER_METHOD,
+    HTTP_PARSER_URI,
+    HTTP_PARSER_VERSION,
+    HTTP_PARSER_REQUEST_LINE_LF,
+    HTTP_PARSER_HEADER_START,
+    HTTP_PARSER_HEADER_NAME,
+    HTTP_PARSER_HEADER_VALUE_START,
+    HTTP_PARSER_HEADER_VALUE,
+    HTTP_PARSER_HEADER_LF,
+    HTTP_PARSER_HEADERS_END_LF,
+    HTTP_PARSER_DONE
+} HTTP_Parser_State;
+
+// Bytes of the receive buffer, the parser never copies them
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+} HTTP_Slice;
+
+typedef struct
+{
+    HTTP_Slice name;
+    HTTP_Slice value; // Without the surrounding whitespace
+} HTTP_Header_Slice;
+
+typedef struct
+{
+    HTTP_Parser_State state;
+    size_t position;    // Next byte to look at, bytes before it are never scanned again
+    size_t token_start; // Start of the token being parsed
+    HTTP_Slice method;
+    HTTP_Slice uri;
+    HTTP_Slice version;
+    HTTP_Header_Slice headers[HTTP_PARSER_MAX_HEADERS];
+    int header_count;
+    int16_t known[HTTP_HEADER_KNOWN_COUNT]; // Index in headers of the first occurrence, -1 if absent
+    size_t header_length; // Bytes up to and including the blank line, body starts here
+} HTTP_Parser;
+
+typedef enum
+{
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_EXTENSION,
+    HTTP_CHUNK_SIZE_LF,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,
+    HTTP_CHUNK_DATA_LF,
+    HTTP_CHUNK_TRAILER_START,
+    HTTP_CHUNK_TRAILER,
+    HTTP_CHUNK_TRAILER_LF,
+    HTTP_CHUNK_END_LF,
+    HTTP_CHUNK_DONE
+} HTTP_Chunk_State;
+
+/* HTTP_Chunk_Decoder:
+ * Resumable decoder for a chunked body. It decodes in place: chunk data is
+ * moved back over the size lines before it, so the decoded body is always
+ * body[0, written) and the bytes not looked at yet start at body[read].
+ * Chunk extensions and trailer fields are skipped.
+ */
+typedef struct
+{
+    HTTP_Chunk_State state;
+    size_t read;        // Next byte of the chunked body to look at
+    size_t written;     // Decoded bytes, always <= read
+    uint64_t remaining; // Bytes left in the current chunk, or its size while reading it
+    int size_digits;
+} HTTP_Chunk_Decoder;
+
+void http_parser_init(HTTP_Parser *parser);
+int http_parser_execute(HTTP_Parser *parser, const char *buffer, size_t length);
+HTTP_Known_Header http_known_header(const char *name, size_t length);
+size_t http_find_headers_end(const char *buffer, size_t *position, size_t length);
+int http_slice_equals(const char *buffer, HTTP_Slice slice, const char *str);
+int http_slice_equals_nocase(const char *buffer, HTTP_Slice slice, const char *str);
+void http_chunk_decoder_init(HTTP_Chunk_Decoder *decoder);
+int http_chunk_decode(HTTP_Chunk_Decoder *decoder, char *body, size_t length);
+
+#endif // HTTP_PARSER_H
@@ -0,0 +1,529 @@
+/**
+ * @file http_router.c
+ * @brief Method and path pattern to handler dispatch over a compressed trie
+ *
+ * Patterns are registered once at startup. A pattern is a path where a segment
+ * may be ":name", which captures that segment, and whose last segment may be
+ * "*name", which captures the rest of the path. Matching walks the trie along
+ * the path, so it costs the length of the path however many routes there are.
+ * Static children win over a parameter and a parameter wins over a wildcard;
+ * the next one is only tried if the path could not be matched below.
+ * Captures are used as file names, so one with a "." or ".." segment, or a
+ * wildcard starting with "/", does not match.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Other project headers
+#include "http.h"
+#include "http_parser.h"
+
+// Project header
+#include "http_router.h"
+
+// Static since it is only used inside this file
+static HTTP_Route_Node *create_route_node(HTTP_Route_Node_Type type, const char *prefix, size_t length);
+static void free_route_node(HTTP_Route_Node *node);
+static int add_route_child(HTTP_Route_Node *node, HTTP_Route_Node *child);
+static int split_route_node(HTTP_Route_Node *node, size_t at);
+static int render_allow_header(HTTP_Route_Node *node);
+static const HTTP_Route_Node *match_route_node(const HTTP_Route_Node *node, const char *path, size_t length, size_t position, HTTP_Route_Match *match);
+static int is_safe_capture(const char *value, size_t length);
+
+HTTP_Router *create_http_router(void)
+{
+    HTTP_Router *router;
+
+    router = (HTTP_Router *)malloc(sizeof(HTTP_Router));
+    if (router == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return NULL;
+    }
+    router->route_count = 0;
+    router->root = create_route_node(HTTP_ROUTE_NODE_STATIC, "", 0);
+    if (router->root == NULL)
+    {
+        free(router);
+        return NULL;
+    }
+    return router;
+}
+
+void free_http_router(HTTP_Router **router)
+{
+    if (router != NULL && *router != NULL)
+    {
+        free_route_node((*router)->root);
+        free(*router);
+        *router = NULL;
+    }
+}
+
+/* http_router_add:
+ * Registers handler for method and pattern. Returns -1 if the pattern is
+ * malformed, it was already registered for that method, or it names a
+ * parameter differently than a pattern registered before at the same place.
+ */
+int http_router_add(HTTP_Router *router, const char *method, const char *pattern, HTTP_Route_Handler handler)
+{
+    const char *p, *found;
+    size_t i, n;
+    HTTP_Route_Node *node, *child, **slot;
+    HTTP_Route *route, **last;
+
+    if (router == NULL || method == NULL || pattern == NULL || handler == NULL || pattern[0] != '/' || method[0] == '\0' || strlen(method) >= METHOD_SIZE)
+    {
+        fprintf(stderr, "Ruta inválida: %s %s\n", method != NULL ? method : "(null)", pattern != NULL ? pattern : "(null)");
+        return -1;
+    }
+
+    node = router->root;
+    p = pattern;
+    while (1)
+    {
+        if (node->type == HTTP_ROUTE_NODE_STATIC)
+        {
+            // Bytes shared with the node, the node is split where they stop being shared
+            for (i = 0; i < node->prefix_length && p[i] != '\0' && p[i] != ':' && p[i] != '*' && p[i] == node->prefix[i]; i++)
+                ;
+            if (i < node->prefix_length && split_route_node(node, i) < 0)
+            {
+                return -1;
+            }
+            p += i;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        if (*p == ':' || *p == '*')
+        {
+            // The name runs up to the next segment
+            n = strcspn(p + 1, "/");
+            if (n == 0 || (*p == '*' && p[1 + n] != '\0'))
+            {
+                fprintf(stderr, "Ruta inválida: %s %s: parámetro sin nombre o wildcard antes del final\n", method, pattern);
+                return -1;
+            }
+            slot = *p == ':' ? &node->param : &node->wildcard;
+            if (*slot == NULL)
+            {
+                *slot = create_route_node(*p == ':' ? HTTP_ROUTE_NODE_PARAM : HTTP_ROUTE_NODE_WILDCARD, p + 1, n);
+                if (*slot == NULL)
+                {
+                    return -1;
+                }
+            }
+            else if ((*slot)->prefix_length != n || memcmp((*slot)->prefix, p + 1, n) != 0)
+            {
+                fprintf(stderr, "Ruta inválida: %s %s: el parámetro %s ya existe con otro nombre\n", method, pattern, (*slot)->prefix);
+                return -1;
+            }
+            node = *slot;
+            p += 1 + n;
+            continue;
+        }
+
+        // Static bytes: follow the child that starts with them or add one
+        found = node->child_count > 0 ? memchr(node->indices, *p, node->child_count) : NULL;
+        if (found != NULL)
+        {
+            node = node->children[found - node->indices];
+            continue;
+        }
+        n = strcspn(p, ":*");
+        child = create_route_node(HTTP_ROUTE_NODE_STATIC, p, n);
+        if (child == NULL || add_route_child(node, child) < 0)
+        {
+            free_route_node(child);
+            return -1;
+        }
+        node = child;
+    }
+
+    // Methods keep the order they were registered in, it is the order Allow lists them
+    for (last = &node->routes; *last != NULL; last = &(*last)->next)
+    {
+        if (strcmp((*last)->method, method) == 0)
+        {
+            fprintf(stderr, "Ruta repetida: %s %s\n", method, pattern);
+            return -1;
+        }
+    }
+    route = (HTTP_Route *)malloc(sizeof(HTTP_Route));
+    if (route == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    strcpy(route->method, method);
+    route->pattern = pattern;
+    route->handler = handler;
+    route->next = NULL;
+    *last = route;
+    if (render_allow_header(node) < 0)
+    {
+        *last = NULL;
+        free(route);
+        return -1;
+    }
+    router->route_count++;
+    return 0;
+}
+
+/* http_router_match:
+ * Finds the route of method and the path of uri, the query string is not part
+ * of the path. On HTTP_ROUTE_FOUND match->route holds the handler and the
+ * captured parameters point into uri, which must outlive match.
+ */
+int http_router_match(const HTTP_Router *router, const char *method, const char *uri, HTTP_Route_Match *match)
+{
+    const HTTP_Route *route;
+
+    match->route = NULL;
+    match->node = NULL;
+    match->uri = uri;
+    match->path_length = strcspn(uri, "?");
+    match->param_count = 0;
+
+    match->node = match_route_node(router->root, uri, match->path_length, 0, match);
+    if (match->node == NULL)
+    {
+        return HTTP_ROUTE_NOT_FOUND;
+    }
+    for (route = match->node->routes; route != NULL; route = route->next)
+    {
+        if (strcmp(route->method, method) == 0)
+        {
+            match->route = route;
+            return HTTP_ROUTE_FOUND;
+        }
+    }
+    return HTTP_ROUTE_METHOD_NOT_ALLOWED;
+}
+
+// Value of the parameter captured as name, not terminated: length tells where it ends
+const char *http_route_param(const HTTP_Route_Match *match, const char *name, size_t *length)
+{
+    int i;
+
+    for (i = 0; i < match->param_count; i++)
+    {
+        if (strcmp(match->params[i].name, name) == 0)
+        {
+            *length = match->params[i].value.length;
+            return match->uri + match->params[i].value.offset;
+        }
+    }
+    *length = 0;
+    return NULL;
+}
+
+/* http_route_allowed_methods:
+ * Writes the methods registered for the matched path as an Allow header value
+ * ("GET, HEAD"). Returns its length or -1 if it does not fit in size.
+ */
+int http_route_allowed_methods(const HTTP_Route_Match *match, char *buffer, size_t size)
+{
+    size_t length, n;
+    const HTTP_Route *route;
+
+    length = 0;
+    if (size == 0)
+    {
+        return -1;
+    }
+    buffer[0] = '\0';
+    for (route = match->node != NULL ? match->node->routes : NULL; route != NULL; route = route->next)
+    {
+        n = strlen(route->method);
+        if (length + n + 3 > size)
+        {
+            return -1;
+        }
+        if (length > 0)
+        {
+            memcpy(buffer + length, ", ", 2);
+            length += 2;
+        }
+        memcpy(buffer + length, route->method, n + 1);
+        length += n;
+    }
+    return (int)length;
+}
+
+/* http_route_allow_header:
+ * "Allow: ...\r\n" line of the matched path, rendered when its routes were
+ * registered, so 405 and OPTIONS responses send it as is. NULL if the path
+ * did not match.
+ */
+const char *http_route_allow_header(const HTTP_Route_Match *match, size_t *length)
+{
+    if (match->node == NULL || match->node->allow == NULL)
+    {
+        *length = 0;
+        return NULL;
+    }
+    *length = match->node->allow_length;
+    return match->node->allow;
+}
+
+static HTTP_Route_Node *create_route_node(HTTP_Route_Node_Type type, const char *prefix, size_t length)
+{
+    HTTP_Route_Node *node;
+
+    node = (HTTP_Route_Node *)calloc(1, sizeof(HTTP_Route_Node));
+    if (node == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return NULL;
+    }
+    node->type = type;
+    node->prefix = (char *)malloc(length + 1);
+    if (node->prefix == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        free(node);
+        return NULL;
+    }
+    memcpy(node->prefix, prefix, length);
+    node->prefix[length] = '\0';
+    node->prefix_length = length;
+    return node;
+}
+
+static void free_route_node(HTTP_Route_Node *node)
+{
+    int i;
+    HTTP_Route *route, *next;
+
+    if (node == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < node->child_count; i++)
+    {
+        free_route_node(node->children[i]);
+    }
+    free_route_node(node->param);
+    free_route_node(node->wildcard);
+    for (route = node->routes; route != NULL; route = next)
+    {
+        next = route->next;
+        free(route);
+    }
+    free(node->allow);
+    free(node->children);
+    free(node->indices);
+    free(node->prefix);
+    free(node);
+}
+
+static int add_route_child(HTTP_Route_Node *node, HTTP_Route_Node *child)
+{
+    char *indices;
+    HTTP_Route_Node **children;
+
+    children = (HTTP_Route_Node **)realloc(node->children, sizeof(HTTP_Route_Node *) * (node->child_count + 1));
+    if (children == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    node->children = children;
+    indices = (char *)realloc(node->indices, node->child_count + 1);
+    if (indices == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    node->indices = indices;
+
+    node->children[node->child_count] = child;
+    node->indices[node->child_count] = child->prefix[0];
+    node->child_count++;
+    return 0;
+}
+
+// Moves prefix[at, ...) and everything below the node to a new child
+static int split_route_node(HTTP_Route_Node *node, size_t at)
+{
+    HTTP_Route_Node *child;
+
+    child = create_route_node(HTTP_ROUTE_NODE_STATIC, node->prefix + at, node->prefix_length - at);
+    if (child == NULL)
+    {
+        return -1;
+    }
+    child->indices = node->indices;
+    child->children = node->children;
+    child->child_count = node->child_count;
+    child->param = node->param;
+    child->wildcard = node->wildcard;
+    child->routes = node->routes;
+    child->allow = node->allow;
+    child->allow_length = node->allow_length;
+
+    node->indices = NULL;
+    node->children = NULL;
+    node->child_count = 0;
+    node->param = NULL;
+    node->wildcard = NULL;
+    node->routes = NULL;
+    node->allow = NULL;
+    node->allow_length = 0;
+    node->prefix[at] = '\0';
+    node->prefix_length = at;
+    if (add_route_child(node, child) < 0)
+    {
+        // Put everything back, the trie stays as it was
+        node->prefix[at] = child->prefix[0];
+        node->prefix_length += child->prefix_length;
+        node->indices = child->indices;
+        node->children = child->children;
+        node->child_count = child->child_count;
+        node->param = child->param;
+        node->wildcard = child->wildcard;
+        node->routes = child->routes;
+        node->allow = child->allow;
+        node->allow_length = child->allow_length;
+        free(child->prefix);
+        free(child);
+        return -1;
+    }
+    return 0;
+}
+
+// Node with routes that path[position, length) ends at below node, NULL if none
+static const HTTP_Route_Node *match_route_node(const HTTP_Route_Node *node, const char *path, size_t length, size_t position, HTTP_Route_Match *match)
+{
+    const char *found;
+    const HTTP_Route_Node *end;
+    size_t n;
+    int param_count;
+
+    param_count = match->param_count;
+    switch (node->type)
+    {
+    case HTTP_ROUTE_NODE_STATIC:
+        if (length - position < node->prefix_length || memcmp(path + position, node->prefix, node->prefix_length) != 0)
+        {
+            return NULL;
+        }
+        position += node->prefix_length;
+        break;
+
+    case HTTP_ROUTE_NODE_PARAM:
+        for (n = 0; position + n < length && path[position + n] != '/'; n++)
+            ;
+        if (n == 0 || param_count >= HTTP_ROUTE_MAX_PARAMS || !is_safe_capture(path + position, n))
+        {
+            return NULL;
+        }
+        match->params[param_count].name = node->prefix;
+        match->params[param_count].value.offset = (uint32_t)position;
+        match->params[param_count].value.length = (uint32_t)n;
+        match->param_count++;
+        position += n;
+        break;
+
+    case HTTP_ROUTE_NODE_WILDCARD:
+        if (position == length || param_count >= HTTP_ROUTE_MAX_PARAMS || !is_safe_capture(path + position, length - position))
+        {
+            return NULL;
+        }
+        match->params[param_count].name = node->prefix;
+        match->params[param_count].value.offset = (uint32_t)position;
+        match->params[param_count].value.length = (uint32_t)(length - position);
+        match->param_count++;
+        return node;
+    }
+
+    if (position == length)
+    {
+        if (node->routes != NULL)
+        {
+            return node;
+        }
+        match->param_count = param_count;
+        return NULL;
+    }
+
+    found = node->child_count > 0 ? memchr(node->indices, path[position], node->child_count) : NULL;
+    if (found != NULL && (end = match_route_node(node->children[found - node->indices], path, length, position, match)) != NULL)
+    {
+        return end;
+    }
+    if (node->param != NULL && (end = match_route_node(node->param, path, length, position, match)) != NULL)
+    {
+        return end;
+    }
+    if (node->wildcard != NULL && (end = match_route_node(node->wildcard, path, length, position, match)) != NULL)
+    {
+        return end;
+    }
+    match->param_count = param_count;
+    return NULL;
+}
+
+// Renders the Allow line of the node again, after a method was added to it
+static int render_allow_header(HTTP_Route_Node *node)
+{
+    char *allow;
+    size_t length;
+    const HTTP_Route *route;
+
+    length = strlen("Allow: \r\n");
+    for (route = node->routes; route != NULL; route = route->next)
+    {
+        length += strlen(route->method) + (route != node->routes ? 2 : 0);
+    }
+    allow = (char *)malloc(length + 1);
+    if (allow == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        return -1;
+    }
+    strcpy(allow, "Allow: ");
+    for (route = node->routes; route != NULL; route = route->next)
+    {
+        if (route != node->routes)
+        {
+            strcat(allow, ", ");
+        }
+        strcat(allow, route->method);
+    }
+    strcat(allow, "\r\n");
+
+    free(node->allow);
+    node->allow = allow;
+    node->allow_length = length;
+    return 0;
+}
+
+// Whether value[0, length) names nothing outside where it is captured: no "." or ".." segment, no leading "/"
+static int is_safe_capture(const char *value, size_t length)
+{
+    size_t start, end;
+
+    if (length > 0 && value[0] == '/')
+    {
+        return 0;
+    }
+    for (start = 0; start < length; start = end + 1)
+    {
+        for (end = start; end < length && value[end] != '/'; end++)
+            ;
+        if ((end - start == 1 && value[start] == '.') || (end - start == 2 && value[start] == '.' && value[start + 1] == '.'))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,90 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+// Standard library headers
+#include <stddef.h>
+
+// Shared headers
+#include "http.h"
+#include "http_parser.h"
+
+// Constants
+#define HTTP_ROUTE_MAX_PARAMS 8 // Parameters captured by one pattern
+
+// Results of http_router_match
+#define HTTP_ROUTE_FOUND 0
+#define HTTP_ROUTE_NOT_FOUND -1          // No pattern matches the path
+#define HTTP_ROUTE_METHOD_NOT_ALLOWED -2 // A pattern matches, but not for this method
+
+typedef enum
+{
+    HTTP_ROUTE_NODE_STATIC,  // Literal bytes of the path
+    HTTP_ROUTE_NODE_PARAM,   // ":name", one path segment
+    HTTP_ROUTE_NODE_WILDCARD // "*name", the rest of the path, always a leaf
+} HTTP_Route_Node_Type;
+
+typedef struct
+{
+    const char *name;
+    HTTP_Slice value; // Offsets into the URI that was matched
+} HTTP_Route_Param;
+
+struct HTTP_Route_Match;
+
+// Builds the response of a matched request, arg is whatever the caller passed to it
+typedef int (*HTTP_Route_Handler)(HTTP_Request *request, const struct HTTP_Route_Match *match, void *arg);
+
+typedef struct HTTP_Route
+{
+    char method[METHOD_SIZE];
+    const char *pattern; // As registered, for logging
+    HTTP_Route_Handler handler;
+    struct HTTP_Route *next; // Next method registered on the same node
+} HTTP_Route;
+
+/* HTTP_Route_Node:
+ * Node of a compressed trie (radix tree). A static node holds the longest run
+ * of bytes its patterns share, so a path is matched comparing each byte once
+ * instead of trying the patterns one by one. indices holds the first byte of
+ * each static child, in the same order as children.
+ */
+typedef struct HTTP_Route_Node
+{
+    HTTP_Route_Node_Type type;
+    char *prefix; // Literal bytes of a static node, name of a param or wildcard
+    size_t prefix_length;
+    char *indices;
+    struct HTTP_Route_Node **children;
+    int child_count;
+    struct HTTP_Route_Node *param;    // ":name" child, tried after the static ones
+    struct HTTP_Route_Node *wildcard; // "*name" child, tried last
+    HTTP_Route *routes;               // Patterns ending here, one per method
+    char *allow;                      // "Allow: <methods of routes>\r\n", NULL without routes
+    size_t allow_length;
+} HTTP_Route_Node;
+
+typedef struct
+{
+    HTTP_Route_Node *root;
+    int route_count;
+} HTTP_Router;
+
+typedef struct HTTP_Route_Match
+{
+    const HTTP_Route *route; // NULL unless HTTP_ROUTE_FOUND
+    const HTTP_Route_Node *node; // Node of the path, NULL if HTTP_ROUTE_NOT_FOUND
+    const char *uri;
+    size_t path_length; // Bytes of the URI before the query string
+    int param_count;
+    HTTP_Route_Param params[HTTP_ROUTE_MAX_PARAMS];
+} HTTP_Route_Match;
+
+HTTP_Router *create_http_router(void);
+void free_http_router(HTTP_Router **router);
+int http_router_add(HTTP_Router *router, const char *method, const char *pattern, HTTP_Route_Handler handler);
+int http_router_match(const HTTP_Router *router, const char *method, const char *uri, HTTP_Route_Match *match);
+const char *http_route_param(const HTTP_Route_Match *match, const char *name, size_t *length);
+int http_route_allowed_methods(const HTTP_Route_Match *match, char *buffer, size_t size);
+const char *http_route_allow_header(const HTTP_Route_Match *match, size_t *length);
+
+#endif // HTTP_ROUTER_H
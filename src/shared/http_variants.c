@@ -0,0 +1,518 @@
+/**
+ * @file http_variants.c
+ * @brief Precompressed variants of static files, chosen by Accept-Encoding
+ *
+ * A file is compressed once, ahead of time, into a sidecar next to it, and
+ * then served to every client that accepts that coding. No request pays for
+ * compression. Sidecars are found at startup by create_http_variant_index;
+ * http_variant_build_gzip adds a missing gzip one while the server runs.
+ */
+
+// Standard library headers
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+// System headers
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// Other project headers
+#include "http_mime.h"
+
+// Project header
+#include "http_variants.h"
+
+// Indexed by HTTP_Content_Coding
+static const char *coding_names[] = {"br", "zstd", "gzip", "identity"};
+static const char *coding_suffixes[] = {".br", ".zst", ".gz", ""};
+
+// Static since it is only used inside this file
+static int compare_variant_files(const void *a, const void *b);
+static int is_compressible(const char *name);
+static int parse_quality(const char *value);
+static int stat_in_folder(const char *folder, const char *name, struct stat *file_stat);
+static int write_all(int fd, const unsigned char *buffer, size_t length);
+
+/* create_http_variant_index:
+ * Lists the regular files of folder and marks, for each, the sidecars that
+ * are at least as new as it. Returns NULL if the folder cannot be read.
+ */
+HTTP_Variant_Index *create_http_variant_index(const char *folder)
+{
+    int i, capacity;
+    unsigned int coding;
+    size_t suffix_length;
+    struct dirent *entry;
+    struct stat file_stat, sidecar_stat;
+    DIR *dp;
+    HTTP_Variant_File *grown, *original;
+    HTTP_Variant_Index *index;
+
+    dp = opendir(folder);
+    if (dp == NULL)
+    {
+        fprintf(stderr, "Error al abrir carpeta %s: %s\n", folder, strerror(errno));
+        return NULL;
+    }
+    index = (HTTP_Variant_Index *)calloc(1, sizeof(HTTP_Variant_Index));
+    if (index == NULL || (index->folder = strdup(folder)) == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        free(index);
+        closedir(dp);
+        return NULL;
+    }
+
+    capacity = 0;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        if (entry->d_type != DT_REG && (entry->d_type != DT_UNKNOWN || stat_in_folder(folder, entry->d_name, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)))
+        {
+            continue;
+        }
+        if (index->count == capacity)
+        {
+            grown = (HTTP_Variant_File *)realloc(index->files, sizeof(HTTP_Variant_File) * (capacity > 0 ? capacity * 2 : 16));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+                closedir(dp);
+                free_http_variant_index(&index);
+                return NULL;
+            }
+            index->files = grown;
+            capacity = capacity > 0 ? capacity * 2 : 16;
+        }
+        memset(&index->files[index->count], 0, sizeof(HTTP_Variant_File));
+        index->files[index->count].name = strdup(entry->d_name);
+        if (index->files[index->count].name == NULL)
+        {
+            fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+            closedir(dp);
+            free_http_variant_index(&index);
+            return NULL;
+        }
+        index->files[index->count].name_length = strlen(entry->d_name);
+        index->files[index->count].compressible = is_compressible(entry->d_name);
+        index->count++;
+    }
+    closedir(dp);
+    if (index->count > 0)
+    {
+        qsort(index->files, index->count, sizeof(HTTP_Variant_File), compare_variant_files);
+    }
+
+    // A sidecar counts when its file is there and it was written after it
+    for (i = 0; i < index->count; i++)
+    {
+        for (coding = 0; coding < HTTP_CODING_COUNT; coding++)
+        {
+            suffix_length = strlen(coding_suffixes[coding]);
+            if (index->files[i].name_length <= suffix_length ||
+                strcmp(index->files[i].name + index->files[i].name_length - suffix_length, coding_suffixes[coding]) != 0)
+            {
+                continue;
+            }
+            original = http_variant_find(index, index->files[i].name, index->files[i].name_length - suffix_length);
+            if (original != NULL && stat_in_folder(folder, original->name, &file_stat) == 0 &&
+                stat_in_folder(folder, index->files[i].name, &sidecar_stat) == 0 && http_variant_is_current(&file_stat, &sidecar_stat))
+            {
+                original->codings |= 1u << coding;
+            }
+        }
+    }
+    return index;
+}
+
+void free_http_variant_index(HTTP_Variant_Index **index)
+{
+    int i;
+
+    if (index != NULL && *index != NULL)
+    {
+        for (i = 0; i < (*index)->count; i++)
+        {
+            free((*index)->files[i].name);
+        }
+        free((*index)->files);
+        free((*index)->folder);
+        free(*index);
+        *index = NULL;
+    }
+}
+
+// File named name[0, length), NULL if the folder had none
+HTTP_Variant_File *http_variant_find(const HTTP_Variant_Index *index, const char *name, size_t length)
+{
+    int low, high, middle, cmp;
+
+    low = 0;
+    high = index->count - 1;
+    while (low <= high)
+    {
+        middle = low + (high - low) / 2;
+        cmp = strncmp(index->files[middle].name, name, length);
+        if (cmp == 0)
+        {
+            cmp = index->files[middle].name_length == length ? 0 : 1;
+        }
+        if (cmp == 0)
+        {
+            return &index->files[middle];
+        }
+        if (cmp < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return NULL;
+}
+
+/* http_variant_is_sidecar:
+ * Whether name is a sidecar in use of another file, listings leave those out.
+ * One older than its file is not served, so it is listed like any other file.
+ */
+int http_variant_is_sidecar(const HTTP_Variant_Index *index, const char *name)
+{
+    unsigned int coding;
+    size_t length, suffix_length;
+    struct stat file_stat, sidecar_stat;
+    const HTTP_Variant_File *original;
+
+    length = strlen(name);
+    for (coding = 0; coding < HTTP_CODING_COUNT; coding++)
+    {
+        suffix_length = strlen(coding_suffixes[coding]);
+        if (length > suffix_length && strcmp(name + length - suffix_length, coding_suffixes[coding]) == 0)
+        {
+            original = http_variant_find(index, name, length - suffix_length);
+            if (original != NULL && (http_variant_codings(original) & (1u << coding)) != 0 &&
+                stat_in_folder(index->folder, original->name, &file_stat) == 0 && stat_in_folder(index->folder, name, &sidecar_stat) == 0 &&
+                http_variant_is_current(&file_stat, &sidecar_stat))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* http_variant_select:
+ * Variant of file to send for an Accept-Encoding: the coding with the highest
+ * quality among the sidecars, the preferred one on a tie. Without the header,
+ * or when nothing it accepts is available, the file as it is.
+ */
+HTTP_Content_Coding http_variant_select(const HTTP_Variant_File *file, const char *accept_encoding)
+{
+    unsigned int codings, coding;
+    int quality, best_quality;
+    HTTP_Content_Coding best;
+
+    codings = http_variant_codings(file);
+    if (accept_encoding == NULL || codings == 0)
+    {
+        return HTTP_CODING_IDENTITY;
+    }
+    best = HTTP_CODING_IDENTITY;
+    best_quality = 0;
+    for (coding = 0; coding < HTTP_CODING_COUNT; coding++)
+    {
+        if ((codings & (1u << coding)) == 0)
+        {
+            continue;
+        }
+        quality = http_accept_encoding_quality(accept_encoding, coding_names[coding]);
+        if (quality > best_quality)
+        {
+            best = (HTTP_Content_Coding)coding;
+            best_quality = quality;
+        }
+    }
+    return best;
+}
+
+/* http_accept_encoding_quality:
+ * Quality an Accept-Encoding value gives coding, in thousandths: 1000 when it
+ * is listed without q, 0 when it is refused or not listed. "*" stands for any
+ * coding the value does not name.
+ */
+int http_accept_encoding_quality(const char *accept_encoding, const char *coding)
+{
+    const char *p, *token;
+    size_t token_length, coding_length;
+    int quality, wildcard;
+
+    coding_length = strlen(coding);
+    wildcard = -1;
+    p = accept_encoding;
+    while (1)
+    {
+        p += strspn(p, " \t,");
+        if (*p == '\0')
+        {
+            break;
+        }
+        token = p;
+        token_length = strcspn(p, " \t,;");
+        p += token_length;
+
+        // Parameters up to the next element, only q matters
+        quality = 1000;
+        while (*p != '\0' && *p != ',')
+        {
+            p += strspn(p, " \t;");
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=')
+            {
+                quality = parse_quality(p + 2);
+            }
+            p += strcspn(p, ";,");
+        }
+
+        if (token_length == coding_length && strncasecmp(token, coding, coding_length) == 0)
+        {
+            return quality;
+        }
+        if (token_length == 1 && token[0] == '*')
+        {
+            wildcard = quality;
+        }
+    }
+    return wildcard > 0 ? wildcard : 0;
+}
+
+// Bit per HTTP_Content_Coding of the sidecars of file, 0 if it has none
+unsigned int http_variant_codings(const HTTP_Variant_File *file)
+{
+    return __atomic_load_n(&file->codings, __ATOMIC_ACQUIRE);
+}
+
+// Marks the sidecar of coding as unusable, returns whether it was marked available until now
+int http_variant_drop(HTTP_Variant_File *file, HTTP_Content_Coding coding)
+{
+    return (__atomic_fetch_and(&file->codings, ~(1u << coding), __ATOMIC_ACQ_REL) & (1u << coding)) != 0;
+}
+
+// Whether a sidecar was written after its file, or at the same time
+int http_variant_is_current(const struct stat *file_stat, const struct stat *sidecar_stat)
+{
+    return sidecar_stat->st_mtim.tv_sec > file_stat->st_mtim.tv_sec ||
+           (sidecar_stat->st_mtim.tv_sec == file_stat->st_mtim.tv_sec && sidecar_stat->st_mtim.tv_nsec >= file_stat->st_mtim.tv_nsec);
+}
+
+const char *http_coding_name(HTTP_Content_Coding coding)
+{
+    return coding_names[coding];
+}
+
+const char *http_coding_suffix(HTTP_Content_Coding coding)
+{
+    return coding_suffixes[coding];
+}
+
+/* http_variant_build_gzip:
+ * Writes the gzip sidecar of file and marks it available once it is complete.
+ * The output goes to a temporary name first, so a request never opens half a
+ * sidecar. Returns 1 if built, 0 if compressing did not make the file smaller,
+ * -1 on error.
+ */
+int http_variant_build_gzip(const HTTP_Variant_Index *index, HTTP_Variant_File *file)
+{
+    unsigned char *input, *output;
+    char *path, *sidecar, *temporary;
+    size_t length;
+    ssize_t bytes_read;
+    int input_fd, output_fd, flush, ret_val, zlib_ret;
+    uLong original_size;
+    z_stream stream;
+
+    length = strlen(index->folder) + 1 + file->name_length;
+    path = (char *)malloc(length + 1);
+    sidecar = (char *)malloc(length + sizeof(".gz"));
+    temporary = (char *)malloc(length + sizeof(".gz.tmp"));
+    input = (unsigned char *)malloc(HTTP_VARIANT_BUFFER_SIZE);
+    output = (unsigned char *)malloc(HTTP_VARIANT_BUFFER_SIZE);
+    if (path == NULL || sidecar == NULL || temporary == NULL || input == NULL || output == NULL)
+    {
+        fprintf(stderr, "Error al asignar memoria: %s\n", strerror(errno));
+        free(path);
+        free(sidecar);
+        free(temporary);
+        free(input);
+        free(output);
+        return -1;
+    }
+    sprintf(path, "%s/%s", index->folder, file->name);
+    sprintf(sidecar, "%s.gz", path);
+    sprintf(temporary, "%s.gz.tmp", path);
+
+    ret_val = -1;
+    input_fd = open(path, O_RDONLY);
+    output_fd = input_fd >= 0 ? open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    memset(&stream, 0, sizeof(stream));
+    // 16 + 15 bits of window: a gzip header and trailer around the deflate stream
+    if (output_fd < 0 || deflateInit2(&stream, HTTP_VARIANT_GZIP_LEVEL, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        fprintf(stderr, "Error al preparar %s: %s\n", sidecar, strerror(errno));
+        if (input_fd >= 0)
+        {
+            close(input_fd);
+        }
+        if (output_fd >= 0)
+        {
+            close(output_fd);
+            unlink(temporary);
+        }
+        free(path);
+        free(sidecar);
+        free(temporary);
+        free(input);
+        free(output);
+        return -1;
+    }
+
+    original_size = 0;
+    do
+    {
+        bytes_read = read(input_fd, input, HTTP_VARIANT_BUFFER_SIZE);
+        if (bytes_read < 0)
+        {
+            fprintf(stderr, "Error al leer %s: %s\n", path, strerror(errno));
+            break;
+        }
+        original_size += bytes_read;
+        flush = bytes_read == 0 ? Z_FINISH : Z_NO_FLUSH;
+        stream.next_in = input;
+        stream.avail_in = (uInt)bytes_read;
+        do
+        {
+            stream.next_out = output;
+            stream.avail_out = HTTP_VARIANT_BUFFER_SIZE;
+            zlib_ret = deflate(&stream, flush);
+            if (write_all(output_fd, output, HTTP_VARIANT_BUFFER_SIZE - stream.avail_out) < 0)
+            {
+                fprintf(stderr, "Error al escribir %s: %s\n", temporary, strerror(errno));
+                zlib_ret = Z_ERRNO;
+                break;
+            }
+        } while (stream.avail_out == 0);
+        if (zlib_ret == Z_ERRNO)
+        {
+            break;
+        }
+        if (zlib_ret == Z_STREAM_END)
+        {
+            ret_val = stream.total_out < original_size ? 1 : 0;
+        }
+    } while (flush != Z_FINISH);
+    deflateEnd(&stream);
+    close(input_fd);
+    if (close(output_fd) != 0)
+    {
+        ret_val = -1;
+    }
+
+    // Published only when complete and worth it, rename replaces atomically
+    if (ret_val == 1 && rename(temporary, sidecar) == 0)
+    {
+        __atomic_or_fetch(&file->codings, 1u << HTTP_CODING_GZIP, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        if (ret_val == 1)
+        {
+            fprintf(stderr, "Error al renombrar %s: %s\n", temporary, strerror(errno));
+            ret_val = -1;
+        }
+        unlink(temporary);
+    }
+
+    free(path);
+    free(sidecar);
+    free(temporary);
+    free(input);
+    free(output);
+    return ret_val;
+}
+
+static int compare_variant_files(const void *a, const void *b)
+{
+    return strcmp(((const HTTP_Variant_File *)a)->name, ((const HTTP_Variant_File *)b)->name);
+}
+
+// Text types compress well, images and archives are compressed already
+static int is_compressible(const char *name)
+{
+    const char *extension, *type;
+
+    extension = strrchr(name, '.');
+    if (extension == NULL)
+    {
+        return 0;
+    }
+    type = get_content_type(extension);
+    return strncmp(type, "text/", 5) == 0 || strcmp(type, "application/javascript") == 0 || strcmp(type, "application/json") == 0 ||
+           strcmp(type, "application/xml") == 0 || strcmp(type, "image/svg+xml") == 0;
+}
+
+// "1", "0.8", "0.125" in thousandths, anything else counts as 0
+static int parse_quality(const char *value)
+{
+    int quality, i;
+
+    if (value[0] != '0' && value[0] != '1')
+    {
+        return 0;
+    }
+    quality = (value[0] - '0') * 1000;
+    if (value[1] == '.')
+    {
+        for (i = 0; i < 3 && value[2 + i] >= '0' && value[2 + i] <= '9'; i++)
+        {
+            quality += (value[2 + i] - '0') * (i == 0 ? 100 : i == 1 ? 10 : 1);
+        }
+    }
+    return quality > 1000 ? 1000 : quality;
+}
+
+static int stat_in_folder(const char *folder, const char *name, struct stat *file_stat)
+{
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%s", folder, name) >= (int)sizeof(path))
+    {
+        return -1;
+    }
+    return stat(path, file_stat);
+}
+
+static int write_all(int fd, const unsigned char *buffer, size_t length)
+{
+    ssize_t written;
+
+    while (length > 0)
+    {
+        written = write(fd, buffer, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return 0;
+}
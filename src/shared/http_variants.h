@@ -0,0 +1,60 @@
+#ifndef HTTP_VARIANTS_H
+#define HTTP_VARIANTS_H
+
+// Standard library headers
+#include <stddef.h>
+
+// System headers
+#include <sys/stat.h>
+
+// Constants
+#define HTTP_VARIANT_GZIP_LEVEL 9     // Built once and served many times, so the smallest output wins
+#define HTTP_VARIANT_BUFFER_SIZE 65536 // Bytes read and written per step while building a variant
+#define HTTP_VARIANT_SUFFIX_SIZE 5     // Longest sidecar suffix, ".zst", + '\0'
+
+// Content codings a file can have a variant in, in the order the server prefers them
+typedef enum
+{
+    HTTP_CODING_BR,
+    HTTP_CODING_ZSTD,
+    HTTP_CODING_GZIP,
+    HTTP_CODING_COUNT,
+    HTTP_CODING_IDENTITY = HTTP_CODING_COUNT // The file as it is
+} HTTP_Content_Coding;
+
+typedef struct
+{
+    char *name; // Inside the folder of the index
+    size_t name_length;
+    int compressible; // Text, a gzip variant can be built for it
+    unsigned int codings; // Bit per HTTP_Content_Coding with a sidecar, set atomically when one is built
+} HTTP_Variant_File;
+
+/* HTTP_Variant_Index:
+ * Regular files of a folder and the precompressed sidecars next to them,
+ * "name.br", "name.zst" and "name.gz". Built at startup, so a request finds
+ * the variants of its file with a binary search instead of trying to open
+ * each of them. Sidecars older than their file are left out, and a file
+ * that changes later is checked again whenever its sidecar is opened.
+ */
+typedef struct
+{
+    char *folder;
+    HTTP_Variant_File *files; // Sorted by name
+    int count;
+} HTTP_Variant_Index;
+
+HTTP_Variant_Index *create_http_variant_index(const char *folder);
+void free_http_variant_index(HTTP_Variant_Index **index);
+HTTP_Variant_File *http_variant_find(const HTTP_Variant_Index *index, const char *name, size_t length);
+int http_variant_is_sidecar(const HTTP_Variant_Index *index, const char *name);
+unsigned int http_variant_codings(const HTTP_Variant_File *file);
+int http_variant_drop(HTTP_Variant_File *file, HTTP_Content_Coding coding);
+int http_variant_is_current(const struct stat *file_stat, const struct stat *sidecar_stat);
+HTTP_Content_Coding http_variant_select(const HTTP_Variant_File *file, const char *accept_encoding);
+int http_accept_encoding_quality(const char *accept_encoding, const char *coding);
+const char *http_coding_name(HTTP_Content_Coding coding);
+const char *http_coding_suffix(HTTP_Content_Coding coding);
+int http_variant_build_gzip(const HTTP_Variant_Index *index, HTTP_Variant_File *file);
+
+#endif // HTTP_VARIANTS_H
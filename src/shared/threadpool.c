@@ -17,11 +17,20 @@
 #include "threadpool.h"
 
 // Static since it is only used inside this file
-static void *threadpool_thread(void *threadpool);
+static void *threadpool_thread(void *worker);
+static void *threadpool_watchdog(void *arg);
+static int threadpool_task_dropped(threadpool_task_t *task);
+static threadpool_task_t *threadpool_next_task(threadpool_t *pool, threadpool_worker_t *self);
+static threadpool_task_t *threadpool_pop_local(threadpool_t *pool, threadpool_worker_t *worker);
+static void threadpool_notify(threadpool_t *pool, threadpool_worker_t *owner);
+static void threadpool_release(threadpool_t *pool, threadpool_task_t *task);
+static void threadpool_finish(threadpool_t *pool, threadpool_task_t *task);
+static long threadpool_elapsed_ms(const struct timespec *since);
 
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
 {
     threadpool_t *pool;
+    pthread_condattr_t condattr;
     int i;
 
     if ((pool = (threadpool_t *)malloc(sizeof(threadpool_t))) == NULL)
@@ -33,25 +42,61 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
     pool->queue_size = queue_size;
     pool->head = pool->tail = pool->count = 0;
     pool->shutdown = pool->started = 0;
+    pool->watchdog_running = 0;
+    pool->watchdog_ms = 0;
+    pool->watchdog_handler = NULL;
+    pool->watchdog_user = NULL;
+
+    // Enough slots for a full shared queue plus a full local queue and a running task per worker
+    pool->slot_count = queue_size + thread_count * (THREADPOOL_LOCAL_QUEUE_SIZE + 1);
+    pool->free_count = pool->slot_count;
 
     pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
-    pool->task_queue = (threadpool_task_t *)malloc(sizeof(threadpool_task_t) * queue_size);
+    pool->workers = (threadpool_worker_t *)calloc(thread_count, sizeof(threadpool_worker_t));
+    pool->tasks = (threadpool_task_t *)malloc(sizeof(threadpool_task_t) * pool->slot_count);
+    pool->free_slots = (int *)malloc(sizeof(int) * pool->slot_count);
+    pool->task_queue = (int *)malloc(sizeof(int) * queue_size);
+
+    // The watchdog sleeps on a monotonic clock like the task deadlines
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
 
     if ((pthread_mutex_init(&(pool->lock), NULL) != 0) ||
-        (pthread_cond_init(&(pool->notify), NULL) != 0) ||
+        (pthread_cond_init(&(pool->watchdog_notify), &condattr) != 0) ||
+        (pthread_key_create(&(pool->worker_key), NULL) != 0) ||
         (pool->threads == NULL) ||
+        (pool->workers == NULL) ||
+        (pool->tasks == NULL) ||
+        (pool->free_slots == NULL) ||
         (pool->task_queue == NULL))
     {
+        pthread_condattr_destroy(&condattr);
         if (pool)
         {
             threadpool_free(pool);
         }
         return NULL;
     }
+    pthread_condattr_destroy(&condattr);
+
+    for (i = 0; i < pool->slot_count; i++)
+    {
+        pool->free_slots[i] = pool->slot_count - 1 - i;
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        if (pthread_cond_init(&(pool->workers[i].notify), NULL) != 0)
+        {
+            threadpool_free(pool);
+            return NULL;
+        }
+        pool->workers[i].pool = pool;
+    }
 
     for (i = 0; i < thread_count; i++)
     {
-        if (pthread_create(&(pool->threads[i]), NULL, threadpool_thread, (void *)pool) != 0)
+        if (pthread_create(&(pool->threads[i]), NULL, threadpool_thread, (void *)&pool->workers[i]) != 0)
         {
             threadpool_destroy(pool, 0);
             return NULL;
@@ -64,7 +109,14 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
 
 int threadpool_add(threadpool_t *pool, void *(*function)(void *), void *argument, threadpool_task_t **task_out, int flags)
 {
-    int next, err = 0;
+    return threadpool_add_with_options(pool, function, argument, task_out, flags, NULL);
+}
+
+int threadpool_add_with_options(threadpool_t *pool, void *(*function)(void *), void *argument, threadpool_task_t **task_out, int flags, const threadpool_options_t *options)
+{
+    int next, slot, err = 0;
+    threadpool_task_t *task;
+    threadpool_worker_t *owner;
 
     if (pool == NULL || function == NULL)
     {
@@ -80,39 +132,85 @@ int threadpool_add(threadpool_t *pool, void *(*function)(void *), void *argument
 
     do
     {
-        if (pool->count == pool->queue_size)
+        if (pool->shutdown)
         {
-            err = THREADPOOL_QUEUE_FULL;
+            err = THREADPOOL_SHUTDOWN;
             break;
         }
 
-        if (pool->shutdown)
+        // Keep tasks with the same key on one worker so their data stays in its cache,
+        // unless that worker already has a full backlog
+        owner = NULL;
+        if (options != NULL && options->affinity_key >= 0)
         {
-            err = THREADPOOL_SHUTDOWN;
-            break;
+            owner = &(pool->workers[options->affinity_key % pool->thread_count]);
+            if (owner->local_count == THREADPOOL_LOCAL_QUEUE_SIZE)
+            {
+                owner = NULL;
+            }
         }
 
-        pool->task_queue[pool->tail].function = function;
-        pool->task_queue[pool->tail].argument = argument;
-        pool->task_queue[pool->tail].result = NULL;
-        pool->task_queue[pool->tail].thread = &pool->threads[pool->tail];
-        pool->task_queue[pool->tail].done = 0;
-        pthread_mutex_init(&pool->task_queue[pool->tail].task_mutex, NULL);
-        pthread_cond_init(&pool->task_queue[pool->tail].task_complete, NULL);
+        // Slots still held by tasks nobody has waited for yet also count as a full queue
+        if ((owner == NULL && pool->count == pool->queue_size) || pool->free_count == 0)
+        {
+            err = THREADPOOL_QUEUE_FULL;
+            break;
+        }
+        slot = pool->free_slots[--pool->free_count];
+        task = &(pool->tasks[slot]);
 
-        if (task_out)
+        if (owner != NULL)
+        {
+            owner->local_queue[owner->local_tail] = slot;
+            task->thread = &pool->threads[owner - pool->workers];
+            owner->local_tail = (owner->local_tail + 1) % THREADPOOL_LOCAL_QUEUE_SIZE;
+            owner->local_count += 1;
+        }
+        else
         {
-            *task_out = &(pool->task_queue[pool->tail]);
+            pool->task_queue[pool->tail] = slot;
+            task->thread = &pool->threads[slot % pool->thread_count];
+            pool->tail = next;
+            pool->count += 1;
         }
 
-        pool->tail = next;
-        pool->count += 1;
+        task->affinity_key = THREADPOOL_NO_AFFINITY;
+        task->pool = pool;
+        task->waited = (task_out != NULL);
+        task->function = function;
+        task->argument = argument;
+        task->result = NULL;
+        task->done = 0;
+        task->status = 0;
+        task->has_deadline = 0;
+        task->token = NULL;
+        pthread_mutex_init(&task->task_mutex, NULL);
+        pthread_cond_init(&task->task_complete, NULL);
 
-        if (pthread_cond_signal(&(pool->notify)) != 0)
+        if (options != NULL)
         {
-            err = THREADPOOL_LOCK_FAILURE;
-            break;
+            task->token = options->token;
+            task->affinity_key = options->affinity_key;
+            if (options->timeout_ms > 0)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &task->deadline);
+                task->deadline.tv_sec += options->timeout_ms / 1000;
+                task->deadline.tv_nsec += (options->timeout_ms % 1000) * 1000000L;
+                if (task->deadline.tv_nsec >= 1000000000L)
+                {
+                    task->deadline.tv_sec += 1;
+                    task->deadline.tv_nsec -= 1000000000L;
+                }
+                task->has_deadline = 1;
+            }
+        }
+
+        if (task_out)
+        {
+            *task_out = task;
         }
+
+        threadpool_notify(pool, owner);
     } while (0);
 
     if (pthread_mutex_unlock(&pool->lock) != 0)
@@ -125,6 +223,19 @@ int threadpool_add(threadpool_t *pool, void *(*function)(void *), void *argument
 
 void *threadpool_wait(threadpool_task_t *task)
 {
+    return threadpool_wait_with_status(task, NULL);
+}
+
+/* threadpool_wait_with_status:
+ * Blocks until the task is done and returns its result.
+ * The task slot goes back to the pool here, so the task must not be touched
+ * afterwards; status receives 0 if the function ran or the THREADPOOL_TASK_*
+ * reason it was dropped.
+ */
+void *threadpool_wait_with_status(threadpool_task_t *task, int *status)
+{
+    void *result;
+
     if (task == NULL || task->thread == NULL)
     {
         return NULL;
@@ -137,7 +248,17 @@ void *threadpool_wait(threadpool_task_t *task)
     }
     pthread_mutex_unlock(&task->task_mutex);
 
-    return task->result; // Return the stored result
+    result = task->result; // Return the stored result
+    if (status != NULL)
+    {
+        *status = task->status;
+    }
+
+    pthread_mutex_lock(&(task->pool->lock));
+    threadpool_release(task->pool, task);
+    pthread_mutex_unlock(&(task->pool->lock));
+
+    return result;
 }
 
 int threadpool_destroy(threadpool_t *pool, int flags)
@@ -164,8 +285,13 @@ int threadpool_destroy(threadpool_t *pool, int flags)
 
         pool->shutdown = (flags & THREADPOOL_GRACEFUL) ? THREADPOOL_GRACEFUL : 1;
 
-        if ((pthread_cond_broadcast(&(pool->notify)) != 0) ||
-            (pthread_mutex_unlock(&(pool->lock)) != 0))
+        for (i = 0; i < pool->thread_count; i++)
+        {
+            pthread_cond_broadcast(&(pool->workers[i].notify));
+        }
+        pthread_cond_signal(&(pool->watchdog_notify));
+
+        if (pthread_mutex_unlock(&(pool->lock)) != 0)
         {
             err = THREADPOOL_LOCK_FAILURE;
             break;
@@ -179,6 +305,16 @@ int threadpool_destroy(threadpool_t *pool, int flags)
                 break;
             }
         }
+
+        if (!err && pool->watchdog_running)
+        {
+            if (pthread_join(pool->watchdog, NULL) != 0)
+            {
+                err = THREADPOOL_THREAD_FAILURE;
+                break;
+            }
+            pool->watchdog_running = 0;
+        }
     } while (0);
 
     if (!err)
@@ -191,6 +327,8 @@ int threadpool_destroy(threadpool_t *pool, int flags)
 
 int threadpool_free(threadpool_t *pool)
 {
+    int i;
+
     if (pool == NULL || pool->started > 0)
     {
         return THREADPOOL_INVALID;
@@ -201,58 +339,397 @@ int threadpool_free(threadpool_t *pool)
         free(pool->threads);
     }
 
+    if (pool->workers)
+    {
+        for (i = 0; i < pool->thread_count; i++)
+        {
+            pthread_cond_destroy(&(pool->workers[i].notify));
+        }
+        free(pool->workers);
+    }
+
+    if (pool->tasks)
+    {
+        free(pool->tasks);
+    }
+
+    if (pool->free_slots)
+    {
+        free(pool->free_slots);
+    }
+
     if (pool->task_queue)
     {
         free(pool->task_queue);
     }
 
+    pthread_key_delete(pool->worker_key);
+    pthread_cond_destroy(&(pool->watchdog_notify));
     pthread_mutex_lock(&(pool->lock));
     pthread_mutex_destroy(&(pool->lock));
-    pthread_cond_destroy(&(pool->notify));
 
     free(pool);
     return 0;
 }
 
-static void *threadpool_thread(void *threadpool)
+/* threadpool_arena:
+ * Returns the arena of the worker running the caller, or NULL outside a worker.
+ * Memory taken from it is only valid until the current task returns, so it must
+ * never be used for the task result or for state shared with later tasks.
+ */
+Arena *threadpool_arena(threadpool_t *pool)
+{
+    threadpool_worker_t *worker;
+
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    worker = (threadpool_worker_t *)pthread_getspecific(pool->worker_key);
+    if (worker == NULL)
+    {
+        return NULL;
+    }
+    return worker->arena;
+}
+
+void threadpool_token_init(threadpool_token_t *token)
+{
+    if (token != NULL)
+    {
+        token->cancelled = 0;
+    }
+}
+
+void threadpool_cancel(threadpool_token_t *token)
+{
+    if (token != NULL)
+    {
+        token->cancelled = 1;
+    }
+}
+
+/* threadpool_cancelled:
+ * Polled by long running tasks to find out if they should stop early.
+ * Returns 1 if the task run by the calling worker was cancelled or went past
+ * its deadline, 0 otherwise (also when called outside a worker).
+ */
+int threadpool_cancelled(threadpool_t *pool)
+{
+    threadpool_worker_t *worker;
+
+    if (pool == NULL)
+    {
+        return 0;
+    }
+
+    worker = (threadpool_worker_t *)pthread_getspecific(pool->worker_key);
+    if (worker == NULL || worker->task == NULL)
+    {
+        return 0;
+    }
+    return threadpool_task_dropped(worker->task) != 0;
+}
+
+/* threadpool_watchdog_start:
+ * Starts a thread that reports tasks running for longer than threshold_ms, so a
+ * handler blocked on a misbehaving peer shows up before the pool runs out of
+ * workers. Each stuck task is reported once through handler.
+ */
+int threadpool_watchdog_start(threadpool_t *pool, long threshold_ms, threadpool_stuck_handler_t handler, void *user)
+{
+    int err = 0;
+
+    if (pool == NULL || handler == NULL || threshold_ms <= 0)
+    {
+        return THREADPOOL_INVALID;
+    }
+
+    if (pthread_mutex_lock(&(pool->lock)) != 0)
+    {
+        return THREADPOOL_LOCK_FAILURE;
+    }
+
+    do
+    {
+        if (pool->shutdown || pool->watchdog_running)
+        {
+            err = THREADPOOL_INVALID;
+            break;
+        }
+
+        pool->watchdog_ms = threshold_ms;
+        pool->watchdog_handler = handler;
+        pool->watchdog_user = user;
+        if (pthread_create(&(pool->watchdog), NULL, threadpool_watchdog, (void *)pool) != 0)
+        {
+            err = THREADPOOL_THREAD_FAILURE;
+            break;
+        }
+        pool->watchdog_running = 1;
+    } while (0);
+
+    if (pthread_mutex_unlock(&(pool->lock)) != 0)
+    {
+        err = THREADPOOL_LOCK_FAILURE;
+    }
+
+    return err;
+}
+
+// Returns the THREADPOOL_TASK_* reason the task should not run or 0 if it can run
+static int threadpool_task_dropped(threadpool_task_t *task)
+{
+    struct timespec now;
+
+    if (task->token != NULL && task->token->cancelled)
+    {
+        return THREADPOOL_TASK_CANCELLED;
+    }
+
+    if (task->has_deadline)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > task->deadline.tv_sec ||
+            (now.tv_sec == task->deadline.tv_sec && now.tv_nsec >= task->deadline.tv_nsec))
+        {
+            return THREADPOOL_TASK_EXPIRED;
+        }
+    }
+    return 0;
+}
+
+/* threadpool_next_task:
+ * Picks the next task for a worker, must be called with the pool lock held.
+ * Affine tasks routed to the worker come first, then the shared queue. As a last
+ * resort an idle worker steals from a busy one so affinity never leaves work
+ * waiting while there are free threads.
+ */
+static threadpool_task_t *threadpool_next_task(threadpool_t *pool, threadpool_worker_t *self)
+{
+    threadpool_task_t *task;
+    int i;
+
+    if (self->local_count > 0)
+    {
+        return threadpool_pop_local(pool, self);
+    }
+
+    if (pool->count > 0)
+    {
+        task = &(pool->tasks[pool->task_queue[pool->head]]);
+        pool->head = (pool->head + 1) % pool->queue_size;
+        pool->count -= 1;
+        return task;
+    }
+
+    for (i = 0; i < pool->thread_count; i++)
+    {
+        if (pool->workers[i].busy && pool->workers[i].local_count > 0)
+        {
+            return threadpool_pop_local(pool, &(pool->workers[i]));
+        }
+    }
+
+    return NULL;
+}
+
+static threadpool_task_t *threadpool_pop_local(threadpool_t *pool, threadpool_worker_t *worker)
 {
-    threadpool_t *pool = (threadpool_t *)threadpool;
     threadpool_task_t *task;
+
+    task = &(pool->tasks[worker->local_queue[worker->local_head]]);
+    worker->local_head = (worker->local_head + 1) % THREADPOOL_LOCAL_QUEUE_SIZE;
+    worker->local_count -= 1;
+    return task;
+}
+
+// Wakes the owner of a new task if it is idle, otherwise any idle worker. Pool lock held.
+static void threadpool_notify(threadpool_t *pool, threadpool_worker_t *owner)
+{
+    int i;
+
+    if (owner != NULL && owner->waiting)
+    {
+        owner->waiting = 0;
+        pthread_cond_signal(&(owner->notify));
+        return;
+    }
+
+    for (i = 0; i < pool->thread_count; i++)
+    {
+        if (pool->workers[i].waiting)
+        {
+            pool->workers[i].waiting = 0;
+            pthread_cond_signal(&(pool->workers[i].notify));
+            return;
+        }
+    }
+}
+
+// Wakes the waiter of a finished task, or frees its slot if nobody will wait. Pool lock held.
+static void threadpool_finish(threadpool_t *pool, threadpool_task_t *task)
+{
+    if (!task->waited)
+    {
+        threadpool_release(pool, task);
+        return;
+    }
+
+    pthread_mutex_lock(&task->task_mutex);
+    task->done = 1;
+    pthread_cond_signal(&task->task_complete);
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+static long threadpool_elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+/* threadpool_watchdog:
+ * Scans the workers every half threshold. The handler runs with the pool lock
+ * held, so a reported task cannot finish (and its connection cannot be reused)
+ * until the handler returns.
+ */
+static void *threadpool_watchdog(void *arg)
+{
+    threadpool_t *pool = (threadpool_t *)arg;
+    threadpool_worker_t *worker;
+    threadpool_stuck_t stuck;
+    struct timespec wake;
+    long interval_ms;
+    int i;
+
+    interval_ms = pool->watchdog_ms / 2;
+    if (interval_ms < THREADPOOL_WATCHDOG_MIN_MS)
+    {
+        interval_ms = THREADPOOL_WATCHDOG_MIN_MS;
+    }
+
+    pthread_mutex_lock(&(pool->lock));
+    while (!pool->shutdown)
+    {
+        for (i = 0; i < pool->thread_count; i++)
+        {
+            worker = &(pool->workers[i]);
+            if (worker->task == NULL || worker->reported)
+            {
+                continue;
+            }
+
+            stuck.elapsed_ms = threadpool_elapsed_ms(&worker->task_start);
+            if (stuck.elapsed_ms < pool->watchdog_ms)
+            {
+                continue;
+            }
+
+            stuck.worker = i;
+            stuck.function = worker->task->function;
+            stuck.argument = worker->task->argument;
+            stuck.affinity_key = worker->task->affinity_key;
+            worker->reported = 1;
+            pool->watchdog_handler(&stuck, pool->watchdog_user);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += interval_ms / 1000;
+        wake.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if (wake.tv_nsec >= 1000000000L)
+        {
+            wake.tv_sec += 1;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&(pool->watchdog_notify), &(pool->lock), &wake);
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    return NULL;
+}
+
+// Gives the slot of a finished task back to the pool. Pool lock held.
+static void threadpool_release(threadpool_t *pool, threadpool_task_t *task)
+{
+    pool->free_slots[pool->free_count++] = (int)(task - pool->tasks);
+}
+
+static void *threadpool_thread(void *worker)
+{
+    threadpool_worker_t *self = (threadpool_worker_t *)worker;
+    threadpool_t *pool = self->pool;
+    threadpool_task_t *task, *finished = NULL;
     void *result;
 
+    // Each worker owns its arena, so allocating from it never takes a lock
+    self->arena = create_arena(ARENA_DEFAULT_BLOCK_SIZE);
+    pthread_setspecific(pool->worker_key, self);
+
     for (;;)
     {
         pthread_mutex_lock(&(pool->lock));
+        self->busy = 0;
 
-        while ((pool->count == 0) && (!pool->shutdown))
+        // Completed under the pool lock so the watchdog never reports a task that already returned
+        if (finished != NULL)
         {
-            pthread_cond_wait(&(pool->notify), &(pool->lock));
+            self->task = NULL;
+            threadpool_finish(pool, finished);
+            finished = NULL;
         }
 
-        if ((pool->shutdown == 1) ||
-            ((pool->shutdown == THREADPOOL_GRACEFUL) && (pool->count == 0)))
+        for (;;)
+        {
+            if (pool->shutdown == 1)
+            {
+                task = NULL;
+                break;
+            }
+            if ((task = threadpool_next_task(pool, self)) != NULL || pool->shutdown)
+            {
+                break;
+            }
+            self->waiting = 1;
+            pthread_cond_wait(&(self->notify), &(pool->lock));
+            self->waiting = 0;
+        }
+
+        // Immediate shutdown, or graceful shutdown with nothing left for us
+        if (task == NULL)
         {
             pthread_mutex_unlock(&(pool->lock));
             break;
         }
 
-        task = &(pool->task_queue[pool->head]);
-        task->done = 0;
-        pool->head = (pool->head + 1) % pool->queue_size;
-        pool->count -= 1;
+        self->busy = 1;
+        self->task = task;
+        self->reported = 0;
+        clock_gettime(CLOCK_MONOTONIC, &self->task_start);
+        if (self->local_count > 0)
+        {
+            // We'll be busy for a while, let an idle worker take our backlog
+            threadpool_notify(pool, NULL);
+        }
 
         pthread_mutex_unlock(&(pool->lock));
 
-        // Execute the function and store the result
-        result = (*(task->function))(task->argument);
-        task->result = result;
+        // Stale work is dropped without running so the worker is free for the next task
+        task->status = threadpool_task_dropped(task);
+        if (task->status == 0)
+        {
+            // Execute the function and store the result
+            result = (*(task->function))(task->argument);
+            task->result = result;
+            arena_reset(self->arena);
+        }
 
-        pthread_mutex_lock(&task->task_mutex);
-        task->done = 1;
-        pthread_cond_signal(&task->task_complete);
-        pthread_mutex_unlock(&task->task_mutex);
+        finished = task;
     }
 
+    free_arena(&self->arena);
     pool->started--;
     return NULL;
 }
@@ -9,13 +9,36 @@
 
 // Standard library headers
 #include <pthread.h>
+#include <time.h>
+
+// Other project headers
+#include "arena.h"
 
 #define THREADPOOL_INVALID -1
 #define THREADPOOL_LOCK_FAILURE -2
 #define THREADPOOL_QUEUE_FULL -3
 #define THREADPOOL_SHUTDOWN -4
 #define THREADPOOL_THREAD_FAILURE -5
+#define THREADPOOL_TASK_EXPIRED -6
+#define THREADPOOL_TASK_CANCELLED -7
 #define THREADPOOL_GRACEFUL 1
+#define THREADPOOL_NO_AFFINITY -1
+#define THREADPOOL_LOCAL_QUEUE_SIZE 4 // Affine tasks a worker can hold before they spill to the shared queue
+#define THREADPOOL_WATCHDOG_MIN_MS 10  // Shortest interval between two watchdog scans
+
+typedef struct
+{
+    volatile int cancelled;
+} threadpool_token_t;
+
+typedef struct
+{
+    long timeout_ms;           // Deadline counted from submission, 0 for no deadline
+    threadpool_token_t *token; // Lets the owner cancel the task, NULL if not needed
+    long affinity_key;         // Tasks with the same key run on the same worker, THREADPOOL_NO_AFFINITY for any
+} threadpool_options_t;
+
+typedef struct threadpool_t threadpool_t;
 
 typedef struct
 {
@@ -26,27 +49,80 @@ typedef struct
     pthread_mutex_t task_mutex;
     pthread_cond_t task_complete;
     int done;
+    int status; // 0 if the function ran, THREADPOOL_TASK_* if it was dropped
+    int has_deadline;
+    struct timespec deadline; // CLOCK_MONOTONIC
+    threadpool_token_t *token;
+    long affinity_key;
+    threadpool_t *pool;
+    int waited; // Slot is released by threadpool_wait instead of by the worker
 } threadpool_task_t;
 
 typedef struct
+{
+    int worker; // Index of the worker running the task
+    void *(*function)(void *);
+    void *argument;
+    long affinity_key; // Usually the connection, THREADPOOL_NO_AFFINITY if the task had none
+    long elapsed_ms;
+} threadpool_stuck_t;
+
+// Called by the watchdog with the pool lock held: must be quick and must not call into the pool
+typedef void (*threadpool_stuck_handler_t)(const threadpool_stuck_t *stuck, void *user);
+
+typedef struct
+{
+    threadpool_t *pool;
+    Arena *arena;                   // Task scoped memory, reset every time a task completes
+    threadpool_task_t *task;        // Task being run, NULL while idle, guarded by the pool lock
+    struct timespec task_start;     // CLOCK_MONOTONIC time the current task was picked up
+    int reported;                   // The watchdog already flagged the current task
+    pthread_cond_t notify;          // Signalled when there is work this worker can take
+    int local_queue[THREADPOOL_LOCAL_QUEUE_SIZE]; // Slots of the tasks routed to this worker by affinity key
+    int local_head;
+    int local_tail;
+    int local_count;
+    int waiting; // Blocked on notify, guarded by the pool lock
+    int busy;    // Running a task, guarded by the pool lock
+} threadpool_worker_t;
+
+struct threadpool_t
 {
     pthread_mutex_t lock;
-    pthread_cond_t notify;
     pthread_t *threads;
-    threadpool_task_t *task_queue;
+    threadpool_worker_t *workers;
+    pthread_key_t worker_key; // Lets a running task find its own worker
+    threadpool_task_t *tasks; // Every queued, running or not yet waited task lives in one of these slots
+    int *free_slots;          // Stack of unused slots
+    int free_count;
+    int slot_count;
+    int *task_queue;          // Shared queue of slots
     int thread_count;
     int queue_size;
     int head;
     int tail;
-    int count;
+    int count; // Tasks in the shared queue
     int shutdown;
     int started;
-} threadpool_t;
+    pthread_t watchdog;
+    pthread_cond_t watchdog_notify; // Wakes the watchdog early on shutdown
+    int watchdog_running;
+    long watchdog_ms; // Tasks running longer than this are reported
+    threadpool_stuck_handler_t watchdog_handler;
+    void *watchdog_user;
+};
 
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags);
 int threadpool_add(threadpool_t *pool, void *(*function)(void *), void *argument, threadpool_task_t **task_out, int flags);
+int threadpool_add_with_options(threadpool_t *pool, void *(*function)(void *), void *argument, threadpool_task_t **task_out, int flags, const threadpool_options_t *options);
 void *threadpool_wait(threadpool_task_t *task);
+void *threadpool_wait_with_status(threadpool_task_t *task, int *status);
 int threadpool_destroy(threadpool_t *pool, int flags);
 int threadpool_free(threadpool_t *pool);
+Arena *threadpool_arena(threadpool_t *pool);
+void threadpool_token_init(threadpool_token_t *token);
+void threadpool_cancel(threadpool_token_t *token);
+int threadpool_cancelled(threadpool_t *pool);
+int threadpool_watchdog_start(threadpool_t *pool, long threshold_ms, threadpool_stuck_handler_t handler, void *user);
 
 #endif /* _THREADPOOL_H_ */